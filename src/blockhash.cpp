@@ -0,0 +1,450 @@
+/*
+Copyright (C) 2013, Basis Technology Corp.
+Copyright (C) 2007-2011, Golden G. Richard III and Vico Marziale.
+Copyright (C) 2005-2007, Golden G. Richard III.
+*
+Written by Golden G. Richard III and Vico Marziale.
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+*
+http://www.apache.org/licenses/LICENSE-2.0
+*
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+Thanks to Kris Kendall, Jesse Kornblum, et al for their work
+on Foremost. Foremost 0.69 was used as the starting point for
+Scalpel, in 2005.
+*/
+
+// Known-block hash sets.  A hash set holds the hashes of the aligned
+// blocks of reference data, such as the operating system and
+// application files of a reference install.  Blocks of an image whose
+// hashes are in the set are skipped like blocks covered by a coverage
+// blockmap.
+
+#include "scalpel.h"
+
+
+// multipliers for the eight lanes of blockHash()
+static const unsigned long long laneKeys[8] = {
+    0x9E3779B185EBCA87ULL, 0xC2B2AE3D27D4EB4FULL,
+    0x165667B19E3779F9ULL, 0x85EBCA77C2B2AE63ULL,
+    0x27D4EB2F165667C5ULL, 0xFF51AFD7ED558CCDULL,
+    0xC4CEB9FE1A85EC53ULL, 0x94D049BB133111EBULL
+};
+
+
+static unsigned long long mixHash(unsigned long long h) {
+
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+
+// hash a block.  The block is consumed in 64 byte stripes by eight
+// independent 64bit lanes, each using a 32x32->64 bit multiply, so the
+// loop maps onto SIMD registers; the lanes are folded at the end.
+// Hashes depend on the host byte order.
+unsigned long long blockHash(const unsigned char *buf, size_t len) {
+
+    unsigned long long acc[8], word, key, h;
+    size_t i, k;
+
+    for(k = 0; k < 8; k++) {
+        acc[k] = laneKeys[k];
+    }
+
+    for(i = 0; i + 64 <= len; i += 64) {
+        for(k = 0; k < 8; k++) {
+            memcpy(&word, buf + i + 8 * k, sizeof(word));
+            key = word ^ laneKeys[k];
+            acc[k ^ 1] += word;
+            acc[k] += (key & 0xFFFFFFFFULL) * (key >> 32);
+        }
+    }
+
+    h = (unsigned long long)len * laneKeys[0];
+    for(k = 0; k < 8; k++) {
+        h = (h ^ mixHash(acc[k])) * laneKeys[1];
+    }
+
+    // blocks that aren't a multiple of 64 bytes
+    for(; i < len; i++) {
+        h = (h ^ buf[i]) * laneKeys[2];
+    }
+
+    return mixHash(h);
+}
+
+
+// if every byte of a block has the same value, return that value,
+// otherwise -1.  Like blockHash(), the block is compared in 64 byte
+// stripes of eight 64bit words, so the loop maps onto SIMD registers;
+// most blocks that aren't uniform are rejected in the first stripe.
+int blockUniformValue(const unsigned char *buf, size_t len) {
+
+    unsigned long long pattern, word, diff;
+    size_t i, k;
+
+    if(len == 0) {
+        return -1;
+    }
+    pattern = buf[0] * 0x0101010101010101ULL;
+
+    for(i = 0; i + 64 <= len; i += 64) {
+        diff = 0;
+        for(k = 0; k < 8; k++) {
+            memcpy(&word, buf + i + 8 * k, sizeof(word));
+            diff |= word ^ pattern;
+        }
+        if(diff) {
+            return -1;
+        }
+    }
+
+    for(; i < len; i++) {
+        if(buf[i] != buf[0]) {
+            return -1;
+        }
+    }
+    return buf[0];
+}
+
+
+// Bloom filter bit 'probe' for 'hash'
+static unsigned long long bloomBit(const BlockHashSet *set,
+                                   unsigned long long hash, unsigned int probe) {
+
+    return (hash + probe * ((hash >> 32 | hash << 32) | 1)) & set->bloommask;
+}
+
+
+// is 'hash' in the hash set?  The Bloom filter rejects most hashes that
+// aren't; the rest are looked up in the sorted table.
+int blockHashSetContains(const BlockHashSet *set, unsigned long long hash) {
+
+    unsigned long long lo = 0, hi = set->numhashes, mid, bit;
+    unsigned int probe;
+
+    for(probe = 0; probe < set->bloomprobes; probe++) {
+        bit = bloomBit(set, hash, probe);
+        if((set->bloom[bit / 8] & (1 << (bit % 8))) == 0) {
+            return FALSE;
+        }
+    }
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if(set->hashes[mid] < hash) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    return lo < set->numhashes && set->hashes[lo] == hash;
+}
+
+
+// open the block hash set 'fn' for state->blockhashset.  The file is
+// mapped where possible, and read otherwise.
+int openBlockHashSet(struct scalpelState *state, char *fn) {
+
+    FILE *f;
+    BlockHashSetHeader header;
+    BlockHashSet *set;
+    unsigned long long bloombytes, filesize;
+    unsigned char *data;
+    struct stat st;
+
+    if((f = fopen(fn, "rb")) == NULL) {
+        fprintf(stderr, "Couldn't open block hash set file:\n%s -- %s\n",
+            fn, strerror(errno));
+        fprintf(state->auditFile,
+            "Couldn't open block hash set file:\n%s -- %s\n",
+            fn, strerror(errno));
+        return SCALPEL_ERROR_FATAL_READ;
+    }
+#ifdef _WIN32
+    // set binary mode for Win32
+    setmode(fileno(f), O_BINARY);
+#endif
+#ifdef __linux
+    fcntl(fileno(f), F_SETFL, O_LARGEFILE);
+#endif
+
+    bloombytes = 0;
+    if(fread(&header, sizeof(BlockHashSetHeader), 1, f) != 1 ||
+        header.magic != BLOCKHASH_SET_MAGIC ||
+        header.blocksize == 0 || header.bloombits < 8 ||
+        (header.bloombits & (header.bloombits - 1)) != 0 ||
+        fstat(fileno(f), &st) ||
+        (filesize = (unsigned long long)st.st_size) !=
+        sizeof(BlockHashSetHeader) + (bloombytes = header.bloombits / 8) +
+        header.numhashes * sizeof(unsigned long long)) {
+            fprintf(stderr, "%s is not a valid block hash set file.\n", fn);
+            fprintf(state->auditFile, "%s is not a valid block hash set file.\n", fn);
+            fclose(f);
+            return SCALPEL_ERROR_FATAL_READ;
+    }
+
+    if(header.version != BLOCKHASH_SET_VERSION) {
+        fprintf(stderr,
+            "Unsupported version %u of block hash set file: %s; aborting.\n",
+            header.version, fn);
+        fprintf(state->auditFile,
+            "Unsupported version %u of block hash set file: %s\n",
+            header.version, fn);
+        fclose(f);
+        return SCALPEL_GENERAL_ABORT;
+    }
+
+    set = (BlockHashSet *)malloc(sizeof(BlockHashSet));
+    checkMemoryAllocation(state, set, __LINE__, __FILE__, "blockhashset");
+    set->blocksize = header.blocksize;
+    set->bloomprobes = header.bloomprobes;
+    set->numhashes = header.numhashes;
+    set->bloommask = header.bloombits - 1;
+    set->mapping = NULL;
+    set->mappinglen = (size_t)filesize;
+
+#ifndef _WIN32
+    if((set->mapping = mmap(0, set->mappinglen, PROT_READ, MAP_SHARED,
+        fileno(f), 0)) == MAP_FAILED) {
+            set->mapping = NULL;
+    }
+    else {
+        madvise(set->mapping, set->mappinglen, MADV_RANDOM);
+    }
+#endif
+
+    if(set->mapping) {
+        data = (unsigned char *)set->mapping + sizeof(BlockHashSetHeader);
+    }
+    else {
+        data = (unsigned char *)malloc((size_t)(filesize - sizeof(BlockHashSetHeader)));
+        checkMemoryAllocation(state, data, __LINE__, __FILE__, "blockhashset");
+        if(fread(data, 1, (size_t)(filesize - sizeof(BlockHashSetHeader)), f) !=
+            filesize - sizeof(BlockHashSetHeader)) {
+                fprintf(stderr,
+                    "Error reading block hash set file (truncated?): %s\n", fn);
+                fprintf(state->auditFile,
+                    "Error reading block hash set file (truncated?): %s\n", fn);
+                free(data);
+                free(set);
+                fclose(f);
+                return SCALPEL_ERROR_FATAL_READ;
+        }
+    }
+    fclose(f);
+
+    set->bloom = data;
+    set->hashes = (const unsigned long long *)(data + bloombytes);
+    state->blockhashset = set;
+
+    fprintf(stdout,
+        "Block hash set \"%s\" holds %"PRIu64 " hashes of %u byte blocks.\n",
+        fn, set->numhashes, set->blocksize);
+
+    return SCALPEL_OK;
+}
+
+
+void closeBlockHashSet(struct scalpelState *state) {
+
+    BlockHashSet *set = state->blockhashset;
+
+    if(!set) {
+        return;
+    }
+#ifndef _WIN32
+    if(set->mapping) {
+        munmap(set->mapping, set->mappinglen);
+    }
+    else
+#endif
+    {
+        free((void *)set->bloom);
+    }
+    free(set);
+    state->blockhashset = NULL;
+}
+
+
+// add the hashes of the aligned blocks of the current image to
+// state->generatedhashes, for a new block hash set (-G).  The partial
+// block at the end of the image and blocks of one repeated byte value,
+// such as zeroed blocks, are left out: those occur in all kinds of
+// files.
+int hashImageBlocks(struct scalpelState *state) {
+
+    unsigned int bs;
+    unsigned long long chunk, off;
+    unsigned char *buf;
+    long long bytesread;
+
+    if(state->coverageblocksize == 0) {	// user didn't override default
+        state->coverageblocksize = 512;
+    }
+    bs = state->coverageblocksize;
+    chunk = SIZE_OF_BUFFER / bs * bs;
+    if(chunk == 0) {
+        chunk = bs;
+    }
+
+    if(scalpelInputOpen(state->inReader) != 0) {
+        return SCALPEL_ERROR_FILE_OPEN;
+    }
+
+    fprintf(stdout, "Hashing %u byte blocks of %s.\n", bs,
+        scalpelInputGetId(state->inReader));
+
+    buf = (unsigned char *)malloc((size_t)chunk);
+    checkMemoryAllocation(state, buf, __LINE__, __FILE__, "blockhash buffer");
+
+    while ((bytesread = scalpelInputRead(state->inReader, buf, 1,
+        (size_t)chunk)) > 0) {
+            if(scalpelInputGetError(state->inReader)) {
+                free(buf);
+                scalpelInputClose(state->inReader);
+                return SCALPEL_ERROR_FILE_READ;
+            }
+            for(off = 0; off + bs <= (unsigned long long)bytesread; off += bs) {
+                if(blockUniformValue(buf + off, bs) >= 0) {
+                    continue;
+                }
+                if(state->numgeneratedhashes == state->generatedhashsize) {
+                    state->generatedhashsize = state->generatedhashsize ?
+                        state->generatedhashsize * 2 : 65536;
+                    state->generatedhashes = (unsigned long long *)
+                        realloc(state->generatedhashes,
+                        state->generatedhashsize * sizeof(unsigned long long));
+                    checkMemoryAllocation(state, state->generatedhashes,
+                        __LINE__, __FILE__, "generatedhashes");
+                }
+                state->generatedhashes[state->numgeneratedhashes++] =
+                    blockHash(buf + off, bs);
+            }
+            if((unsigned long long)bytesread < chunk) {
+                break;
+            }
+    }
+
+    free(buf);
+    scalpelInputClose(state->inReader);
+    return SCALPEL_OK;
+}
+
+
+static int compareHashes(const void *a, const void *b) {
+
+    unsigned long long ha = *(const unsigned long long *)a;
+    unsigned long long hb = *(const unsigned long long *)b;
+
+    return ha < hb ? -1 : (ha > hb ? 1 : 0);
+}
+
+
+// write the hashes collected by hashImageBlocks() to the block hash set
+// file 'fn'.  Duplicate hashes are stored once, and the Bloom filter
+// has at least BLOCKHASH_BLOOM_BITS bits per hash.
+int writeBlockHashSet(struct scalpelState *state, char *fn) {
+
+    char tmpfn[MAX_STRING_LENGTH + 4];
+    FILE *f;
+    BlockHashSetHeader header;
+    BlockHashSet set;
+    unsigned char *bloom;
+    unsigned long long *hashes = state->generatedhashes, n = 0, i, bit;
+    unsigned int probe;
+    int ok;
+
+    if(state->numgeneratedhashes > 0) {
+        qsort(hashes, (size_t)state->numgeneratedhashes,
+            sizeof(unsigned long long), compareHashes);
+        for(i = 1, n = 1; i < state->numgeneratedhashes; i++) {
+            if(hashes[i] != hashes[n - 1]) {
+                hashes[n++] = hashes[i];
+            }
+        }
+    }
+
+    header.magic = BLOCKHASH_SET_MAGIC;
+    header.version = BLOCKHASH_SET_VERSION;
+    header.blocksize = state->coverageblocksize;
+    header.bloomprobes = BLOCKHASH_BLOOM_PROBES;
+    header.numhashes = n;
+    for(header.bloombits = 64; header.bloombits < n * BLOCKHASH_BLOOM_BITS;
+        header.bloombits *= 2) {
+    }
+
+    bloom = (unsigned char *)calloc((size_t)(header.bloombits / 8), 1);
+    checkMemoryAllocation(state, bloom, __LINE__, __FILE__, "bloom filter");
+    set.bloommask = header.bloombits - 1;
+    for(i = 0; i < n; i++) {
+        for(probe = 0; probe < BLOCKHASH_BLOOM_PROBES; probe++) {
+            bit = bloomBit(&set, hashes[i], probe);
+            bloom[bit / 8] |= 1 << (bit % 8);
+        }
+    }
+
+    snprintf(tmpfn, sizeof(tmpfn), "%s.tmp", fn);
+    if((f = fopen(tmpfn, "wb")) == NULL) {
+        fprintf(stderr, "Error writing to block hash set file: %s -- %s\n",
+            tmpfn, strerror(errno));
+        fprintf(state->auditFile,
+            "Error writing to block hash set file: %s -- %s\n",
+            tmpfn, strerror(errno));
+        free(bloom);
+        return SCALPEL_ERROR_FILE_WRITE;
+    }
+#ifdef _WIN32
+    // set binary mode for Win32
+    setmode(fileno(f), O_BINARY);
+#endif
+
+    ok = fwrite(&header, sizeof(BlockHashSetHeader), 1, f) == 1 &&
+        fwrite(bloom, 1, (size_t)(header.bloombits / 8), f) ==
+        header.bloombits / 8 &&
+        fwrite(hashes, sizeof(unsigned long long), (size_t)n, f) == n;
+    free(bloom);
+
+    if(!ok || fflush(f)) {
+        fprintf(stderr, "Error writing to block hash set file: %s -- %s\n",
+            tmpfn, strerror(errno));
+        fprintf(state->auditFile,
+            "Error writing to block hash set file: %s -- %s\n",
+            tmpfn, strerror(errno));
+        fclose(f);
+        unlink(tmpfn);
+        return SCALPEL_ERROR_FILE_WRITE;
+    }
+    fclose(f);
+
+#ifdef _WIN32
+    unlink(fn);
+#endif
+    if(rename(tmpfn, fn)) {
+        fprintf(stderr, "Error writing to block hash set file: %s -- %s\n",
+            fn, strerror(errno));
+        fprintf(state->auditFile,
+            "Error writing to block hash set file: %s -- %s\n",
+            fn, strerror(errno));
+        return SCALPEL_ERROR_FILE_WRITE;
+    }
+
+    fprintf(stdout, "Wrote %"PRIu64 " hashes of %u byte blocks to %s.\n",
+        n, header.blocksize, fn);
+    fprintf(state->auditFile, "Wrote %"PRIu64 " hashes of %u byte blocks to %s.\n",
+        n, header.blocksize, fn);
+
+    return SCALPEL_OK;
+}
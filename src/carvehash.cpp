@@ -0,0 +1,542 @@
+/*
+Copyright (C) 2013, Basis Technology Corp.
+Copyright (C) 2007-2011, Golden G. Richard III and Vico Marziale.
+Copyright (C) 2005-2007, Golden G. Richard III.
+*
+Written by Golden G. Richard III and Vico Marziale.
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+*
+http://www.apache.org/licenses/LICENSE-2.0
+*
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+Thanks to Kris Kendall, Jesse Kornblum, et al for their work
+on Foremost. Foremost 0.69 was used as the starting point for
+Scalpel, in 2005.
+*/
+
+// Content digests of carved files (-a).  The digests are computed
+// incrementally, from the buffers the carved files are written from, so
+// carved output never has to be read back to be hashed.  MD5, SHA-1 and
+// SHA-256 are built in; the fuzzy hash needs libfuzzy (ssdeep).
+
+#include "scalpel.h"
+
+#ifdef HAVE_LIBFUZZY
+#include <fuzzy.h>
+#endif
+
+
+#define ROTL32(x, n)  (((x) << (n)) | ((x) >> (32 - (n))))
+#define ROTR32(x, n)  (((x) >> (n)) | ((x) << (32 - (n))))
+
+
+static unsigned int loadLittleEndian32(const unsigned char *p) {
+
+    return (unsigned int)p[0] | ((unsigned int)p[1] << 8) |
+        ((unsigned int)p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+
+static unsigned int loadBigEndian32(const unsigned char *p) {
+
+    return ((unsigned int)p[0] << 24) | ((unsigned int)p[1] << 16) |
+        ((unsigned int)p[2] << 8) | (unsigned int)p[3];
+}
+
+
+/********** MD5 (RFC 1321) **********/
+
+static const unsigned int md5Sines[64] = {
+    0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a,
+    0xa8304613, 0xfd469501, 0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be,
+    0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821, 0xf61e2562, 0xc040b340,
+    0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+    0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8,
+    0x676f02d9, 0x8d2a4c8a, 0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c,
+    0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70, 0x289b7ec6, 0xeaa127fa,
+    0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+    0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92,
+    0xffeff47d, 0x85845dd1, 0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1,
+    0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391
+};
+
+static const unsigned char md5Shifts[64] = {
+    7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+    5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20,
+    4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+    6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21
+};
+
+
+static void md5Block(unsigned int state[4], const unsigned char *block) {
+
+    unsigned int m[16], a = state[0], b = state[1], c = state[2], d = state[3];
+    unsigned int f, t;
+    int i, g;
+
+    for(i = 0; i < 16; i++) {
+        m[i] = loadLittleEndian32(block + i * 4);
+    }
+
+    for(i = 0; i < 64; i++) {
+        if(i < 16) {
+            f = (b & c) | (~b & d);
+            g = i;
+        }
+        else if(i < 32) {
+            f = (d & b) | (~d & c);
+            g = (5 * i + 1) % 16;
+        }
+        else if(i < 48) {
+            f = b ^ c ^ d;
+            g = (3 * i + 5) % 16;
+        }
+        else {
+            f = c ^ (b | ~d);
+            g = (7 * i) % 16;
+        }
+        t = d;
+        d = c;
+        c = b;
+        b = b + ROTL32(a + f + md5Sines[i] + m[g], md5Shifts[i]);
+        a = t;
+    }
+
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+}
+
+
+/********** SHA-1 (FIPS 180-4) **********/
+
+static void sha1Block(unsigned int state[5], const unsigned char *block) {
+
+    unsigned int w[80], a = state[0], b = state[1], c = state[2], d = state[3],
+        e = state[4], f, k, t;
+    int i;
+
+    for(i = 0; i < 16; i++) {
+        w[i] = loadBigEndian32(block + i * 4);
+    }
+    for(i = 16; i < 80; i++) {
+        w[i] = ROTL32(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+    }
+
+    for(i = 0; i < 80; i++) {
+        if(i < 20) {
+            f = (b & c) | (~b & d);
+            k = 0x5a827999;
+        }
+        else if(i < 40) {
+            f = b ^ c ^ d;
+            k = 0x6ed9eba1;
+        }
+        else if(i < 60) {
+            f = (b & c) | (b & d) | (c & d);
+            k = 0x8f1bbcdc;
+        }
+        else {
+            f = b ^ c ^ d;
+            k = 0xca62c1d6;
+        }
+        t = ROTL32(a, 5) + f + e + k + w[i];
+        e = d;
+        d = c;
+        c = ROTL32(b, 30);
+        b = a;
+        a = t;
+    }
+
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+}
+
+
+/********** SHA-256 (FIPS 180-4) **********/
+
+static const unsigned int sha256Constants[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+    0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+    0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+    0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+    0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+
+static void sha256Block(unsigned int state[8], const unsigned char *block) {
+
+    unsigned int w[64], s[8], t1, t2;
+    int i;
+
+    for(i = 0; i < 16; i++) {
+        w[i] = loadBigEndian32(block + i * 4);
+    }
+    for(i = 16; i < 64; i++) {
+        w[i] = w[i - 16] + w[i - 7] +
+            (ROTR32(w[i - 15], 7) ^ ROTR32(w[i - 15], 18) ^ (w[i - 15] >> 3)) +
+            (ROTR32(w[i - 2], 17) ^ ROTR32(w[i - 2], 19) ^ (w[i - 2] >> 10));
+    }
+
+    for(i = 0; i < 8; i++) {
+        s[i] = state[i];
+    }
+    for(i = 0; i < 64; i++) {
+        t1 = s[7] + (ROTR32(s[4], 6) ^ ROTR32(s[4], 11) ^ ROTR32(s[4], 25)) +
+            ((s[4] & s[5]) ^ (~s[4] & s[6])) + sha256Constants[i] + w[i];
+        t2 = (ROTR32(s[0], 2) ^ ROTR32(s[0], 13) ^ ROTR32(s[0], 22)) +
+            ((s[0] & s[1]) ^ (s[0] & s[2]) ^ (s[1] & s[2]));
+        s[7] = s[6];
+        s[6] = s[5];
+        s[5] = s[4];
+        s[4] = s[3] + t1;
+        s[3] = s[2];
+        s[2] = s[1];
+        s[1] = s[0];
+        s[0] = t1 + t2;
+    }
+    for(i = 0; i < 8; i++) {
+        state[i] += s[i];
+    }
+}
+
+
+/********** block buffering shared by the three digests **********/
+
+typedef void (*DigestBlockFunction)(unsigned int *state, const unsigned char *block);
+
+
+// feed 'len' bytes to a 64 byte block digest; whole blocks are digested
+// straight from 'buf'
+static void digestUpdate(DigestContext *ctx, DigestBlockFunction block,
+                         const unsigned char *buf, size_t len) {
+
+    size_t used = (size_t)(ctx->count % 64), n;
+
+    ctx->count += len;
+    if(used > 0) {
+        n = 64 - used < len ? 64 - used : len;
+        memcpy(ctx->buf + used, buf, n);
+        buf += n;
+        len -= n;
+        if(used + n < 64) {
+            return;
+        }
+        block(ctx->state, ctx->buf);
+    }
+    for(; len >= 64; buf += 64, len -= 64) {
+        block(ctx->state, buf);
+    }
+    memcpy(ctx->buf, buf, len);
+}
+
+
+// pad the last block with the message length in bits, little endian for
+// MD5 and big endian for the SHA digests
+static void digestFinish(DigestContext *ctx, DigestBlockFunction block,
+                         int bigendian) {
+
+    unsigned long long bits = ctx->count * 8;
+    size_t used = (size_t)(ctx->count % 64);
+    int i;
+
+    ctx->buf[used++] = 0x80;
+    if(used > 56) {
+        memset(ctx->buf + used, 0, 64 - used);
+        block(ctx->state, ctx->buf);
+        used = 0;
+    }
+    memset(ctx->buf + used, 0, 56 - used);
+    for(i = 0; i < 8; i++) {
+        ctx->buf[56 + i] = (unsigned char)(bits >> (bigendian ? 56 - i * 8 : i * 8));
+    }
+    block(ctx->state, ctx->buf);
+}
+
+
+static void digestToHex(const DigestContext *ctx, int words, int bigendian,
+                        char *hex) {
+
+    static const char digits[] = "0123456789abcdef";
+    unsigned char byte;
+    int i, j;
+
+    for(i = 0; i < words; i++) {
+        for(j = 0; j < 4; j++) {
+            byte = (unsigned char)(ctx->state[i] >> (bigendian ? 24 - j * 8 : j * 8));
+            *hex++ = digits[byte >> 4];
+            *hex++ = digits[byte & 0xf];
+        }
+    }
+    *hex = '\0';
+}
+
+
+static void md5BlockFunction(unsigned int *state, const unsigned char *block) {
+    md5Block(state, block);
+}
+
+static void sha1BlockFunction(unsigned int *state, const unsigned char *block) {
+    sha1Block(state, block);
+}
+
+static void sha256BlockFunction(unsigned int *state, const unsigned char *block) {
+    sha256Block(state, block);
+}
+
+
+/********** carved file digests **********/
+
+// names of the digests, in the order of the SCALPEL_HASH_* bits
+static const char *hashNames[SCALPEL_NUM_HASHES] = {
+    "md5", "sha1", "sha256", "fuzzy"
+};
+
+
+// set state->hashAlgorithms from a comma separated list of digest names
+int parseHashList(struct scalpelState *state, const char *list) {
+
+    const char *name = list, *end;
+    size_t len;
+    int i;
+
+    state->hashAlgorithms = 0;
+    while (*name) {
+        end = strchr(name, ',');
+        len = end ? (size_t)(end - name) : strlen(name);
+        for(i = 0; i < SCALPEL_NUM_HASHES; i++) {
+            if(len == strlen(hashNames[i]) && !strncasecmp(name, hashNames[i], len)) {
+                break;
+            }
+        }
+        if(i == SCALPEL_NUM_HASHES) {
+            fprintf(stderr, "ERROR: Unknown digest \"%.*s\".\n", (int)len, name);
+            return SCALPEL_GENERAL_ABORT;
+        }
+#ifndef HAVE_LIBFUZZY
+        if((1 << i) == SCALPEL_HASH_FUZZY) {
+            fprintf(stderr, "ERROR: This build of Scalpel has no fuzzy hashing (libfuzzy).\n");
+            return SCALPEL_GENERAL_ABORT;
+        }
+#endif
+        state->hashAlgorithms |= 1 << i;
+        name += len;
+        if(*name == ',') {
+            name++;
+        }
+    }
+    return state->hashAlgorithms ? SCALPEL_OK : SCALPEL_GENERAL_ABORT;
+}
+
+
+// the name of digest 'i' (0 .. SCALPEL_NUM_HASHES - 1)
+const char *hashName(int i) {
+
+    return hashNames[i];
+}
+
+
+// start the digests of a carved file, or return NULL if no digests are
+// computed
+CarveHash *startCarveHash(struct scalpelState *state) {
+
+    static const unsigned int md5Init[4] = {
+        0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476
+    };
+    static const unsigned int sha1Init[5] = {
+        0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0
+    };
+    static const unsigned int sha256Init[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+    CarveHash *hash;
+
+    if(!state->hashAlgorithms) {
+        return NULL;
+    }
+
+    hash = (CarveHash *)malloc(sizeof(CarveHash));
+    checkMemoryAllocation(state, hash, __LINE__, __FILE__, "carvehash");
+    memset(hash, 0, sizeof(CarveHash));
+    memcpy(hash->md5.state, md5Init, sizeof(md5Init));
+    memcpy(hash->sha1.state, sha1Init, sizeof(sha1Init));
+    memcpy(hash->sha256.state, sha256Init, sizeof(sha256Init));
+#ifdef HAVE_LIBFUZZY
+    if(state->hashAlgorithms & SCALPEL_HASH_FUZZY) {
+        hash->fuzzy = fuzzy_new();
+        checkMemoryAllocation(state, hash->fuzzy, __LINE__, __FILE__, "fuzzy");
+    }
+#endif
+    return hash;
+}
+
+
+// add the next 'len' bytes of a carved file to its digests
+void updateCarveHash(struct scalpelState *state, CarveHash *hash,
+                     const unsigned char *buf, size_t len) {
+
+    if(state->hashAlgorithms & SCALPEL_HASH_MD5) {
+        digestUpdate(&hash->md5, md5BlockFunction, buf, len);
+    }
+    if(state->hashAlgorithms & SCALPEL_HASH_SHA1) {
+        digestUpdate(&hash->sha1, sha1BlockFunction, buf, len);
+    }
+    if(state->hashAlgorithms & SCALPEL_HASH_SHA256) {
+        digestUpdate(&hash->sha256, sha256BlockFunction, buf, len);
+    }
+#ifdef HAVE_LIBFUZZY
+    if(hash->fuzzy) {
+        fuzzy_update(hash->fuzzy, buf, len);
+    }
+#endif
+}
+
+
+// finish the digests of a carved file as strings, empty for digests not
+// computed, and release 'hash'
+void finishCarveHash(struct scalpelState *state, CarveHash *hash,
+                     char digests[SCALPEL_NUM_HASHES][SCALPEL_MAX_DIGEST_STRING]) {
+
+    int i;
+
+    for(i = 0; i < SCALPEL_NUM_HASHES; i++) {
+        digests[i][0] = '\0';
+    }
+    if(state->hashAlgorithms & SCALPEL_HASH_MD5) {
+        digestFinish(&hash->md5, md5BlockFunction, FALSE);
+        digestToHex(&hash->md5, 4, FALSE, digests[0]);
+    }
+    if(state->hashAlgorithms & SCALPEL_HASH_SHA1) {
+        digestFinish(&hash->sha1, sha1BlockFunction, TRUE);
+        digestToHex(&hash->sha1, 5, TRUE, digests[1]);
+    }
+    if(state->hashAlgorithms & SCALPEL_HASH_SHA256) {
+        digestFinish(&hash->sha256, sha256BlockFunction, TRUE);
+        digestToHex(&hash->sha256, 8, TRUE, digests[2]);
+    }
+#ifdef HAVE_LIBFUZZY
+    if(hash->fuzzy) {
+        if(fuzzy_digest(hash->fuzzy, digests[3], 0) != 0) {
+            digests[3][0] = '\0';
+        }
+        fuzzy_free(hash->fuzzy);
+    }
+#endif
+    free(hash);
+}
+
+
+// release the digests of a carved file that was abandoned
+void discardCarveHash(CarveHash *hash) {
+
+    if(!hash) {
+        return;
+    }
+#ifdef HAVE_LIBFUZZY
+    if(hash->fuzzy) {
+        fuzzy_free(hash->fuzzy);
+    }
+#endif
+    free(hash);
+}
+
+
+/********** identical carved files **********/
+
+// find the carved file with the same length and SHA-256 digest in the
+// open addressing hash table of carved files, or the free slot for it
+static CarvedContent *findCarvedContentSlot(struct scalpelState *state,
+                                            unsigned long long length,
+                                            const char *sha256) {
+
+    CarvedContent *slot;
+    unsigned long long h = length, k;
+    int i;
+
+    // the digest is already uniformly distributed
+    for(i = 0; i < 16 && sha256[i]; i++) {
+        h = (h << 4) ^ (h >> 60) ^
+            (unsigned long long)(isdigit(sha256[i]) ? sha256[i] - '0' : sha256[i] - 'a' + 10);
+    }
+    for(k = h & (state->carvedcontentsize - 1);;
+        k = (k + 1) & (state->carvedcontentsize - 1)) {
+            slot = &(state->carvedcontent[k]);
+            if(!slot->path || (slot->length == length && !strcmp(slot->sha256, sha256))) {
+                return slot;
+            }
+    }
+}
+
+
+// look up a carved file by its length and SHA-256 digest.  Returns the
+// earlier carved file with the same content, or NULL after recording
+// 'carve', stored at 'path' relative to the output directory, as the
+// first copy.
+const CarvedContent *findCarvedContent(struct scalpelState *state,
+                                       struct CarveInfo *carve, const char *path,
+                                       const char *sha256) {
+
+    CarvedContent *old = state->carvedcontent, *slot;
+    unsigned long long oldsize = state->carvedcontentsize, k;
+    unsigned long long length = carve->stop - carve->start + 1;
+
+    if((state->carvedcontentused + 1) * 2 > state->carvedcontentsize) {
+        // grow and rehash
+        state->carvedcontentsize = oldsize ? oldsize * 2 : CARVED_CONTENT_MIN_SIZE;
+        state->carvedcontent = (CarvedContent *)
+            calloc((size_t)state->carvedcontentsize, sizeof(CarvedContent));
+        checkMemoryAllocation(state, state->carvedcontent, __LINE__, __FILE__,
+            "carvedcontent");
+        for(k = 0; k < oldsize; k++) {
+            if(old[k].path) {
+                *findCarvedContentSlot(state, old[k].length, old[k].sha256) = old[k];
+            }
+        }
+        free(old);
+    }
+
+    slot = findCarvedContentSlot(state, length, sha256);
+    if(slot->path) {
+        return slot;
+    }
+    slot->length = length;
+    slot->packsegment = carve->packsegment;
+    slot->packoffset = carve->packoffset;
+    strncpy(slot->sha256, sha256, sizeof(slot->sha256) - 1);
+    slot->path = (char *)malloc(strlen(path) + 1);
+    checkMemoryAllocation(state, slot->path, __LINE__, __FILE__, "carvedcontent");
+    strcpy(slot->path, path);
+    state->carvedcontentused++;
+    return NULL;
+}
+
+
+void freeCarvedContent(struct scalpelState *state) {
+
+    unsigned long long k;
+
+    for(k = 0; k < state->carvedcontentsize; k++) {
+        free(state->carvedcontent[k].path);
+    }
+    free(state->carvedcontent);
+    state->carvedcontent = NULL;
+    state->carvedcontentsize = 0;
+    state->carvedcontentused = 0;
+}
@@ -29,14 +29,41 @@ Scalpel, in 2005.
 static char *readbuffer;	// Read buffer--process image files in 
                             // SIZE_OF_BUFFER-size chunks.
 
+// A run of blocks of a SIZE_OF_BUFFER chunk that the search threads
+// skip: blocks found in the block hash set, or blocks of one constant
+// byte value.
+#define SKIPRUN_KNOWN  -1
+
+typedef struct SkipRun {
+    unsigned long long begin;	// buffer offsets of the run
+    unsigned long long end;
+    int value;			// SKIPRUN_KNOWN or the constant byte value
+} SkipRun;
+
 // Info needed for each of above SIZE_OF_BUFFER chunks.
 typedef struct readbuf_info {
     long long bytesread;		// number of bytes in this buf
     long long beginreadpos;	    // position in the image
+    unsigned long long firstextent;	// coverage map run holding beginreadpos
     char *readbuf;		        // pointer SIZE_OF_BUFFER array
+    SkipRun *skipruns;		// runs of blocks not to search
+    unsigned long long numskipruns;
+    unsigned long long skiprunsize;
 } readbuf_info;
 
 
+// CarveInfo structs for the files to carve from the current image are
+// allocated from a list of blocks.  The first block holds
+// CARVEINFO_MIN_BLOCK_SIZE structs and each new block doubles in size,
+// up to CARVEINFO_MAX_BLOCK_SIZE.
+typedef struct CarveInfoBlock {
+    struct CarveInfoBlock *next;
+    unsigned long size;		        // # structs in this block
+    unsigned long used;		        // # structs handed out from this block
+    CarveInfo carves[1];	        // actually 'size' structs
+} CarveInfoBlock;
+
+
 // queues to facilitiate async reads, concurrent cpu, gpu work
 static syncqueue_t *full_readbuf;	// que of full buffers read from image
 static syncqueue_t *empty_readbuf;	// que of empty buffers
@@ -78,6 +105,9 @@ typedef struct ThreadFindAllParams {
     };
     int casesensitive;
     int nosearchoverlap;
+    SkipRun *skipruns;		// runs of blocks not to search
+    unsigned long long numskipruns;
+    long skipoverlap;		// match may extend this far into a run
     struct scalpelState *state;
 } ThreadFindAllParams;
 
@@ -94,28 +124,84 @@ static pthread_mutex_t *workavailable;
 //static sem_t *workcomplete;	// semaphores that allow main thread to wait
 // for all search threads to complete current job
 static pthread_mutex_t *workcomplete;
+static int numsearchthreads;	// threads created in searchthreads
+static volatile int searchshutdown;	// set when the thread pool is torn down
 
 #endif
 
 // prototypes for private dig.c functions
 static unsigned long long 
-    adjustForEmbedding(struct SearchSpecLine *currentneedle,
-                       unsigned long long headerindex,
-                       unsigned long long *prevstopindex);
-static int writeHeaderFooterDatabase(struct scalpelState *state);
+    firstFooterAfter(struct SearchSpecLine *currentneedle,
+                     unsigned long long lo,
+                     unsigned long long position);
+static unsigned long long *
+    matchEmbeddedFooters(struct scalpelState *state,
+                         struct SearchSpecLine *currentneedle);
+static struct CarveInfo *allocateCarveInfo(struct scalpelState *state,
+                                           CarveInfoBlock **blocks);
+static void freeCarveInfoBlocks(struct scalpelState *state,
+                                CarveInfoBlock *blocks);
+static void carveFilename(struct scalpelState *state,
+                          struct CarveInfo *carve, char *fn);
+static void createOrganizeDir(struct scalpelState *state,
+                              struct CarveInfo *carve);
+static int writeHeaderFooterDatabase(struct scalpelState *state,
+                                     unsigned long long filesize);
+static int readHeaderFooterDatabase(struct scalpelState *state,
+                                    unsigned long long filesize);
+static int fingerprintImage(struct scalpelState *state,
+                            unsigned long long filesize);
 static int setupCoverageMaps(struct scalpelState *state, 
                              unsigned long long filesize);
 static int auditUpdateCoverageBlockmap(struct scalpelState *state,
-                                       struct CarveInfo *carve);
-static int updateCoverageBlockmap(struct scalpelState *state,
-                                  unsigned long long block);
-static void generateFragments(struct scalpelState *state, Queue * fragments,
-                              struct CarveInfo *carve);
+                                       struct CarveInfo *carve,
+                                       QueuePool *fragmentpool,
+                                       char digests[SCALPEL_NUM_HASHES][SCALPEL_MAX_DIGEST_STRING],
+                                       const CarvedContent *duplicate);
+static const CarvedContent *identifyCarvedFile(struct scalpelState *state,
+                                               struct CarveInfo *carve, char *fn,
+                                               char digests[SCALPEL_NUM_HASHES][SCALPEL_MAX_DIGEST_STRING]);
+static int storeDuplicateOnce(struct scalpelState *state,
+                              struct CarveInfo *carve, char *fn,
+                              const CarvedContent *duplicate);
+static void queueCoverageUpdate(struct scalpelState *state,
+                                unsigned long long start,
+                                unsigned long long stop);
+static void applyCoverageUpdates(struct scalpelState *state);
+static void generateFragments(struct scalpelState *state, PoolQueue * fragments,
+                              QueuePool *fragmentpool, struct CarveInfo *carve);
 static unsigned long long 
     positionUseCoverageBlockmap(struct scalpelState *state,
-                                unsigned long long
-                                position);
-static void destroyCoverageMaps(struct scalpelState *state);
+                                unsigned long long position,
+                                unsigned long long *extent);
+static int destroyCoverageMaps(struct scalpelState *state);
+static void discardCoverageMaps(struct scalpelState *state);
+static int readCoverageBlockmap(struct scalpelState *state, char *fn,
+                               CoverageBlockmapHeader *header);
+static int readLegacyCoverageBlockmap(struct scalpelState *state, char *fn);
+static int writeCoverageBlockmap(struct scalpelState *state, char *fn,
+                                 unsigned char *bits);
+static CoverageOverflow *findCoverageOverflow(struct scalpelState *state,
+                                              unsigned long long block,
+                                              int create);
+static unsigned long long coverageBlockmapCount(struct scalpelState *state,
+                                                unsigned long long block);
+static unsigned long long sortedCoverageOverflow(struct scalpelState *state,
+                                                 CoverageOverflow **entries);
+static void buildCoverageIndex(struct scalpelState *state);
+static void restrictCoverageToRegions(struct scalpelState *state);
+static void findSkipRuns(struct scalpelState *state, readbuf_info *rinfo,
+                         unsigned long long *counted);
+static void mergeKnownBlocks(struct scalpelState *state);
+static int useCoverageTranslation(struct scalpelState *state);
+static unsigned long long coverageRank(struct scalpelState *state,
+                                       unsigned long long block);
+static unsigned long long findCoverageExtent(struct scalpelState *state,
+                                             unsigned long long position,
+                                             unsigned long long *extent);
+static unsigned long long
+    logicalUseCoverageBlockmap(struct scalpelState *state,
+                               unsigned long long position);
 static int fseeko_use_coverage_map(struct scalpelState *state, 
                                    ScalpelInputReader * const inReader,
                                    off64_t offset);
@@ -123,103 +209,330 @@ static off64_t ftello_use_coverage_map(struct scalpelState *state,
                                        ScalpelInputReader * const inReader);
 static size_t fread_use_coverage_map(struct scalpelState *state, void *ptr,
                                      size_t size, size_t nmemb, 
-                                     ScalpelInputReader * const inReader);
+                                     ScalpelInputReader * const inReader,
+                                     unsigned long long *extent);
+// allocate a CarveInfo struct from the current image file's blocks
+static struct CarveInfo *allocateCarveInfo(struct scalpelState *state,
+                                           CarveInfoBlock **blocks) {
+
+    CarveInfoBlock *block = *blocks;
+    unsigned long size = CARVEINFO_MIN_BLOCK_SIZE;
+
+    if(!block || block->used == block->size) {
+        if(block && block->size < CARVEINFO_MAX_BLOCK_SIZE) {
+            size = block->size * 2;
+        }
+        else if(block) {
+            size = block->size;
+        }
+        block = (CarveInfoBlock *)malloc(sizeof(CarveInfoBlock) +
+            (size - 1) * sizeof(CarveInfo));
+        checkMemoryAllocation(state, block, __LINE__, __FILE__, "carveinfo");
+        block->next = *blocks;
+        block->size = size;
+        block->used = 0;
+        *blocks = block;
+    }
+    return &(block->carves[block->used++]);
+}
+
+
+// release all CarveInfo structs for an image file, closing any carved
+// files left open when carving was abandoned
+static void freeCarveInfoBlocks(struct scalpelState *state,
+                                CarveInfoBlock *blocks) {
+
+    CarveInfoBlock *next;
+    unsigned long i;
+
+    while (blocks) {
+        next = blocks->next;
+        for(i = 0; i < blocks->used; i++) {
+            if(!state->previewMode && !state->packOutput && blocks->carves[i].fp) {
+                fclose(blocks->carves[i].fp);
+            }
+            discardCarveHash(blocks->carves[i].hash);
+        }
+        free(blocks);
+        blocks = next;
+    }
+}
+
+
+// generate the output filename for a file to carve.  Files are numbered
+// in the order their carving was planned, and the organization
+// subdirectory changes every state->organizeMaxFilesPerSub files of a
+// type.
+static void carveFilename(struct scalpelState *state,
+                          struct CarveInfo *carve, char *fn) {
+
+    struct SearchSpecLine *currentneedle = &(state->SearchSpec[carve->needlenum]);
+    char orgdir[MAX_STRING_LENGTH];	// buffer for name of organizing subdirectory
+    unsigned long long filenum = carve->serial;
+
+    if(state->organizeSubdirectories) {
+        snprintf(orgdir, MAX_STRING_LENGTH, "%s/%s-%d-%1lu",
+            state->outputdirectory,
+            currentneedle->suffix,
+            carve->needlenum, (unsigned long)(currentneedle->firstorganizeDirNum +
+            carve->filenum / state->organizeMaxFilesPerSub));
+    }
+    else {
+        snprintf(orgdir, MAX_STRING_LENGTH, "%s", state->outputdirectory);
+    }
+
+    if(state->modeNoSuffix || currentneedle->suffix[0] ==
+        SCALPEL_NOEXTENSION) {
+#ifdef _WIN32
+            snprintf(fn, MAX_STRING_LENGTH, "%s/%08I64u",
+                orgdir, filenum);
+#else
+            snprintf(fn, MAX_STRING_LENGTH, "%s/%08llu",
+                orgdir, filenum);
+#endif
+
+    }
+    else {
+#ifdef _WIN32
+        snprintf(fn, MAX_STRING_LENGTH, "%s/%08I64u.%s",
+            orgdir, filenum, currentneedle->suffix);
+#else
+        snprintf(fn, MAX_STRING_LENGTH, "%s/%08llu.%s",
+            orgdir, filenum, currentneedle->suffix);
+#endif
+    }
+}
+
+
+// create the organization subdirectory for a file to carve, if it
+// wasn't created already.  Files of each type are opened in order, so
+// remembering the last subdirectory created for the type is enough.
+static void createOrganizeDir(struct scalpelState *state,
+                              struct CarveInfo *carve) {
+
+    struct SearchSpecLine *currentneedle = &(state->SearchSpec[carve->needlenum]);
+    char orgdir[MAX_STRING_LENGTH];	// buffer for name of organizing subdirectory
+    long dirnum;
+
+    if(!state->organizeSubdirectories || state->previewMode || state->packOutput) {
+        return;
+    }
+
+    dirnum = currentneedle->firstorganizeDirNum +
+        carve->filenum / state->organizeMaxFilesPerSub;
+    if(dirnum == currentneedle->createdDirNum) {
+        return;
+    }
+
+    snprintf(orgdir, MAX_STRING_LENGTH, "%s/%s-%d-%1lu",
+        state->outputdirectory,
+        currentneedle->suffix,
+        carve->needlenum, (unsigned long)dirnum);
+#ifdef _WIN32
+    mkdir(orgdir);
+#else
+    mkdir(orgdir, 0777);
+#endif
+    currentneedle->createdDirNum = dirnum;
+}
+
+
 #ifdef UNUSED
 static void printhex(char *s, int len);
 #endif
 
+// size of an input whose size is unknown, for displayPosition()
+#define PROGRESS_SIZE_UNKNOWN  ULLONG_MAX
+
 static void clean_up(struct scalpelState *state, int signum);
 static int displayPosition(int *units, unsigned long long pos,
                            unsigned long long size, const char *fn);
 static int setupAuditFile(struct scalpelState *state);
+static void auditCarveTableHeader(struct scalpelState *state);
 static int digBuffer(struct scalpelState *state,
                      unsigned long long lengthofbuf,
-                     unsigned long long offset);
+                     unsigned long long offset,
+                     unsigned long long firstextent,
+                     SkipRun *skipruns,
+                     unsigned long long numskipruns);
+static int checkpointDue(struct scalpelState *state);
+static int writeCheckpoint(struct scalpelState *state, int pass,
+                           unsigned long long cursor, PoolQueue *current);
+static int checkpointStartImage(struct scalpelState *state, int *resuming);
+static int restoreCheckpointOffsets(struct scalpelState *state);
+static int openCheckpointJournal(struct scalpelState *state, int resuming,
+                                 unsigned long long filesize);
+static int checkpointEndImage(struct scalpelState *state);
+static int resumeCarves(struct scalpelState *state, PoolQueue *carvelists,
+                        unsigned long long filesize);
+static int digAndCarveImageFile(struct scalpelState *state);
 #ifdef MULTICORE_THREADING
 static void *threadedFindAll(void *args);
 #endif
 
 
-// force header/footer matching to deal with embedded headers/footers
+// binary search for the index of the first footer at or after index
+// 'lo' whose position is greater than 'position'.  Footer positions
+// are sorted in ascending order.  Returns numfooters if there is no
+// such footer.
 static unsigned long long
-adjustForEmbedding(struct SearchSpecLine *currentneedle,
-                   unsigned long long headerindex,
-                   unsigned long long *prevstopindex) {
-
-    unsigned long long h = headerindex + 1;
-    unsigned long long f = 0;
-    int header = 0;
-    int footer = 0;
-    long long headerstack = 0;
-    unsigned long long start = currentneedle->offsets.headers[headerindex] + 1;
-    unsigned long long candidatefooter;
-    int morecandidates = 1;
-    int moretests = 1;
-
-    // skip footers which precede header
-    while (*prevstopindex < currentneedle->offsets.numfooters &&
-           currentneedle->offsets.footers[*prevstopindex] < start) {
-            (*prevstopindex)++;
-    }
-
-    f = *prevstopindex;
-    candidatefooter = *prevstopindex;
-
-    // skip footers until header/footer count balances
-    while (candidatefooter < currentneedle->offsets.numfooters && 
-           morecandidates) {
-        // see if this footer is viable
-        morecandidates = 0;	 // assumption is yes, viable
-        moretests = 1;
-        while (moretests && 
-               start < currentneedle->offsets.footers[candidatefooter]) {
-            header = 0;
-            footer = 0;
-            if(h < currentneedle->offsets.numheaders
-                && currentneedle->offsets.headers[h] >= start
-                && currentneedle->offsets.headers[h] <
-                currentneedle->offsets.footers[candidatefooter]) {
-                    header = 1;
-            }
-            if(f < currentneedle->offsets.numfooters
-                && currentneedle->offsets.footers[f] >= start
-                && currentneedle->offsets.footers[f] <
-                currentneedle->offsets.footers[candidatefooter]) {
-                    footer = 1;
-            }
-
-            if(header && (!footer ||
-                currentneedle->offsets.headers[h] <
-                currentneedle->offsets.footers[f])) {
-                    h++;
-                    headerstack++;
-                    start = (h < currentneedle->offsets.numheaders)
-                        ? currentneedle->offsets.headers[h] : start + 1;
-            }
-            else if(footer) {
-                f++;
-                headerstack--;
-                if(headerstack < 0) {
-                    headerstack = 0;
+firstFooterAfter(struct SearchSpecLine *currentneedle,
+                 unsigned long long lo, unsigned long long position) {
+
+    unsigned long long hi = currentneedle->offsets.numfooters;
+    unsigned long long mid;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if(currentneedle->offsets.footers[mid] <= position) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+
+// the last byte to carve for a FORWARD or FORWARD_NEXT file starting at
+// 'start' and ended by the footer at 'footer', or -1 if no footer
+// follows the header.  For FORWARD, include the footer in the carved
+// file; for FORWARD_NEXT, don't include footer in carved file.  For
+// FORWARD_NEXT, if no footer is found, then the maximum carve size for
+// this file type will be used and carving will proceed.  For FORWARD,
+// if no footer is found then no carving will be performed unless -b
+// was specified on the command line.  Returns 0 if nothing is to be
+// carved, and sets *chopped if the file is cut at the max carve size.
+static long long
+forwardCarveStop(struct scalpelState *state,
+                 struct SearchSpecLine *currentneedle,
+                 long long start, long long footer, char *chopped) {
+
+    long long stop = 0;
+
+    if(footer >= 0) {
+        stop = footer;
+
+        if(currentneedle->searchtype == SEARCHTYPE_FORWARD) {
+            // include footer in carved file
+            stop += currentneedle->endlength - 1;
+            // 	BUG? this or above?		    stop += currentneedle->offsets.footerlens[j] - 1;
+        }
+        else {
+            // FORWARD_NEXT--don't include footer in carved file
+            stop--;
+        }
+        // sanity check on size of potential file to carve--different
+        // actions depending on FORWARD or FORWARD_NEXT semantics
+        if(stop - start + 1 > (long long)currentneedle->length) {
+            if(currentneedle->searchtype == SEARCHTYPE_FORWARD) {
+                // if the user specified -b, then foremost 0.69
+                // compatibility is desired: carve this file even 
+                // though the footer wasn't found and indicate
+                // the file was chopped, in the log.  Otherwise, 
+                // carve nothing and move on.
+                if(state->carveWithMissingFooters) {
+                    stop = start + currentneedle->length - 1;
+                    *chopped = 1;
+                }
+                else {
+                    stop = 0;
                 }
-                start = (f < currentneedle->offsets.numfooters)
-                    ? currentneedle->offsets.footers[f] : start + 1;
             }
             else {
-                moretests = 0;
+                // footer found for FORWARD_NEXT, but distance exceeds
+                // max carve size for this file type, so use max carve
+                // size as stop
+                stop = start + currentneedle->length - 1;
+                *chopped = 1;
             }
         }
+    }
+    else if(currentneedle->searchtype == SEARCHTYPE_FORWARD_NEXT ||
+        (currentneedle->searchtype == SEARCHTYPE_FORWARD &&
+        state->carveWithMissingFooters)) {
+            // no footer found for SEARCHTYPE_FORWARD_NEXT, or no footer
+            // found for SEARCHTYPE_FORWARD and user specified -b, so just use
+            // max carve size for this file type as stop
+            stop = start + currentneedle->length - 1;
+    }
+    return stop;
+}
+
+
+// the last byte to carve for a REVERSE file starting at 'start', or 0 if
+// nothing is to be carved.  Want matching footer as far away from header
+// as possible, within maximum carving size for this file type.  Don't
+// bother to look at footers that can't possibly match a header and
+// remember this info in *prevstopindex, as the next headers will be even
+// deeper into the image file.  Footer is included in carved file for
+// this type of carve.  Both ends of the range of candidate footers are
+// found by binary search.
+static long long
+reverseCarveStop(struct SearchSpecLine *currentneedle,
+                 unsigned long long start, unsigned long long *prevstopindex) {
+
+    unsigned long long j;
+
+    *prevstopindex = firstFooterAfter(currentneedle, *prevstopindex, start);
+    j = firstFooterAfter(currentneedle, *prevstopindex,
+        ULLONG_MAX - start < currentneedle->length ? ULLONG_MAX :
+        start + currentneedle->length);
+    if(j > *prevstopindex) {
+        return currentneedle->offsets.footers[j - 1] + currentneedle->endlength - 1;
+    }
+    return 0;
+}
 
-        if(headerstack > 0) {
-            // header/footer imbalance, need to try next footer
-            candidatefooter++;
-            // this footer counts against footer deficit!
-            headerstack--;
-            morecandidates = 1;
+
+// force header/footer matching to deal with embedded headers/footers.
+// Headers and footers are merged in a single pass, in order of
+// position, pushing each header on a stack and matching each footer
+// to the most recent unmatched header, so that nested files of the
+// same type are paired like parentheses.  A footer at the same
+// position as a header can't end the file starting there, so footers
+// are processed first on ties.  Returns an array holding the index of
+// the matching footer for each header, or numfooters if the header is
+// unmatched; the caller frees it.
+static unsigned long long *
+matchEmbeddedFooters(struct scalpelState *state,
+                     struct SearchSpecLine *currentneedle) {
+
+    unsigned long long numheaders = currentneedle->offsets.numheaders;
+    unsigned long long numfooters = currentneedle->offsets.numfooters;
+    unsigned long long *match, *headerstack;
+    unsigned long long h = 0, f = 0, top = 0;
+
+    match = (unsigned long long *)
+        malloc(sizeof(unsigned long long) * (numheaders + 1));
+    checkMemoryAllocation(state, match, __LINE__, __FILE__, "match");
+    headerstack = (unsigned long long *)
+        malloc(sizeof(unsigned long long) * (numheaders + 1));
+    checkMemoryAllocation(state, headerstack, __LINE__, __FILE__, "headerstack");
+
+    while (h < numheaders) {
+        if(f < numfooters && currentneedle->offsets.footers[f] <=
+            currentneedle->offsets.headers[h]) {
+                // footer closes the innermost open header, if any
+                if(top > 0) {
+                    match[headerstack[--top]] = f;
+                }
+                f++;
+        }
+        else {
+            match[h] = numfooters;
+            headerstack[top++] = h++;
         }
     }
 
-    return (headerstack > 0) ? 999999999999999999ULL : candidatefooter;
+    // remaining footers close the headers still open
+    while (top > 0 && f < numfooters) {
+        match[headerstack[--top]] = f++;
+    }
+
+    free(headerstack);
+    return match;
 }
 
 
@@ -242,15 +555,19 @@ static void clean_up(struct scalpelState *state, int signum) {
     std::string msg = ss.str();
     scalpelLog(state, msg.c_str());
     closeAuditFile(state->auditFile);
+    state->auditFile = NULL;
     throw std::runtime_error(msg);
 }
 
-// display progress bar
+// display progress bar.  'size' is PROGRESS_SIZE_UNKNOWN for a stream,
+// for which only the position is shown.
 static int
 displayPosition(int *units,
                 unsigned long long pos, unsigned long long size, 
                 const char *fn) {
-    double percentDone = (((double)pos) / (double)(size) * 100);
+    // an image whose blocks are all covered has no logical bytes left;
+    // report it as complete rather than dividing by zero
+    double percentDone = size ? (((double)pos) / (double)(size) * 100) : 100.0;
     double position = (double)pos;
     int count;
     int barlength, i, len;
@@ -318,6 +635,12 @@ displayPosition(int *units,
         return SCALPEL_OK;
     }
 
+    if(size == PROGRESS_SIZE_UNKNOWN) {
+        fprintf(stdout, "\r%s: %6.1f %s", fn, position, buf);
+        fflush(stdout);
+        return SCALPEL_OK;
+    }
+
     len = 0;
     len +=
         snprintf(line + len, sizeof(line) - len, "\r%s: %5.1f%% ", fn, percentDone);
@@ -371,6 +694,11 @@ static int setupAuditFile(struct scalpelState *state) {
     if(realpath(scalpelInputGetId(state->inReader), inputStreamId)) {
         scalpelLog(state, "\nOpening target \"%s\"\n\n", inputStreamId);
     }
+    else if(scalpelInputIsStream(state->inReader)) {
+        // standard input has no path
+        scalpelLog(state, "\nOpening target \"%s\"\n\n",
+            scalpelInputGetId(state->inReader));
+    }
     else {
         //handleError(state, SCALPEL_ERROR_FILE_OPEN);
         return SCALPEL_ERROR_FILE_OPEN;
@@ -386,30 +714,39 @@ static int setupAuditFile(struct scalpelState *state) {
         }
     }
 
+    return SCALPEL_OK;
+}
+
+// start the table of carved files in the audit log for the current
+// image file
+static void auditCarveTableHeader(struct scalpelState *state) {
+
+    int i;
 
     fprintf(state->auditFile, "The following files were carved:\n");
     fprintf(state->auditFile,
-        "File\t\t  Start\t\t\tChop\t\tLength\t\tExtracted From\n");
-
-    return SCALPEL_OK;
+        "File\t\t  Start\t\t\tChop\t\tLength\t\tExtracted From");
+    for(i = 0; i < SCALPEL_NUM_HASHES; i++) {
+        if(state->hashAlgorithms & (1 << i)) {
+            fprintf(state->auditFile, "\t%s", hashName(i));
+        }
+    }
+    fprintf(state->auditFile, "\n");
 }
 
 static int
 digBuffer(struct scalpelState *state, unsigned long long lengthofbuf,
-          unsigned long long offset) {
+          unsigned long long offset, unsigned long long firstextent,
+          SkipRun *skipruns, unsigned long long numskipruns) {
 
     unsigned long long startLocation = 0;
     int needlenum, i = 0;
     struct SearchSpecLine *currentneedle = 0;
+    long skipoverlap = findLongestNeedle(state->SearchSpec) - 1;
     //  gettimeofday_t srchnow, srchthen;
 
     // for each file type, find all headers and some (or all) footers
 
-    // signal check
-    if(signal_caught == SIGTERM || signal_caught == SIGINT) {
-        clean_up(state, signal_caught);
-    }
-
 
     ///////////////////////////////////////////////////
     ///////////////////////////////////////////////////
@@ -443,6 +780,9 @@ digBuffer(struct scalpelState *state, unsigned long long lengthofbuf,
 
             needlenum = readbuffer[d] - 1;
             currentneedle = &(state->SearchSpec[needlenum]);
+            if(currentneedle->offsetsPreloaded) {
+                continue;
+            }
             startLocation = offset + i;
 
             // found a header--record location in header offsets database
@@ -450,7 +790,7 @@ digBuffer(struct scalpelState *state, unsigned long long lengthofbuf,
 
                 fprintf(stdout, "A %s header was found at : %"PRIu64 "\n",
                     currentneedle->suffix,
-                    positionUseCoverageBlockmap(state, startLocation));
+                    positionUseCoverageBlockmap(state, startLocation, &firstextent));
 
             }
 
@@ -490,13 +830,16 @@ digBuffer(struct scalpelState *state, unsigned long long lengthofbuf,
 
             needlenum = -1 * readbuffer[d] - 1;
             currentneedle = &(state->SearchSpec[needlenum]);
+            if(currentneedle->offsetsPreloaded) {
+                continue;
+            }
             startLocation = offset + i;
             // found a footer--record location in footer offsets database
             if(state->modeVerbose) {
 
                 fprintf(stdout, "A %s footer was found at : %"PRIu64 "\n",
                     currentneedle->suffix,
-                    positionUseCoverageBlockmap(state, startLocation));
+                    positionUseCoverageBlockmap(state, startLocation, &firstextent));
 
             }
 
@@ -563,6 +906,11 @@ digBuffer(struct scalpelState *state, unsigned long long lengthofbuf,
         currentneedle = &(state->SearchSpec[needlenum]);
         // # of matches in last element of foundat array
         foundat[needlenum][MAX_MATCHES_PER_BUFFER] = 0;
+        // offsets for this type came from a header/footer database
+        if(currentneedle->offsetsPreloaded) {
+            threadargs[needlenum].length = 0;
+            continue;
+        }
         threadargs[needlenum].id = needlenum;
         threadargs[needlenum].str = currentneedle->begin;
         threadargs[needlenum].length = currentneedle->beginlength;
@@ -579,6 +927,9 @@ digBuffer(struct scalpelState *state, unsigned long long lengthofbuf,
         }
         threadargs[needlenum].casesensitive = currentneedle->casesensitive;
         threadargs[needlenum].nosearchoverlap = state->noSearchOverlap;
+        threadargs[needlenum].skipruns = skipruns;
+        threadargs[needlenum].numskipruns = numskipruns;
+        threadargs[needlenum].skipoverlap = skipoverlap;
         threadargs[needlenum].state = state;
 
         // unblock thread
@@ -599,7 +950,9 @@ digBuffer(struct scalpelState *state, unsigned long long lengthofbuf,
     for(needlenum = 0; needlenum < state->specLines; needlenum++) {
         //    sem_wait(&workcomplete[needlenum]);
 
-        pthread_mutex_lock(&workcomplete[needlenum]);
+        if(threadargs[needlenum].length > 0) {
+            pthread_mutex_lock(&workcomplete[needlenum]);
+        }
 
     }
 
@@ -620,7 +973,7 @@ digBuffer(struct scalpelState *state, unsigned long long lengthofbuf,
 
                 fprintf(stdout, "A %s header was found at : %"PRIu64 "\n",
                     currentneedle->suffix,
-                    positionUseCoverageBlockmap(state, startLocation));
+                    positionUseCoverageBlockmap(state, startLocation, &firstextent));
             }
 
             currentneedle->offsets.numheaders++;
@@ -677,6 +1030,9 @@ digBuffer(struct scalpelState *state, unsigned long long lengthofbuf,
     // 
     // a header/footer database is being created.  In this case, ALL headers and
     // footers must be discovered)
+    //
+    // AND the offsets for the file type weren't loaded from a previous
+    // header/footer database.
 
     if(state->modeVerbose) {
         printf("Waking up threads for footer searches.\n");
@@ -684,7 +1040,7 @@ digBuffer(struct scalpelState *state, unsigned long long lengthofbuf,
 
     for(needlenum = 0; needlenum < state->specLines; needlenum++) {
         currentneedle = &(state->SearchSpec[needlenum]);
-        if(
+        if(!currentneedle->offsetsPreloaded && (
             // regular case--want to search for only "viable" (in the sense that they are
             // useful for carving unfragmented files) footers, to save time
             (currentneedle->offsets.numheaders > 0 &&
@@ -697,7 +1053,7 @@ digBuffer(struct scalpelState *state, unsigned long long lengthofbuf,
             currentneedle->length))) ||
             // generating header/footer database, need to find all footers
             // BUG:  ALSO need to do this for discovery of fragmented files--document this
-            (currentneedle->endlength && state->generateHeaderFooterDatabase)) {
+            (currentneedle->endlength && state->generateHeaderFooterDatabase))) {
                 // # of matches in last element of foundat array
                 foundat[needlenum][MAX_MATCHES_PER_BUFFER] = 0;
                 threadargs[needlenum].id = needlenum;
@@ -716,6 +1072,9 @@ digBuffer(struct scalpelState *state, unsigned long long lengthofbuf,
                 }
                 threadargs[needlenum].casesensitive = currentneedle->casesensitive;
                 threadargs[needlenum].nosearchoverlap = state->noSearchOverlap;
+                threadargs[needlenum].skipruns = skipruns;
+                threadargs[needlenum].numskipruns = numskipruns;
+                threadargs[needlenum].skipoverlap = skipoverlap;
                 threadargs[needlenum].state = state;
 
                 // unblock thread
@@ -758,7 +1117,7 @@ digBuffer(struct scalpelState *state, unsigned long long lengthofbuf,
 
                 fprintf(stdout, "A %s footer was found at : %"PRIu64 "\n",
                     currentneedle->suffix,
-                    positionUseCoverageBlockmap(state, startLocation));
+                    positionUseCoverageBlockmap(state, startLocation, &firstextent));
             }
 
             currentneedle->offsets.numfooters++;
@@ -969,12 +1328,15 @@ void *streaming_reader(void *sss) {
     readbuf_info *rinfo = NULL;
     long long filesize = 0, bytesread = 0, filebegin = 0,
         fileposition = 0, beginreadpos = 0;
+    unsigned long long extent = 0, constantcounted = 0;
     long err = SCALPEL_OK;
     int displayUnits = UNITS_BYTES;
     int longestneedle = findLongestNeedle(state->SearchSpec);
 
     filebegin = scalpelInputTello(state->inReader);
-    if((filesize = scalpelInputGetSize(state->inReader)) == -1) {
+    // the size of a stream is unknown
+    if(!scalpelInputIsStream(state->inReader) &&
+        (filesize = scalpelInputGetSize(state->inReader)) == -1) {
         fprintf(stderr,
             "ERROR: Couldn't measure size of input: %s\n",
             scalpelInputGetId(state->inReader));
@@ -988,7 +1350,7 @@ void *streaming_reader(void *sss) {
     // Read chunk of image into empty buffer.
     while ((bytesread =
         fread_use_coverage_map(state, rinfo->readbuf, 1, SIZE_OF_BUFFER,
-        state->inReader)) > longestneedle - 1) {
+        state->inReader, &extent)) > longestneedle - 1) {
 
             if(state->modeVerbose) {
                 fprintf(stdout, "Read %"PRIu64 " bytes from image file.\n", bytesread);
@@ -1002,15 +1364,18 @@ void *streaming_reader(void *sss) {
             // progress report needs a fileposition that doesn't depend on coverage map
             fileposition = scalpelInputTello(state->inReader);
             displayPosition(&displayUnits, fileposition - filebegin,
+                scalpelInputIsStream(state->inReader) ? PROGRESS_SIZE_UNKNOWN :
                 filesize, scalpelInputGetId(state->inReader));
 
             // if carving is dependent on coverage map, need adjusted fileposition
             fileposition = ftello_use_coverage_map(state, state->inReader);
             beginreadpos = fileposition - bytesread;
 
-            //signal check
+            // signal check--stop reading and let the consumer checkpoint
+            // and clean up
             if(signal_caught == SIGTERM || signal_caught == SIGINT) {
-                clean_up(state, signal_caught);
+                put(empty_readbuf, (void *)rinfo);
+                break;
             }
 
             // Put now-full buffer into full_readbuf queue.
@@ -1018,6 +1383,8 @@ void *streaming_reader(void *sss) {
             // position 
             rinfo->bytesread = bytesread;
             rinfo->beginreadpos = beginreadpos - state->skip;
+            rinfo->firstextent = extent;
+            findSkipRuns(state, rinfo, &constantcounted);
             put(full_readbuf, (void *)rinfo);
 
             // At this point, the host, GPU, whatever can start searching the buffer. 
@@ -1031,6 +1398,11 @@ void *streaming_reader(void *sss) {
             fseeko_use_coverage_map(state, state->inReader, -1 * (longestneedle - 1));
     }
 
+    // a failed read ends the loop like the end of the image does
+    if(scalpelInputGetError(state->inReader)) {
+        err = SCALPEL_ERROR_FILE_READ;
+    }
+
 exit_reader_thread:
     if (err != SCALPEL_OK) {
         handleError(state, err);
@@ -1042,6 +1414,8 @@ exit_reader_thread:
     // mark as end of reads
     rinfo->bytesread = 0;
     rinfo->beginreadpos = 0;
+    rinfo->firstextent = 0;
+    rinfo->numskipruns = 0;
     // put in queue
     put(full_readbuf, (void *)rinfo);
 
@@ -1061,13 +1435,49 @@ exit_reader_thread:
 // image file.  This buffer is now global and named "readbuffer".
 int digImageFile(struct scalpelState *state) {
 
-    int status, err;
+    int status, err, searchneeded, resuming;
     int longestneedle = findLongestNeedle(state->SearchSpec);
     //long long filebegin;
     long long filesize;
+    unsigned long long nextcursor = 0;
+
+    state->imageCarved = FALSE;
+
+    // a stream can be read only once, so it's carved while it is dug
+    if(scalpelInputIsStream(state->inReader)) {
+        return digAndCarveImageFile(state);
+    }
+
+    // generating a block hash set (-G): the image is hashed instead of
+    // searched
+    if(state->blockhashoutput) {
+        return hashImageBlocks(state);
+    }
+
+    // with -F the image is carved while it is dug, unless the offsets of
+    // the whole image are needed, or pass 1 must be checkpointed
+    if(state->singlePass) {
+        if(!state->generateHeaderFooterDatabase && !state->useHeaderFooterDatabase &&
+            !state->blockhashfile && state->checkpointInterval <= 0 &&
+            !state->checkpoint && !state->resumeFromCheckpoint) {
+                return digAndCarveImageFile(state);
+        }
+        fprintf(stdout,
+            "Image file %s is carved in two passes; -F can't be combined with -d, -D,\n"
+            "-H or checkpoints.\n", scalpelInputGetId(state->inReader));
+    }
 
+    // when resuming from a checkpoint, images completed before the
+    // checkpoint are skipped and the one in progress is picked up
+    // where it left off
+    if((err = checkpointStartImage(state, &resuming)) != SCALPEL_OK) {
+        return err;
+    }
+    if(state->checkpoint && state->checkpoint->skipImage) {
+        return SCALPEL_OK;
+    }
 
-    if ((err = setupAuditFile(state)) != SCALPEL_OK) {
+    if (!resuming && (err = setupAuditFile(state)) != SCALPEL_OK) {
         return err;
     }
 
@@ -1104,6 +1514,11 @@ int digImageFile(struct scalpelState *state) {
         return SCALPEL_ERROR_FILE_TOO_SMALL;
     }
 
+    if(resuming && (state->checkpoint->resumeImageSize != (unsigned long long)filesize ||
+        state->checkpoint->resumeSkip != state->skip)) {
+            return SCALPEL_ERROR_BAD_CHECKPOINT;
+    }
+
 
     if(state->modeVerbose) {
         fprintf(stdout, "Total file size is %"PRIu64 " bytes\n", filesize);
@@ -1115,6 +1530,60 @@ int digImageFile(struct scalpelState *state) {
         return err;
     }
 
+    if((state->useHeaderFooterDatabase || state->generateHeaderFooterDatabase) &&
+        (err = fingerprintImage(state, filesize)) != SCALPEL_OK) {
+            return err;
+    }
+
+    // reuse offsets from a previous header/footer database, if requested,
+    // so that only new or changed file types are searched for.  If nothing
+    // is left to search for, pass 1 is unnecessary.
+    searchneeded = state->specLines;
+    if(state->useHeaderFooterDatabase) {
+        searchneeded = readHeaderFooterDatabase(state, filesize);
+    }
+
+    if(!resuming) {
+        auditCarveTableHeader(state);
+    }
+    else if((err = restoreCheckpointOffsets(state)) != SCALPEL_OK) {
+        return err;
+    }
+
+    if((err = openCheckpointJournal(state, resuming, filesize)) != SCALPEL_OK) {
+        return err;
+    }
+
+    if(searchneeded == 0 || (resuming && state->checkpoint->resumePass == 2)) {
+        if(searchneeded == 0) {
+            fprintf(stdout,
+                "Image file pass 1/2 skipped, all headers/footers loaded from database.\n");
+        }
+        else {
+            fprintf(stdout, "Image file pass 1/2 completed before checkpoint.\n");
+        }
+        // carveImageFile() carves using the last buffer handed out in pass 1
+        readbuffer = readbuf_store[0].readbuf;
+        scalpelInputClose(state->inReader);
+        if(!resuming) {
+            return writeCheckpoint(state, 2, state->skip, NULL);
+        }
+        return SCALPEL_OK;
+    }
+
+    if(resuming) {
+        // continue pass 1 with the first buffer not searched before the
+        // checkpoint
+        nextcursor = state->checkpoint->resumeCursor;
+        fseeko_use_coverage_map(state, state->inReader, nextcursor);
+        state->checkpoint->resumePass = 0;
+        fprintf(stdout, "Resuming image file pass 1/2 at offset %"PRIu64 ".\n",
+            nextcursor + state->skip);
+    }
+    if((err = writeCheckpoint(state, 1, nextcursor, NULL)) != SCALPEL_OK) {
+        return err;
+    }
+
     // process SIZE_OF_BUFFER-sized chunks of the current image
     // file and look for both headers and footers, recording their
     // offsets for use in the 2nd scalpel phase, when file data will 
@@ -1123,6 +1592,7 @@ int digImageFile(struct scalpelState *state) {
     fprintf(stdout, "Image file pass 1/2.\n");
 
     // Create and start the streaming reader thread for this image file.
+    state->constantbytes = 0;
     pthread_t reader;
     if(pthread_create(&reader, NULL, streaming_reader, (void *)state) != 0) {
         return SCALPEL_ERROR_PTHREAD_FAILURE;
@@ -1144,10 +1614,15 @@ int digImageFile(struct scalpelState *state) {
     // buffers. We get the results buffers and call digBuffer to decode them.
     while (!gpu_finished) {  // || !results_readbuf->empty) {
         readbuf_info *rinfo = (readbuf_info *)get(results_readbuf);
+        // signal check--everything before this buffer has been searched
+        if(signal_caught == SIGTERM || signal_caught == SIGINT) {
+            writeCheckpoint(state, 1, rinfo->beginreadpos, NULL);
+            clean_up(state, signal_caught);
+        }
         readbuffer = rinfo->readbuf;
         if((status =
-            digBuffer(state, rinfo->bytesread, rinfo->beginreadpos
-            )) != SCALPEL_OK) {
+            digBuffer(state, rinfo->bytesread, rinfo->beginreadpos,
+            rinfo->firstextent, rinfo->skipruns, rinfo->numskipruns)) != SCALPEL_OK) {
                 return status;
         }
         put(empty_readbuf, (void *)rinfo);
@@ -1156,10 +1631,15 @@ int digImageFile(struct scalpelState *state) {
     // the GPU is finished, but there may still be results buffers to decode
     while (!results_readbuf->empty) {
         readbuf_info *rinfo = (readbuf_info *)get(results_readbuf);
+        // signal check--everything before this buffer has been searched
+        if(signal_caught == SIGTERM || signal_caught == SIGINT) {
+            writeCheckpoint(state, 1, rinfo->beginreadpos, NULL);
+            clean_up(state, signal_caught);
+        }
         readbuffer = rinfo->readbuf;
         if((status =
-            digBuffer(state, rinfo->bytesread, rinfo->beginreadpos
-            )) != SCALPEL_OK) {
+            digBuffer(state, rinfo->bytesread, rinfo->beginreadpos,
+            rinfo->firstextent, rinfo->skipruns, rinfo->numskipruns)) != SCALPEL_OK) {
                 return status;
         }
         put(empty_readbuf, (void *)rinfo);
@@ -1180,17 +1660,110 @@ int digImageFile(struct scalpelState *state) {
             // end of reads condition - we're done
             break;
         }
+        if(signal_caught == SIGTERM || signal_caught == SIGINT) {
+            // discard buffers until the reader notices the signal and
+            // stops, so it isn't left blocked on a queue
+            put(empty_readbuf, (void *)rinfo);
+            continue;
+        }
         readbuffer = rinfo->readbuf;
         if ((status = digBuffer(state, rinfo->bytesread, 
-            rinfo->beginreadpos)) != SCALPEL_OK) {
+            rinfo->beginreadpos, rinfo->firstextent, rinfo->skipruns,
+            rinfo->numskipruns)) != SCALPEL_OK) {
                 return status;
         }
+        // the next buffer overlaps this one by longestneedle - 1 bytes
+        nextcursor = rinfo->beginreadpos + rinfo->bytesread - (longestneedle - 1);
         put(empty_readbuf, (void *)rinfo);
+
+        if(checkpointDue(state) &&
+            (status = writeCheckpoint(state, 1, nextcursor, NULL)) != SCALPEL_OK) {
+                return status;
+        }
     }
 
 #endif
 
-    return SCALPEL_OK;
+    // the reader closes the image after queueing the end marker; wait for
+    // it so the close can't race with the carving pass reopening the image
+    pthread_join(reader, NULL);
+
+    if(state->constantbytes > 0) {
+        fprintf(stdout,
+            "\n%"PRIu64 " bytes of constant blocks were skipped by the searches.\n",
+            state->constantbytes);
+    }
+
+    // the reader stops early if a signal was caught
+    if(signal_caught == SIGTERM || signal_caught == SIGINT) {
+        writeCheckpoint(state, 1, nextcursor, NULL);
+        clean_up(state, signal_caught);
+    }
+
+    mergeKnownBlocks(state);
+
+    return writeCheckpoint(state, 2, state->skip, NULL);
+}
+
+
+// print the number of files of each type carved from the current image
+// file
+static void printWorkload(struct scalpelState *state) {
+
+    struct SearchSpecLine *currentneedle;
+    int needlenum;
+
+    for(needlenum = 0; needlenum < state->specLines; needlenum++) {
+        currentneedle = &(state->SearchSpec[needlenum]);
+        fprintf(stdout, "%s with header \"", currentneedle->suffix);
+        fprintf(stdout, "%s", currentneedle->begintext);
+        fprintf(stdout, "\" and footer \"");
+        if(currentneedle->end == 0) {
+            fprintf(stdout, "NONE");
+        }
+        else {
+            fprintf(stdout, "%s", currentneedle->endtext);
+        }
+
+        fprintf(stdout, "\" --> %"PRIu64 " files\n", currentneedle->numfilestocarve);
+
+
+    }
+}
+
+
+// tear down the header/footer database of one file type
+static void releaseNeedleOffsets(struct SearchSpecLine *currentneedle) {
+
+    if(currentneedle->offsets.headers) {
+        free(currentneedle->offsets.headers);
+        currentneedle->offsets.headers = NULL;
+    }
+    if(currentneedle->offsets.footers) {
+        free(currentneedle->offsets.footers);
+        currentneedle->offsets.footers = NULL;
+    }
+    currentneedle->offsets.headers = 0;
+    currentneedle->offsets.footers = 0;
+    currentneedle->offsets.numheaders = 0;
+    currentneedle->offsets.numfooters = 0;
+    currentneedle->offsets.headerstorage = 0;
+    currentneedle->offsets.footerstorage = 0;
+}
+
+
+// tear down the header/footer databases of the current image file
+static void releaseOffsets(struct scalpelState *state) {
+
+    struct SearchSpecLine *currentneedle;
+    int needlenum;
+
+    for(needlenum = 0; needlenum < state->specLines; needlenum++) {
+        currentneedle = &(state->SearchSpec[needlenum]);
+        releaseNeedleOffsets(currentneedle);
+        currentneedle->numfilestocarve = 0;
+        currentneedle->offsetsPreloaded = FALSE;
+    }
 }
 
 
@@ -1205,31 +1778,48 @@ int carveImageFile(struct scalpelState *state) {
     int openErr;
     struct SearchSpecLine *currentneedle;
     struct CarveInfo *carveinfo;
+    CarveInfoBlock *carveblocks = NULL;	// storage for carveinfo structs
     char fn[MAX_STRING_LENGTH];	// temp buffer for output filename
-    char orgdir[MAX_STRING_LENGTH];	// buffer for name of organizing subdirectory
+    char digests[SCALPEL_NUM_HASHES][SCALPEL_MAX_DIGEST_STRING];
+    const CarvedContent *duplicate;	// earlier carved file with the same content
     long long start, stop;	// temp begin/end bytes for file to carve
     unsigned long long prevstopindex;	// tracks index of first 'reasonable' 
     // footer
+    unsigned long long *embeddedfooters;	// matching footer for each header,
+    // with -e
     int needlenum;
     long long filesize = 0, bytesread = 0, fileposition = 0, filebegin = 0;
+    unsigned long long readextent = 0;	// coverage map run being read
     long err = 0;
     int displayUnits = UNITS_BYTES;
     int success = 0;
     long long i, j;
-    int halt;
     char chopped;			// file chopped because it exceeds
     // max carve size for type?
     int CURRENTFILESOPEN = 0;	// number of files open (during carve)
-    unsigned long long firstcandidatefooter=0;
 
     // index of header and footer within image file, in SIZE_OF_BUFFER
     // blocks
     unsigned long long headerblockindex, footerblockindex;
 
-    struct Queue *carvelists;	// one entry for each SIZE_OF_BUFFER bytes of
+    PoolQueue *carvelists;	// one entry for each SIZE_OF_BUFFER bytes of
     // input file
+    QueuePool carvepool;	// elements of all carvelists
+    QueuePool fragmentpool;	// elements of fragment lists for auditing
     //  struct timeval queuenow, queuethen;
 
+    // image was completed before the checkpoint being resumed from
+    if(state->checkpoint && state->checkpoint->skipImage) {
+        state->checkpoint->skipImage = FALSE;
+        return SCALPEL_OK;
+    }
+
+    // nothing to carve when generating a block hash set, or when
+    // digImageFile() carved the whole image in a single pass
+    if(state->blockhashoutput || state->imageCarved) {
+        return SCALPEL_OK;
+    }
+
     // open image file and get size so carvelists can be allocated
     if((openErr = scalpelInputOpen(state->inReader)) != 0 ) {
         fprintf(stderr, "ERROR: Couldn't open input file: %s -- %s\n",
@@ -1264,16 +1854,19 @@ int carveImageFile(struct scalpelState *state) {
     // queue doesn't consume much memory, anyway.
 
     carvelists =
-        (Queue *) malloc(sizeof(Queue) * (2 + (filesize / SIZE_OF_BUFFER)));
+        (PoolQueue *) malloc(sizeof(PoolQueue) * (2 + (filesize / SIZE_OF_BUFFER)));
     checkMemoryAllocation(state, carvelists, __LINE__, __FILE__, "carvelists");
 
     // queue associated with each buffer of data holds pointers to
-    // CarveInfo structures.
+    // CarveInfo structures.  Carving is single-threaded, so the queues
+    // are unsynchronized and share one pool of elements.
 
     fprintf(stdout, "Allocating work queues...\n");
 
+    init_queue_pool(&carvepool, sizeof(struct CarveInfo *));
+    init_queue_pool(&fragmentpool, sizeof(struct Fragment));
     for(i = 0; i < 2 + (filesize / SIZE_OF_BUFFER); i++) {
-        init_queue(&carvelists[i], sizeof(struct CarveInfo *), TRUE, 0, TRUE);
+        init_pool_queue(&carvelists[i], &carvepool, TRUE);
     }
     fprintf(stdout, "Work queues allocation complete. Building work queues...\n");
 
@@ -1283,6 +1876,19 @@ int carveImageFile(struct scalpelState *state) {
 
         currentneedle = &(state->SearchSpec[needlenum]);
 
+        // organization subdirectories for this type are numbered from here
+        currentneedle->firstorganizeDirNum = currentneedle->organizeDirNum;
+        currentneedle->createdDirNum = -1;
+
+        // with -e, resolve nesting of embedded files for all headers of
+        // this type up front
+        embeddedfooters = NULL;
+        if(state->handleEmbedded && currentneedle->endlength &&
+            (currentneedle->searchtype == SEARCHTYPE_FORWARD ||
+            currentneedle->searchtype == SEARCHTYPE_FORWARD_NEXT)) {
+                embeddedfooters = matchEmbeddedFooters(state, currentneedle);
+        }
+
         // handle each discovered header independently
 
         prevstopindex = 0;
@@ -1315,107 +1921,24 @@ int carveImageFile(struct scalpelState *state) {
             else if(currentneedle->searchtype == SEARCHTYPE_FORWARD ||
                 currentneedle->searchtype == SEARCHTYPE_FORWARD_NEXT) {
                     // footer defined: use FORWARD or FORWARD_NEXT semantics.
-                    // Stop at first occurrence of footer, but for FORWARD,
-                    // include the header in the carved file; for FORWARD_NEXT,
-                    // don't include footer in carved file.  For FORWARD_NEXT, if
-                    // no footer is found, then the maximum carve size for this
-                    // file type will be used and carving will proceed.  For
-                    // FORWARD, if no footer is found then no carving will be
-                    // performed unless -b was specified on the command line.
-
-                    halt = 0;
-
-                    if (state->handleEmbedded && 
-                        (currentneedle->searchtype == SEARCHTYPE_FORWARD ||
-                        currentneedle->searchtype == SEARCHTYPE_FORWARD_NEXT)) {
-                            firstcandidatefooter=adjustForEmbedding(currentneedle, i, &prevstopindex);
+                    // Stop at first occurrence of footer.
+                    if(embeddedfooters) {
+                        j = embeddedfooters[i];
                     }
                     else {
-                        firstcandidatefooter=prevstopindex;
+                        // footers which precede this header can't match
+                        // it or any of the following headers
+                        j = firstFooterAfter(currentneedle, prevstopindex, start);
+                        prevstopindex = j;
                     }
 
-                    for (j=firstcandidatefooter;
-                        j < (long long)currentneedle->offsets.numfooters && ! halt; j++) {
-
-                            if((long long)currentneedle->offsets.footers[j] <= start) {
-                                if (! state->handleEmbedded) {
-                                    prevstopindex=j;
-                                }
-
-                            }
-                            else {
-                                halt = 1;
-                                stop = currentneedle->offsets.footers[j];
-
-                                if(currentneedle->searchtype == SEARCHTYPE_FORWARD) {
-                                    // include footer in carved file
-                                    stop += currentneedle->endlength - 1;
-                                    // 	BUG? this or above?		    stop += currentneedle->offsets.footerlens[j] - 1;
-                                }
-                                else {
-                                    // FORWARD_NEXT--don't include footer in carved file
-                                    stop--;
-                                }
-                                // sanity check on size of potential file to carve--different
-                                // actions depending on FORWARD or FORWARD_NEXT semantics
-                                if(stop - start + 1 > (long long)currentneedle->length) {
-                                    if(currentneedle->searchtype == SEARCHTYPE_FORWARD) {
-                                        // if the user specified -b, then foremost 0.69
-                                        // compatibility is desired: carve this file even 
-                                        // though the footer wasn't found and indicate
-                                        // the file was chopped, in the log.  Otherwise, 
-                                        // carve nothing and move on.
-                                        if(state->carveWithMissingFooters) {
-                                            stop = start + currentneedle->length - 1;
-                                            chopped = 1;
-                                        }
-                                        else {
-                                            stop = 0;
-                                        }
-                                    }
-                                    else {
-                                        // footer found for FORWARD_NEXT, but distance exceeds
-                                        // max carve size for this file type, so use max carve
-                                        // size as stop
-                                        stop = start + currentneedle->length - 1;
-                                        chopped = 1;
-                                    }
-                                }
-                            }
-                    }
-                    if(!halt &&
-                        (currentneedle->searchtype == SEARCHTYPE_FORWARD_NEXT ||
-                        (currentneedle->searchtype == SEARCHTYPE_FORWARD &&
-                        state->carveWithMissingFooters))) {
-                            // no footer found for SEARCHTYPE_FORWARD_NEXT, or no footer
-                            // found for SEARCHTYPE_FORWARD and user specified -b, so just use
-                            // max carve size for this file type as stop
-                            stop = start + currentneedle->length - 1;
-                    }
+                    stop = forwardCarveStop(state, currentneedle, start,
+                        j < (long long)currentneedle->offsets.numfooters ?
+                        (long long)currentneedle->offsets.footers[j] : -1, &chopped);
             }
             else {
-                // footer defined: use REVERSE semantics: want matching footer
-                // as far away from header as possible, within maximum carving
-                // size for this file type.  Don't bother to look at footers
-                // that can't possibly match a header and remember this info
-                // in prevstopindex, as the next headers will be even deeper
-                // into the image file.  Footer is included in carved file for
-                // this type of carve.
-                halt = 0;
-                for(j = prevstopindex; j < (long long)currentneedle->offsets.numfooters &&
-                    !halt; j++) {
-                        if((long long)currentneedle->offsets.footers[j] <= start) {
-                            prevstopindex = j;
-                        }
-                        else if(currentneedle->offsets.footers[j] - start <=
-                            currentneedle->length) {
-                                stop = currentneedle->offsets.footers[j]
-                                + currentneedle->endlength - 1;
-                        }
-                        else {
-                            halt = 1;
-                        }
-                }
+                // footer defined: use REVERSE semantics
+                stop = reverseCarveStop(currentneedle, start, &prevstopindex);
             }
 
             // if stop <> 0, then we have enough information to set up a
@@ -1437,111 +1960,63 @@ int carveImageFile(struct scalpelState *state) {
                 footerblockindex = stop / SIZE_OF_BUFFER;
 
                 // set up a struct CarveInfo for inclusion into the
-                // appropriate carvelists
+                // appropriate carvelists.  The output filename is
+                // generated when the file is opened, from the file type
+                // and the file's number among files of this type.
+
+                carveinfo = allocateCarveInfo(state, &carveblocks);
+                carveinfo->needlenum = needlenum;
+                carveinfo->filenum = currentneedle->numfilestocarve;
+                carveinfo->serial = state->fileswritten;
+                carveinfo->start = start;
+                carveinfo->stop = stop;
+                carveinfo->chopped = chopped;
+                createOrganizeDir(state, carveinfo);
 
-                // generate unique filename for file to carve
-
-                if(state->organizeSubdirectories) {
-                    snprintf(orgdir, MAX_STRING_LENGTH, "%s/%s-%d-%1lu",
-                        state->outputdirectory,
-                        currentneedle->suffix,
-                        needlenum, currentneedle->organizeDirNum);
-                    if(!state->previewMode) {
-#ifdef _WIN32
-                        mkdir(orgdir);
-#else
-                        mkdir(orgdir, 0777);
-#endif
-                    }
-                }
-                else {
-                    snprintf(orgdir, MAX_STRING_LENGTH, "%s", state->outputdirectory);
-                }
-
-                if(state->modeNoSuffix || currentneedle->suffix[0] ==
-                    SCALPEL_NOEXTENSION) {
-#ifdef _WIN32
-                        snprintf(fn, MAX_STRING_LENGTH, "%s/%08I64u",
-                            orgdir, state->fileswritten);
-#else
-                        snprintf(fn, MAX_STRING_LENGTH, "%s/%08llu",
-                            orgdir, state->fileswritten);
-#endif
-
-                }
-                else {
-#ifdef _WIN32
-                    snprintf(fn, MAX_STRING_LENGTH, "%s/%08I64u.%s",
-                        orgdir, state->fileswritten, currentneedle->suffix);
-#else
-                    snprintf(fn, MAX_STRING_LENGTH, "%s/%08llu.%s",
-                        orgdir, state->fileswritten, currentneedle->suffix);
-#endif
-                }
-                state->fileswritten++;
-                currentneedle->numfilestocarve++;
-                if(currentneedle->numfilestocarve % state->organizeMaxFilesPerSub == 0) {
-                    currentneedle->organizeDirNum++;
-                }
-
-                carveinfo = (struct CarveInfo *)malloc(sizeof(struct CarveInfo));
-                checkMemoryAllocation(state, carveinfo, __LINE__, __FILE__,
-                    "carveinfo");
-
-                // remember filename
-                carveinfo->filename = (char *)malloc(strlen(fn) + 1);
-                checkMemoryAllocation(state, carveinfo->filename, __LINE__,
-                    __FILE__, "carveinfo");
-                strcpy(carveinfo->filename, fn);
-                carveinfo->start = start;
-                carveinfo->stop = stop;
-                carveinfo->chopped = chopped;
+                state->fileswritten++;
+                currentneedle->numfilestocarve++;
+                if(currentneedle->numfilestocarve % state->organizeMaxFilesPerSub == 0) {
+                    currentneedle->organizeDirNum++;
+                }
 
                 // fp will be allocated when the first byte of the file is
                 // in the current buffer and cleaned up when we encounter the
                 // last byte of the file.
                 carveinfo->fp = 0;
+                carveinfo->hash = NULL;
+
+                if(state->modeVerbose) {
+                    carveFilename(state, carveinfo, fn);
+                    fprintf(stdout, "Adding %s to queue\n", fn);
+                }
 
                 if(headerblockindex == footerblockindex) {
                     // header and footer will both appear in the same buffer
-                    fprintf(stdout, "Adding %s to queue\n", carveinfo->filename);
-                    add_to_queue(&carvelists[headerblockindex],
+                    pool_add_to_queue(&carvelists[headerblockindex],
                         &carveinfo, STARTSTOPCARVE);
                 }
                 else {
                     // header/footer will appear in different buffers, add carveinfo to 
                     // stop and start lists...
-                    fprintf(stdout, "Adding %s to queue\n", carveinfo->filename);
-                    add_to_queue(&carvelists[headerblockindex], &carveinfo, STARTCARVE);
-                    add_to_queue(&carvelists[footerblockindex], &carveinfo, STOPCARVE);
+                    pool_add_to_queue(&carvelists[headerblockindex], &carveinfo, STARTCARVE);
+                    pool_add_to_queue(&carvelists[footerblockindex], &carveinfo, STOPCARVE);
                     // .. and to all lists in between (these will result in a full
                     // SIZE_OF_BUFFER bytes being carved into the file).  
                     for(j = (long long)headerblockindex + 1; j < (long long)footerblockindex; j++) {
-                        add_to_queue(&carvelists[j], &carveinfo, CONTINUECARVE);
+                        pool_add_to_queue(&carvelists[j], &carveinfo, CONTINUECARVE);
                     }
                 }
             }
         }
-    }
 
-    fprintf(stdout, "Work queues built.  Workload:\n");
-    for(needlenum = 0; needlenum < state->specLines; needlenum++) {
-        currentneedle = &(state->SearchSpec[needlenum]);
-        fprintf(stdout, "%s with header \"", currentneedle->suffix);
-        fprintf(stdout, "%s", currentneedle->begintext);
-        fprintf(stdout, "\" and footer \"");
-        if(currentneedle->end == 0) {
-            fprintf(stdout, "NONE");
-        }
-        else {
-            fprintf(stdout, "%s", currentneedle->endtext);
+        if(embeddedfooters) {
+            free(embeddedfooters);
         }
-
-        fprintf(stdout, "\" --> %"PRIu64 " files\n", currentneedle->numfilestocarve);
-
-
     }
 
+    fprintf(stdout, "Work queues built.  Workload:\n");
+    printWorkload(state);
+
     if(state->previewMode) {
         fprintf(stdout, "** PREVIEW MODE: GENERATING AUDIT LOG ONLY **\n");
         fprintf(stdout, "** NO CARVED FILES WILL BE WRITTEN **\n");
@@ -1550,6 +2025,17 @@ int carveImageFile(struct scalpelState *state) {
     fprintf(stdout, "Carving files from image.\n");
     fprintf(stdout, "Image file pass 2/2.\n");
 
+    // if resuming pass 2, discard output written after the checkpoint
+    // and continue from the checkpoint position
+    if(state->checkpoint && state->checkpoint->resumePass == 2) {
+        if((err = resumeCarves(state, carvelists, filesize)) != SCALPEL_OK) {
+            goto exit_carve;
+        }
+        fseeko_use_coverage_map(state, state->inReader,
+            state->checkpoint->resumeCursor - state->skip);
+        state->checkpoint->resumePass = 0;
+    }
+
     // now read image file in SIZE_OF_BUFFER-sized windows, writing
     // carved files to output directory
 
@@ -1561,7 +2047,13 @@ int carveImageFile(struct scalpelState *state) {
         // seek
         fileposition = ftello_use_coverage_map(state, state->inReader);
 
-        while (queue_length(&carvelists[fileposition / SIZE_OF_BUFFER]) == 0
+        if(checkpointDue(state) &&
+            (err = writeCheckpoint(state, 2, fileposition,
+            &carvelists[fileposition / SIZE_OF_BUFFER])) != SCALPEL_OK) {
+                goto exit_carve;
+        }
+
+        while (pool_queue_length(&carvelists[fileposition / SIZE_OF_BUFFER]) == 0
             && success) {
                 biglseek += SIZE_OF_BUFFER;
                 fileposition += SIZE_OF_BUFFER;
@@ -1581,12 +2073,15 @@ int carveImageFile(struct scalpelState *state) {
             continue;
         }
 
-        if(!state->previewMode) {
+        // carved files are hashed from the read buffer, also in preview mode
+        if(!state->previewMode || state->hashAlgorithms) {
             bytesread =
-                fread_use_coverage_map(state, readbuffer, 1, SIZE_OF_BUFFER, state->inReader);
+                fread_use_coverage_map(state, readbuffer, 1, SIZE_OF_BUFFER, state->inReader,
+                &readextent);
             // Check for read errors
             if((err = scalpelInputGetError(state->inReader))) {
-                return SCALPEL_ERROR_FILE_READ;
+                err = SCALPEL_ERROR_FILE_READ;
+                goto exit_carve;
             }
             else if(bytesread == 0) {
                 // no error, but image file exhausted
@@ -1599,13 +2094,17 @@ int carveImageFile(struct scalpelState *state) {
             // reads.  This isn't optimal, but it's fast enough and avoids
             // complicating the file carving code further.
 
+            // seeking doesn't stop at the end of the image file
             fileposition = ftello_use_coverage_map(state, state->inReader);
-            fseeko_use_coverage_map(state, state->inReader, SIZE_OF_BUFFER);
+            fseeko_use_coverage_map(state, state->inReader,
+                fileposition + SIZE_OF_BUFFER <= filesize ? SIZE_OF_BUFFER :
+                (fileposition < filesize ? filesize - fileposition : 0));
             bytesread = ftello_use_coverage_map(state, state->inReader) - fileposition;
 
             // Check for errors
             if((err = scalpelInputGetError(state->inReader))) {
-                return SCALPEL_ERROR_FILE_READ;
+                err = SCALPEL_ERROR_FILE_READ;
+                goto exit_carve;
             }
             else if(bytesread == 0) {
                 // no error, but image file exhausted
@@ -1624,25 +2123,27 @@ int carveImageFile(struct scalpelState *state) {
         // if using coverage map for carving, need adjusted file position
         fileposition = ftello_use_coverage_map(state, state->inReader);
 
-        // signal check
+        // signal check--nothing in this buffer has been carved yet
         if(signal_caught == SIGTERM || signal_caught == SIGINT) {
+            writeCheckpoint(state, 2, fileposition - bytesread,
+                &carvelists[(fileposition - bytesread) / SIZE_OF_BUFFER]);
             clean_up(state, signal_caught);
         }
 
         // deal with work for this SIZE_OF_BUFFER-sized block by
         // examining the associated queue
-        rewind_queue(&carvelists[(fileposition - bytesread) / SIZE_OF_BUFFER]);
+        pool_rewind_queue(&carvelists[(fileposition - bytesread) / SIZE_OF_BUFFER]);
 
-        while (!end_of_queue
+        while (!pool_end_of_queue
             (&carvelists[(fileposition - bytesread) / SIZE_OF_BUFFER])) {
                 struct CarveInfo *carve;
                 int operation;
                 unsigned long long bytestowrite = 0, byteswritten = 0, offset = 0;
 
-                peek_at_current(&carvelists
+                pool_peek_at_current(&carvelists
                     [(fileposition - bytesread) / SIZE_OF_BUFFER], &carve);
                 operation =
-                    current_priority(&carvelists
+                    pool_current_priority(&carvelists
                     [(fileposition - bytesread) / SIZE_OF_BUFFER]);
 
                 // open file, if beginning of carve operation or file had to be closed
@@ -1650,25 +2151,37 @@ int carveImageFile(struct scalpelState *state) {
                 if(operation == STARTSTOPCARVE ||
                     operation == STARTCARVE || carve->fp == 0) {
 
-                        if(!state->previewMode && state->modeVerbose) {
-                            fprintf(stdout, "OPENING %s\n", carve->filename);
-                        }
-
                         carve->fp = (FILE *) 1;
-                        if(!state->previewMode) {
-                            carve->fp = fopen(carve->filename, "ab");
+                        if(state->packOutput) {
+                            // carved files are written to their extents of
+                            // the pack instead
+                            if((operation == STARTSTOPCARVE || operation == STARTCARVE) &&
+                                (err = reservePackExtent(state, carve)) != SCALPEL_OK) {
+                                    goto exit_carve;
+                            }
+                        }
+                        else if(!state->previewMode) {
+                            carveFilename(state, carve, fn);
+                            if(state->modeVerbose) {
+                                fprintf(stdout, "OPENING %s\n", fn);
+                            }
+                            carve->fp = fopen(fn, "ab");
                         }
 
                         if(!carve->fp) {
                             fprintf(stderr, "Error opening file: %s -- %s\n",
-                                carve->filename, strerror(errno));
+                                fn, strerror(errno));
                             fprintf(state->auditFile, "Error opening file: %s -- %s\n",
-                                carve->filename, strerror(errno));
-                            return SCALPEL_ERROR_FILE_WRITE;
+                                fn, strerror(errno));
+                            err = SCALPEL_ERROR_FILE_WRITE;
+                            goto exit_carve;
                         }
                         else {
                             CURRENTFILESOPEN++;
                         }
+                        if(operation == STARTSTOPCARVE || operation == STARTCARVE) {
+                            carve->hash = startCarveHash(state);
+                        }
                 }
 
                 // write some portion of current readbuffer
@@ -1693,21 +2206,34 @@ int carveImageFile(struct scalpelState *state) {
                     break;
                 }
 
-                if(!state->previewMode) {
+                if(state->packOutput) {
+                    if((err = writePackExtent(state, carve,
+                        fileposition - bytesread + offset - carve->start,
+                        readbuffer + offset, bytestowrite)) != SCALPEL_OK) {
+                            goto exit_carve;
+                    }
+                }
+                else if(!state->previewMode) {
                     //	struct timeval writenow, writethen;
                     //	gettimeofday(&writethen, 0);
                     if((byteswritten = fwrite(readbuffer + offset,
                         sizeof(char),
                         bytestowrite, carve->fp)) != bytestowrite) {
 
+                            carveFilename(state, carve, fn);
                             fprintf(stderr, "Error writing to file: %s -- %s\n",
-                                carve->filename, strerror(ferror(carve->fp)));
+                                fn, strerror(ferror(carve->fp)));
                             fprintf(state->auditFile,
                                 "Error writing to file: %s -- %s\n",
-                                carve->filename, strerror(ferror(carve->fp)));
-                            return SCALPEL_ERROR_FILE_WRITE;
+                                fn, strerror(ferror(carve->fp)));
+                            err = SCALPEL_ERROR_FILE_WRITE;
+                            goto exit_carve;
                     }
                 }
+                if(carve->hash) {
+                    updateCarveHash(state, carve->hash,
+                        (unsigned char *)readbuffer + offset, bytestowrite);
+                }
 
                 // close file, if necessary.  Always do it on STARTSTOPCARVE and
                 // STOPCARVE, but also do it if we have a large number of files
@@ -1717,37 +2243,46 @@ int carveImageFile(struct scalpelState *state) {
                 if(operation == STARTSTOPCARVE ||
                     operation == STOPCARVE || CURRENTFILESOPEN > MAX_FILES_TO_OPEN) {
                         err = 0;
-                        if(!state->previewMode) {
+                        if(!state->previewMode && !state->packOutput) {
                             if(state->modeVerbose) {
-                                fprintf(stdout, "CLOSING %s\n", carve->filename);
+                                carveFilename(state, carve, fn);
+                                fprintf(stdout, "CLOSING %s\n", fn);
                             }
                             err = fclose(carve->fp);
                         }
 
                         if(err) {
+                            carveFilename(state, carve, fn);
                             fprintf(stderr, "Error closing file: %s -- %s\n\n",
-                                carve->filename, strerror(ferror(carve->fp)));
+                                fn, strerror(errno));
                             fprintf(state->auditFile,
                                 "Error closing file: %s -- %s\n\n",
-                                carve->filename, strerror(ferror(carve->fp)));
-                            return SCALPEL_ERROR_FILE_WRITE;
+                                fn, strerror(errno));
+                            carve->fp = 0;
+                            err = SCALPEL_ERROR_FILE_WRITE;
+                            goto exit_carve;
                         }
                         else {
                             CURRENTFILESOPEN--;
                             carve->fp = 0;
 
-                            // release filename buffer if it won't be needed again.  Don't release it
-                            // if the file was closed only because a large number of files are currently
-                            // open!
+                            // audit the file if it won't be opened again.  Don't do
+                            // it if the file was closed only because a large number
+                            // of files are currently open!
                             if(operation == STARTSTOPCARVE || operation == STOPCARVE) {
-                                auditUpdateCoverageBlockmap(state, carve);
-                                free(carve->filename);
-                                carve->filename = NULL;
+                                carveFilename(state, carve, fn);
+                                duplicate = identifyCarvedFile(state, carve, fn, digests);
+                                if(duplicate && !state->previewMode) {
+                                    storeDuplicateOnce(state, carve, fn, duplicate);
+                                }
+                                if((err = auditUpdateCoverageBlockmap(state, carve,
+                                    &fragmentpool, digests, duplicate)) != SCALPEL_OK) {
+                                        goto exit_carve;
+                                }
                             }
-                            // free(carve);
                         }
                 }
-                next_element(&carvelists[(fileposition - bytesread) / SIZE_OF_BUFFER]);
+                pool_next_element(&carvelists[(fileposition - bytesread) / SIZE_OF_BUFFER]);
         }
     }
 
@@ -1758,1062 +2293,2732 @@ int carveImageFile(struct scalpelState *state) {
     // cleanup for current image file.  
 
     if(state->generateHeaderFooterDatabase) {
-        if((err = writeHeaderFooterDatabase(state)) != SCALPEL_OK) {
-            return err;
+        if((err = writeHeaderFooterDatabase(state, filesize)) != SCALPEL_OK) {
+            goto exit_carve;
         }
     }
 
     // tear down coverage maps, if necessary
-    destroyCoverageMaps(state);
+    if((err = destroyCoverageMaps(state)) != SCALPEL_OK) {
+        goto exit_carve;
+    }
 
     printf("Processing of image file complete. Cleaning up...\n");
 
     // tear down header/footer databases
-
-    for(needlenum = 0; needlenum < state->specLines; needlenum++) {
-        currentneedle = &(state->SearchSpec[needlenum]);
-        if(currentneedle->offsets.headers) {
-            free(currentneedle->offsets.headers);
-            currentneedle->offsets.headers = NULL;
-        }
-        if(currentneedle->offsets.footers) {
-            free(currentneedle->offsets.footers);
-            currentneedle->offsets.footers = NULL;
-        }
-        currentneedle->offsets.headers = 0;
-        currentneedle->offsets.footers = 0;
-        currentneedle->offsets.numheaders = 0;
-        currentneedle->offsets.numfooters = 0;
-        currentneedle->offsets.headerstorage = 0;
-        currentneedle->offsets.footerstorage = 0;
-        currentneedle->numfilestocarve = 0;
-    }
+    releaseOffsets(state);
 
     // tear down work queues--no memory deallocation for each queue
-    // entry required, because memory associated with fp and the
-    // filename was freed after the carved file was closed.
+    // entry required, because carved files were closed as they were
+    // completed and the CarveInfo structs are released together.
+    // Queue elements are released with their pools.
+
+    destroy_queue_pool(&carvepool);
+    destroy_queue_pool(&fragmentpool);
+    freeCarveInfoBlocks(state, carveblocks);
+    carveblocks = NULL;
 
-    // destroy queues    
-    for(i = 0; i < 2 + (filesize / SIZE_OF_BUFFER); i++) {
-        rewind_queue(&carvelists[i]);
-        
-        while (!end_of_queue(&carvelists[i]))
-        {
-            // We need to free the CarveInfo strutures allocated
-            // above. Since these structures may have been added
-            // to multiple elements in the queue we want to make 
-            // sure we only free them once. That's accomplished 
-            // by checking the operation (priority). 
-            // The structures will either have been added to a 
-            // single STARTSTOPCARVE element or to a STARTCARVE,
-            // STOPCARVE and 0 or more CONTINUECARVE elements.
-            // We ensure the structures are only freed once by
-            // calling free when we come across either a STARTCARVE
-            // or STARTSTOPCARVE element.
-            switch (current_priority(&carvelists[i]))
-            {
-                case STARTCARVE:
-                case STARTSTOPCARVE:
-                {
-                    struct CarveInfo *carve;
-            
-                    peek_at_current(&carvelists[i], &carve);
-                    free(carve);
-                }
-                default:
-                    next_element(&carvelists[i]);
-            }
-        }
-        
-        destroy_queue(&carvelists[i]);
-    }
     // destroy array of queues
     free(carvelists);
     carvelists = NULL;
 
+    if((err = checkpointEndImage(state)) != SCALPEL_OK) {
+        return err;
+    }
+
     printf("Done.");
     return SCALPEL_OK;
+
+exit_carve:
+    // carving failed--release the work queues and CarveInfo structs
+    destroy_queue_pool(&carvepool);
+    destroy_queue_pool(&fragmentpool);
+    freeCarveInfoBlocks(state, carveblocks);
+    free(carvelists);
+    destroyCoverageMaps(state);
+    return err;
 }
 
 
-// The coverage blockmap marks which blocks (of a user-specified size)
-// have been "covered" by a carved file.  If the coverage blockmap
-// is to be modified, check to see if it exists.  If it does, then
-// open it and set the file handle in the Scalpel state.  If it
-// doesn't, create a zeroed copy and set the file handle in the
-// Scalpel state.  If the coverage blockmap is guiding carving, then
-// create the coverage bitmap and initialize it using the coverage
-// blockmap file.  The difference between the coverage blockmap (on
-// disk) and the coverage bitmap (in memory) is that the blockmap
-// counts carved files that cover a block.  The coverage bitmap only
-// indicates if ANY carved file covers a block.  'filesize' is the
-// size of the image file being examined.
+// Single-pass carving.  A stream can be read only once, so it is dug and
+// carved in one pass, as are image files with -F.  The bytes read are
+// kept in a ring, the window, and headers of each type are decided in
+// order, as in carveImageFile(), as soon as every header and footer
+// within the header's reach has been found.  A header's reach is the max
+// carve size for its type, or the window size if that's smaller.  A file
+// is written from the window as soon as its carving is decided.  File
+// types of an image file whose max carve size exceeds the window are
+// deferred: their offsets are kept whole and carveImageFile() carves them
+// in a second pass.
+
+#define NO_MATCH  ULLONG_MAX
+
+// single-pass carving progress for a file type.  Header and footer
+// indices are absolute, counted from the first header or footer found in
+// the image file.  Decided headers and footers that can't end a file any
+// more are dropped from the offset arrays, which then start at absolute
+// indices 'headerbase' and 'footerbase'.
+typedef struct CarveCursor {
+    unsigned long long reach;	// longest file carved from the window
+    unsigned long long headerbase;
+    unsigned long long footerbase;
+    unsigned long long nextheader;	// first header not decided yet
+    unsigned long long prevstopindex;	// first footer that may end a file
+    int embedded;			// nested header/footer matching (-e)
+    unsigned long long mergeheader;	// next header and footer to merge,
+    unsigned long long mergefooter;	// with -e
+    unsigned long long *matches;	// position of the footer matching each
+    unsigned long long matchsize;	// merged header, parallel to the
+                                    // header array, with -e
+    unsigned long long *stack;	// headers not matched yet, with -e
+    unsigned long long stacksize;
+    unsigned long long top;
+    int deferred;			// carved by carveImageFile() instead
+} CarveCursor;
+
+typedef struct CarveWindow {
+    unsigned char *data;	// input bytes, at position % size
+    unsigned long long size;
+    unsigned long long end;	// position after the last byte in the window
+    CarveCursor *cursors;	// one for each file type
+    QueuePool fragmentpool;	// elements of fragment lists for auditing
+} CarveWindow;
+
+
+// merge the headers and footers found before 'frontier', or all of them
+// if 'final', into the nesting of matchEmbeddedFooters().  Every header
+// and footer before the frontier is known, so a footer before the next
+// header, or a header before the next footer, is processed in the same
+// order as there.
+static void mergeWindowFooters(struct scalpelState *state,
+                               struct SearchSpecLine *currentneedle,
+                               CarveCursor *cursor,
+                               unsigned long long frontier, int final) {
+
+    struct SearchSpecOffsets *offsets = &(currentneedle->offsets);
+    unsigned long long headerend = cursor->headerbase + offsets->numheaders;
+    unsigned long long footerend = cursor->footerbase + offsets->numfooters;
+    unsigned long long header, footer, h;
+    int havefooter;
+
+    if(cursor->matchsize < offsets->numheaders) {
+        cursor->matchsize = offsets->headerstorage;
+        cursor->matches = (unsigned long long *)realloc(cursor->matches,
+            sizeof(unsigned long long) * cursor->matchsize);
+        checkMemoryAllocation(state, cursor->matches, __LINE__, __FILE__, "matches");
+    }
 
-static int
-    setupCoverageMaps(struct scalpelState *state, unsigned long long filesize) {
+    while (cursor->mergeheader < headerend || cursor->mergefooter < footerend) {
+        header = cursor->mergeheader < headerend ?
+            offsets->headers[cursor->mergeheader - cursor->headerbase] : NO_MATCH;
+        footer = cursor->mergefooter < footerend ?
+            offsets->footers[cursor->mergefooter - cursor->footerbase] : NO_MATCH;
+        havefooter = footer != NO_MATCH && (final || footer < frontier);
+
+        if(havefooter && footer <= header) {
+            // footer closes the innermost open header, if any, unless that
+            // header was given up on already
+            if(cursor->top > 0) {
+                h = cursor->stack[--cursor->top];
+                if(h >= cursor->nextheader) {
+                    cursor->matches[h - cursor->headerbase] = footer;
+                }
+            }
+            cursor->mergefooter++;
+        }
+        else if(header != NO_MATCH && (final || header < frontier)) {
+            if(cursor->top == cursor->stacksize) {
+                cursor->stacksize = cursor->stacksize ? cursor->stacksize * 2 : 100;
+                cursor->stack = (unsigned long long *)realloc(cursor->stack,
+                    sizeof(unsigned long long) * cursor->stacksize);
+                checkMemoryAllocation(state, cursor->stack, __LINE__, __FILE__,
+                    "headerstack");
+            }
+            cursor->matches[cursor->mergeheader - cursor->headerbase] = NO_MATCH;
+            cursor->stack[cursor->top++] = cursor->mergeheader++;
+        }
+        else {
+            break;
+        }
+    }
+}
 
-    char fn[MAX_STRING_LENGTH];	// filename for coverage blockmap
-    unsigned long long i, k;
-    int empty;
-    unsigned int blocksize, entry;
 
+// drop decided headers, and footers which can't end a file any more,
+// from the offset arrays of a file type once they make up more than half
+// of them.  The last header is kept, since digBuffer() looks at it to
+// decide whether to search for footers.
+static void compactWindowOffsets(struct SearchSpecLine *currentneedle,
+                                 CarveCursor *cursor) {
 
-    state->coveragebitmap = 0;
-    state->coverageblockmap = 0;
+    struct SearchSpecOffsets *offsets = &(currentneedle->offsets);
+    unsigned long long drop;
 
-    if(!state->useCoverageBlockmap && !state->updateCoverageBlockmap) {
-        return SCALPEL_OK;
+    drop = cursor->nextheader - cursor->headerbase;
+    if(drop >= offsets->numheaders) {
+        drop = offsets->numheaders ? offsets->numheaders - 1 : 0;
+    }
+    if(drop > 0 && drop * 2 > offsets->numheaders) {
+        memmove(offsets->headers, offsets->headers + drop,
+            sizeof(unsigned long long) * (offsets->numheaders - drop));
+        memmove(offsets->headerlens, offsets->headerlens + drop,
+            sizeof(size_t) * (offsets->numheaders - drop));
+        if(cursor->embedded) {
+            memmove(cursor->matches, cursor->matches + drop, sizeof(unsigned long long) *
+                (cursor->mergeheader - cursor->headerbase - drop));
+        }
+        offsets->numheaders -= drop;
+        cursor->headerbase += drop;
     }
 
-    fprintf(stdout, "Setting up coverage blockmap.\n");
-    // generate pathname for coverage blockmap
-    snprintf(fn, MAX_STRING_LENGTH, "%s", state->coveragefile);
-
-    fprintf(stdout, "Coverage blockmap is \"%s\".\n", fn);
-
-    empty = ((state->coverageblockmap = fopen(fn, "rb")) == NULL);
-    fprintf(stdout, "Coverage blockmap file is %s.\n",
-        (empty ? "EMPTY" : "NOT EMPTY"));
+    drop = (cursor->embedded ? cursor->mergefooter : cursor->prevstopindex) -
+        cursor->footerbase;
+    if(drop > 0 && drop * 2 > offsets->numfooters) {
+        memmove(offsets->footers, offsets->footers + drop,
+            sizeof(unsigned long long) * (offsets->numfooters - drop));
+        memmove(offsets->footerlens, offsets->footerlens + drop,
+            sizeof(size_t) * (offsets->numfooters - drop));
+        offsets->numfooters -= drop;
+        cursor->footerbase += drop;
+    }
+}
 
-    if(!empty) {
-#ifdef _WIN32
-        // set binary mode for Win32
-        setmode(fileno(state->coverageblockmap), O_BINARY);
-#endif
-#ifdef __linux
-        fcntl(fileno(state->coverageblockmap), F_SETFL, O_LARGEFILE);
-#endif
 
-        fprintf(stdout, "Reading blocksize from coverage blockmap file.\n");
+// write a file to carve from the window and audit it.  The file is
+// hashed before it is written, so a file identical to one carved before
+// isn't written at all if identical files are stored once (-x).
+static int carveFromWindow(struct scalpelState *state, CarveWindow *win,
+                           struct CarveInfo *carve) {
 
-        // read block size and make sure it matches user-specified block size
-        if(fread(&blocksize, sizeof(unsigned int), 1, state->coverageblockmap) != 1) {
-            fprintf(stderr,
-                "Error reading coverage blockmap blocksize in\ncoverage blockmap file: %s\n",
-                fn);
-            fprintf(state->auditFile,
-                "Error reading coverage blockmap blocksize in\ncoverage blockmap file: %s\n",
-                fn);
-            return SCALPEL_ERROR_FATAL_READ;
+    char fn[MAX_STRING_LENGTH];	// temp buffer for output filename
+    char digests[SCALPEL_NUM_HASHES][SCALPEL_MAX_DIGEST_STRING];
+    const CarvedContent *duplicate;
+    int err;
+    unsigned long long offset = carve->start % win->size;
+    unsigned long long length = carve->stop - carve->start + 1;
+    unsigned long long first = length < win->size - offset ? length :
+        win->size - offset;
+    FILE *fp;
+
+    createOrganizeDir(state, carve);
+    carveFilename(state, carve, fn);
+    if((carve->hash = startCarveHash(state))) {
+        updateCarveHash(state, carve->hash, win->data + offset, first);
+        updateCarveHash(state, carve->hash, win->data, length - first);
+    }
+    // the first copy of a content is recorded with its pack extent
+    if(state->packOutput && (err = reservePackExtent(state, carve)) != SCALPEL_OK) {
+        return err;
+    }
+    duplicate = identifyCarvedFile(state, carve, fn, digests);
+    if(state->packOutput) {
+        if(duplicate) {
+            releasePackExtent(state, carve);
+            storeDuplicateOnce(state, carve, fn, duplicate);
         }
-
-        if(state->coverageblocksize != 0 && blocksize != state->coverageblocksize) {
-            fprintf(stderr,
-                "User-specified blocksize does not match blocksize in\ncoverage blockmap file: %s; aborting.\n",
-                fn);
+        else if((err = writePackExtent(state, carve, 0, win->data + offset, first)) != SCALPEL_OK ||
+            (err = writePackExtent(state, carve, first, win->data, length - first)) != SCALPEL_OK) {
+                return err;
+        }
+    }
+    else if(!state->previewMode &&
+        !(duplicate && storeDuplicateOnce(state, carve, fn, duplicate))) {
+        if(state->modeVerbose) {
+            fprintf(stdout, "CARVING %s\n", fn);
+        }
+        if(!(fp = fopen(fn, "ab"))) {
+            fprintf(stderr, "Error opening file: %s -- %s\n",
+                fn, strerror(errno));
+            fprintf(state->auditFile, "Error opening file: %s -- %s\n",
+                fn, strerror(errno));
+            return SCALPEL_ERROR_FILE_WRITE;
+        }
+        // the file may wrap around the end of the window
+        if(fwrite(win->data + offset, sizeof(char), first, fp) != first ||
+            fwrite(win->data, sizeof(char), length - first, fp) != length - first) {
+                fprintf(stderr, "Error writing to file: %s -- %s\n",
+                    fn, strerror(errno));
+                fprintf(state->auditFile,
+                    "Error writing to file: %s -- %s\n",
+                    fn, strerror(errno));
+                fclose(fp);
+                return SCALPEL_ERROR_FILE_WRITE;
+        }
+        if(fclose(fp)) {
+            fprintf(stderr, "Error closing file: %s -- %s\n\n",
+                fn, strerror(errno));
             fprintf(state->auditFile,
-                "User-specified blocksize does not match blocksize in\ncoverage blockmap file: %s\n",
-                fn);
-            return SCALPEL_GENERAL_ABORT;
+                "Error closing file: %s -- %s\n\n",
+                fn, strerror(errno));
+            return SCALPEL_ERROR_FILE_WRITE;
         }
+    }
+    return auditUpdateCoverageBlockmap(state, carve, &win->fragmentpool,
+        digests, duplicate);
+}
 
-        state->coverageblocksize = blocksize;
-        fprintf(stdout, "Blocksize for coverage blockmap is %u.\n",
-            state->coverageblocksize);
-
-        state->coveragenumblocks =
-            (unsigned long
-            long)(ceil((double)filesize / (double)state->coverageblocksize));
 
-        fprintf(stdout, "# of blocks in coverage blockmap is %"PRIu64 ".\n",
-            state->coveragenumblocks);
+// decide, in order, the carving of the headers of a file type whose
+// outcome is known now that everything before 'frontier' has been
+// searched, or of all remaining headers if 'final', and carve the files
+// from the window.  The outcome is the one carveImageFile() would
+// arrive at, except that a file that may be longer than the window is
+// carved up to the window size and marked chopped, and that a footer not
+// found within a header's reach is taken to be too far away, which
+// marks a file carved without a footer chopped.
+static int decideWindowCarves(struct scalpelState *state, CarveWindow *win,
+                              int needlenum, unsigned long long frontier,
+                              int final) {
+
+    struct SearchSpecLine *currentneedle = &(state->SearchSpec[needlenum]);
+    struct SearchSpecOffsets *offsets = &(currentneedle->offsets);
+    CarveCursor *cursor = &(win->cursors[needlenum]);
+    struct CarveInfo carve;
+    unsigned long long start, footer, i, j;
+    long long stop;
+    char chopped;
+    int err;
 
+    if(cursor->deferred) {
+        return SCALPEL_OK;
+    }
 
-        fprintf(stdout, "Allocating and clearing in-core coverage bitmap.\n");
-        // for bitmap, 8 bits per unsigned char, with each bit representing one
-        // block
-        state->coveragebitmap =
-            (unsigned char *)malloc((state->coveragenumblocks / 8) *
-            sizeof(unsigned char));
-        checkMemoryAllocation(state, state->coveragebitmap, __LINE__, __FILE__,
-            "coveragebitmap");
+    if(cursor->embedded) {
+        mergeWindowFooters(state, currentneedle, cursor, frontier, final);
+    }
 
-        // zap coverage bitmap 
-        for(k = 0; k < state->coveragenumblocks / 8; k++) {
-            state->coveragebitmap[k] = 0;
+    while (cursor->nextheader < cursor->headerbase + offsets->numheaders) {
+        i = cursor->nextheader;
+        start = offsets->headers[i - cursor->headerbase];
+        if(!final && (start >= frontier || frontier - start <= cursor->reach)) {
+            break;
         }
+        cursor->nextheader++;
 
-        fprintf(stdout,
-            "Reading existing coverage blockmap...this may take a while.\n");
-
-        for(i = 0; i < state->coveragenumblocks; i++) {
-            fseeko(state->coverageblockmap, (i + 1) * sizeof(unsigned int), SEEK_SET);
-            if(fread(&entry, sizeof(unsigned int), 1, state->coverageblockmap) != 1) {
-                fprintf(stderr,
-                    "Error reading coverage blockmap entry (blockmap truncated?): %s\n",
-                    fn);
-                fprintf(state->auditFile,
-                    "Error reading coverage blockmap entry (blockmap truncated?): %s\n",
-                    fn);
-                return SCALPEL_ERROR_FATAL_READ;
-            }
-            if(entry) {
-                state->coveragebitmap[i / 8] |= 1 << (i % 8);
-            }
-        }
-    }
-    else if(empty && state->useCoverageBlockmap && !state->updateCoverageBlockmap) {
-        fprintf(stderr,
-            "-u option requires that the blockmap file %s exist.\n", fn);
-        fprintf(state->auditFile,
-            "-u option requires that the blockmap file %s exist.\n", fn);
-        return SCALPEL_GENERAL_ABORT;
-    }
-    else {
-        // empty coverage blockmap
-        if(state->coverageblocksize == 0) {	// user didn't override default
-            state->coverageblocksize = 512;
+        // block aligned test for "-q"
+        if(state->blockAlignedOnly && start % state->alignedblocksize != 0) {
+            continue;
         }
-        fprintf(stdout, "Blocksize for coverage blockmap is %u.\n",
-            state->coverageblocksize);
-        state->coveragenumblocks =
-            (unsigned long long)ceil((double)filesize /
-            (double)state->coverageblocksize);
-
-        fprintf(stdout, "# of blocks in coverage blockmap is %"PRIu64 ".\n",
-            state->coveragenumblocks);
 
-        fprintf(stdout, "Allocating and clearing in-core coverage bitmap.\n");
-        // for bitmap, 8 bits per unsigned char, with each bit representing one
-        // block
-        state->coveragebitmap =
-            (unsigned char *)malloc((state->coveragenumblocks / 8) *
-            sizeof(unsigned char));
-        checkMemoryAllocation(state, state->coveragebitmap, __LINE__, __FILE__,
-            "coveragebitmap");
-
-        // zap coverage bitmap 
-        for(k = 0; k < state->coveragenumblocks / 8; k++) {
-            state->coveragebitmap[k] = 0;
-        }
-    }
+        stop = 0;
+        chopped = 0;
 
-    // change mode to read/write for future updates if coverage blockmap will be updated
-    if(state->updateCoverageBlockmap) {
-        if(state->modeVerbose) {
-            fprintf(stdout, "Changing mode of coverage blockmap file to R/W.\n");
+        if(!currentneedle->endlength) {
+            // no footer defined for this file type
+            stop = start + currentneedle->length - 1;
+            chopped = 1;
         }
+        else if(currentneedle->searchtype == SEARCHTYPE_FORWARD ||
+            currentneedle->searchtype == SEARCHTYPE_FORWARD_NEXT) {
+                if(cursor->embedded) {
+                    footer = cursor->matches[i - cursor->headerbase];
+                }
+                else {
+                    j = firstFooterAfter(currentneedle,
+                        cursor->prevstopindex - cursor->footerbase, start);
+                    cursor->prevstopindex = cursor->footerbase + j;
+                    footer = j < offsets->numfooters ? offsets->footers[j] : NO_MATCH;
+                }
 
-        if(!empty) {
-            fclose(state->coverageblockmap);
+                if(footer != NO_MATCH && (final || footer < frontier)) {
+                    stop = forwardCarveStop(state, currentneedle, start,
+                        footer, &chopped);
+                }
+                else if(final) {
+                    stop = forwardCarveStop(state, currentneedle, start, -1, &chopped);
+                }
+                else if(cursor->reach < currentneedle->length) {
+                    // the footer may lie past the window
+                    stop = start + cursor->reach - 1;
+                    chopped = 1;
+                }
+                else {
+                    // any footer lies at the frontier or beyond it, too far
+                    // from the header
+                    stop = forwardCarveStop(state, currentneedle, start,
+                        frontier, &chopped);
+                }
         }
-        if((state->coverageblockmap = fopen(fn, (empty ? "w+b" : "r+b"))) == NULL) {
-            fprintf(stderr, "Error writing to coverage blockmap file: %s\n", fn);
-            fprintf(state->auditFile,
-                "Error writing to coverage blockmap file: %s\n", fn);
-            return SCALPEL_ERROR_FILE_WRITE;
+        else {
+            // REVERSE
+            j = cursor->prevstopindex - cursor->footerbase;
+            stop = reverseCarveStop(currentneedle, start, &j);
+            cursor->prevstopindex = cursor->footerbase + j;
+            if(!final && cursor->reach < currentneedle->length) {
+                // a footer past the window may end the file
+                stop = start + cursor->reach - 1;
+                chopped = 1;
+            }
         }
 
-#ifdef _WIN32
-        // set binary mode for Win32
-        setmode(fileno(state->coverageblockmap), O_BINARY);
-#endif
-#ifdef __linux
-        fcntl(fileno(state->coverageblockmap), F_SETFL, O_LARGEFILE);
-#endif
+        if(stop && (stop - (long long)start + 1) >= (long long)currentneedle->minlength) {
 
-        if(empty) {
-            // create entries in empty coverage blockmap file
-            fprintf(stdout,
-                "Writing empty coverage blockmap...this may take a while.\n");
-            entry = 0;
-            if(fwrite
-                (&(state->coverageblocksize), sizeof(unsigned int), 1,
-                state->coverageblockmap) != 1) {
-                    fprintf(stderr,
-                        "Error writing initial entry in coverage blockmap file!\n");
-                    fprintf(state->auditFile,
-                        "Error writing initial entry in coverage blockmap file!\n");
-                    return SCALPEL_ERROR_FILE_WRITE;
+            // don't carve past the end of the input or of the window
+            if(stop >= (long long)win->end) {
+                stop = win->end - 1;
             }
-            for(k = 0; k < state->coveragenumblocks; k++) {
-                if(fwrite
-                    (&entry, sizeof(unsigned int), 1, state->coverageblockmap) != 1) {
-                        fprintf(stderr, "Error writing to coverage blockmap file!\n");
-                        fprintf(state->auditFile,
-                            "Error writing to coverage blockmap file!\n");
-                        return SCALPEL_ERROR_FILE_WRITE;
-                }
+            if((unsigned long long)(stop - start + 1) > cursor->reach) {
+                stop = start + cursor->reach - 1;
+                chopped = 1;
+            }
+
+            carve.fp = 0;
+            carve.needlenum = needlenum;
+            carve.filenum = currentneedle->numfilestocarve;
+            carve.serial = state->fileswritten;
+            carve.start = start;
+            carve.stop = stop;
+            carve.chopped = chopped;
+            if((err = carveFromWindow(state, win, &carve)) != SCALPEL_OK) {
+                return err;
+            }
+
+            state->fileswritten++;
+            currentneedle->numfilestocarve++;
+            if(currentneedle->numfilestocarve % state->organizeMaxFilesPerSub == 0) {
+                currentneedle->organizeDirNum++;
             }
         }
     }
 
-    fprintf(stdout, "Finished setting up coverage blockmap.\n");
-
+    compactWindowOffsets(currentneedle, cursor);
     return SCALPEL_OK;
-
 }
 
-// map carve->start ... carve->stop into a queue of 'fragments' that
-// define a carved file in the disk image.  
-static void
-    generateFragments(struct scalpelState *state, Queue * fragments,
-    CarveInfo * carve) {
 
-    unsigned long long curblock, neededbytes =
-        carve->stop - carve->start + 1, bytestoskip, morebytes, totalbytes =
-        0, curpos;
+// dig and carve a stream, or an image file with -F, in a single pass,
+// retaining a window of the input as large as the largest max carve
+// size, up to SCALPEL_MAX_DEFAULT_WINDOW bytes, or of state->windowsize
+// bytes if set.  If file types are deferred, the coverage maps and the
+// offsets of those types are kept for carveImageFile(), and
+// state->imageCarved stays clear.
+static int digAndCarveImageFile(struct scalpelState *state) {
 
-    Fragment frag;
+    struct SearchSpecLine *currentneedle;
+    CarveWindow win;
+    readbuf_info *rinfo;
+    unsigned long long window = 0, frontier, at, chunk, readend;
+    long long filesize = 0;
+    int longestneedle = findLongestNeedle(state->SearchSpec);
+    int stream = scalpelInputIsStream(state->inReader);
+    int needlenum, deferred = 0, secondpass = FALSE, err = SCALPEL_OK;
+    pthread_t reader;
 
+    // a stream can't be looked at before or after it is carved
+    if(stream && (state->blockhashoutput || useCoverageTranslation(state) ||
+        state->generateHeaderFooterDatabase || state->useHeaderFooterDatabase)) {
+            fprintf(stderr,
+                "ERROR: %s is read as a stream, which can't be combined with -d, -D, -G,\n"
+                "-H, -l, -m or -u.\n", scalpelInputGetId(state->inReader));
+            return SCALPEL_GENERAL_ABORT;
+    }
+    if(stream && state->resumeFromCheckpoint) {
+        fprintf(stderr, "ERROR: %s is read as a stream, which can't be resumed.\n",
+            scalpelInputGetId(state->inReader));
+        return SCALPEL_GENERAL_ABORT;
+    }
 
-    init_queue(fragments, sizeof(struct Fragment), TRUE, 0, TRUE);
+    if(state->SearchSpec[0].suffix == NULL) {
+        return SCALPEL_ERROR_NO_SEARCH_SPEC;
+    }
 
-    if(!state->useCoverageBlockmap) {
-        // no translation necessary
-        frag.start = carve->start;
-        frag.stop = carve->stop;
-        add_to_queue(fragments, &frag, 0);
-        return;
+    if((err = setupAuditFile(state)) != SCALPEL_OK) {
+        return err;
     }
-    else {
-        curpos = positionUseCoverageBlockmap(state, carve->start);
-        curblock = curpos / state->coverageblocksize;
-
-        while (totalbytes < neededbytes && curblock < state->coveragenumblocks) {
-
-            morebytes = 0;
-            bytestoskip = 0;
-
-            // skip covered blocks
-            while (curblock < state->coveragenumblocks &&
-                (state->coveragebitmap[curblock / 8] & (1 << (curblock % 8)))) {
-                    bytestoskip += state->coverageblocksize -
-                        curpos % state->coverageblocksize;
-                    curblock++;
-            }
-
-            curpos += bytestoskip;
-
-            // accumulate uncovered blocks in fragment
-            while (curblock < state->coveragenumblocks &&
-                ((state->
-                coveragebitmap[curblock / 8] & (1 << (curblock % 8))) == 0)
-                && totalbytes + morebytes < neededbytes) {
-
-                    morebytes += state->coverageblocksize -
-                        curpos % state->coverageblocksize;
 
-                    curblock++;
-            }
+    if(scalpelInputOpen(state->inReader) != 0) {
+        return SCALPEL_ERROR_FILE_OPEN;
+    }
 
-            // cap size
-            if(totalbytes + morebytes > neededbytes) {
-                morebytes = neededbytes - totalbytes;
-            }
+    if(state->skip > 0 && !skipInFile(state, state->inReader)) {
+        return SCALPEL_ERROR_FILE_READ;
+    }
 
-            frag.start = curpos;
-            curpos += morebytes;
-            frag.stop = curpos - 1;
-            totalbytes += morebytes;
+    if(!stream) {
+        if((filesize = scalpelInputGetSize(state->inReader)) == -1) {
+            fprintf(stderr,
+                "ERROR: Couldn't measure size of image file %s\n",
+                scalpelInputGetId(state->inReader));
+            return SCALPEL_ERROR_FILE_READ;
+        }
 
-            add_to_queue(fragments, &frag, 0);
+        // can't process an image file smaller than the longest needle
+        if(filesize <= longestneedle * 2) {
+            return SCALPEL_ERROR_FILE_TOO_SMALL;
         }
     }
-}
-
-
-// If the coverage blockmap is used to guide carving, then use the
-// coverage blockmap to map a logical index in the disk image (i.e.,
-// the index skips covered blocks) to an actual disk image index.  If
-// the coverage blockmap isn't being used, just returns the second
-// argument.  
-//
-// ***This function assumes that the 'position' does NOT lie
-// within a covered block! ***
-static unsigned long long
-    positionUseCoverageBlockmap(struct scalpelState *state,
-    unsigned long long position) {
-
-    unsigned long long totalbytes = 0, neededbytes = position,
-        morebytes, curblock = 0, curpos = 0, bytestoskip;
 
-    if(!state->useCoverageBlockmap) {
-        return position;
+    // a stream has no coverage maps, but carved files are audited
+    // through them
+    if((err = setupCoverageMaps(state, filesize)) != SCALPEL_OK) {
+        return err;
     }
-    else {
-        while (totalbytes < neededbytes && curblock < state->coveragenumblocks) {
-            morebytes = 0;
-            bytestoskip = 0;
-
-            // skip covered blocks
-            while (curblock < state->coveragenumblocks &&
-                (state->coveragebitmap[curblock / 8] & (1 << (curblock % 8)))) {
-                    bytestoskip += state->coverageblocksize -
-                        curpos % state->coverageblocksize;
-                    curblock++;
-            }
 
-            curpos += bytestoskip;
-
-            // accumulate uncovered blocks
-            while (curblock < state->coveragenumblocks &&
-                ((state->
-                coveragebitmap[curblock / 8] & (1 << (curblock % 8))) == 0)
-                && totalbytes + morebytes < neededbytes) {
-
-                    morebytes += state->coverageblocksize -
-                        curpos % state->coverageblocksize;
-                    curblock++;
-            }
+    for(needlenum = 0; needlenum < state->specLines; needlenum++) {
+        if(state->SearchSpec[needlenum].length > window) {
+            window = state->SearchSpec[needlenum].length;
+        }
+    }
+    if(window > SCALPEL_MAX_DEFAULT_WINDOW) {
+        window = SCALPEL_MAX_DEFAULT_WINDOW;
+    }
+    if(state->windowsize) {
+        window = state->windowsize;
+    }
 
-            // cap size
-            if(totalbytes + morebytes > neededbytes) {
-                morebytes = neededbytes - totalbytes;
-            }
+    win.size = window + SIZE_OF_BUFFER;
+    win.data = (unsigned char *)malloc(win.size);
+    checkMemoryAllocation(state, win.data, __LINE__, __FILE__, "window");
+    win.end = 0;
+    win.cursors = (CarveCursor *)calloc(state->specLines, sizeof(CarveCursor));
+    checkMemoryAllocation(state, win.cursors, __LINE__, __FILE__, "cursors");
+    init_queue_pool(&win.fragmentpool, sizeof(struct Fragment));
 
-            curpos += morebytes;
-            totalbytes += morebytes;
+    for(needlenum = 0; needlenum < state->specLines; needlenum++) {
+        currentneedle = &(state->SearchSpec[needlenum]);
+        win.cursors[needlenum].reach = currentneedle->length < window ?
+            currentneedle->length : window;
+        win.cursors[needlenum].embedded = state->handleEmbedded &&
+            currentneedle->endlength &&
+            (currentneedle->searchtype == SEARCHTYPE_FORWARD ||
+            currentneedle->searchtype == SEARCHTYPE_FORWARD_NEXT);
+        if(currentneedle->length > window && !stream) {
+            win.cursors[needlenum].deferred = TRUE;
+            deferred++;
+            fprintf(stdout,
+                "%s files may be longer than the %"PRIu64 " byte window and are carved\n"
+                "in a second pass.\n", currentneedle->suffix, window);
+        }
+        else if(currentneedle->length > window) {
+            fprintf(stdout,
+                "WARNING: %s files may be longer than the %"PRIu64 " byte window; those\n"
+                "not ended within the window are carved up to its size and marked chopped.\n",
+                currentneedle->suffix, window);
         }
 
-        return curpos;
+        // organization subdirectories for this type are numbered from here
+        currentneedle->firstorganizeDirNum = currentneedle->organizeDirNum;
+        currentneedle->createdDirNum = -1;
     }
-}
 
+    auditCarveTableHeader(state);
 
-// update the coverage blockmap for a carved file (if appropriate) and write entries into
-// the audit log describing the carved file.  If the file is fragmented, then multiple
-// lines are written to indicate where the fragments occur. 
-static int
-    auditUpdateCoverageBlockmap(struct scalpelState *state,
-                                struct CarveInfo *carve) {
+    if(state->previewMode) {
+        fprintf(stdout, "** PREVIEW MODE: GENERATING AUDIT LOG ONLY **\n");
+        fprintf(stdout, "** NO CARVED FILES WILL BE WRITTEN **\n");
+    }
 
-    struct Queue fragments;
-    Fragment *frag;
-    int err;
-    unsigned long long k;
+    fprintf(stdout, "Image file single pass, carving from a %"PRIu64 " byte window.\n",
+        window);
 
-    // If the coverage blockmap used to guide carving, then carve->start and
-    // carve->stop may not correspond to addresses in the disk image--the coverage blockmap
-    // processing layer in Scalpel may have skipped "in use" blocks.  Transform carve->start
-    // and carve->stop into a list of fragments that contain real disk image offsets.
-    generateFragments(state, &fragments, carve);
+    // Create and start the streaming reader thread for this image file.
+    state->constantbytes = 0;
+    if(pthread_create(&reader, NULL, streaming_reader, (void *)state) != 0) {
+        err = SCALPEL_ERROR_PTHREAD_FAILURE;
+        goto exit_window;
+    }
 
-    rewind_queue(&fragments);
-    while (!end_of_queue(&fragments)) {
-        frag = (Fragment *) pointer_to_current(&fragments);
-        fprintf(state->auditFile, "%s", base_name(carve->filename));
-#ifdef _WIN32
-        fprintf(state->auditFile, "%13I64u\t\t", frag->start);
-#else
-        fprintf(state->auditFile, "%13llu\t\t", frag->start);
-#endif
+#ifdef MULTICORE_THREADING
 
-        fprintf(state->auditFile, "%3s", carve->chopped ? "YES   " : "NO    ");
+    while (1) {
 
-#ifdef _WIN32
-        fprintf(state->auditFile, "%13I64u\t\t", frag->stop - frag->start + 1);
-#else
-        fprintf(state->auditFile, "%13llu\t\t", frag->stop - frag->start + 1);
-#endif
+        rinfo = (readbuf_info *)get(full_readbuf);
+        if ((rinfo->bytesread == 0) && (rinfo->beginreadpos == 0)) {
+            // end of reads condition - we're done
+            break;
+        }
+        if(signal_caught == SIGTERM || signal_caught == SIGINT) {
+            // discard buffers until the reader notices the signal and
+            // stops, so it isn't left blocked on a queue
+            put(empty_readbuf, (void *)rinfo);
+            continue;
+        }
 
-        fprintf(state->auditFile, "%s\n", base_name(scalpelInputGetId(state->inReader)));
+        // keep the bytes not seen before; the buffers overlap by
+        // longestneedle - 1 bytes
+        readend = rinfo->beginreadpos + rinfo->bytesread;
+        for(at = win.end > (unsigned long long)rinfo->beginreadpos ? win.end :
+            rinfo->beginreadpos; at < readend; at += chunk) {
+                chunk = win.size - at % win.size;
+                if(chunk > readend - at) {
+                    chunk = readend - at;
+                }
+                memcpy(win.data + at % win.size,
+                    rinfo->readbuf + (at - rinfo->beginreadpos), chunk);
+        }
+        if(readend > win.end) {
+            win.end = readend;
+        }
 
-        fflush(state->auditFile);
+        readbuffer = rinfo->readbuf;
+        if ((err = digBuffer(state, rinfo->bytesread, 
+            rinfo->beginreadpos, rinfo->firstextent, rinfo->skipruns,
+            rinfo->numskipruns)) != SCALPEL_OK) {
+                goto exit_window;
+        }
+        put(empty_readbuf, (void *)rinfo);
 
-        // update coverage blockmap, if appropriate
-        if(state->updateCoverageBlockmap) {
-            for(k = frag->start / state->coverageblocksize;
-                k <= frag->stop / state->coverageblocksize; k++) {
-                    if((err = updateCoverageBlockmap(state, k)) != SCALPEL_OK) {
-                        destroy_queue(&fragments);
-                        return err;
-                    }
+        // every header and footer before the overlap with the next buffer
+        // has been found
+        frontier = readend - (longestneedle - 1);
+        for(needlenum = 0; needlenum < state->specLines; needlenum++) {
+            if((err = decideWindowCarves(state, &win, needlenum, frontier,
+                FALSE)) != SCALPEL_OK) {
+                    goto exit_window;
             }
         }
-        next_element(&fragments);
     }
 
-    destroy_queue(&fragments);
+#else
 
-    return SCALPEL_OK;
-}
+    fprintf(stderr, "ERROR: Single pass carving needs the multi-core search.\n");
+    err = SCALPEL_GENERAL_ABORT;
+    goto exit_window;
+
+#endif
 
+    // the reader closes the stream after queueing the end marker
+    pthread_join(reader, NULL);
 
-static int
-    updateCoverageBlockmap(struct scalpelState *state, unsigned long long block) {
+    if(state->constantbytes > 0) {
+        fprintf(stdout,
+            "\n%"PRIu64 " bytes of constant blocks were skipped by the searches.\n",
+            state->constantbytes);
+    }
 
-    unsigned int entry;
+    // the reader stops early if a signal was caught; files decided so
+    // far are complete
+    if(signal_caught == SIGTERM || signal_caught == SIGINT) {
+        err = SCALPEL_OK;
+        goto exit_window;
+    }
 
-    if(state->updateCoverageBlockmap) {
-        // first entry in file is block size, so seek one unsigned int further
-        fseeko(state->coverageblockmap, (block + 1) * sizeof(unsigned int),
-            SEEK_SET);
-        if(fread(&entry, sizeof(unsigned int), 1, state->coverageblockmap) != 1) {
-            fprintf(stderr, "Error reading coverage blockmap entry!\n");
-            fprintf(state->auditFile, "Error reading coverage blockmap entry!\n");
-            return SCALPEL_ERROR_FATAL_READ;
-        }
-        entry++;
-        // first entry in file is block size, so seek one unsigned int further 
-        fseeko(state->coverageblockmap, (block + 1) * sizeof(unsigned int),
-            SEEK_SET);
-        if(fwrite(&entry, sizeof(unsigned int), 1, state->coverageblockmap)
-            != 1) {
-                fprintf(stderr, "Error writing to coverage blockmap file!\n");
-                fprintf(state->auditFile, "Error writing to coverage blockmap file!\n");
-                return SCALPEL_ERROR_FILE_WRITE;
+    // the whole stream has been searched
+    for(needlenum = 0; needlenum < state->specLines; needlenum++) {
+        if((err = decideWindowCarves(state, &win, needlenum, win.end,
+            TRUE)) != SCALPEL_OK) {
+                goto exit_window;
         }
     }
 
-    return SCALPEL_OK;
-}
+    if(deferred) {
+        fprintf(stdout, "\nImage file single pass complete, %d file types remain.\n",
+            deferred);
+        secondpass = TRUE;
+    }
+    else {
+        fprintf(stdout, "\nImage file carved.  Workload:\n");
+        printWorkload(state);
 
+        printf("Processing of image file complete. Cleaning up...\n");
+        state->imageCarved = TRUE;
+    }
 
+exit_window:
+    for(needlenum = 0; needlenum < state->specLines; needlenum++) {
+        if(secondpass && !win.cursors[needlenum].deferred) {
+            releaseNeedleOffsets(&(state->SearchSpec[needlenum]));
+        }
+        free(win.cursors[needlenum].matches);
+        free(win.cursors[needlenum].stack);
+    }
+    free(win.cursors);
+    free(win.data);
+    destroy_queue_pool(&win.fragmentpool);
 
-static void destroyCoverageMaps(struct scalpelState *state) {
+    // carveImageFile() carves the deferred file types
+    if(secondpass) {
+        return SCALPEL_OK;
+    }
 
-    //  memory associated with coverage bitmap, close coverage blockmap file
+    destroyCoverageMaps(state);
+    releaseOffsets(state);
 
-    if(state->coveragebitmap) {
-        free(state->coveragebitmap);
-        state->coveragebitmap = NULL;
+    if(signal_caught == SIGTERM || signal_caught == SIGINT) {
+        clean_up(state, signal_caught);
     }
 
-    if(state->useCoverageBlockmap || state->updateCoverageBlockmap) {
-        fclose(state->coverageblockmap);
-        state->coverageblockmap = NULL;
+    if(err == SCALPEL_OK) {
+        printf("Done.");
     }
+    return err;
 }
 
 
-// simple wrapper for fseeko with SEEK_CUR semantics that uses the
-// coverage bitmap to skip over covered blocks, IF the coverage
-// blockmap is being used.  The offset is adjusted so that covered
-// blocks are silently skipped when seeking if the coverage blockmap
-// is used, otherwise an fseeko() with an umodified offset is
-// performed.
-static int
-fseeko_use_coverage_map(struct scalpelState *state, ScalpelInputReader * const inReader, off64_t offset) {
-
-    off64_t currentpos;
-
-    // BUG TEST: revision 5 changed curbloc to unsigned, removed all tests for 
-    // curblock >= 0 from each of next three while loops
-    // we should put back guards to make sure we don't underflow
-    // what did I break? anything? maybe not?
-
-    unsigned long long curblock, bytestoskip, bytestokeep, totalbytes = 0;
-    int sign;
-
-    if(state->useCoverageBlockmap) {
-        currentpos = scalpelInputTello(state->inReader);
-        sign = (offset > 0 ? 1 : -1);
-
-        curblock = currentpos / state->coverageblocksize;
-
-        while (totalbytes < (offset > 0 ? offset : offset * -1) &&
-            curblock < state->coveragenumblocks) {
-                bytestoskip = 0;
-
-                // covered blocks increase offset
-                while (curblock < state->coveragenumblocks &&
-                    (state->coveragebitmap[curblock / 8] & (1 << (curblock % 8)))) {
-
-                        bytestoskip += (state->coverageblocksize -
-                            currentpos % state->coverageblocksize);
-                        curblock += sign;
-                }
+// The coverage blockmap marks which blocks (of a user-specified size)
+// have been "covered" by a carved file.  If the coverage blockmap
+// exists, it's loaded with a single read of its bitmap (or, for a
+// Scalpel 2.0 blockmap, with large reads of its entries) into the
+// coverage bitmap, which guides carving.  If the coverage blockmap is
+// to be modified, a new or old-format blockmap is first written in the
+// current format and its bitmap is then mmap()ed, so that updates are
+// made in place as carved files are closed.  Counts for blocks covered
+// by more than one carved file are kept in memory and written by
+// destroyCoverageMaps().  If state->coverageLegacyFormat is set, or on
+// Win32, the updated blockmap is kept in memory and written in full by
+// destroyCoverageMaps() instead.  The difference between the coverage
+// blockmap (on disk) and the coverage bitmap (in memory) is that the
+// blockmap counts carved files that cover a block.  The coverage
+// bitmap only indicates if ANY carved file covers a block, and doesn't
+// change while the image file is processed.  'filesize' is the size of
+// the image file being examined.
 
-                offset += (bytestoskip * sign);
-                currentpos += (bytestoskip * sign);
+static int
+    setupCoverageMaps(struct scalpelState *state, unsigned long long filesize) {
 
-                bytestokeep = 0;
+    char fn[MAX_STRING_LENGTH];	// filename for coverage blockmap
+    unsigned long long numbytes;
+    int empty, legacy = FALSE, err;
+    unsigned int blocksize;
+    CoverageBlockmapHeader header;
 
-                // uncovered blocks don't increase offset
-                while (curblock < state->coveragenumblocks &&
-                    ((state->
-                    coveragebitmap[curblock / 8] & (1 << (curblock % 8))) == 0)
-                    && totalbytes < (offset > 0 ? offset : offset * -1)) {
 
-                        bytestokeep += (state->coverageblocksize -
-                            currentpos % state->coverageblocksize);
+    state->coveragebitmap = 0;
+    state->coverageblockmap = 0;
+    state->coveragerank = 0;
+    state->coverageextents = 0;
+    state->coveragemapbits = 0;
+    state->coveragemapping = 0;
+    state->coverageoverflow = 0;
+    state->coverageoverflowsize = 0;
+    state->coverageoverflowused = 0;
+    state->coverageupdates = 0;
+    state->coveragenumupdates = 0;
+    state->coverageupdatesize = 0;
+    state->coverageknown = 0;
+    state->coverageknowncount = 0;
+
+    if(!useCoverageTranslation(state)) {
+        return SCALPEL_OK;
+    }
 
-                        curblock += sign;
-                }
+    fprintf(stdout, "Setting up coverage blockmap.\n");
 
-                totalbytes += bytestokeep;
-                currentpos += (bytestokeep * sign);
+    // known blocks are tracked at the block size of the block hash set
+    if(state->blockhashfile) {
+        if(!state->blockhashset &&
+            (err = openBlockHashSet(state, state->blockhashfile)) != SCALPEL_OK) {
+                return err;
         }
+        if(state->coverageblocksize != 0 &&
+            state->coverageblocksize != state->blockhashset->blocksize) {
+                fprintf(stderr,
+                    "Coverage blocksize does not match blocksize in\nblock hash set file: %s; aborting.\n",
+                    state->blockhashfile);
+                fprintf(state->auditFile,
+                    "Coverage blocksize does not match blocksize in\nblock hash set file: %s\n",
+                    state->blockhashfile);
+                return SCALPEL_GENERAL_ABORT;
+        }
+        state->coverageblocksize = state->blockhashset->blocksize;
     }
 
-    return scalpelInputSeeko(state->inReader, offset, SCALPEL_SEEK_CUR);
-}
-
+    if(state->useCoverageBlockmap) {
+        // generate pathname for coverage blockmap
+        snprintf(fn, MAX_STRING_LENGTH, "%s", state->coveragefile);
 
-// simple wrapper for ftello() that uses the coverage bitmap to
-// report the current file position *minus* the contribution of
-// marked blocks, IF the coverage blockmap is being used.  If a
-// coverage blockmap isn't in use, just performs a standard ftello()
-// call.
-//
-// GGRIII:  *** This could use optimization, e.g., use of a pre-computed
-// table to avoid walking the coverage bitmap on each call.
+        fprintf(stdout, "Coverage blockmap is \"%s\".\n", fn);
 
-static off64_t ftello_use_coverage_map(struct scalpelState *state, ScalpelInputReader * const inReader) {
+        empty = ((state->coverageblockmap = fopen(fn, "rb")) == NULL);
+        fprintf(stdout, "Coverage blockmap file is %s.\n",
+            (empty ? "EMPTY" : "NOT EMPTY"));
+    }
+    else {
+        // region list only, nothing is covered yet
+        empty = TRUE;
+    }
 
-    off64_t currentpos, decrease = 0;
-    unsigned long long endblock, k;
+    if(!empty) {
+#ifdef _WIN32
+        // set binary mode for Win32
+        setmode(fileno(state->coverageblockmap), O_BINARY);
+#endif
+#ifdef __linux
+        fcntl(fileno(state->coverageblockmap), F_SETFL, O_LARGEFILE);
+#endif
 
-    currentpos = scalpelInputTello(state->inReader);
+        fprintf(stdout, "Reading blocksize from coverage blockmap file.\n");
 
-    if(state->useCoverageBlockmap) {
-        endblock = currentpos / state->coverageblocksize;
+        // read block size and make sure it matches user-specified block
+        // size.  A Scalpel 2.0 blockmap starts with the block size.
+        if(fread(&blocksize, sizeof(unsigned int), 1, state->coverageblockmap) != 1 ||
+            (blocksize == COVERAGE_BLOCKMAP_MAGIC &&
+            (fseeko(state->coverageblockmap, 0, SEEK_SET) ||
+            fread(&header, sizeof(CoverageBlockmapHeader), 1,
+            state->coverageblockmap) != 1))) {
+                fprintf(stderr,
+                    "Error reading coverage blockmap blocksize in\ncoverage blockmap file: %s\n",
+                    fn);
+                fprintf(state->auditFile,
+                    "Error reading coverage blockmap blocksize in\ncoverage blockmap file: %s\n",
+                    fn);
+                discardCoverageMaps(state);
+                return SCALPEL_ERROR_FATAL_READ;
+        }
 
-        // covered blocks don't contribute to current file position
-        for(k = 0; k <= endblock; k++) {
-            if(state->coveragebitmap[k / 8] & (1 << (k % 8))) {
-                decrease += state->coverageblocksize;
+        if(blocksize == COVERAGE_BLOCKMAP_MAGIC) {
+            if(header.version != COVERAGE_BLOCKMAP_VERSION) {
+                fprintf(stderr,
+                    "Unsupported version %u of coverage blockmap file: %s; aborting.\n",
+                    header.version, fn);
+                fprintf(state->auditFile,
+                    "Unsupported version %u of coverage blockmap file: %s\n",
+                    header.version, fn);
+                discardCoverageMaps(state);
+                return SCALPEL_GENERAL_ABORT;
             }
+            blocksize = header.blocksize;
         }
-
-        if(state->coveragebitmap[endblock / 8] & (1 << (endblock % 8))) {
-            decrease += (state->coverageblocksize -
-                currentpos % state->coverageblocksize);
+        else {
+            legacy = TRUE;
+            fprintf(stdout, "Coverage blockmap file is in Scalpel 2.0 format.\n");
         }
 
-        if(state->modeVerbose && state->useCoverageBlockmap) {
-            fprintf(stdout,
-                "Coverage map decreased current file position by %"PRIu64 " bytes.\n",
-                (unsigned long long)decrease);
+        if(blocksize == 0 ||
+            (state->coverageblocksize != 0 && blocksize != state->coverageblocksize)) {
+            fprintf(stderr,
+                "User-specified blocksize does not match blocksize in\ncoverage blockmap file: %s; aborting.\n",
+                fn);
+            fprintf(state->auditFile,
+                "User-specified blocksize does not match blocksize in\ncoverage blockmap file: %s\n",
+                fn);
+            discardCoverageMaps(state);
+            return SCALPEL_GENERAL_ABORT;
         }
-    }
 
-    return currentpos - decrease;
-}
+        state->coverageblocksize = blocksize;
+        fprintf(stdout, "Blocksize for coverage blockmap is %u.\n",
+            state->coverageblocksize);
+    }
+    else if(empty && state->useCoverageBlockmap && !state->updateCoverageBlockmap) {
+        fprintf(stderr,
+            "-u option requires that the blockmap file %s exist.\n", fn);
+        fprintf(state->auditFile,
+            "-u option requires that the blockmap file %s exist.\n", fn);
+        return SCALPEL_GENERAL_ABORT;
+    }
+    else {
+        // empty coverage blockmap
+        if(state->coverageblocksize == 0) {	// user didn't override default
+            state->coverageblocksize = 512;
+        }
+        fprintf(stdout, "Blocksize for coverage blockmap is %u.\n",
+            state->coverageblocksize);
+    }
 
-// simple wrapper for fread() that uses the coverage bitmap--the read silently
-// skips blocks that are marked covered (corresponding bit in coverage
-// bitmap is 1)
-static size_t
-fread_use_coverage_map(struct scalpelState *state, void *ptr,
-                       size_t size, size_t nmemb, ScalpelInputReader * const inReader) {
+    state->coveragenumblocks =
+        (unsigned long long)ceil((double)filesize /
+        (double)state->coverageblocksize);
 
-    unsigned long long curblock, neededbytes = nmemb * size, bytestoskip,
-        bytestoread, bytesread, totalbytesread = 0, curpos;
-    int shortread;
-    //  gettimeofday_t readnow, readthen;
+    fprintf(stdout, "# of blocks in coverage blockmap is %"PRIu64 ".\n",
+        state->coveragenumblocks);
 
-    //  gettimeofday(&readthen, 0);
+    if(!empty && !legacy && header.numblocks != state->coveragenumblocks) {
+        fprintf(stderr,
+            "Coverage blockmap file %s has %"PRIu64 " blocks, image file needs %"PRIu64 "; aborting.\n",
+            fn, header.numblocks, state->coveragenumblocks);
+        fprintf(state->auditFile,
+            "Coverage blockmap file %s has %"PRIu64 " blocks, image file needs %"PRIu64 ".\n",
+            fn, header.numblocks, state->coveragenumblocks);
+        discardCoverageMaps(state);
+        return SCALPEL_GENERAL_ABORT;
+    }
 
-    if(state->useCoverageBlockmap) {
-        if(state->modeVerbose) {
-            fprintf(stdout,
-                "Issuing coverage map-based READ, wants %"PRIu64 " bytes.\n",
-                neededbytes);
-        }
+    fprintf(stdout, "Allocating and clearing in-core coverage bitmap.\n");
+    // for bitmap, 8 bits per unsigned char, with each bit representing one
+    // block
+    numbytes = (state->coveragenumblocks + 7) / 8;
+    state->coveragebitmap =
+        (unsigned char *)malloc(numbytes * sizeof(unsigned char));
+    checkMemoryAllocation(state, state->coveragebitmap, __LINE__, __FILE__,
+        "coveragebitmap");
 
-        curpos = scalpelInputTello(inReader);
-        curblock = curpos / state->coverageblocksize;
-        shortread = 0;
+    // zap coverage bitmap 
+    memset(state->coveragebitmap, 0, numbytes);
 
-        while (totalbytesread < neededbytes
-            && curblock < state->coveragenumblocks && !shortread) {
-                bytestoread = 0;
-                bytestoskip = 0;
+    if(!empty) {
+        fprintf(stdout, "Reading existing coverage blockmap.\n");
 
-                // skip covered blocks
-                while (curblock < state->coveragenumblocks &&
-                    (state->coveragebitmap[curblock / 8] & (1 << (curblock % 8)))) {
-                        bytestoskip += (state->coverageblocksize -
-                            curpos % state->coverageblocksize);
-                        curblock++;
-                }
+        if(legacy) {
+            err = readLegacyCoverageBlockmap(state, fn);
+        }
+        else {
+            err = readCoverageBlockmap(state, fn, &header);
+        }
+        if(err != SCALPEL_OK) {
+            discardCoverageMaps(state);
+            return err;
+        }
+        fclose(state->coverageblockmap);
+        state->coverageblockmap = NULL;
 
-                curpos += bytestoskip;
+        // clear bits past the last block
+        if(state->coveragenumblocks % 8) {
+            state->coveragebitmap[numbytes - 1] &=
+                (1 << (state->coveragenumblocks % 8)) - 1;
+        }
+    }
 
+    // prepare the blockmap for updates as files are carved
+    if(state->updateCoverageBlockmap) {
+#ifndef _WIN32
+        if(!state->coverageLegacyFormat) {
+            // a new or old-format blockmap is converted to the current
+            // format before it's mapped
+            if((empty || legacy) &&
+                (err = writeCoverageBlockmap(state, fn, state->coveragebitmap))
+                != SCALPEL_OK) {
+                    discardCoverageMaps(state);
+                    return err;
+            }
 
-                if(state->modeVerbose) {
-                    fprintf(stdout,
-                        "fread using coverage map to skip %"PRIu64 " bytes.\n", bytestoskip);
-                }
+            if(state->modeVerbose) {
+                fprintf(stdout, "Mapping coverage blockmap file R/W.\n");
+            }
 
-                scalpelInputSeeko(inReader, (off64_t) bytestoskip, SCALPEL_SEEK_CUR);
+            state->coveragemappinglen =
+                (size_t)(sizeof(CoverageBlockmapHeader) + numbytes);
+            if((state->coverageblockmap = fopen(fn, "r+b")) == NULL ||
+                (state->coveragemapping = mmap(0, state->coveragemappinglen,
+                PROT_READ | PROT_WRITE, MAP_SHARED,
+                fileno(state->coverageblockmap), 0)) == MAP_FAILED) {
+                    fprintf(stderr, "Error writing to coverage blockmap file: %s -- %s\n",
+                        fn, strerror(errno));
+                    fprintf(state->auditFile,
+                        "Error writing to coverage blockmap file: %s -- %s\n",
+                        fn, strerror(errno));
+                    state->coveragemapping = NULL;
+                    discardCoverageMaps(state);
+                    return SCALPEL_ERROR_FILE_WRITE;
+            }
+            state->coveragemapbits = (unsigned char *)state->coveragemapping +
+                sizeof(CoverageBlockmapHeader);
+        }
+#endif
 
-                // accumulate uncovered blocks for read
-                while (curblock < state->coveragenumblocks &&
-                    ((state->
-                    coveragebitmap[curblock / 8] & (1 << (curblock % 8))) == 0)
-                    && totalbytesread + bytestoread <= neededbytes) {
+        if(!state->coveragemapping) {
+            state->coveragemapbits =
+                (unsigned char *)malloc(numbytes * sizeof(unsigned char));
+            checkMemoryAllocation(state, state->coveragemapbits, __LINE__,
+                __FILE__, "coveragemapbits");
+            memcpy(state->coveragemapbits, state->coveragebitmap, numbytes);
+        }
+    }
 
-                        bytestoread += (state->coverageblocksize -
-                            curpos % state->coverageblocksize);
+    // blocks outside the regions are skipped just like covered blocks,
+    // but aren't recorded in the blockmap file
+    if(state->numregions > 0) {
+        restrictCoverageToRegions(state);
+    }
 
-                        curblock++;
-                }
+    // blocks found in the block hash set in pass 1
+    if(state->blockhashset) {
+        state->coverageknown = (unsigned char *)calloc((size_t)numbytes, 1);
+        checkMemoryAllocation(state, state->coverageknown, __LINE__, __FILE__,
+            "coverageknown");
+    }
 
-                // cap read size
-                if(totalbytesread + bytestoread > neededbytes) {
-                    bytestoread = neededbytes - totalbytesread;
-                }
+    buildCoverageIndex(state);
 
+    fprintf(stdout, "Finished setting up coverage blockmap.\n");
 
-                if(state->modeVerbose) {
-                    fprintf(stdout,
-                        "fread using coverage map found %"PRIu64 " consecutive bytes.\n",
-                        bytestoread);
-                }
+    return SCALPEL_OK;
 
-                if((bytesread =
-                    scalpelInputRead(state->inReader, (char *)ptr + totalbytesread, 1, (size_t) bytestoread))
-                    < bytestoread)
-                {
-                    shortread = 1;
-                }
+}
 
-                totalbytesread += bytesread;
-                curpos += bytestoread;
 
-                if(state->modeVerbose) {
-                    fprintf(stdout, "fread using coverage map read %"PRIu64 " bytes.\n",
-                        bytesread);
-                }
-        }
+// load the bitmap and overflow table from a coverage blockmap file in
+// the current format, with the file positioned after its header
+static int readCoverageBlockmap(struct scalpelState *state, char *fn,
+                               CoverageBlockmapHeader *header) {
 
-        if(state->modeVerbose) {
-            fprintf(stdout, "Coverage map-based READ complete.\n");
-        }
+    CoverageOverflow *entries;
+    unsigned long long k;
 
-        // conform with fread() semantics by returning # of items read
-        return totalbytesread / size;
+    if(fread(state->coveragebitmap, 1, (size_t)((state->coveragenumblocks + 7) / 8),
+        state->coverageblockmap) != (state->coveragenumblocks + 7) / 8) {
+            fprintf(stderr,
+                "Error reading coverage blockmap entry (blockmap truncated?): %s\n",
+                fn);
+            fprintf(state->auditFile,
+                "Error reading coverage blockmap entry (blockmap truncated?): %s\n",
+                fn);
+            return SCALPEL_ERROR_FATAL_READ;
     }
-    else {
-        size_t ret = scalpelInputRead(state->inReader, ptr, size, nmemb);
-        return ret;
+
+    // counts are only needed if the blockmap will be updated
+    if(!state->updateCoverageBlockmap || header->numoverflow == 0) {
+        return SCALPEL_OK;
     }
-}
 
-#ifdef MULTICORE_THREADING
+    entries = (CoverageOverflow *)malloc(header->numoverflow *
+        sizeof(CoverageOverflow));
+    checkMemoryAllocation(state, entries, __LINE__, __FILE__, "coverageoverflow");
+    if(fread(entries, sizeof(CoverageOverflow), (size_t)header->numoverflow,
+        state->coverageblockmap) != header->numoverflow) {
+            fprintf(stderr,
+                "Error reading coverage blockmap entry (blockmap truncated?): %s\n",
+                fn);
+            fprintf(state->auditFile,
+                "Error reading coverage blockmap entry (blockmap truncated?): %s\n",
+                fn);
+            free(entries);
+            return SCALPEL_ERROR_FATAL_READ;
+    }
+    for(k = 0; k < header->numoverflow; k++) {
+        if(entries[k].block < state->coveragenumblocks && entries[k].count > 1) {
+            findCoverageOverflow(state, entries[k].block, TRUE)->count =
+                entries[k].count;
+        }
+    }
+    free(entries);
 
-// threaded header/footer search
-static void *threadedFindAll(void *args) {
+    return SCALPEL_OK;
+}
 
-    int id = ((ThreadFindAllParams *) args)->id;
-    char *str;
-    size_t length;
-    char *startpos;
-    long offset;
-    char **foundat;
-    size_t *foundatlens;
-    size_t *table = 0;
-    regex_t *regexp = 0;
-    int strisRE;
-    int casesensitive;
-    int nosearchoverlap;
-    struct scalpelState *state;
 
-    regmatch_t *match;
+// load a Scalpel 2.0 coverage blockmap, one unsigned int count per block
+// following the block size, COVERAGE_LEGACY_CHUNK entries at a time
+static int readLegacyCoverageBlockmap(struct scalpelState *state, char *fn) {
 
-    // wait for work
-    //  sem_wait(&workavailable[id]);
+    unsigned int *entries;
+    unsigned long long i, k, n;
 
-    // you need to be holding the workcomplete mutex initially
-    pthread_mutex_lock(&workcomplete[id]);
-    pthread_mutex_lock(&workavailable[id]);
+    entries = (unsigned int *)malloc(COVERAGE_LEGACY_CHUNK * sizeof(unsigned int));
+    checkMemoryAllocation(state, entries, __LINE__, __FILE__, "blockmap entries");
 
-    while (1) {
-        // get args that define current workload
-        str = ((ThreadFindAllParams *) args)->str;
-        length = ((ThreadFindAllParams *) args)->length;
-        startpos = ((ThreadFindAllParams *) args)->startpos;
-        offset = ((ThreadFindAllParams *) args)->offset;
-        foundat = ((ThreadFindAllParams *) args)->foundat;
-        foundatlens = ((ThreadFindAllParams *) args)->foundatlens;
-        strisRE = ((ThreadFindAllParams *) args)->strisRE;
-        if(strisRE) {
-            regexp = ((ThreadFindAllParams *) args)->regex;
+    for(i = 0; i < state->coveragenumblocks; i += n) {
+        n = state->coveragenumblocks - i;
+        if(n > COVERAGE_LEGACY_CHUNK) {
+            n = COVERAGE_LEGACY_CHUNK;
         }
-        else {
-            table = ((ThreadFindAllParams *) args)->table;
+        if(fread(entries, sizeof(unsigned int), (size_t)n,
+            state->coverageblockmap) != n) {
+                fprintf(stderr,
+                    "Error reading coverage blockmap entry (blockmap truncated?): %s\n",
+                    fn);
+                fprintf(state->auditFile,
+                    "Error reading coverage blockmap entry (blockmap truncated?): %s\n",
+                    fn);
+                free(entries);
+                return SCALPEL_ERROR_FATAL_READ;
         }
-        casesensitive = ((ThreadFindAllParams *) args)->casesensitive;
-        nosearchoverlap = ((ThreadFindAllParams *) args)->nosearchoverlap;
-        state = ((ThreadFindAllParams *) args)->state;
-
-        if(state->modeVerbose) {
-            printf("needle search thread # %d awake.\n", id);
+        for(k = 0; k < n; k++) {
+            if(entries[k]) {
+                state->coveragebitmap[(i + k) / 8] |= 1 << ((i + k) % 8);
+                if(entries[k] > 1 && state->updateCoverageBlockmap) {
+                    findCoverageOverflow(state, i + k, TRUE)->count = entries[k];
+                }
+            }
         }
+    }
+    free(entries);
 
-        while (startpos) {
-            if(!strisRE) {
-                startpos = bm_needleinhaystack(str,
-                    length,
-                    startpos,
-                    offset - (long)startpos,
-                    table, casesensitive);
+    return SCALPEL_OK;
+}
+
+
+// write a complete coverage blockmap with bitmap 'bits' and the current
+// overflow counts, in the format selected by state->coverageLegacyFormat.
+// The blockmap is written to a temporary file which then replaces 'fn'.
+static int writeCoverageBlockmap(struct scalpelState *state, char *fn,
+                                 unsigned char *bits) {
+
+    char tmpfn[MAX_STRING_LENGTH + 4];
+    FILE *f;
+    CoverageBlockmapHeader header;
+    CoverageOverflow *entries = 0;
+    unsigned int *counts;
+    unsigned long long i, k, n;
+    int ok;
+
+    snprintf(tmpfn, sizeof(tmpfn), "%s.tmp", fn);
+    if((f = fopen(tmpfn, "wb")) == NULL) {
+        fprintf(stderr, "Error writing to coverage blockmap file: %s -- %s\n",
+            tmpfn, strerror(errno));
+        fprintf(state->auditFile,
+            "Error writing to coverage blockmap file: %s -- %s\n",
+            tmpfn, strerror(errno));
+        return SCALPEL_ERROR_FILE_WRITE;
+    }
+#ifdef _WIN32
+    // set binary mode for Win32
+    setmode(fileno(f), O_BINARY);
+#endif
+
+    if(state->coverageLegacyFormat) {
+        counts = (unsigned int *)malloc(COVERAGE_LEGACY_CHUNK * sizeof(unsigned int));
+        checkMemoryAllocation(state, counts, __LINE__, __FILE__, "blockmap entries");
+
+        ok = fwrite(&(state->coverageblocksize), sizeof(unsigned int), 1, f) == 1;
+        for(i = 0; ok && i < state->coveragenumblocks; i += n) {
+            n = state->coveragenumblocks - i;
+            if(n > COVERAGE_LEGACY_CHUNK) {
+                n = COVERAGE_LEGACY_CHUNK;
             }
-            else {
-                //printf("Before regexp search, startpos = %p\n", startpos);
-                match = re_needleinhaystack(regexp, startpos, offset - (long)startpos);
-                if(!match) {
-                    startpos = 0;
-                }
-                else {
-                    startpos = match->rm_so + startpos;
-                    length = match->rm_eo - match->rm_so;
-                    free(match);
-                    match = NULL;
-                    //printf("After regexp search, startpos = %p\n", startpos);
+            for(k = 0; k < n; k++) {
+                counts[k] = 0;
+                if(bits[(i + k) / 8] & (1 << ((i + k) % 8))) {
+                    counts[k] = (unsigned int)coverageBlockmapCount(state, i + k);
                 }
             }
+            ok = fwrite(counts, sizeof(unsigned int), (size_t)n, f) == n;
+        }
+        free(counts);
+    }
+    else {
+        header.magic = COVERAGE_BLOCKMAP_MAGIC;
+        header.version = COVERAGE_BLOCKMAP_VERSION;
+        header.blocksize = state->coverageblocksize;
+        header.reserved = 0;
+        header.numblocks = state->coveragenumblocks;
+        header.numoverflow = sortedCoverageOverflow(state, &entries);
+
+        ok = fwrite(&header, sizeof(CoverageBlockmapHeader), 1, f) == 1 &&
+            fwrite(bits, 1, (size_t)((state->coveragenumblocks + 7) / 8), f) ==
+            (state->coveragenumblocks + 7) / 8 &&
+            fwrite(entries, sizeof(CoverageOverflow), (size_t)header.numoverflow,
+            f) == header.numoverflow;
+        free(entries);
+    }
 
-            if(startpos) {
-                // remember match location
-                foundat[(long)(foundat[MAX_MATCHES_PER_BUFFER])] = startpos;
-                foundatlens[(long)(foundat[MAX_MATCHES_PER_BUFFER])] = length;
-                foundat[MAX_MATCHES_PER_BUFFER]++;
+    if(!ok || fflush(f)) {
+        fprintf(stderr, "Error writing to coverage blockmap file: %s -- %s\n",
+            tmpfn, strerror(errno));
+        fprintf(state->auditFile,
+            "Error writing to coverage blockmap file: %s -- %s\n",
+            tmpfn, strerror(errno));
+        fclose(f);
+        unlink(tmpfn);
+        return SCALPEL_ERROR_FILE_WRITE;
+    }
+#ifndef _WIN32
+    fsync(fileno(f));
+#endif
+    fclose(f);
 
-                // move past match position.  Foremost 0.69 didn't find overlapping
-                // headers/footers.  If you need that behavior, specify "-r" on the
-                // command line.  Scalpel's default behavior is to find overlapping
-                // headers/footers.
+    // replace previous blockmap
+#ifdef _WIN32
+    unlink(fn);
+#endif
+    if(rename(tmpfn, fn)) {
+        fprintf(stderr, "Error writing to coverage blockmap file: %s -- %s\n",
+            fn, strerror(errno));
+        fprintf(state->auditFile,
+            "Error writing to coverage blockmap file: %s -- %s\n",
+            fn, strerror(errno));
+        return SCALPEL_ERROR_FILE_WRITE;
+    }
 
-                if(nosearchoverlap) {
-                    startpos += length;
-                }
-                else {
-                    startpos++;
-                }
+    return SCALPEL_OK;
+}
+
+
+// find the overflow count for 'block' in the open addressing hash
+// table of counts > 1.  If 'create' is set, a missing entry is added
+// with a count of 1.  Otherwise NULL is returned for a missing entry.
+static CoverageOverflow *findCoverageOverflow(struct scalpelState *state,
+                                              unsigned long long block,
+                                              int create) {
+
+    CoverageOverflow *old = state->coverageoverflow, *slot;
+    unsigned long long oldsize = state->coverageoverflowsize, k, h;
+
+    if(create && (state->coverageoverflowused + 1) * 2 > state->coverageoverflowsize) {
+        // grow and rehash
+        state->coverageoverflowsize = oldsize ? oldsize * 2 : COVERAGE_OVERFLOW_MIN_SIZE;
+        state->coverageoverflow = (CoverageOverflow *)
+            calloc((size_t)state->coverageoverflowsize, sizeof(CoverageOverflow));
+        checkMemoryAllocation(state, state->coverageoverflow, __LINE__, __FILE__,
+            "coverageoverflow");
+        state->coverageoverflowused = 0;
+        for(k = 0; k < oldsize; k++) {
+            if(old[k].count) {
+                *findCoverageOverflow(state, old[k].block, TRUE) = old[k];
             }
         }
+        free(old);
+    }
 
-        if(state->modeVerbose) {
-            printf("needle search thread # %d asleep.\n", id);
-        }
+    if(state->coverageoverflowsize == 0) {
+        return NULL;
+    }
 
-        // signal completion of work
-        //    sem_post(&workcomplete[id]);
-        pthread_mutex_unlock(&workcomplete[id]);
+    h = block * 0x9E3779B97F4A7C15ULL;
+    h ^= h >> 32;
+    for(k = h & (state->coverageoverflowsize - 1);;
+        k = (k + 1) & (state->coverageoverflowsize - 1)) {
+            slot = &(state->coverageoverflow[k]);
+            if(slot->count && slot->block == block) {
+                return slot;
+            }
+            if(!slot->count) {
+                if(!create) {
+                    return NULL;
+                }
+                slot->block = block;
+                slot->count = 1;
+                state->coverageoverflowused++;
+                return slot;
+            }
+    }
+}
 
-        // wait for more work
-        //    sem_wait(&workavailable[id]);
-        pthread_mutex_lock(&workavailable[id]);
 
-    }
+// # of carved files covering 'block', which must be marked in the
+// blockmap bitmap
+static unsigned long long coverageBlockmapCount(struct scalpelState *state,
+                                                unsigned long long block) {
 
-    return 0;
+    CoverageOverflow *slot = findCoverageOverflow(state, block, FALSE);
 
+    return slot ? slot->count : 1;
 }
 
-#endif
 
+static int compareCoverageOverflow(const void *a, const void *b) {
 
-// Buffers for reading image in and holding gpu results.
-// The ourCudaMallocHost call MUST be executed by the 
-// gpu_handler thread.
-void init_store() {
+    unsigned long long blocka = ((const CoverageOverflow *)a)->block;
+    unsigned long long blockb = ((const CoverageOverflow *)b)->block;
 
-    // 3 queues:
-    //              inque filled by reader, emptied by gpu_handler
-    //              outque filled by gpu_handler, emptied by host thread
-    //              freequeue filled by host, emptied by reader
+    return blocka < blockb ? -1 : (blocka > blockb ? 1 : 0);
+}
 
-    // the queues hold pointers to full and empty SIZE_OF_BUFFER read buffers 
-    full_readbuf = syncqueue_init("full_readbuf", QUEUELEN);
-    empty_readbuf = syncqueue_init("empty_readbuf", QUEUELEN);
-#ifdef GPU_THREADING
-    results_readbuf = syncqueue_init("results_readbuf", QUEUELEN);
-#endif
 
-    // backing store of actual buffers pointed to above, along with some  
-    // necessary bookeeping info
-    //readbuf_info *readbuf_store;
-    if((readbuf_store =
-        (readbuf_info *)malloc(QUEUELEN * sizeof(readbuf_info))) == 0) {
-            fprintf(stderr, (char *)"malloc %lu failed in streaming reader\n",
-                (unsigned long)QUEUELEN * sizeof(readbuf_info));
-    }
+// collect the overflow counts, sorted by block, into a newly allocated
+// array and return the # of entries
+static unsigned long long sortedCoverageOverflow(struct scalpelState *state,
+                                                 CoverageOverflow **entries) {
 
-    // initialization
-    int g;
-    for(g = 0; g < QUEUELEN; g++) {
-        readbuf_store[g].bytesread = 0;
-        readbuf_store[g].beginreadpos = 0;
+    unsigned long long k, n = 0;
 
-        // for fast gpu operation we need to use the CUDA pinned-memory allocations
-#ifdef GPU_THREADING
-        ourCudaMallocHost((void **)&(readbuf_store[g].readbuf), SIZE_OF_BUFFER);
-#else
-        readbuf_store[g].readbuf = (char *)malloc(SIZE_OF_BUFFER);
-#endif
+    *entries = (CoverageOverflow *)malloc((state->coverageoverflowused + 1) *
+        sizeof(CoverageOverflow));
+    checkMemoryAllocation(state, *entries, __LINE__, __FILE__, "coverageoverflow");
 
-        // put pointer to empty but initialized readbuf in the empty que        
-        put(empty_readbuf, (void *)(&readbuf_store[g]));
+    for(k = 0; k < state->coverageoverflowsize; k++) {
+        if(state->coverageoverflow[k].count) {
+            (*entries)[n++] = state->coverageoverflow[k];
+        }
     }
+    qsort(*entries, (size_t)n, sizeof(CoverageOverflow), compareCoverageOverflow);
+
+    return n;
 }
 
+// map carve->start ... carve->stop into a queue of 'fragments' that
+// define a carved file in the disk image.  
+static void
+    generateFragments(struct scalpelState *state, PoolQueue * fragments,
+    QueuePool *fragmentpool, CarveInfo * carve) {
 
-//free storage initialized in init_store()
-void destroyStore() {
-    if (full_readbuf) {
-        syncqueue_destroy(full_readbuf);
-        full_readbuf = NULL;
-    }
+    unsigned long long curblock, neededbytes =
+        carve->stop - carve->start + 1, bytestoskip, morebytes, totalbytes =
+        0, curpos;
 
-    if (empty_readbuf) {
-        syncqueue_destroy(empty_readbuf);
-        empty_readbuf = NULL;
-    }
+    Fragment frag;
 
-    if (readbuf_store) {
-        for(int g = 0; g < QUEUELEN; g++) {
 
-#ifdef GPU_THREADING
-            //TODO free this ourCudaMallocHost((void **)&(readbuf_store[g].readbuf), SIZE_OF_BUFFER);
-#else
-            free(readbuf_store[g].readbuf);
-            readbuf_store[g].readbuf = NULL;
-#endif
-        }
-        free(readbuf_store);
-        readbuf_store = NULL;
+    init_pool_queue(fragments, fragmentpool, TRUE);
+
+    if(!useCoverageTranslation(state)) {
+        // no translation necessary
+        frag.start = carve->start;
+        frag.stop = carve->stop;
+        pool_add_to_queue(fragments, &frag, 0);
+        return;
     }
-}
+    else {
+        curpos = positionUseCoverageBlockmap(state, carve->start, NULL);
+        curblock = curpos / state->coverageblocksize;
 
+        while (totalbytes < neededbytes && curblock < state->coveragenumblocks) {
 
-// initialize thread-related data structures for either GPU_THREADING or 
-// MULTICORE_THREADING models
-int init_threading_model(struct scalpelState *state) {
+            morebytes = 0;
+            bytestoskip = 0;
 
-    int i;
+            // skip covered blocks
+            while (curblock < state->coveragenumblocks &&
+                (state->coveragebitmap[curblock / 8] & (1 << (curblock % 8)))) {
+                    bytestoskip += state->coverageblocksize -
+                        (curpos + bytestoskip) % state->coverageblocksize;
+                    curblock++;
+            }
 
-#ifdef GPU_THREADING
+            curpos += bytestoskip;
 
-    printf("GPU-based threading model enabled.\n");
+            // accumulate uncovered blocks in fragment
+            while (curblock < state->coveragenumblocks &&
+                ((state->
+                coveragebitmap[curblock / 8] & (1 << (curblock % 8))) == 0)
+                && totalbytes + morebytes < neededbytes) {
 
-#endif
+                    morebytes += state->coverageblocksize -
+                        (curpos + morebytes) % state->coverageblocksize;
 
-#ifdef MULTICORE_THREADING
+                    curblock++;
+            }
 
-    printf("Multi-core CPU threading model enabled.\n");
-    printf("Initializing thread group data structures.\n");
+            // cap size
+            if(totalbytes + morebytes > neededbytes) {
+                morebytes = neededbytes - totalbytes;
+            }
 
-    // initialize global data structures for threads
-    searchthreads = (pthread_t *) malloc(state->specLines * sizeof(pthread_t));
-    checkMemoryAllocation(state, searchthreads, __LINE__, __FILE__,
-        "searchthreads");
-    threadargs =
-        (ThreadFindAllParams *) malloc(state->specLines *
-        sizeof(ThreadFindAllParams));
-    checkMemoryAllocation(state, threadargs, __LINE__, __FILE__, "args");
-    foundat = (char ***)malloc(state->specLines * sizeof(char *));
-    checkMemoryAllocation(state, foundat, __LINE__, __FILE__, "foundat");
-    foundatlens = (size_t **) malloc(state->specLines * sizeof(size_t));
-    checkMemoryAllocation(state, foundatlens, __LINE__, __FILE__, "foundatlens");
-    workavailable = (pthread_mutex_t *)malloc(state->specLines * sizeof(pthread_mutex_t));
+            frag.start = curpos;
+            curpos += morebytes;
+            frag.stop = curpos - 1;
+            totalbytes += morebytes;
 
-    checkMemoryAllocation(state, workavailable, __LINE__, __FILE__,
-        "workavailable");
-    workcomplete = (pthread_mutex_t *)malloc(state->specLines * sizeof(pthread_mutex_t));
+            pool_add_to_queue(fragments, &frag, 0);
+        }
+    }
+}
 
-    checkMemoryAllocation(state, workcomplete, __LINE__, __FILE__,
-        "workcomplete");
 
-    printf("Creating threads...\n");
-    for(i = 0; i < state->specLines; i++) {
-        foundat[i] = (char **)malloc((MAX_MATCHES_PER_BUFFER + 1) * sizeof(char *));
-        checkMemoryAllocation(state, foundat[i], __LINE__, __FILE__, "foundat");
-        foundatlens[i] = (size_t *) malloc(MAX_MATCHES_PER_BUFFER * sizeof(size_t));
-        checkMemoryAllocation(state, foundatlens[i], __LINE__, __FILE__,
-            "foundatlens");
-        foundat[i][MAX_MATCHES_PER_BUFFER] = 0;
+// coverage translation is needed if a coverage blockmap is used, the
+// image is restricted to a region list or known blocks are skipped
+static int useCoverageTranslation(struct scalpelState *state) {
 
-        // BUG:  NEED PROPER ERROR CODE/MESSAGE FOR MX CREATION FAILURE
-        if(pthread_mutex_init(&workavailable[i], 0)) {
-            //return SCALPEL_ERROR_PTHREAD_FAILURE;
-            std::string msg ("COULDN'T CREATE MUTEX\n");
-            fprintf(stderr, "%s", msg.c_str());
-            throw std::runtime_error(msg);
-        }
+    return state->useCoverageBlockmap || state->numregions > 0 ||
+        state->blockhashfile != NULL;
+}
 
-        pthread_mutex_lock(&workavailable[i]);
 
-        if(pthread_mutex_init(&workcomplete[i], 0)) {
-            std::string msg ("COULDN'T CREATE MUTEX\n");
-            fprintf(stderr, "%s", msg.c_str());
-            throw std::runtime_error(msg);
-        }		
+// mark blocks 'start' ... 'stop' - 1 covered in the coverage bitmap
+static void setCoverageBits(struct scalpelState *state,
+                            unsigned long long start,
+                            unsigned long long stop) {
 
-        // create a thread in the thread pool; thread will block on workavailable[] 
-        // semaphore until there's work to do
+    unsigned long long block;
 
-        // FIX:  NEED PROPER ERROR CODE/MESSAGE FOR THREAD CREATION FAILURE
-        threadargs[i].id = i;	// thread needs to read id before blocking
-        if(pthread_create
-            (&searchthreads[i], NULL, &threadedFindAll, &threadargs[i])) {
-                //return SCALPEL_ERROR_PTHREAD_FAILURE;
-                std::string msg ("COULDN'T CREATE THREAD\n");
-                fprintf(stderr, "%s", msg.c_str());
-                throw std::runtime_error(msg);
+    for(block = start; block < stop; block++) {
+        if(block % 8 == 0 && block + 8 <= stop) {
+            memset(state->coveragebitmap + block / 8, 0xFF, (stop - block) / 8);
+            block += (stop - block) / 8 * 8 - 1;
+            continue;
         }
+        state->coveragebitmap[block / 8] |= 1 << (block % 8);
     }
-    printf("Thread creation completed.\n");
+}
 
-#endif
 
-    return 0;
+// mark the blocks outside the region list covered in the coverage bitmap,
+// so that they're skipped by both passes.  A block partly inside a region
+// stays uncovered.  Regions past the end of the image are ignored.
+static void restrictCoverageToRegions(struct scalpelState *state) {
+
+    unsigned long long i, first, last, next = 0;
+    unsigned int bs = state->coverageblocksize;
+
+    for(i = 0; i < state->numregions &&
+        state->regions[i].offset / bs < state->coveragenumblocks; i++) {
+            first = state->regions[i].offset / bs;
+            last = (state->regions[i].offset + state->regions[i].length - 1) / bs;
+            if(first > next) {
+                setCoverageBits(state, next, first);
+            }
+            if(last + 1 > next) {
+                next = last + 1;
+            }
+    }
+    if(next < state->coveragenumblocks) {
+        setCoverageBits(state, next, state->coveragenumblocks);
+    }
+
+    if(state->modeVerbose) {
+        fprintf(stdout, "Restricted coverage bitmap to %"PRIu64 " regions.\n",
+            state->numregions);
+    }
 }
 
-void destroy_threading_model(struct scalpelState *state) {
 
-#ifdef MULTICORE_THREADING
-    for(int i = 0; i < state->specLines; i++) {
+// add bytes 'begin' ... 'end' - 1 of a buffer to its runs of blocks
+// not to search.  'value' is SKIPRUN_KNOWN for blocks found in the block
+// hash set, otherwise the byte value of constant blocks.
+static void addSkipRun(struct scalpelState *state, readbuf_info *rinfo,
+                       unsigned long long begin, unsigned long long end,
+                       int value) {
 
-        if (foundat) {
-            free(foundat[i]);
-            foundat[i]= NULL;
+    unsigned long long n = rinfo->numskipruns;
+
+    if(n > 0 && rinfo->skipruns[n - 1].end == begin &&
+        rinfo->skipruns[n - 1].value == value) {
+            rinfo->skipruns[n - 1].end = end;
+            return;
+    }
+
+    if(n == rinfo->skiprunsize) {
+        rinfo->skiprunsize = rinfo->skiprunsize ? rinfo->skiprunsize * 2 : 64;
+        rinfo->skipruns = (SkipRun *)realloc(rinfo->skipruns,
+            rinfo->skiprunsize * sizeof(SkipRun));
+        checkMemoryAllocation(state, rinfo->skipruns, __LINE__, __FILE__,
+            "skipruns");
+    }
+    rinfo->skipruns[n].begin = begin;
+    rinfo->skipruns[n].end = end;
+    rinfo->skipruns[n].value = value;
+    rinfo->numskipruns++;
+}
+
+
+// find the runs of blocks of a buffer read in pass 1 that the search
+// threads skip: blocks of one constant byte value, such as zeroed or
+// TRIMmed space, and blocks found in the block hash set, if any.  Known
+// blocks are recorded in state->coverageknown.  Called by the reader
+// thread, so this overlaps with the searches of earlier buffers; only
+// the reader thread touches state->coverageknown and
+// state->constantbytes until pass 1 is finished.  'counted' is the
+// position up to which constant blocks were counted, since buffers
+// overlap.
+static void findSkipRuns(struct scalpelState *state, readbuf_info *rinfo,
+                         unsigned long long *counted) {
+
+    unsigned int bs = state->coverageblocksize ? state->coverageblocksize :
+        SCALPEL_BLOCK_SIZE;
+    unsigned long long position = rinfo->beginreadpos, off, block = 0,
+        extent = 0;
+    const unsigned char *buf = (const unsigned char *)rinfo->readbuf;
+    int value;
+
+    rinfo->numskipruns = 0;
+    off = (bs - position % bs) % bs;
+
+    // the block holding the start of the buffer was hashed with an
+    // earlier buffer, if it was complete there
+    if(off > 0 && state->blockhashset) {
+        block = (positionUseCoverageBlockmap(state, position + 1, &extent) - 1) / bs;
+        if(state->coverageknown[block / 8] & (1 << (block % 8))) {
+            addSkipRun(state, rinfo, 0, off, SKIPRUN_KNOWN);
         }
+    }
 
-        if (foundatlens) {
-            free(foundatlens[i]);
-            foundatlens[i] = NULL;
+    for(; off + bs <= (unsigned long long)rinfo->bytesread; off += bs) {
+        if(state->blockhashset) {
+            block = (positionUseCoverageBlockmap(state, position + off + 1,
+                &extent) - 1) / bs;
+            if(state->coverageknown[block / 8] & (1 << (block % 8))) {
+                addSkipRun(state, rinfo, off, off + bs, SKIPRUN_KNOWN);
+                continue;
+            }
         }
 
-        if (workavailable) {
-            pthread_mutex_destroy(&workavailable[i]);
+        // constant blocks aren't put in block hash sets (see
+        // hashImageBlocks()), so they needn't be hashed
+        if((value = blockUniformValue(buf + off, bs)) >= 0) {
+            addSkipRun(state, rinfo, off, off + bs, value);
+            if(position + off >= *counted) {
+                state->constantbytes += bs;
+                *counted = position + off + bs;
+            }
+            continue;
+        }
+
+        if(state->blockhashset &&
+            blockHashSetContains(state->blockhashset, blockHash(buf + off, bs))) {
+                state->coverageknown[block / 8] |= 1 << (block % 8);
+                state->coverageknowncount++;
+                addSkipRun(state, rinfo, off, off + bs, SKIPRUN_KNOWN);
         }
-        if (workcomplete) {
-            pthread_mutex_destroy(&workcomplete[i]);
-        }        
     }
+}
 
-    if (workcomplete) {
-        free(workcomplete);
-        workcomplete = NULL;
+
+// translate the header/footer offsets in 'offsets' (count 'num') from
+// logical positions to actual image positions, dropping those that lie
+// in blocks found in the block hash set.  Returns the new count.
+static unsigned long long knownOffsetsToPositions(struct scalpelState *state,
+                                                  unsigned long long *offsets,
+                                                  size_t *lens,
+                                                  unsigned long long num) {
+
+    unsigned long long i, n = 0, pos, block, extent = 0;
+
+    for(i = 0; i < num; i++) {
+        pos = positionUseCoverageBlockmap(state, offsets[i] + 1, &extent) - 1;
+        block = pos / state->coverageblocksize;
+        if(state->coverageknown[block / 8] & (1 << (block % 8))) {
+            continue;
+        }
+        offsets[n] = pos;
+        lens[n] = lens[i];
+        n++;
     }
-    if (workavailable) {
-        free(workavailable);
-        workavailable = NULL;
+    return n;
+}
+
+
+// after pass 1, mark the blocks found in the block hash set covered in
+// the coverage bitmap, so that pass 2 never carves through them, and
+// move the header/footer offsets found in pass 1 to the new logical
+// positions.  Headers and footers in known blocks are dropped.  The
+// coverage blockmap updated with -m isn't affected.
+static void mergeKnownBlocks(struct scalpelState *state) {
+
+    struct SearchSpecLine *currentneedle;
+    SearchSpecOffsets *offsets;
+    unsigned long long i, numbytes = (state->coveragenumblocks + 7) / 8;
+    int needlenum;
+
+    if(!state->coverageknown || state->coverageknowncount == 0) {
+        return;
     }
 
-    if (foundatlens) {
-        free(foundatlens);
-        foundatlens = NULL;
+    fprintf(stdout,
+        "\n%"PRIu64 " blocks were found in the block hash set and are skipped.\n",
+        state->coverageknowncount);
+
+    for(needlenum = 0; needlenum < state->specLines; needlenum++) {
+        currentneedle = &(state->SearchSpec[needlenum]);
+        offsets = &(currentneedle->offsets);
+        offsets->numheaders = knownOffsetsToPositions(state, offsets->headers,
+            offsets->headerlens, offsets->numheaders);
+        offsets->numfooters = knownOffsetsToPositions(state, offsets->footers,
+            offsets->footerlens, offsets->numfooters);
     }
-    if (foundat) {
-        free(foundat);
-        foundat = NULL;
+
+    for(i = 0; i < numbytes; i++) {
+        state->coveragebitmap[i] |= state->coverageknown[i];
     }
-    if (threadargs) {
-        free(threadargs);
-        threadargs = NULL;
+    free(state->coveragerank);
+    free(state->coverageextents);
+    buildCoverageIndex(state);
+
+    for(needlenum = 0; needlenum < state->specLines; needlenum++) {
+        offsets = &(state->SearchSpec[needlenum].offsets);
+        for(i = 0; i < offsets->numheaders; i++) {
+            offsets->headers[i] = logicalUseCoverageBlockmap(state, offsets->headers[i]);
+        }
+        for(i = 0; i < offsets->numfooters; i++) {
+            offsets->footers[i] = logicalUseCoverageBlockmap(state, offsets->footers[i]);
+        }
     }
-    if (searchthreads) {
-        free (searchthreads);
-        searchthreads = NULL;
+}
+
+
+// # of bits set in each possible byte of the coverage bitmap
+#define B2(n) n, n + 1, n + 1, n + 2
+#define B4(n) B2(n), B2(n + 1), B2(n + 1), B2(n + 2)
+#define B6(n) B4(n), B4(n + 1), B4(n + 1), B4(n + 2)
+static const unsigned char bitsSetTable[256] = {
+    B6(0), B6(1), B6(1), B6(2)
+};
+#undef B2
+#undef B4
+#undef B6
+
+
+// build the rank table and extent list over the coverage bitmap.  The
+// bitmap doesn't change while an image file is processed, so this is
+// done once in setupCoverageMaps().  Bits past the last block must be
+// clear.
+static void buildCoverageIndex(struct scalpelState *state) {
+
+    unsigned long long numsuper =
+        state->coveragenumblocks / COVERAGE_RANK_BLOCKS + 1;
+    unsigned long long sb, k, end, covered = 0, n;
+    int pass, incovered;
+
+    state->coveragerank =
+        (unsigned long long *)malloc(numsuper * sizeof(unsigned long long));
+    checkMemoryAllocation(state, state->coveragerank, __LINE__, __FILE__,
+        "coveragerank");
+
+    for(sb = 0; sb < numsuper; sb++) {
+        state->coveragerank[sb] = covered;
+        end = (sb + 1) * COVERAGE_RANK_BLOCKS;
+        if(end > state->coveragenumblocks) {
+            end = state->coveragenumblocks;
+        }
+        for(k = sb * COVERAGE_RANK_BLOCKS / 8; k < (end + 7) / 8; k++) {
+            covered += bitsSetTable[state->coveragebitmap[k]];
+        }
+    }
+    state->coverageuncovered = state->coveragenumblocks - covered;
+
+    // count the runs of uncovered blocks, then record them.  Whole bytes
+    // that don't end the current run are skipped.
+    for(pass = 0; pass < 2; pass++) {
+        n = 0;
+        incovered = TRUE;
+        covered = 0;
+        for(k = 0; k < state->coveragenumblocks; k++) {
+            if(k % 8 == 0 && k + 8 <= state->coveragenumblocks &&
+                state->coveragebitmap[k / 8] == (incovered ? 0xFF : 0x00)) {
+                    covered += incovered ? 8 : 0;
+                    k += 7;
+                    continue;
+            }
+            if((state->coveragebitmap[k / 8] & (1 << (k % 8))) != 0) {
+                covered++;
+                incovered = TRUE;
+            }
+            else if(incovered) {
+                if(pass) {
+                    state->coverageextents[n].block = k;
+                    state->coverageextents[n].logical = k - covered;
+                }
+                n++;
+                incovered = FALSE;
+            }
+        }
+        if(!pass) {
+            state->coveragenumextents = n;
+            state->coverageextents =
+                (CoverageExtent *)malloc((n + 1) * sizeof(CoverageExtent));
+            checkMemoryAllocation(state, state->coverageextents, __LINE__,
+                __FILE__, "coverageextents");
+        }
     }
+    state->coverageextents[n].block = state->coveragenumblocks;
+    state->coverageextents[n].logical = state->coverageuncovered;
+}
 
-#endif
 
+// # of covered blocks before 'block'
+static unsigned long long coverageRank(struct scalpelState *state,
+                                       unsigned long long block) {
+
+    unsigned long long k, count;
+
+    if(block > state->coveragenumblocks) {
+        block = state->coveragenumblocks;
+    }
+
+    count = state->coveragerank[block / COVERAGE_RANK_BLOCKS];
+    for(k = block / COVERAGE_RANK_BLOCKS * COVERAGE_RANK_BLOCKS / 8;
+        k < block / 8; k++) {
+            count += bitsSetTable[state->coveragebitmap[k]];
+    }
+    if(block % 8) {
+        count += bitsSetTable[state->coveragebitmap[block / 8] &
+            ((1 << (block % 8)) - 1)];
+    }
+    return count;
 }
 
-// write header/footer database for current image file into the
-// Scalpel output directory. No information is written into the
-// database for file types without a suffix.  The filename used
-// is the current image filename with ".hfd" appended.  The 
-// format of the database file is straightforward:
-//
-// suffix_#1 (string)
+
+// find the run of uncovered blocks holding 'position', a position
+// that skips covered blocks, which must be before the end of the last
+// run.  'extent', if not NULL, is the run to try first and is set to
+// the run found, so that increasing positions are found without a
+// search.
+static unsigned long long findCoverageExtent(struct scalpelState *state,
+                                             unsigned long long position,
+                                             unsigned long long *extent) {
+
+    unsigned long long block = position / state->coverageblocksize;
+    unsigned long long lo = 0, hi = state->coveragenumextents - 1, mid;
+    CoverageExtent *extents = state->coverageextents;
+
+    if(extent && *extent < state->coveragenumextents) {
+        for(mid = *extent; mid < *extent + 2 && mid < state->coveragenumextents;
+            mid++) {
+                if(extents[mid].logical <= block && block < extents[mid + 1].logical) {
+                    *extent = mid;
+                    return mid;
+                }
+        }
+    }
+
+    // last run starting at or before 'block'
+    while (lo < hi) {
+        mid = lo + (hi - lo + 1) / 2;
+        if(extents[mid].logical <= block) {
+            lo = mid;
+        }
+        else {
+            hi = mid - 1;
+        }
+    }
+    if(extent) {
+        *extent = lo;
+    }
+    return lo;
+}
+
+
+// If the coverage blockmap is used to guide carving, then use the
+// coverage blockmap to map a logical index in the disk image (i.e.,
+// the index skips covered blocks) to an actual disk image index.  If
+// the coverage blockmap isn't being used, just returns the second
+// argument.  A logical index at the end of an uncovered block maps to
+// the end of that block, not to the start of the next uncovered block.
+// 'extent' is passed to findCoverageExtent().
+//
+// ***This function assumes that the 'position' does NOT lie
+// within a covered block! ***
+static unsigned long long
+    positionUseCoverageBlockmap(struct scalpelState *state,
+    unsigned long long position, unsigned long long *extent) {
+
+    unsigned long long e;
+
+    if(!useCoverageTranslation(state) || position == 0) {
+        return position;
+    }
+
+    if(position > state->coverageuncovered * state->coverageblocksize) {
+        // beyond the last uncovered block
+        return state->coveragenumblocks * state->coverageblocksize;
+    }
+
+    e = findCoverageExtent(state, position - 1, extent);
+    return position + (state->coverageextents[e].block -
+        state->coverageextents[e].logical) * state->coverageblocksize;
+}
+
+
+// the inverse of positionUseCoverageBlockmap(): map an actual disk
+// image index to a logical index that skips covered blocks.  An index
+// within a covered block maps to the logical index of the end of the
+// preceding uncovered block.
+static unsigned long long
+    logicalUseCoverageBlockmap(struct scalpelState *state,
+                               unsigned long long position) {
+
+    unsigned long long block = position / state->coverageblocksize;
+
+    if(!useCoverageTranslation(state)) {
+        return position;
+    }
+
+    if(block >= state->coveragenumblocks) {
+        return position - coverageRank(state, state->coveragenumblocks) *
+            state->coverageblocksize;
+    }
+
+    position -= coverageRank(state, block) * state->coverageblocksize;
+    if(state->coveragebitmap[block / 8] & (1 << (block % 8))) {
+        position -= position % state->coverageblocksize;
+    }
+    return position;
+}
+
+
+// the path of output file 'fn' relative to the output directory
+static const char *outputRelativePath(struct scalpelState *state,
+                                      const char *fn) {
+
+    size_t dirlen = strlen(state->outputdirectory);
+
+    if(!strncmp(fn, state->outputdirectory, dirlen) && fn[dirlen] == '/') {
+        return fn + dirlen + 1;
+    }
+    return fn;
+}
+
+
+// finish the digests of a carved file and, if identical carved files are
+// stored once (-x), look for an earlier carved file with the same
+// content.  Returns the earlier file, or NULL if the file is the first
+// with its content.
+static const CarvedContent *identifyCarvedFile(struct scalpelState *state,
+                                               struct CarveInfo *carve, char *fn,
+                                               char digests[SCALPEL_NUM_HASHES][SCALPEL_MAX_DIGEST_STRING]) {
+
+    if(carve->hash) {
+        finishCarveHash(state, carve->hash, digests);
+        carve->hash = NULL;
+    }
+    else {
+        memset(digests, 0, sizeof(char) * SCALPEL_NUM_HASHES * SCALPEL_MAX_DIGEST_STRING);
+    }
+
+    if(!state->dedupMode || !digests[2][0]) {
+        return NULL;
+    }
+    return findCarvedContent(state, carve, outputRelativePath(state, fn), digests[2]);
+}
+
+
+// store a carved file identical to the earlier carved file 'duplicate'
+// only once: make 'fn' a hardlink to it, or remove 'fn', depending on
+// state->dedupMode.  'fn' may not have been written yet.  In a pack, the
+// file's index entry refers to the earlier file's extent instead.
+// Returns FALSE if the copy must be kept, e.g. because the filesystem
+// refuses the link.
+static int storeDuplicateOnce(struct scalpelState *state,
+                              struct CarveInfo *carve, char *fn,
+                              const CarvedContent *duplicate) {
+
+    char path[MAX_STRING_LENGTH];
+
+    if(state->packOutput) {
+        carve->packsegment = duplicate->packsegment;
+        carve->packoffset = duplicate->packoffset;
+    }
+    else if(state->dedupMode == SCALPEL_DEDUP_DROP) {
+        if(unlink(fn) && errno != ENOENT) {
+            return FALSE;
+        }
+    }
+    else {
+        snprintf(path, MAX_STRING_LENGTH, "%s/%s", state->outputdirectory, duplicate->path);
+        if(replaceWithHardLink(path, fn)) {
+            if(state->modeVerbose) {
+                fprintf(stdout, "Can't link %s to %s -- %s\n", fn, path, strerror(errno));
+            }
+            return FALSE;
+        }
+    }
+    state->duplicatefiles++;
+    state->duplicatebytes += carve->stop - carve->start + 1;
+    return TRUE;
+}
+
+
+// write the manifest row of a carved file: its path in the output
+// directory, the image it was carved from, the image offset of its first
+// byte, its length, whether it was chopped, its digests and the earlier
+// carved file it duplicates, if any
+static void writeManifestEntry(struct scalpelState *state,
+                               struct CarveInfo *carve, char *fn,
+                               unsigned long long start,
+                               char digests[SCALPEL_NUM_HASHES][SCALPEL_MAX_DIGEST_STRING],
+                               const CarvedContent *duplicate) {
+
+    const char *image = scalpelInputGetId(state->inReader);
+    int i;
+
+    fprintf(state->manifestFile, "%s,\"", outputRelativePath(state, fn));
+    // quote the image id, which may hold commas
+    for(; *image; image++) {
+        if(*image == '"') {
+            fputc('"', state->manifestFile);
+        }
+        fputc(*image, state->manifestFile);
+    }
+#ifdef _WIN32
+    fprintf(state->manifestFile, "\",%I64u,%I64u,%d", start,
+        carve->stop - carve->start + 1, carve->chopped ? 1 : 0);
+#else
+    fprintf(state->manifestFile, "\",%llu,%llu,%d", start,
+        carve->stop - carve->start + 1, carve->chopped ? 1 : 0);
+#endif
+    for(i = 0; i < SCALPEL_NUM_HASHES; i++) {
+        if(state->hashAlgorithms & (1 << i)) {
+            fprintf(state->manifestFile, ",%s", digests[i]);
+        }
+    }
+    if(state->dedupMode) {
+        fprintf(state->manifestFile, ",%s", duplicate ? duplicate->path : "");
+    }
+    fprintf(state->manifestFile, "\n");
+    fflush(state->manifestFile);
+}
+
+
+// update the coverage blockmap for a carved file (if appropriate) and write entries into
+// the audit log describing the carved file.  If the file is fragmented, then multiple
+// lines are written to indicate where the fragments occur.  'digests' and 'duplicate'
+// are from identifyCarvedFile().
+static int
+    auditUpdateCoverageBlockmap(struct scalpelState *state,
+                                struct CarveInfo *carve,
+                                QueuePool *fragmentpool,
+                                char digests[SCALPEL_NUM_HASHES][SCALPEL_MAX_DIGEST_STRING],
+                                const CarvedContent *duplicate) {
+
+    PoolQueue fragments;
+    Fragment *frag;
+    char fn[MAX_STRING_LENGTH];	// output filename
+    int i, err;
+
+    // If the coverage blockmap used to guide carving, then carve->start and
+    // carve->stop may not correspond to addresses in the disk image--the coverage blockmap
+    // processing layer in Scalpel may have skipped "in use" blocks.  Transform carve->start
+    // and carve->stop into a list of fragments that contain real disk image offsets.
+    generateFragments(state, &fragments, fragmentpool, carve);
+
+    carveFilename(state, carve, fn);
+    if(state->pack && (err = writePackIndexEntry(state, carve, outputRelativePath(state, fn),
+        digests[2], &fragments)) != SCALPEL_OK) {
+            destroy_pool_queue(&fragments);
+            return err;
+    }
+
+    pool_rewind_queue(&fragments);
+    if(state->manifestFile) {
+        writeManifestEntry(state, carve, fn,
+            ((Fragment *) pool_pointer_to_current(&fragments))->start, digests,
+            duplicate);
+    }
+    while (!pool_end_of_queue(&fragments)) {
+        frag = (Fragment *) pool_pointer_to_current(&fragments);
+        fprintf(state->auditFile, "%s", base_name(fn));
+#ifdef _WIN32
+        fprintf(state->auditFile, "%13I64u\t\t", frag->start);
+#else
+        fprintf(state->auditFile, "%13llu\t\t", frag->start);
+#endif
+
+        fprintf(state->auditFile, "%3s", carve->chopped ? "YES   " : "NO    ");
+
+#ifdef _WIN32
+        fprintf(state->auditFile, "%13I64u\t\t", frag->stop - frag->start + 1);
+#else
+        fprintf(state->auditFile, "%13llu\t\t", frag->stop - frag->start + 1);
+#endif
+
+        fprintf(state->auditFile, "%s", base_name(scalpelInputGetId(state->inReader)));
+        for(i = 0; i < SCALPEL_NUM_HASHES; i++) {
+            if(state->hashAlgorithms & (1 << i)) {
+                fprintf(state->auditFile, "\t%s", digests[i]);
+            }
+        }
+        if(duplicate) {
+            fprintf(state->auditFile, "\tduplicate of %s", duplicate->path);
+        }
+        fprintf(state->auditFile, "\n");
+
+        fflush(state->auditFile);
+
+        // queue update of coverage blockmap, if appropriate
+        queueCoverageUpdate(state, frag->start / state->coverageblocksize,
+            frag->stop / state->coverageblocksize);
+        pool_next_element(&fragments);
+    }
+
+    destroy_pool_queue(&fragments);
+
+    return SCALPEL_OK;
+}
+
+
+// queue an update of the coverage blockmap for blocks 'start' ... 'stop'
+// of a carved file.  Updates are applied in batches by
+// applyCoverageUpdates(), so that the blockmap is swept in order once
+// rather than updated block by block as each carved file is closed.
+static void queueCoverageUpdate(struct scalpelState *state,
+                                unsigned long long start,
+                                unsigned long long stop) {
+
+    if(!state->updateCoverageBlockmap) {
+        return;
+    }
+
+    if(state->coveragenumupdates == state->coverageupdatesize) {
+        if(state->coverageupdatesize >= COVERAGE_UPDATE_BUDGET) {
+            applyCoverageUpdates(state);
+        }
+        else {
+            state->coverageupdatesize = state->coverageupdatesize ?
+                state->coverageupdatesize * 2 : COVERAGE_UPDATE_MIN_SIZE;
+            state->coverageupdates = (CoverageInterval *)
+                realloc(state->coverageupdates,
+                state->coverageupdatesize * sizeof(CoverageInterval));
+            checkMemoryAllocation(state, state->coverageupdates, __LINE__,
+                __FILE__, "coverageupdates");
+        }
+    }
+
+    state->coverageupdates[state->coveragenumupdates].start = start;
+    state->coverageupdates[state->coveragenumupdates].stop = stop;
+    state->coveragenumupdates++;
+}
+
+
+static int compareBlocks(const void *a, const void *b) {
+
+    unsigned long long blocka = *(const unsigned long long *)a;
+    unsigned long long blockb = *(const unsigned long long *)b;
+
+    return blocka < blockb ? -1 : (blocka > blockb ? 1 : 0);
+}
+
+
+// apply the queued coverage blockmap updates.  The interval starts and
+// ends are sorted and merged into segments of blocks covered by the same
+// # of queued intervals, and each segment is added to the blockmap in
+// block order.
+static void applyCoverageUpdates(struct scalpelState *state) {
+
+    unsigned long long *starts, *ends, n = state->coveragenumupdates, i = 0,
+        j = 0, depth = 0, block, segstart, segend, extra;
+    unsigned char *bits = state->coveragemapbits;
+
+    if(n == 0) {
+        return;
+    }
+
+    if(state->modeVerbose) {
+        fprintf(stdout, "Applying %"PRIu64 " coverage blockmap updates.\n", n);
+    }
+
+    // an interval covering blocks start ... stop adds one to the depth
+    // at 'start' and removes it at 'stop + 1'
+    starts = (unsigned long long *)malloc(2 * n * sizeof(unsigned long long));
+    checkMemoryAllocation(state, starts, __LINE__, __FILE__, "coverageupdates");
+    ends = starts + n;
+    for(i = 0; i < n; i++) {
+        starts[i] = state->coverageupdates[i].start;
+        ends[i] = state->coverageupdates[i].stop + 1;
+    }
+    qsort(starts, (size_t)n, sizeof(unsigned long long), compareBlocks);
+    qsort(ends, (size_t)n, sizeof(unsigned long long), compareBlocks);
+
+    i = 0;
+    segstart = starts[0];
+    while (j < n) {
+        // end of the current segment is the next change in depth
+        if(i < n && starts[i] <= ends[j]) {
+            segend = starts[i];
+        }
+        else {
+            segend = ends[j];
+        }
+
+        for(block = segstart; depth > 0 && block < segend &&
+            block < state->coveragenumblocks; block++) {
+                // whole bytes of uncovered blocks
+                if(depth == 1 && block % 8 == 0 && block + 8 <= segend &&
+                    block + 8 <= state->coveragenumblocks && bits[block / 8] == 0) {
+                        bits[block / 8] = 0xFF;
+                        block += 7;
+                        continue;
+                }
+                extra = depth;
+                if((bits[block / 8] & (1 << (block % 8))) == 0) {
+                    bits[block / 8] |= 1 << (block % 8);
+                    extra--;
+                }
+                if(extra) {
+                    findCoverageOverflow(state, block, TRUE)->count += extra;
+                }
+        }
+
+        // all intervals starting or ending at 'segend'
+        while (i < n && starts[i] == segend) {
+            depth++;
+            i++;
+        }
+        while (j < n && ends[j] == segend) {
+            depth--;
+            j++;
+        }
+        segstart = segend;
+    }
+
+    free(starts);
+    state->coveragenumupdates = 0;
+}
+
+
+// write the updated coverage blockmap, if necessary, and release the
+// coverage maps.  For a mapped blockmap, only the header and the
+// overflow counts remain to be written.
+static int destroyCoverageMaps(struct scalpelState *state) {
+
+    CoverageOverflow *entries = 0;
+    unsigned long long numoverflow;
+    int err = SCALPEL_OK;
+
+    if(state->coveragemapbits) {
+        applyCoverageUpdates(state);
+    }
+
+#ifndef _WIN32
+    if(state->coveragemapping) {
+        numoverflow = sortedCoverageOverflow(state, &entries);
+        ((CoverageBlockmapHeader *)state->coveragemapping)->numoverflow = numoverflow;
+        if(munmap(state->coveragemapping, state->coveragemappinglen) ||
+            fseeko(state->coverageblockmap, (off64_t)state->coveragemappinglen, SEEK_SET) ||
+            fwrite(entries, sizeof(CoverageOverflow), (size_t)numoverflow,
+            state->coverageblockmap) != numoverflow ||
+            fflush(state->coverageblockmap)) {
+                fprintf(stderr, "Error writing to coverage blockmap file: %s -- %s\n",
+                    state->coveragefile, strerror(errno));
+                fprintf(state->auditFile,
+                    "Error writing to coverage blockmap file: %s -- %s\n",
+                    state->coveragefile, strerror(errno));
+                err = SCALPEL_ERROR_FILE_WRITE;
+        }
+        state->coveragemapping = NULL;
+        state->coveragemapbits = NULL;
+        free(entries);
+    }
+#endif
+
+    if(state->coveragemapbits) {
+        err = writeCoverageBlockmap(state, state->coveragefile,
+            state->coveragemapbits);
+    }
+
+    discardCoverageMaps(state);
+    return err;
+}
+
+
+// release memory associated with coverage bitmap and blockmap, close
+// coverage blockmap file.  Updates not yet written are lost.
+static void discardCoverageMaps(struct scalpelState *state) {
+
+    if(state->coveragebitmap) {
+        free(state->coveragebitmap);
+        state->coveragebitmap = NULL;
+    }
+
+    if(state->coverageknown) {
+        free(state->coverageknown);
+        state->coverageknown = NULL;
+    }
+
+    if(state->coveragerank) {
+        free(state->coveragerank);
+        state->coveragerank = NULL;
+    }
+
+    if(state->coverageextents) {
+        free(state->coverageextents);
+        state->coverageextents = NULL;
+    }
+
+#ifndef _WIN32
+    if(state->coveragemapping) {
+        munmap(state->coveragemapping, state->coveragemappinglen);
+        state->coveragemapping = NULL;
+    }
+    else
+#endif
+    if(state->coveragemapbits) {
+        free(state->coveragemapbits);
+    }
+    state->coveragemapbits = NULL;
+
+    if(state->coverageoverflow) {
+        free(state->coverageoverflow);
+        state->coverageoverflow = NULL;
+    }
+    state->coverageoverflowsize = 0;
+    state->coverageoverflowused = 0;
+
+    if(state->coverageupdates) {
+        free(state->coverageupdates);
+        state->coverageupdates = NULL;
+    }
+    state->coveragenumupdates = 0;
+    state->coverageupdatesize = 0;
+
+    if(state->coverageblockmap) {
+        fclose(state->coverageblockmap);
+        state->coverageblockmap = NULL;
+    }
+}
+
+
+// simple wrapper for fseeko with SEEK_CUR semantics that uses the
+// coverage bitmap to skip over covered blocks, IF the coverage
+// blockmap is being used.  The offset is adjusted so that covered
+// blocks are silently skipped when seeking if the coverage blockmap
+// is used, otherwise an fseeko() with an umodified offset is
+// performed.
+static int
+fseeko_use_coverage_map(struct scalpelState *state, ScalpelInputReader * const inReader, off64_t offset) {
+
+    off64_t currentpos, logicalpos;
+
+    if(useCoverageTranslation(state)) {
+        currentpos = scalpelInputTello(inReader);
+        logicalpos = logicalUseCoverageBlockmap(state, currentpos) + offset;
+        if(logicalpos < 0) {
+            logicalpos = 0;
+        }
+        offset = positionUseCoverageBlockmap(state, logicalpos, NULL) - currentpos;
+    }
+
+    return scalpelInputSeeko(inReader, offset, SCALPEL_SEEK_CUR);
+}
+
+
+// simple wrapper for ftello() that uses the coverage bitmap to
+// report the current file position *minus* the contribution of
+// marked blocks, IF the coverage blockmap is being used.  If a
+// coverage blockmap isn't in use, just performs a standard ftello()
+// call.
+
+static off64_t ftello_use_coverage_map(struct scalpelState *state, ScalpelInputReader * const inReader) {
+
+    off64_t currentpos, decrease = 0;
+
+    currentpos = scalpelInputTello(inReader);
+
+    if(useCoverageTranslation(state)) {
+        // covered blocks don't contribute to current file position
+        decrease = currentpos - logicalUseCoverageBlockmap(state, currentpos);
+
+        if(state->modeVerbose) {
+            fprintf(stdout,
+                "Coverage map decreased current file position by %"PRIu64 " bytes.\n",
+                (unsigned long long)decrease);
+        }
+    }
+
+    return currentpos - decrease;
+}
+
+// simple wrapper for fread() that uses the coverage bitmap--the read silently
+// skips blocks that are marked covered (corresponding bit in coverage
+// bitmap is 1).  Each run of uncovered blocks in the extent list is read
+// with a single read.  'extent', if not NULL, is the run to try first
+// and is set to the run holding the first byte read, which is also the
+// place to start translating positions within the buffer.
+static size_t
+fread_use_coverage_map(struct scalpelState *state, void *ptr,
+                       size_t size, size_t nmemb, ScalpelInputReader * const inReader,
+                       unsigned long long *extent) {
+
+    unsigned long long neededbytes = nmemb * size, bytestoread,
+        bytesread, totalbytesread = 0, curpos, logicalpos, target, e, runend;
+    CoverageExtent *extents = state->coverageextents;
+    //  gettimeofday_t readnow, readthen;
+
+    //  gettimeofday(&readthen, 0);
+
+    if(useCoverageTranslation(state)) {
+        if(state->modeVerbose) {
+            fprintf(stdout,
+                "Issuing coverage map-based READ, wants %"PRIu64 " bytes.\n",
+                neededbytes);
+        }
+
+        curpos = scalpelInputTello(inReader);
+        logicalpos = logicalUseCoverageBlockmap(state, curpos);
+
+        if(logicalpos < state->coverageuncovered * state->coverageblocksize) {
+            e = findCoverageExtent(state, logicalpos, extent);
+
+            while (totalbytesread < neededbytes && e < state->coveragenumextents) {
+
+                // skip covered blocks
+                target = logicalpos + (extents[e].block - extents[e].logical) *
+                    state->coverageblocksize;
+                if(target != curpos) {
+                    if(state->modeVerbose) {
+                        fprintf(stdout,
+                            "fread using coverage map to skip %"PRIu64 " bytes.\n",
+                            target - curpos);
+                    }
+                    scalpelInputSeeko(inReader, (off64_t) (target - curpos),
+                        SCALPEL_SEEK_CUR);
+                    curpos = target;
+                }
+
+                // rest of the current run of uncovered blocks, capped
+                runend = extents[e + 1].logical * state->coverageblocksize;
+                bytestoread = runend - logicalpos;
+                if(totalbytesread + bytestoread > neededbytes) {
+                    bytestoread = neededbytes - totalbytesread;
+                }
+
+                if(state->modeVerbose) {
+                    fprintf(stdout,
+                        "fread using coverage map found %"PRIu64 " consecutive bytes.\n",
+                        bytestoread);
+                }
+
+                bytesread = scalpelInputRead(state->inReader,
+                    (char *)ptr + totalbytesread, 1, (size_t) bytestoread);
+
+                totalbytesread += bytesread;
+                curpos += bytesread;
+                logicalpos += bytesread;
+
+                if(state->modeVerbose) {
+                    fprintf(stdout, "fread using coverage map read %"PRIu64 " bytes.\n",
+                        bytesread);
+                }
+
+                if(bytesread < bytestoread) {
+                    break;
+                }
+                if(logicalpos == runend) {
+                    e++;
+                }
+            }
+        }
+
+        if(state->modeVerbose) {
+            fprintf(stdout, "Coverage map-based READ complete.\n");
+        }
+
+        // conform with fread() semantics by returning # of items read
+        return totalbytesread / size;
+    }
+    else {
+        size_t ret = scalpelInputRead(state->inReader, ptr, size, nmemb);
+        return ret;
+    }
+}
+
+#ifdef MULTICORE_THREADING
+
+// find the first of the runs 'skipruns[from]' ... that a search for
+// needle 'str' skips and set 'runend' to the end of the skipped part.
+// Matches can't start in known blocks.  In a run of constant byte c, a
+// match can only start in the last k bytes, where k is the length of
+// the needle's longest prefix matching c; runs the needle could match
+// entirely, and constant runs searched for regular expressions, aren't
+// skipped.
+static unsigned long long nextSkipRun(SkipRun *skipruns,
+                                      unsigned long long numskipruns,
+                                      unsigned long long from,
+                                      char *str, size_t length, int strisRE,
+                                      int casesensitive,
+                                      unsigned long long *runend) {
+
+    size_t k;
+
+    for(; from < numskipruns; from++) {
+        if(skipruns[from].value == SKIPRUN_KNOWN) {
+            *runend = skipruns[from].end;
+            return from;
+        }
+        if(strisRE) {
+            continue;
+        }
+        for(k = 0; k < length &&
+            charactersMatch(str[k], (char)skipruns[from].value, casesensitive); k++) {
+        }
+        if(k < length && skipruns[from].end - k > skipruns[from].begin) {
+            *runend = skipruns[from].end - k;
+            return from;
+        }
+    }
+    return from;
+}
+
+// threaded header/footer search
+static void *threadedFindAll(void *args) {
+
+    int id = ((ThreadFindAllParams *) args)->id;
+    char *str;
+    size_t length;
+    char *startpos;
+    long offset;
+    char **foundat;
+    size_t *foundatlens;
+    size_t *table = 0;
+    regex_t *regexp = 0;
+    int strisRE;
+    int casesensitive;
+    int nosearchoverlap;
+    SkipRun *skipruns;
+    unsigned long long numskipruns, run, runend = 0;
+    long skipoverlap, segend;
+    char *base;
+    struct scalpelState *state;
+
+    regmatch_t *match;
+
+    // wait for work
+    //  sem_wait(&workavailable[id]);
+
+    // you need to be holding the workcomplete mutex initially
+    pthread_mutex_lock(&workcomplete[id]);
+    pthread_mutex_lock(&workavailable[id]);
+
+    while (1) {
+        // woken by destroy_threading_model() rather than for work
+        if(searchshutdown) {
+            pthread_mutex_unlock(&workavailable[id]);
+            break;
+        }
+
+        // get args that define current workload
+        str = ((ThreadFindAllParams *) args)->str;
+        length = ((ThreadFindAllParams *) args)->length;
+        startpos = ((ThreadFindAllParams *) args)->startpos;
+        offset = ((ThreadFindAllParams *) args)->offset;
+        foundat = ((ThreadFindAllParams *) args)->foundat;
+        foundatlens = ((ThreadFindAllParams *) args)->foundatlens;
+        strisRE = ((ThreadFindAllParams *) args)->strisRE;
+        if(strisRE) {
+            regexp = ((ThreadFindAllParams *) args)->regex;
+        }
+        else {
+            table = ((ThreadFindAllParams *) args)->table;
+        }
+        casesensitive = ((ThreadFindAllParams *) args)->casesensitive;
+        nosearchoverlap = ((ThreadFindAllParams *) args)->nosearchoverlap;
+        skipruns = ((ThreadFindAllParams *) args)->skipruns;
+        numskipruns = ((ThreadFindAllParams *) args)->numskipruns;
+        skipoverlap = ((ThreadFindAllParams *) args)->skipoverlap;
+        state = ((ThreadFindAllParams *) args)->state;
+
+        if(state->modeVerbose) {
+            printf("needle search thread # %d awake.\n", id);
+        }
+
+        base = startpos;
+        run = nextSkipRun(skipruns, numskipruns, 0, str, length, strisRE,
+            casesensitive, &runend);
+        while (startpos) {
+            // runs of known or constant blocks aren't searched.  A match
+            // must start before the next run, but may extend into it.
+            while (run < numskipruns && startpos >= base + skipruns[run].begin) {
+                if(startpos < base + runend) {
+                    startpos = base + runend;
+                }
+                run = nextSkipRun(skipruns, numskipruns, run + 1, str, length,
+                    strisRE, casesensitive, &runend);
+            }
+            segend = offset;
+            if(run < numskipruns &&
+                (long)(base + skipruns[run].begin) + skipoverlap < offset) {
+                    segend = (long)(base + skipruns[run].begin) + skipoverlap;
+            }
+            if((long)startpos >= offset) {
+                break;
+            }
+
+            if(!strisRE) {
+                startpos = bm_needleinhaystack(str,
+                    length,
+                    startpos,
+                    segend - (long)startpos,
+                    table, casesensitive);
+            }
+            else {
+                //printf("Before regexp search, startpos = %p\n", startpos);
+                match = re_needleinhaystack(regexp, startpos, segend - (long)startpos);
+                if(!match) {
+                    startpos = 0;
+                }
+                else {
+                    startpos = match->rm_so + startpos;
+                    length = match->rm_eo - match->rm_so;
+                    free(match);
+                    match = NULL;
+                    //printf("After regexp search, startpos = %p\n", startpos);
+                }
+            }
+
+            // nothing found before the next run, or the match starts
+            // in it--continue after the skipped part of the run
+            if(run < numskipruns &&
+                (!startpos || startpos >= base + skipruns[run].begin)) {
+                    startpos = base + runend;
+                    run = nextSkipRun(skipruns, numskipruns, run + 1, str,
+                        length, strisRE, casesensitive, &runend);
+                    continue;
+            }
+
+            if(startpos) {
+                // remember match location
+                foundat[(long)(foundat[MAX_MATCHES_PER_BUFFER])] = startpos;
+                foundatlens[(long)(foundat[MAX_MATCHES_PER_BUFFER])] = length;
+                foundat[MAX_MATCHES_PER_BUFFER]++;
+
+                // move past match position.  Foremost 0.69 didn't find overlapping
+                // headers/footers.  If you need that behavior, specify "-r" on the
+                // command line.  Scalpel's default behavior is to find overlapping
+                // headers/footers.
+
+                if(nosearchoverlap) {
+                    startpos += length;
+                }
+                else {
+                    startpos++;
+                }
+            }
+        }
+
+        if(state->modeVerbose) {
+            printf("needle search thread # %d asleep.\n", id);
+        }
+
+        // signal completion of work
+        //    sem_post(&workcomplete[id]);
+        pthread_mutex_unlock(&workcomplete[id]);
+
+        // wait for more work
+        //    sem_wait(&workavailable[id]);
+        pthread_mutex_lock(&workavailable[id]);
+
+    }
+
+    return 0;
+
+}
+
+#endif
+
+
+// Buffers for reading image in and holding gpu results.
+// The ourCudaMallocHost call MUST be executed by the 
+// gpu_handler thread.
+void init_store() {
+
+    // 3 queues:
+    //              inque filled by reader, emptied by gpu_handler
+    //              outque filled by gpu_handler, emptied by host thread
+    //              freequeue filled by host, emptied by reader
+
+    // the queues hold pointers to full and empty SIZE_OF_BUFFER read buffers 
+    full_readbuf = syncqueue_init("full_readbuf", QUEUELEN);
+    empty_readbuf = syncqueue_init("empty_readbuf", QUEUELEN);
+#ifdef GPU_THREADING
+    results_readbuf = syncqueue_init("results_readbuf", QUEUELEN);
+#endif
+
+    // backing store of actual buffers pointed to above, along with some  
+    // necessary bookeeping info
+    //readbuf_info *readbuf_store;
+    if((readbuf_store =
+        (readbuf_info *)malloc(QUEUELEN * sizeof(readbuf_info))) == 0) {
+            fprintf(stderr, (char *)"malloc %lu failed in streaming reader\n",
+                (unsigned long)QUEUELEN * sizeof(readbuf_info));
+    }
+
+    // initialization
+    int g;
+    for(g = 0; g < QUEUELEN; g++) {
+        readbuf_store[g].bytesread = 0;
+        readbuf_store[g].beginreadpos = 0;
+        readbuf_store[g].skipruns = NULL;
+        readbuf_store[g].numskipruns = 0;
+        readbuf_store[g].skiprunsize = 0;
+
+        // for fast gpu operation we need to use the CUDA pinned-memory allocations
+#ifdef GPU_THREADING
+        ourCudaMallocHost((void **)&(readbuf_store[g].readbuf), SIZE_OF_BUFFER);
+#else
+        readbuf_store[g].readbuf = (char *)malloc(SIZE_OF_BUFFER);
+#endif
+
+        // put pointer to empty but initialized readbuf in the empty que        
+        put(empty_readbuf, (void *)(&readbuf_store[g]));
+    }
+}
+
+
+//free storage initialized in init_store()
+void destroyStore() {
+    if (full_readbuf) {
+        syncqueue_destroy(full_readbuf);
+        full_readbuf = NULL;
+    }
+
+    if (empty_readbuf) {
+        syncqueue_destroy(empty_readbuf);
+        empty_readbuf = NULL;
+    }
+
+    if (readbuf_store) {
+        for(int g = 0; g < QUEUELEN; g++) {
+
+#ifdef GPU_THREADING
+            //TODO free this ourCudaMallocHost((void **)&(readbuf_store[g].readbuf), SIZE_OF_BUFFER);
+#else
+            free(readbuf_store[g].readbuf);
+            readbuf_store[g].readbuf = NULL;
+#endif
+            free(readbuf_store[g].skipruns);
+            readbuf_store[g].skipruns = NULL;
+        }
+        free(readbuf_store);
+        readbuf_store = NULL;
+    }
+}
+
+
+// initialize thread-related data structures for either GPU_THREADING or 
+// MULTICORE_THREADING models
+int init_threading_model(struct scalpelState *state) {
+
+    int i;
+
+#ifdef GPU_THREADING
+
+    printf("GPU-based threading model enabled.\n");
+
+#endif
+
+#ifdef MULTICORE_THREADING
+
+    printf("Multi-core CPU threading model enabled.\n");
+    printf("Initializing thread group data structures.\n");
+
+    // initialize global data structures for threads
+    searchthreads = (pthread_t *) malloc(state->specLines * sizeof(pthread_t));
+    checkMemoryAllocation(state, searchthreads, __LINE__, __FILE__,
+        "searchthreads");
+    threadargs =
+        (ThreadFindAllParams *) malloc(state->specLines *
+        sizeof(ThreadFindAllParams));
+    checkMemoryAllocation(state, threadargs, __LINE__, __FILE__, "args");
+    foundat = (char ***)malloc(state->specLines * sizeof(char *));
+    checkMemoryAllocation(state, foundat, __LINE__, __FILE__, "foundat");
+    foundatlens = (size_t **) malloc(state->specLines * sizeof(size_t));
+    checkMemoryAllocation(state, foundatlens, __LINE__, __FILE__, "foundatlens");
+    numsearchthreads = 0;
+    searchshutdown = 0;
+    workavailable = (pthread_mutex_t *)malloc(state->specLines * sizeof(pthread_mutex_t));
+
+    checkMemoryAllocation(state, workavailable, __LINE__, __FILE__,
+        "workavailable");
+    workcomplete = (pthread_mutex_t *)malloc(state->specLines * sizeof(pthread_mutex_t));
+
+    checkMemoryAllocation(state, workcomplete, __LINE__, __FILE__,
+        "workcomplete");
+
+    printf("Creating threads...\n");
+    for(i = 0; i < state->specLines; i++) {
+        foundat[i] = (char **)malloc((MAX_MATCHES_PER_BUFFER + 1) * sizeof(char *));
+        checkMemoryAllocation(state, foundat[i], __LINE__, __FILE__, "foundat");
+        foundatlens[i] = (size_t *) malloc(MAX_MATCHES_PER_BUFFER * sizeof(size_t));
+        checkMemoryAllocation(state, foundatlens[i], __LINE__, __FILE__,
+            "foundatlens");
+        foundat[i][MAX_MATCHES_PER_BUFFER] = 0;
+
+        // BUG:  NEED PROPER ERROR CODE/MESSAGE FOR MX CREATION FAILURE
+        if(pthread_mutex_init(&workavailable[i], 0)) {
+            //return SCALPEL_ERROR_PTHREAD_FAILURE;
+            std::string msg ("COULDN'T CREATE MUTEX\n");
+            fprintf(stderr, "%s", msg.c_str());
+            throw std::runtime_error(msg);
+        }
+
+        pthread_mutex_lock(&workavailable[i]);
+
+        if(pthread_mutex_init(&workcomplete[i], 0)) {
+            std::string msg ("COULDN'T CREATE MUTEX\n");
+            fprintf(stderr, "%s", msg.c_str());
+            throw std::runtime_error(msg);
+        }		
+
+        // create a thread in the thread pool; thread will block on workavailable[] 
+        // semaphore until there's work to do
+
+        // FIX:  NEED PROPER ERROR CODE/MESSAGE FOR THREAD CREATION FAILURE
+        threadargs[i].id = i;	// thread needs to read id before blocking
+        if(pthread_create
+            (&searchthreads[i], NULL, &threadedFindAll, &threadargs[i])) {
+                //return SCALPEL_ERROR_PTHREAD_FAILURE;
+                std::string msg ("COULDN'T CREATE THREAD\n");
+                fprintf(stderr, "%s", msg.c_str());
+                throw std::runtime_error(msg);
+        }
+        numsearchthreads++;
+    }
+    printf("Thread creation completed.\n");
+
+#endif
+
+    return 0;
+}
+
+void destroy_threading_model(struct scalpelState *state) {
+
+#ifdef MULTICORE_THREADING
+    // a search thread may still be on its way back to wait on workavailable
+    // after signalling workcomplete, so wake each one and wait for it to exit
+    // before its mutexes are destroyed
+    searchshutdown = 1;
+    for(int i = 0; i < numsearchthreads; i++) {
+        pthread_mutex_unlock(&workavailable[i]);
+        pthread_join(searchthreads[i], NULL);
+    }
+    numsearchthreads = 0;
+
+    for(int i = 0; i < state->specLines; i++) {
+
+        if (foundat) {
+            free(foundat[i]);
+            foundat[i]= NULL;
+        }
+
+        if (foundatlens) {
+            free(foundatlens[i]);
+            foundatlens[i] = NULL;
+        }
+
+        if (workavailable) {
+            pthread_mutex_destroy(&workavailable[i]);
+        }
+        if (workcomplete) {
+            pthread_mutex_destroy(&workcomplete[i]);
+        }        
+    }
+
+    if (workcomplete) {
+        free(workcomplete);
+        workcomplete = NULL;
+    }
+    if (workavailable) {
+        free(workavailable);
+        workavailable = NULL;
+    }
+
+    if (foundatlens) {
+        free(foundatlens);
+        foundatlens = NULL;
+    }
+    if (foundat) {
+        free(foundat);
+        foundat = NULL;
+    }
+    if (threadargs) {
+        free(threadargs);
+        threadargs = NULL;
+    }
+    if (searchthreads) {
+        free (searchthreads);
+        searchthreads = NULL;
+    }
+
+#endif
+
+}
+
+// FNV-1a hash over a block of bytes, used to fingerprint search spec
+// lines in the header/footer database.
+static unsigned long long fnv1aHash(unsigned long long hash,
+                                    const void *data, size_t len) {
+
+    const unsigned char *p = (const unsigned char *)data;
+    size_t i;
+
+    for(i = 0; i < len; i++) {
+        hash ^= p[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+// compute a fingerprint for a search spec line which covers everything
+// that determines the set of headers and footers discovered in pass 1:
+// suffix, case sensitivity, header/footer patterns (and whether they're
+// regular expressions), the wildcard character and the -r option.
+// Max/min carve sizes and the search type only affect carving, so
+// changing them doesn't invalidate stored offsets.
+static unsigned long long fingerprintSearchSpecLine(struct scalpelState *state,
+                                                    struct SearchSpecLine *s) {
+
+    unsigned long long hash = 0xcbf29ce484222325ULL;
+
+    hash = fnv1aHash(hash, s->suffix, strlen(s->suffix) + 1);
+    hash = fnv1aHash(hash, &(s->casesensitive), sizeof(s->casesensitive));
+    hash = fnv1aHash(hash, &(s->beginisRE), sizeof(s->beginisRE));
+    hash = fnv1aHash(hash, &(s->beginlength), sizeof(s->beginlength));
+    hash = fnv1aHash(hash, s->begin, s->beginlength);
+    hash = fnv1aHash(hash, &(s->endisRE), sizeof(s->endisRE));
+    hash = fnv1aHash(hash, &(s->endlength), sizeof(s->endlength));
+    hash = fnv1aHash(hash, s->end, s->endlength);
+    hash = fnv1aHash(hash, &wildcard, sizeof(wildcard));
+    hash = fnv1aHash(hash, &(state->noSearchOverlap),
+        sizeof(state->noSearchOverlap));
+    return hash;
+}
+
+// write header/footer database for current image file into the
+// Scalpel output directory.  The filename used is the current image
+// filename with ".hfd" appended.  The format of the database file is
+// straightforward:
+//
+// scalpel-hfd version image_size skip (string, int, 2 x unsigned long long)
+// suffix_#1 (string, "NONE" for file types without a suffix)
+// fingerprint_#1 (unsigned long long, hex)
 // number_of_headers (unsigned long long)
 // header_pos_#1 (unsigned long long)
 // header_pos_#2 (unsigned long long) 
@@ -2823,6 +5028,7 @@ void destroy_threading_model(struct scalpelState *state) {
 // footer_pos_#2 (unsigned long long) 
 // ...
 // suffix_#2 (string)
+// fingerprint_#2 (unsigned long long, hex)
 // number_of_headers (unsigned long long)
 // header_pos_#1 (unsigned long long)
 // header_pos_#2 (unsigned long long) 
@@ -2833,113 +5039,1100 @@ void destroy_threading_model(struct scalpelState *state) {
 // ...
 // ...
 //
-// If state->useCoverageBlockmap, then translation is required to
-// produce real disk image addresses for the generated header/footer
-// database file, because the Scalpel carving engine isn't aware of
-// gaps created by blocks that are covered by previously carved files.
+// The fingerprint identifies the search spec line (see
+// fingerprintSearchSpecLine()) that produced the offsets, so that a
+// later run with -D can reuse offsets for unchanged file types and
+// search only for new or modified ones.
+//
+// If a coverage blockmap or region list is used, then translation is
+// required to produce real disk image addresses for the generated
+// header/footer database file, because the Scalpel carving engine isn't
+// aware of gaps created by blocks that are covered by previously carved
+// files or that lie outside the regions.
+
+static int writeHeaderFooterDatabase(struct scalpelState *state,
+                                     unsigned long long filesize) {
+
+    FILE *dbfile;
+    char fn[MAX_STRING_LENGTH];	// filename for header/footer database
+    int needlenum;
+    struct SearchSpecLine *currentneedle;
+    unsigned long long i, extent = 0;
+
+    // generate unique name for header/footer database
+    snprintf(fn, MAX_STRING_LENGTH, "%s/%s.hfd",
+        state->outputdirectory, base_name(scalpelInputGetId(state->inReader)));
+
+    if((dbfile = fopen(fn, "w")) == NULL) {
+        fprintf(stderr, "Error writing to header/footer database file: %s\n", fn);
+        fprintf(state->auditFile,
+            "Error writing to header/footer database file: %s\n", fn);
+        return SCALPEL_ERROR_FILE_WRITE;
+    }
+
+#ifdef _WIN32
+    // set binary mode for Win32
+    setmode(fileno(dbfile), O_BINARY);
+#endif
+#ifdef __linux
+    fcntl(fileno(dbfile), F_SETFL, O_LARGEFILE);
+#endif
+
+    // version, image size, skip and a fingerprint of the image's contents
+    // identify the image the offsets belong to
+    if(fprintf(dbfile, "%s %d %"PRIu64 " %"PRIu64 " %016llx\n",
+        SCALPEL_HFD_MAGIC, SCALPEL_HFD_VERSION, filesize, state->skip,
+        state->imageFingerprint) <= 0) {
+            fprintf(stderr,
+                "Error writing to header/footer database file: %s\n", fn);
+            fprintf(state->auditFile,
+                "Error writing to header/footer database file: %s\n", fn);
+            fclose(dbfile);
+            return SCALPEL_ERROR_FILE_WRITE;
+    }
+
+    for(needlenum = 0; needlenum < state->specLines; needlenum++) {
+        currentneedle = &(state->SearchSpec[needlenum]);
+
+        // output current suffix and fingerprint
+        if(fprintf(dbfile, "%s\n%016llx\n",
+            currentneedle->suffix[0] == SCALPEL_NOEXTENSION ?
+            SCALPEL_NOEXTENSION_SUFFIX : currentneedle->suffix,
+            fingerprintSearchSpecLine(state, currentneedle)) <= 0) {
+                fprintf(stderr,
+                    "Error writing to header/footer database file: %s\n", fn);
+                fprintf(state->auditFile,
+                    "Error writing to header/footer database file: %s\n", fn);
+                fclose(dbfile);
+                return SCALPEL_ERROR_FILE_WRITE;
+        }
+
+        // # of headers
+        if(fprintf(dbfile, "%"PRIu64 "\n", currentneedle->offsets.numheaders)
+            <= 0) {
+
+                fprintf(stderr,
+                    "Error writing to header/footer database file: %s\n", fn);
+                fprintf(state->auditFile,
+                    "Error writing to header/footer database file: %s\n", fn);
+                fclose(dbfile);
+                return SCALPEL_ERROR_FILE_WRITE;
+        }
+
+        // all header positions for current suffix
+        for(i = 0; i < currentneedle->offsets.numheaders; i++) {
+#ifdef _WIN32
+            if(fprintf
+                (dbfile, "%"PRIu64 "\n",
+                positionUseCoverageBlockmap(state,
+                currentneedle->offsets.
+                headers[i], &extent)) <= 0) {
+#else
+            if(fprintf
+                (dbfile, "%llu\n",
+                positionUseCoverageBlockmap(state,
+                currentneedle->offsets.
+                headers[i], &extent)) <= 0) {
+#endif
+                    fprintf(stderr,
+                        "Error writing to header/footer database file: %s\n", fn);
+                    fprintf(state->auditFile,
+                        "Error writing to header/footer database file: %s\n", fn);
+                    fclose(dbfile);
+                    return SCALPEL_ERROR_FILE_WRITE;
+            }
+        }
+
+        // # of footers
+        if(fprintf(dbfile, "%"PRIu64 "\n", currentneedle->offsets.numfooters)
+            <= 0) {
+                fprintf(stderr,
+                    "Error writing to header/footer database file: %s\n", fn);
+                fprintf(state->auditFile,
+                    "Error writing to header/footer database file: %s\n", fn);
+                fclose(dbfile);
+                return SCALPEL_ERROR_FILE_WRITE;
+        }
+
+        // all footer positions for current suffix
+        for(i = 0; i < currentneedle->offsets.numfooters; i++) {
+            if(fprintf
+                (dbfile, "%"PRIu64 "\n",
+                positionUseCoverageBlockmap(state,
+                currentneedle->offsets.
+                footers[i], &extent)) <= 0) {
+
+                    fprintf(stderr,
+                        "Error writing to header/footer database file: %s\n", fn);
+                    fprintf(state->auditFile,
+                        "Error writing to header/footer database file: %s\n", fn);
+                    fclose(dbfile);
+                    return SCALPEL_ERROR_FILE_WRITE;
+            }
+        }
+    }
+    fclose(dbfile);
+    return SCALPEL_OK;
+}
+
+// fingerprint the contents of the current image file, so that a
+// header/footer database isn't reused for a different image of the same
+// size.  Only SCALPEL_HFD_SAMPLES samples spread evenly across the image
+// are hashed, which is cheap enough to do before pass 1.  The image's
+// read position is left unchanged.
+static int fingerprintImage(struct scalpelState *state,
+                            unsigned long long filesize) {
+
+    unsigned char *samples;
+    unsigned long long position, samplesize, offset;
+    size_t total = 0;
+    int i, bytesread;
+
+    samples = (unsigned char *)
+        malloc(SCALPEL_HFD_SAMPLES * SCALPEL_HFD_SAMPLE_SIZE);
+    checkMemoryAllocation(state, samples, __LINE__, __FILE__,
+        "image fingerprint samples");
+
+    samplesize = filesize < SCALPEL_HFD_SAMPLE_SIZE ?
+        filesize : SCALPEL_HFD_SAMPLE_SIZE;
+    position = scalpelInputTello(state->inReader);
+
+    for(i = 0; i < SCALPEL_HFD_SAMPLES; i++) {
+        offset = (filesize - samplesize) * i / (SCALPEL_HFD_SAMPLES - 1);
+        if(scalpelInputSeeko(state->inReader, offset, SCALPEL_SEEK_SET) != 0 ||
+            (bytesread = scalpelInputRead(state->inReader, samples + total, 1,
+            samplesize)) < 0) {
+                free(samples);
+                return SCALPEL_ERROR_FILE_READ;
+        }
+        total += bytesread;
+    }
+
+    state->imageFingerprint = blockHash(samples, total);
+    free(samples);
+
+    if(scalpelInputSeeko(state->inReader, position, SCALPEL_SEEK_SET) != 0) {
+        return SCALPEL_ERROR_FILE_READ;
+    }
+    return SCALPEL_OK;
+}
+
+// read one line of a header/footer database and convert it to an
+// unsigned long long in the specified base.  Returns FALSE on EOF or
+// a malformed line.
+static int readHeaderFooterDatabaseValue(FILE *dbfile,
+                                         unsigned long long *value,
+                                         int base) {
+
+    char line[MAX_STRING_LENGTH];
+    char *endptr;
+
+    if(fgets(line, MAX_STRING_LENGTH, dbfile) == NULL) {
+        return FALSE;
+    }
+    *value = strtoull(line, &endptr, base);
+    return endptr != line && (*endptr == '\n' || *endptr == '\0');
+}
+
+// read an array of 'count' offsets from a header/footer database.
+// Offsets are written in ascending order and must lie within the image.
+// Returns NULL on a malformed database.
+static unsigned long long *readHeaderFooterDatabaseOffsets(struct scalpelState *state,
+                                                           FILE *dbfile,
+                                                           unsigned long long count,
+                                                           unsigned long long filesize) {
+
+    unsigned long long *offsets;
+    unsigned long long i;
+
+    offsets = (unsigned long long *)
+        malloc(sizeof(unsigned long long) * (count > 0 ? count : 1));
+    checkMemoryAllocation(state, offsets, __LINE__, __FILE__,
+        "header/footer database offsets");
+
+    for(i = 0; i < count; i++) {
+        if(!readHeaderFooterDatabaseValue(dbfile, &offsets[i], 10) ||
+            offsets[i] >= filesize || (i > 0 && offsets[i] < offsets[i - 1])) {
+            free(offsets);
+            return NULL;
+        }
+    }
+    return offsets;
+}
+
+// attach offsets loaded from a header/footer database to a search spec
+// line, which then needn't be searched for during pass 1.
+static void preloadOffsets(struct scalpelState *state,
+                           struct SearchSpecLine *currentneedle,
+                           unsigned long long *headers,
+                           unsigned long long numheaders,
+                           unsigned long long *footers,
+                           unsigned long long numfooters) {
+
+    unsigned long long i;
+
+    if(currentneedle->offsets.headers) {
+        free(currentneedle->offsets.headers);
+    }
+    if(currentneedle->offsets.headerlens) {
+        free(currentneedle->offsets.headerlens);
+    }
+    if(currentneedle->offsets.footers) {
+        free(currentneedle->offsets.footers);
+    }
+    if(currentneedle->offsets.footerlens) {
+        free(currentneedle->offsets.footerlens);
+    }
+
+    // match lengths aren't stored in the database; for regular
+    // expressions they're unknown and recorded as 0
+    currentneedle->offsets.headerlens = (size_t *)
+        malloc(sizeof(size_t) * (numheaders > 0 ? numheaders : 1));
+    checkMemoryAllocation(state, currentneedle->offsets.headerlens,
+        __LINE__, __FILE__, "header array");
+    for(i = 0; i < numheaders; i++) {
+        currentneedle->offsets.headerlens[i] =
+            currentneedle->beginisRE ? 0 : currentneedle->beginlength;
+    }
+    currentneedle->offsets.footerlens = (size_t *)
+        malloc(sizeof(size_t) * (numfooters > 0 ? numfooters : 1));
+    checkMemoryAllocation(state, currentneedle->offsets.footerlens,
+        __LINE__, __FILE__, "footer array");
+    for(i = 0; i < numfooters; i++) {
+        currentneedle->offsets.footerlens[i] =
+            currentneedle->endisRE ? 0 : currentneedle->endlength;
+    }
+
+    currentneedle->offsets.headers = headers;
+    currentneedle->offsets.numheaders = numheaders;
+    currentneedle->offsets.headerstorage = numheaders > 0 ? numheaders : 1;
+    currentneedle->offsets.footers = footers;
+    currentneedle->offsets.numfooters = numfooters;
+    currentneedle->offsets.footerstorage = numfooters > 0 ? numfooters : 1;
+    currentneedle->offsetsPreloaded = TRUE;
+}
+
+// throw away any offsets loaded from a header/footer database, e.g.,
+// because the database turned out to be damaged.
+static void discardPreloadedOffsets(struct scalpelState *state) {
+
+    int needlenum;
+    struct SearchSpecLine *currentneedle;
+
+    for(needlenum = 0; needlenum < state->specLines; needlenum++) {
+        currentneedle = &(state->SearchSpec[needlenum]);
+        if(currentneedle->offsetsPreloaded) {
+            free(currentneedle->offsets.headers);
+            currentneedle->offsets.headers = NULL;
+            free(currentneedle->offsets.footers);
+            currentneedle->offsets.footers = NULL;
+            currentneedle->offsets.numheaders = 0;
+            currentneedle->offsets.numfooters = 0;
+            currentneedle->offsets.headerstorage = 0;
+            currentneedle->offsets.footerstorage = 0;
+            currentneedle->offsetsPreloaded = FALSE;
+        }
+    }
+}
+
+// load the header/footer database written for the current image file by
+// a previous run with -d (see writeHeaderFooterDatabase()) from
+// state->headerFooterDatabaseDir.  Each search spec line whose
+// fingerprint matches a database entry receives the stored offsets and
+// is marked as preloaded, so that pass 1 searches only for new or
+// changed file types.  A missing, stale or damaged database isn't an
+// error--a warning is issued and every file type is searched for.
+// Returns the number of file types which still need to be searched for.
+static int readHeaderFooterDatabase(struct scalpelState *state,
+                                    unsigned long long filesize) {
+
+    FILE *dbfile;
+    char fn[MAX_STRING_LENGTH];	// filename for header/footer database
+    char line[MAX_STRING_LENGTH];
+    char magic[MAX_STRING_LENGTH];
+    int version = 0, needlenum, searchneeded = 0, damaged = FALSE;
+    unsigned long long dbfilesize = 0, dbskip = 0, dbimage = 0, fingerprint;
+    unsigned long long numheaders, numfooters;
+    unsigned long long *headers, *footers;
+    struct SearchSpecLine *currentneedle;
+
+    for(needlenum = 0; needlenum < state->specLines; needlenum++) {
+        state->SearchSpec[needlenum].offsetsPreloaded = FALSE;
+    }
+
+    snprintf(fn, MAX_STRING_LENGTH, "%s/%s.hfd",
+        state->headerFooterDatabaseDir,
+        base_name(scalpelInputGetId(state->inReader)));
+
+    if(useCoverageTranslation(state)) {
+        fprintf(stderr,
+            "Warning: header/footer databases can't be reused with coverage blockmaps,\n"
+            "region lists or block hash sets.\n");
+        fprintf(state->auditFile,
+            "Warning: header/footer databases can't be reused with coverage blockmaps,\n"
+            "region lists or block hash sets.\n");
+        return state->specLines;
+    }
+
+    if((dbfile = fopen(fn, "r")) == NULL) {
+        fprintf(stderr,
+            "Warning: Couldn't open header/footer database %s -- %s\n"
+            "         All file types will be searched for.\n", fn, strerror(errno));
+        fprintf(state->auditFile,
+            "Warning: Couldn't open header/footer database %s -- %s\n"
+            "         All file types will be searched for.\n", fn, strerror(errno));
+        return state->specLines;
+    }
+
+    // header/footer databases predating fingerprints can't be reused
+    if(fgets(line, MAX_STRING_LENGTH, dbfile) == NULL ||
+        sscanf(line, "%s %d %llu %llu %llx", magic, &version, &dbfilesize,
+        &dbskip, &dbimage) != 5 ||
+        strcmp(magic, SCALPEL_HFD_MAGIC) || version != SCALPEL_HFD_VERSION) {
+            fprintf(stderr,
+                "Warning: %s isn't a version %d header/footer database.\n"
+                "         All file types will be searched for.\n",
+                fn, SCALPEL_HFD_VERSION);
+            fprintf(state->auditFile,
+                "Warning: %s isn't a version %d header/footer database.\n"
+                "         All file types will be searched for.\n",
+                fn, SCALPEL_HFD_VERSION);
+            fclose(dbfile);
+            return state->specLines;
+    }
+
+    if(dbfilesize != filesize || dbskip != state->skip ||
+        dbimage != state->imageFingerprint) {
+        fprintf(stderr,
+            "Warning: header/footer database %s was built for a different image\n"
+            "         or skip value.  All file types will be searched for.\n", fn);
+        fprintf(state->auditFile,
+            "Warning: header/footer database %s was built for a different image\n"
+            "         or skip value.  All file types will be searched for.\n", fn);
+        fclose(dbfile);
+        return state->specLines;
+    }
 
-static int writeHeaderFooterDatabase(struct scalpelState *state) {
+    while (fgets(line, MAX_STRING_LENGTH, dbfile) != NULL) {
 
-    FILE *dbfile;
-    char fn[MAX_STRING_LENGTH];	// filename for header/footer database
-    int needlenum;
-    struct SearchSpecLine *currentneedle;
-    unsigned long long i;
+        // suffix line is informational, fingerprint identifies the file type
+        if(!readHeaderFooterDatabaseValue(dbfile, &fingerprint, 16) ||
+            !readHeaderFooterDatabaseValue(dbfile, &numheaders, 10) ||
+            (headers = readHeaderFooterDatabaseOffsets(state, dbfile,
+            numheaders, filesize)) == NULL) {
+                damaged = TRUE;
+                break;
+        }
+        if(!readHeaderFooterDatabaseValue(dbfile, &numfooters, 10) ||
+            (footers = readHeaderFooterDatabaseOffsets(state, dbfile,
+            numfooters, filesize)) == NULL) {
+                free(headers);
+                damaged = TRUE;
+                break;
+        }
 
-    // generate unique name for header/footer database
-    snprintf(fn, MAX_STRING_LENGTH, "%s/%s.hfd",
-        state->outputdirectory, base_name(scalpelInputGetId(state->inReader)));
+        for(needlenum = 0; needlenum < state->specLines; needlenum++) {
+            currentneedle = &(state->SearchSpec[needlenum]);
+            if(!currentneedle->offsetsPreloaded &&
+                fingerprintSearchSpecLine(state, currentneedle) == fingerprint) {
+                    break;
+            }
+        }
 
-    if((dbfile = fopen(fn, "w")) == NULL) {
-        fprintf(stderr, "Error writing to header/footer database file: %s\n", fn);
-        fprintf(state->auditFile,
-            "Error writing to header/footer database file: %s\n", fn);
-        return SCALPEL_ERROR_FILE_WRITE;
+        if(needlenum < state->specLines) {
+            preloadOffsets(state, currentneedle, headers, numheaders,
+                footers, numfooters);
+        }
+        else {
+            // file type was removed or changed since the database was built
+            free(headers);
+            free(footers);
+        }
     }
+    fclose(dbfile);
 
-#ifdef _WIN32
-    // set binary mode for Win32
-    setmode(fileno(dbfile), O_BINARY);
-#endif
-#ifdef __linux
-    fcntl(fileno(dbfile), F_SETFL, O_LARGEFILE);
-#endif
+    if(damaged) {
+        discardPreloadedOffsets(state);
+        fprintf(stderr,
+            "Warning: header/footer database %s is damaged.\n"
+            "         All file types will be searched for.\n", fn);
+        fprintf(state->auditFile,
+            "Warning: header/footer database %s is damaged.\n"
+            "         All file types will be searched for.\n", fn);
+        return state->specLines;
+    }
 
+    fprintf(state->auditFile, "\nReusing header/footer database %s:\n", fn);
     for(needlenum = 0; needlenum < state->specLines; needlenum++) {
         currentneedle = &(state->SearchSpec[needlenum]);
+        if(currentneedle->offsetsPreloaded) {
+            fprintf(state->auditFile,
+                "  %s: %"PRIu64 " headers, %"PRIu64 " footers loaded\n",
+                currentneedle->suffix[0] == SCALPEL_NOEXTENSION ?
+                SCALPEL_NOEXTENSION_SUFFIX : currentneedle->suffix,
+                currentneedle->offsets.numheaders,
+                currentneedle->offsets.numfooters);
+        }
+        else {
+            fprintf(state->auditFile, "  %s: new or changed, will be searched for\n",
+                currentneedle->suffix[0] == SCALPEL_NOEXTENSION ?
+                SCALPEL_NOEXTENSION_SUFFIX : currentneedle->suffix);
+            searchneeded++;
+        }
+    }
 
-        if(currentneedle->suffix[0] != SCALPEL_NOEXTENSION) {
-            // output current suffix
-            if(fprintf(dbfile, "%s\n", currentneedle->suffix) <= 0) {
-                fprintf(stderr,
-                    "Error writing to header/footer database file: %s\n", fn);
-                fprintf(state->auditFile,
-                    "Error writing to header/footer database file: %s\n", fn);
-                return SCALPEL_ERROR_FILE_WRITE;
+    fprintf(stdout,
+        "Reusing header/footer database %s; %d of %d file types need to be searched for.\n",
+        fn, searchneeded, state->specLines);
+
+    return searchneeded;
+}
+	
+
+
+// Checkpoints allow an interrupted run to be resumed (-R) rather than
+// restarted.  While an image file is processed, header/footer offsets
+// are appended to a journal in the output directory and, every
+// state->checkpointInterval seconds (and when a SIGINT/SIGTERM is
+// caught), a small checkpoint file is atomically replaced.  It records
+// the valid length of the journal and the audit file, the position
+// reached in pass 1 or pass 2, the carved files that were partially
+// written at that position, the images already completed, and the
+// per-rule state needed to reproduce carved file names.  Since only
+// new offsets are appended to the journal, the cost of a checkpoint
+// doesn't grow with the size of the image.  The format of the
+// checkpoint file is:
+//
+// scalpel-checkpoint version
+// audit audit_file_length
+// fileswritten state->fileswritten at start of current image
+// rule fingerprint organizeDirNum journaled_headers journaled_footers
+// ... (one "rule" line per search spec line)
+// done image (one line per completed image)
+// image image_size skip image             (only while an image is processed)
+// pass pass cursor                        ("")
+// journal journal_length                  ("")
+// partial bytes_written filename          (zero or more, pass 2 only)
+//
+// In pass 1, the cursor is the offset (relative to -s) of the next
+// buffer to search; in pass 2 it's the image file position of the next
+// buffer to carve from.  The journal holds one "rule h|f offset" line
+// per header or footer.
+
+static Checkpoint *allocateCheckpoint(struct scalpelState *state) {
+
+    Checkpoint *ckpt;
+
+    ckpt = (Checkpoint *)malloc(sizeof(Checkpoint));
+    checkMemoryAllocation(state, ckpt, __LINE__, __FILE__, "checkpoint");
+    memset(ckpt, 0, sizeof(Checkpoint));
+    return ckpt;
+}
+
+// fingerprint of everything in a search spec line that affects which
+// files are carved, used to verify that the configuration file didn't
+// change before a run is resumed
+static unsigned long long checkpointFingerprint(struct scalpelState *state,
+                                                struct SearchSpecLine *s) {
+
+    unsigned long long hash = fingerprintSearchSpecLine(state, s);
+
+    hash = fnv1aHash(hash, &(s->length), sizeof(s->length));
+    hash = fnv1aHash(hash, &(s->minlength), sizeof(s->minlength));
+    hash = fnv1aHash(hash, &(s->searchtype), sizeof(s->searchtype));
+    return hash;
+}
+
+// TRUE if it's time for a periodic checkpoint
+static int checkpointDue(struct scalpelState *state) {
+
+    return state->checkpointInterval > 0 && state->checkpoint &&
+        state->checkpoint->inImage &&
+        time(0) - state->checkpoint->lastcheckpoint >= state->checkpointInterval;
+}
+
+// write a checkpoint for the current image file.  'pass' and 'cursor'
+// define where processing will resume.  In pass 2, 'current' is the
+// work queue for the buffer at 'cursor'; carves that continue or stop
+// in it were partially written and are recorded, after their output
+// is flushed.
+static int writeCheckpoint(struct scalpelState *state, int pass,
+                           unsigned long long cursor, PoolQueue *current) {
+
+    Checkpoint *ckpt = state->checkpoint;
+    char fn[MAX_STRING_LENGTH];
+    char tmpfn[MAX_STRING_LENGTH + 4];
+    char carvefn[MAX_STRING_LENGTH];
+    FILE *f;
+    struct SearchSpecLine *currentneedle;
+    struct CarveInfo *carve;
+    unsigned long long j;
+    int needlenum, i, operation;
+
+    if(state->checkpointInterval <= 0 || !ckpt) {
+        return SCALPEL_OK;
+    }
+
+    // append header/footer offsets discovered since the last checkpoint
+    if(ckpt->inImage) {
+        for(needlenum = 0; needlenum < state->specLines; needlenum++) {
+            currentneedle = &(state->SearchSpec[needlenum]);
+            if(currentneedle->offsetsPreloaded) {
+                // reloaded from the header/footer database on resume
+                continue;
+            }
+            for(j = ckpt->journaledheaders[needlenum];
+                j < currentneedle->offsets.numheaders; j++) {
+                    fprintf(ckpt->journal, "%d h %llu\n", needlenum,
+                        currentneedle->offsets.headers[j]);
+            }
+            ckpt->journaledheaders[needlenum] = currentneedle->offsets.numheaders;
+            for(j = ckpt->journaledfooters[needlenum];
+                j < currentneedle->offsets.numfooters; j++) {
+                    fprintf(ckpt->journal, "%d f %llu\n", needlenum,
+                        currentneedle->offsets.footers[j]);
+            }
+            ckpt->journaledfooters[needlenum] = currentneedle->offsets.numfooters;
+        }
+        if(fflush(ckpt->journal)) {
+            fprintf(stderr, "Error writing checkpoint journal -- %s\n", strerror(errno));
+            return SCALPEL_ERROR_FILE_WRITE;
+        }
+#ifndef _WIN32
+        fsync(fileno(ckpt->journal));
+#endif
+        ckpt->journalsize = ftello(ckpt->journal);
+    }
+
+    // everything the checkpoint refers to must be on disk first
+    fflush(state->auditFile);
+    if(pass == 2 && current && !state->previewMode) {
+        pool_rewind_queue(current);
+        while (!pool_end_of_queue(current)) {
+            pool_peek_at_current(current, &carve);
+            operation = pool_current_priority(current);
+            if((operation == CONTINUECARVE || operation == STOPCARVE) && carve->fp) {
+                fflush(carve->fp);
             }
+            pool_next_element(current);
+        }
+    }
 
-            // # of headers
-            if(fprintf(dbfile, "%"PRIu64 "\n", currentneedle->offsets.numheaders)
-                <= 0) {
+    snprintf(fn, MAX_STRING_LENGTH, "%s/%s", state->outputdirectory,
+        SCALPEL_CHECKPOINT_FILE);
+    snprintf(tmpfn, sizeof(tmpfn), "%s.tmp", fn);
 
-                    fprintf(stderr,
-                        "Error writing to header/footer database file: %s\n", fn);
-                    fprintf(state->auditFile,
-                        "Error writing to header/footer database file: %s\n", fn);
-                    return SCALPEL_ERROR_FILE_WRITE;
+    if((f = fopen(tmpfn, "w")) == NULL) {
+        fprintf(stderr, "Error writing to checkpoint file: %s -- %s\n", tmpfn,
+            strerror(errno));
+        return SCALPEL_ERROR_FILE_WRITE;
+    }
+
+    fprintf(f, "%s %d\n", SCALPEL_CHECKPOINT_MAGIC, SCALPEL_CHECKPOINT_VERSION);
+    fprintf(f, "audit %lld\n", (long long)ftello(state->auditFile));
+    fprintf(f, "fileswritten %llu\n",
+        ckpt->inImage ? ckpt->startfileswritten : state->fileswritten);
+    for(needlenum = 0; needlenum < state->specLines; needlenum++) {
+        currentneedle = &(state->SearchSpec[needlenum]);
+        fprintf(f, "rule %016llx %lu %llu %llu\n",
+            checkpointFingerprint(state, currentneedle),
+            ckpt->inImage ? ckpt->startorganizeDirNum[needlenum] :
+            currentneedle->organizeDirNum,
+            ckpt->inImage ? ckpt->journaledheaders[needlenum] : 0ULL,
+            ckpt->inImage ? ckpt->journaledfooters[needlenum] : 0ULL);
+    }
+    for(i = 0; i < ckpt->numdone; i++) {
+        fprintf(f, "done %s\n", ckpt->done[i]);
+    }
+
+    if(ckpt->inImage) {
+        fprintf(f, "image %llu %llu %s\n", ckpt->imagesize, state->skip,
+            scalpelInputGetId(state->inReader));
+        fprintf(f, "pass %d %llu\n", pass, cursor);
+        fprintf(f, "journal %llu\n", ckpt->journalsize);
+
+        if(pass == 2 && current) {
+            pool_rewind_queue(current);
+            while (!pool_end_of_queue(current)) {
+                pool_peek_at_current(current, &carve);
+                operation = pool_current_priority(current);
+                if(operation == CONTINUECARVE || operation == STOPCARVE) {
+                    carveFilename(state, carve, carvefn);
+                    fprintf(f, "partial %llu %s\n", cursor - carve->start, carvefn);
+                }
+                pool_next_element(current);
             }
+        }
+    }
+
+    if(fflush(f)) {
+        fprintf(stderr, "Error writing to checkpoint file: %s -- %s\n", tmpfn,
+            strerror(errno));
+        fclose(f);
+        return SCALPEL_ERROR_FILE_WRITE;
+    }
+#ifndef _WIN32
+    fsync(fileno(f));
+#endif
+    fclose(f);
 
-            // all header positions for current suffix
-            for(i = 0; i < currentneedle->offsets.numheaders; i++) {
+    // replace previous checkpoint
 #ifdef _WIN32
-                if(fprintf
-                    (dbfile, "%"PRIu64 "\n",
-                    positionUseCoverageBlockmap(state,
-                    currentneedle->offsets.
-                    headers[i])) <= 0) {
-#else
-                if(fprintf
-                    (dbfile, "%llu\n",
-                    positionUseCoverageBlockmap(state,
-                    currentneedle->offsets.
-                    headers[i])) <= 0) {
+    unlink(fn);
 #endif
-                        fprintf(stderr,
-                            "Error writing to header/footer database file: %s\n", fn);
-                        fprintf(state->auditFile,
-                            "Error writing to header/footer database file: %s\n", fn);
-                        return SCALPEL_ERROR_FILE_WRITE;
-                }
+    if(rename(tmpfn, fn)) {
+        fprintf(stderr, "Error writing to checkpoint file: %s -- %s\n", fn,
+            strerror(errno));
+        return SCALPEL_ERROR_FILE_WRITE;
+    }
+
+    ckpt->lastcheckpoint = time(0);
+    return SCALPEL_OK;
+}
+
+// read the checkpoint file left in the output directory by an
+// interrupted run.  Called by openAuditFile() when resuming.  The
+// per-rule information is checked against the configuration file
+// when the first image file is processed.
+int readCheckpoint(struct scalpelState *state) {
+
+    Checkpoint *ckpt;
+    char fn[MAX_STRING_LENGTH];
+    char line[MAX_STRING_LENGTH];
+    char magic[MAX_STRING_LENGTH];
+    char *p, *endptr;
+    int version = 0, damaged = FALSE;
+    size_t len;
+    FILE *f;
+
+    snprintf(fn, MAX_STRING_LENGTH, "%s/%s", state->outputdirectory,
+        SCALPEL_CHECKPOINT_FILE);
+
+    if((f = fopen(fn, "r")) == NULL) {
+        fprintf(stderr, "ERROR: Couldn't open checkpoint file:\n%s -- %s\n",
+            fn, strerror(errno));
+        return SCALPEL_ERROR_FATAL_READ;
+    }
+
+    if(fgets(line, MAX_STRING_LENGTH, f) == NULL ||
+        sscanf(line, "%s %d", magic, &version) != 2 ||
+        strcmp(magic, SCALPEL_CHECKPOINT_MAGIC) ||
+        version != SCALPEL_CHECKPOINT_VERSION) {
+            fprintf(stderr, "ERROR: %s isn't a version %d checkpoint file.\n",
+                fn, SCALPEL_CHECKPOINT_VERSION);
+            fclose(f);
+            return SCALPEL_ERROR_FATAL_READ;
+    }
+
+    ckpt = allocateCheckpoint(state);
+
+    while (!damaged && fgets(line, MAX_STRING_LENGTH, f) != NULL) {
+        len = strlen(line);
+        if(len > 0 && line[len - 1] == '\n') {
+            line[len - 1] = 0;
+        }
+
+        if(!strncmp(line, "audit ", 6)) {
+            ckpt->auditoffset = strtoll(line + 6, NULL, 10);
+        }
+        else if(!strncmp(line, "fileswritten ", 13)) {
+            ckpt->resumeFilesWritten = strtoull(line + 13, NULL, 10);
+        }
+        else if(!strncmp(line, "rule ", 5)) {
+            if(ckpt->resumeRules > MAX_FILE_TYPES ||
+                sscanf(line + 5, "%llx %lu %llu %llu",
+                &ckpt->resumeFingerprint[ckpt->resumeRules],
+                &ckpt->resumeOrganizeDirNum[ckpt->resumeRules],
+                &ckpt->resumeHeaders[ckpt->resumeRules],
+                &ckpt->resumeFooters[ckpt->resumeRules]) != 4) {
+                    damaged = TRUE;
+            }
+            ckpt->resumeRules++;
+        }
+        else if(!strncmp(line, "done ", 5)) {
+            ckpt->done = (char **)realloc(ckpt->done,
+                sizeof(char *) * (ckpt->numdone + 1));
+            checkMemoryAllocation(state, ckpt->done, __LINE__, __FILE__,
+                "checkpoint done list");
+            ckpt->done[ckpt->numdone] = (char *)malloc(strlen(line + 5) + 1);
+            checkMemoryAllocation(state, ckpt->done[ckpt->numdone], __LINE__,
+                __FILE__, "checkpoint done list");
+            strcpy(ckpt->done[ckpt->numdone++], line + 5);
+        }
+        else if(!strncmp(line, "image ", 6)) {
+            ckpt->resumeImageSize = strtoull(line + 6, &endptr, 10);
+            ckpt->resumeSkip = strtoull(endptr, &p, 10);
+            if(*p != ' ') {
+                damaged = TRUE;
+                continue;
+            }
+            p++;
+            ckpt->resumeImage = (char *)malloc(strlen(p) + 1);
+            checkMemoryAllocation(state, ckpt->resumeImage, __LINE__, __FILE__,
+                "checkpoint image");
+            strcpy(ckpt->resumeImage, p);
+        }
+        else if(!strncmp(line, "pass ", 5)) {
+            if(sscanf(line + 5, "%d %llu", &ckpt->resumePass,
+                &ckpt->resumeCursor) != 2 ||
+                ckpt->resumePass < 1 || ckpt->resumePass > 2) {
+                    damaged = TRUE;
+            }
+        }
+        else if(!strncmp(line, "journal ", 8)) {
+            ckpt->journalsize = strtoull(line + 8, NULL, 10);
+        }
+        else if(!strncmp(line, "partial ", 8)) {
+            ckpt->partialnames = (char **)realloc(ckpt->partialnames,
+                sizeof(char *) * (ckpt->numpartial + 1));
+            checkMemoryAllocation(state, ckpt->partialnames, __LINE__, __FILE__,
+                "checkpoint partial list");
+            ckpt->partialbytes = (unsigned long long *)realloc(ckpt->partialbytes,
+                sizeof(unsigned long long) * (ckpt->numpartial + 1));
+            checkMemoryAllocation(state, ckpt->partialbytes, __LINE__, __FILE__,
+                "checkpoint partial list");
+            ckpt->partialbytes[ckpt->numpartial] = strtoull(line + 8, &p, 10);
+            if(*p != ' ') {
+                damaged = TRUE;
+                continue;
             }
+            p++;
+            ckpt->partialnames[ckpt->numpartial] = (char *)malloc(strlen(p) + 1);
+            checkMemoryAllocation(state, ckpt->partialnames[ckpt->numpartial],
+                __LINE__, __FILE__, "checkpoint partial list");
+            strcpy(ckpt->partialnames[ckpt->numpartial++], p);
+        }
+        else {
+            damaged = TRUE;
+        }
+    }
+    fclose(f);
 
-            // # of footers
-            if(fprintf(dbfile, "%"PRIu64 "\n", currentneedle->offsets.numfooters)
-                <= 0) {
-                    fprintf(stderr,
-                        "Error writing to header/footer database file: %s\n", fn);
-                    fprintf(state->auditFile,
-                        "Error writing to header/footer database file: %s\n", fn);
-                    return SCALPEL_ERROR_FILE_WRITE;
+    state->checkpoint = ckpt;
+    if(damaged || (ckpt->resumeImage == NULL) != (ckpt->resumePass == 0)) {
+        fprintf(stderr, "ERROR: Checkpoint file %s is damaged.\n", fn);
+        return SCALPEL_ERROR_FATAL_READ;
+    }
+    ckpt->resumeDone = ckpt->numdone;
+    return SCALPEL_OK;
+}
+
+// set up checkpointing for the image file about to be processed.  When
+// resuming, restores per-rule state from the checkpoint the first time
+// through, sets ckpt->skipImage if the image was completed before the
+// checkpoint, and sets *resuming if the image was in progress.
+static int checkpointStartImage(struct scalpelState *state, int *resuming) {
+
+    Checkpoint *ckpt = state->checkpoint;
+    const char *id = scalpelInputGetId(state->inReader);
+    int needlenum, i;
+
+    *resuming = FALSE;
+    if(state->checkpointInterval <= 0 && !ckpt) {
+        return SCALPEL_OK;
+    }
+    if(!ckpt) {
+        ckpt = state->checkpoint = allocateCheckpoint(state);
+    }
+
+    if(state->resumeFromCheckpoint && !ckpt->rulesRestored) {
+        // configuration must be unchanged, otherwise carved file names
+        // and offsets in the journal would be meaningless
+        if(ckpt->resumeRules != state->specLines) {
+            return SCALPEL_ERROR_BAD_CHECKPOINT;
+        }
+        for(needlenum = 0; needlenum < state->specLines; needlenum++) {
+            if(ckpt->resumeFingerprint[needlenum] !=
+                checkpointFingerprint(state, &(state->SearchSpec[needlenum]))) {
+                    return SCALPEL_ERROR_BAD_CHECKPOINT;
             }
+        }
+        state->fileswritten = ckpt->resumeFilesWritten;
+        for(needlenum = 0; needlenum < state->specLines; needlenum++) {
+            state->SearchSpec[needlenum].organizeDirNum =
+                ckpt->resumeOrganizeDirNum[needlenum];
+        }
+        ckpt->rulesRestored = TRUE;
+    }
 
-            // all footer positions for current suffix
-            for(i = 0; i < currentneedle->offsets.numfooters; i++) {
-                if(fprintf
-                    (dbfile, "%"PRIu64 "\n",
-                    positionUseCoverageBlockmap(state,
-                    currentneedle->offsets.
-                    footers[i])) <= 0) {
+    for(i = 0; i < ckpt->resumeDone; i++) {
+        if(!strcmp(ckpt->done[i], id)) {
+            fprintf(stdout,
+                "Processing of image file %s was completed before the checkpoint, skipping.\n",
+                id);
+            ckpt->skipImage = TRUE;
+            return SCALPEL_OK;
+        }
+    }
+
+    *resuming = ckpt->resumePass && !strcmp(ckpt->resumeImage, id);
+
+    ckpt->startfileswritten = state->fileswritten;
+    for(needlenum = 0; needlenum < state->specLines; needlenum++) {
+        ckpt->startorganizeDirNum[needlenum] =
+            state->SearchSpec[needlenum].organizeDirNum;
+    }
+    return SCALPEL_OK;
+}
+
+// restore the header/footer offsets recorded in the journal for an image
+// file that was in progress at the last checkpoint.  File types whose
+// offsets were loaded from a header/footer database (-D) are left alone.
+static int restoreCheckpointOffsets(struct scalpelState *state) {
+
+    Checkpoint *ckpt = state->checkpoint;
+    char fn[MAX_STRING_LENGTH];
+    char line[MAX_STRING_LENGTH];
+    struct SearchSpecLine *currentneedle;
+    unsigned long long pos, n;
+    int needlenum, damaged = FALSE;
+    char *p, type;
+    FILE *journal;
+
+    for(needlenum = 0; needlenum < state->specLines; needlenum++) {
+        currentneedle = &(state->SearchSpec[needlenum]);
+        if(currentneedle->offsetsPreloaded) {
+            continue;
+        }
+        n = ckpt->resumeHeaders[needlenum] + 100;
+        currentneedle->offsets.headers = (unsigned long long *)
+            realloc(currentneedle->offsets.headers, sizeof(unsigned long long) * n);
+        checkMemoryAllocation(state, currentneedle->offsets.headers,
+            __LINE__, __FILE__, "header array");
+        currentneedle->offsets.headerlens = (size_t *)
+            realloc(currentneedle->offsets.headerlens, sizeof(size_t) * n);
+        checkMemoryAllocation(state, currentneedle->offsets.headerlens,
+            __LINE__, __FILE__, "header array");
+        currentneedle->offsets.headerstorage = n;
+        currentneedle->offsets.numheaders = 0;
+
+        n = ckpt->resumeFooters[needlenum] + 100;
+        currentneedle->offsets.footers = (unsigned long long *)
+            realloc(currentneedle->offsets.footers, sizeof(unsigned long long) * n);
+        checkMemoryAllocation(state, currentneedle->offsets.footers,
+            __LINE__, __FILE__, "footer array");
+        currentneedle->offsets.footerlens = (size_t *)
+            realloc(currentneedle->offsets.footerlens, sizeof(size_t) * n);
+        checkMemoryAllocation(state, currentneedle->offsets.footerlens,
+            __LINE__, __FILE__, "footer array");
+        currentneedle->offsets.footerstorage = n;
+        currentneedle->offsets.numfooters = 0;
+    }
+
+    snprintf(fn, MAX_STRING_LENGTH, "%s/%s", state->outputdirectory,
+        SCALPEL_CHECKPOINT_JOURNAL);
+    if((journal = fopen(fn, "r")) == NULL) {
+        fprintf(stderr, "ERROR: Couldn't open checkpoint journal:\n%s -- %s\n",
+            fn, strerror(errno));
+        return SCALPEL_ERROR_BAD_CHECKPOINT;
+    }
 
-                        fprintf(stderr,
-                            "Error writing to header/footer database file: %s\n", fn);
-                        fprintf(state->auditFile,
-                            "Error writing to header/footer database file: %s\n", fn);
-                        return SCALPEL_ERROR_FILE_WRITE;
+    // only the part of the journal covered by the checkpoint is valid
+    while (!damaged && (unsigned long long)ftello(journal) < ckpt->journalsize &&
+        fgets(line, MAX_STRING_LENGTH, journal) != NULL) {
+            needlenum = strtol(line, &p, 10);
+            if(needlenum < 0 || needlenum >= state->specLines ||
+                (p[1] != 'h' && p[1] != 'f')) {
+                    damaged = TRUE;
+                    continue;
+            }
+            currentneedle = &(state->SearchSpec[needlenum]);
+            if(currentneedle->offsetsPreloaded) {
+                continue;
+            }
+            // offsets are journaled in ascending order and lie within the image
+            type = p[1];
+            pos = strtoull(p + 3, &p, 10);
+            if((*p != '\n' && *p != '\0') || pos >= ckpt->resumeImageSize) {
+                damaged = TRUE;
+                continue;
+            }
+            if(type == 'h') {
+                if(currentneedle->offsets.numheaders >= ckpt->resumeHeaders[needlenum] ||
+                    (currentneedle->offsets.numheaders > 0 &&
+                    pos < currentneedle->offsets.headers[currentneedle->offsets.numheaders - 1])) {
+                    damaged = TRUE;
+                    continue;
+                }
+                currentneedle->offsets.headers[currentneedle->offsets.numheaders] = pos;
+                currentneedle->offsets.headerlens[currentneedle->offsets.numheaders++] =
+                    currentneedle->beginisRE ? 0 : currentneedle->beginlength;
+            }
+            else {
+                if(currentneedle->offsets.numfooters >= ckpt->resumeFooters[needlenum] ||
+                    (currentneedle->offsets.numfooters > 0 &&
+                    pos < currentneedle->offsets.footers[currentneedle->offsets.numfooters - 1])) {
+                    damaged = TRUE;
+                    continue;
                 }
+                currentneedle->offsets.footers[currentneedle->offsets.numfooters] = pos;
+                currentneedle->offsets.footerlens[currentneedle->offsets.numfooters++] =
+                    currentneedle->endisRE ? 0 : currentneedle->endlength;
+            }
+    }
+    fclose(journal);
+
+    for(needlenum = 0; needlenum < state->specLines && !damaged; needlenum++) {
+        currentneedle = &(state->SearchSpec[needlenum]);
+        damaged = !currentneedle->offsetsPreloaded &&
+            (currentneedle->offsets.numheaders != ckpt->resumeHeaders[needlenum] ||
+            currentneedle->offsets.numfooters != ckpt->resumeFooters[needlenum]);
+    }
+
+    if(damaged) {
+        fprintf(stderr, "ERROR: Checkpoint journal %s is damaged.\n", fn);
+        return SCALPEL_ERROR_BAD_CHECKPOINT;
+    }
+    return SCALPEL_OK;
+}
+
+// open the offset journal for the current image file.  A fresh journal
+// is started unless 'resuming', in which case anything written after
+// the last checkpoint is discarded and new offsets are appended.
+static int openCheckpointJournal(struct scalpelState *state, int resuming,
+                                 unsigned long long filesize) {
+
+    Checkpoint *ckpt = state->checkpoint;
+    char fn[MAX_STRING_LENGTH];
+    int needlenum;
+
+    if(state->checkpointInterval <= 0) {
+        return SCALPEL_OK;
+    }
+
+    snprintf(fn, MAX_STRING_LENGTH, "%s/%s", state->outputdirectory,
+        SCALPEL_CHECKPOINT_JOURNAL);
+    if(resuming && truncateFile(fn, ckpt->journalsize)) {
+        fprintf(stderr, "Error writing checkpoint journal: %s -- %s\n", fn,
+            strerror(errno));
+        return SCALPEL_ERROR_FILE_WRITE;
+    }
+    if((ckpt->journal = fopen(fn, resuming ? "a" : "w")) == NULL) {
+        fprintf(stderr, "Error writing checkpoint journal: %s -- %s\n", fn,
+            strerror(errno));
+        return SCALPEL_ERROR_FILE_WRITE;
+    }
+
+    for(needlenum = 0; needlenum < state->specLines; needlenum++) {
+        ckpt->journaledheaders[needlenum] = resuming ? ckpt->resumeHeaders[needlenum] : 0;
+        ckpt->journaledfooters[needlenum] = resuming ? ckpt->resumeFooters[needlenum] : 0;
+    }
+    if(!resuming) {
+        ckpt->journalsize = 0;
+    }
+    ckpt->imagesize = filesize;
+    ckpt->inImage = TRUE;
+    return SCALPEL_OK;
+}
+
+// record that processing of the current image file is complete
+static int checkpointEndImage(struct scalpelState *state) {
+
+    Checkpoint *ckpt = state->checkpoint;
+    const char *id = scalpelInputGetId(state->inReader);
+
+    if(!ckpt || !ckpt->inImage) {
+        return SCALPEL_OK;
+    }
+
+    if(ckpt->journal) {
+        fclose(ckpt->journal);
+        ckpt->journal = NULL;
+    }
+    ckpt->inImage = FALSE;
+
+    ckpt->done = (char **)realloc(ckpt->done, sizeof(char *) * (ckpt->numdone + 1));
+    checkMemoryAllocation(state, ckpt->done, __LINE__, __FILE__,
+        "checkpoint done list");
+    ckpt->done[ckpt->numdone] = (char *)malloc(strlen(id) + 1);
+    checkMemoryAllocation(state, ckpt->done[ckpt->numdone], __LINE__, __FILE__,
+        "checkpoint done list");
+    strcpy(ckpt->done[ckpt->numdone++], id);
+
+    return writeCheckpoint(state, 0, 0, NULL);
+}
+
+// throw away pass 2 output written after the checkpoint of the image
+// file being resumed: files that start at or beyond the checkpoint are
+// removed and files that were partially written are cut back to their
+// length at the checkpoint.  Carves completed before the checkpoint
+// are skipped.
+static int resumeCarves(struct scalpelState *state, PoolQueue *carvelists,
+                        unsigned long long filesize) {
+
+    Checkpoint *ckpt = state->checkpoint;
+    struct CarveInfo *carve;
+    char fn[MAX_STRING_LENGTH];
+    unsigned long long i;
+    int operation, k;
+
+    for(i = 0; i < 2 + (filesize / SIZE_OF_BUFFER); i++) {
+        pool_rewind_queue(&carvelists[i]);
+        while (!pool_end_of_queue(&carvelists[i])) {
+            pool_peek_at_current(&carvelists[i], &carve);
+            operation = pool_current_priority(&carvelists[i]);
+            if((operation == STARTCARVE || operation == STARTSTOPCARVE) &&
+                carve->start >= ckpt->resumeCursor && !state->previewMode) {
+                    carveFilename(state, carve, fn);
+                    unlink(fn);
             }
+            pool_next_element(&carvelists[i]);
         }
     }
-    fclose(dbfile);
+
+    for(k = 0; k < ckpt->numpartial && !state->previewMode; k++) {
+        if(truncateFile(ckpt->partialnames[k], ckpt->partialbytes[k])) {
+            fprintf(stderr, "Error truncating file: %s -- %s\n",
+                ckpt->partialnames[k], strerror(errno));
+            fprintf(state->auditFile, "Error truncating file: %s -- %s\n",
+                ckpt->partialnames[k], strerror(errno));
+            return SCALPEL_ERROR_FILE_WRITE;
+        }
+    }
+
+    fprintf(stdout, "Resuming image file pass 2/2 at offset %llu.\n",
+        ckpt->resumeCursor);
     return SCALPEL_OK;
 }
-	
+
+// release checkpoint state at the end of a run.  If no image file is
+// in progress and the checkpoint being resumed from (if any) was
+// used, the run is complete and the checkpoint files are removed;
+// otherwise they're left for a resumed run.
+void finishCheckpoint(struct scalpelState *state) {
+
+    Checkpoint *ckpt = state->checkpoint;
+    char fn[MAX_STRING_LENGTH];
+    int i;
+
+    if(!ckpt) {
+        return;
+    }
+
+    if(ckpt->journal) {
+        fclose(ckpt->journal);
+    }
+
+    if(!ckpt->inImage && !ckpt->resumePass &&
+        (!state->resumeFromCheckpoint || ckpt->rulesRestored)) {
+        snprintf(fn, MAX_STRING_LENGTH, "%s/%s", state->outputdirectory,
+            SCALPEL_CHECKPOINT_FILE);
+        unlink(fn);
+        snprintf(fn, MAX_STRING_LENGTH, "%s/%s", state->outputdirectory,
+            SCALPEL_CHECKPOINT_JOURNAL);
+        unlink(fn);
+    }
+
+    for(i = 0; i < ckpt->numdone; i++) {
+        free(ckpt->done[i]);
+    }
+    free(ckpt->done);
+    for(i = 0; i < ckpt->numpartial; i++) {
+        free(ckpt->partialnames[i]);
+    }
+    free(ckpt->partialnames);
+    free(ckpt->partialbytes);
+    free(ckpt->resumeImage);
+    free(ckpt);
+    state->checkpoint = NULL;
+}
@@ -86,11 +86,34 @@ int openAuditFile(struct scalpelState *state)
     char *timestring = ctime(&now);
     char fn[MAX_STRING_LENGTH];
     char *buf;
-    int err = SCALPEL_OK;
+    int i, err = SCALPEL_OK;
 
     buf = (char *)malloc(NUM_SEARCH_SPEC_ELEMENTS * MAX_STRING_LENGTH);
     checkMemoryAllocation(state, buf, __LINE__, __FILE__, "buf");
 
+    if(state->resumeFromCheckpoint) {
+        // resuming an interrupted run: the output directory holds its
+        // results so far, and the audit file is kept up to the last
+        // checkpoint
+        if((err = readCheckpoint(state)) != SCALPEL_OK) {
+            goto out;
+        }
+
+        snprintf(fn, MAX_STRING_LENGTH, "%s/audit.txt", state->outputdirectory);
+        if(truncateFile(fn, state->checkpoint->auditoffset) ||
+            !(state->auditFile = fopen(fn, "a"))) {
+                fprintf(stderr, "Couldn't open audit file\n%s -- %s\n", fn,
+                    strerror(errno));
+                err = SCALPEL_ERROR_FATAL_READ;
+                goto out;
+        }
+
+        fprintf(state->auditFile,
+            "\nResumed from checkpoint at %sCommand line:\n%s\n\n",
+            timestring, state->invocation);
+        goto out;
+    }
+
     if(!outputDirectoryOK(state->outputdirectory)) {
         err = SCALPEL_ERROR_NONEMPTY_DIRECTORY;
         goto out;
@@ -115,7 +138,38 @@ int openAuditFile(struct scalpelState *state)
         SCALPEL_VERSION, timestring, state->invocation,
         state->outputdirectory, state->conffile);
 
-    // copy config file into audit log
+    // copy config file into audit log.  Generating a block hash set
+    // doesn't use one.
+
+    if(state->blockhashoutput) {
+        goto out;
+    }
+
+    // the manifest lists the digests of carved files, one row per file
+    if(state->hashAlgorithms) {
+        snprintf(fn, MAX_STRING_LENGTH, "%s/%s", state->outputdirectory,
+            SCALPEL_MANIFEST_FILE);
+        if(!(state->manifestFile = fopen(fn, "w"))) {
+            fprintf(stderr, "Couldn't open manifest file\n%s -- %s\n", fn,
+                strerror(errno));
+            err = SCALPEL_ERROR_FATAL_READ;
+            goto out;
+        }
+        fprintf(state->manifestFile, "file,image,start,length,chopped");
+        for(i = 0; i < SCALPEL_NUM_HASHES; i++) {
+            if(state->hashAlgorithms & (1 << i)) {
+                fprintf(state->manifestFile, ",%s", hashName(i));
+            }
+        }
+        if(state->dedupMode) {
+            fprintf(state->manifestFile, ",duplicate_of");
+        }
+        fprintf(state->manifestFile, "\n");
+    }
+
+    if(state->packOutput && (err = openPack(state)) != SCALPEL_OK) {
+        goto out;
+    }
 
     f = fopen(state->conffile, "r");
     if(f == NULL) {
@@ -140,6 +194,52 @@ out:
     return err;
 }
 
+// set the length of a file, e.g., to throw away output written after
+// the last checkpoint.  Returns 0 on success.
+int truncateFile(const char *fn, unsigned long long length) {
+
+#ifdef _WIN32
+    int fd, err;
+
+    if((fd = open(fn, O_WRONLY | O_BINARY)) < 0) {
+        return -1;
+    }
+    err = _chsize_s(fd, length);
+    close(fd);
+    return err ? -1 : 0;
+#else
+    return truncate(fn, length);
+#endif
+}
+
+// make 'fn' a hardlink to 'existing', replacing 'fn' if it exists.  The
+// link is made under a temporary name first, so 'fn' is left alone if
+// the filesystem refuses it.  Returns 0 on success.
+int replaceWithHardLink(const char *existing, const char *fn) {
+
+    char tmpfn[MAX_STRING_LENGTH];
+
+    snprintf(tmpfn, MAX_STRING_LENGTH, "%s.link", fn);
+#ifdef _WIN32
+    if(!CreateHardLinkA(tmpfn, existing, NULL)) {
+        return -1;
+    }
+    if(!MoveFileExA(tmpfn, fn, MOVEFILE_REPLACE_EXISTING)) {
+        DeleteFileA(tmpfn);
+        return -1;
+    }
+#else
+    if(link(existing, tmpfn)) {
+        return -1;
+    }
+    if(rename(tmpfn, fn)) {
+        unlink(tmpfn);
+        return -1;
+    }
+#endif
+    return 0;
+}
+
 // write final completion message and close the audit file, if it's
 // open
 int closeAuditFile(FILE * f) {
@@ -439,6 +439,14 @@ void handleError(struct scalpelState *state, int error)
             "Skipping...\n", inputId);
         break;
 
+    case SCALPEL_ERROR_BAD_CHECKPOINT:
+        // non-fatal
+        scalpelLog(state,
+            "The checkpoint in the output directory doesn't match the input file %s\n"
+            "or the configuration file, so processing can't be resumed.\n"
+            "Skipping...\n", inputId);
+        break;
+
     case SCALPEL_ERROR_FATAL_READ:
         // fatal
         msg = "Scalpel was unable to read a needed file and will abort.\n";
@@ -24,6 +24,10 @@ Scalpel, in 2005.
 #include "scalpel.h"
 #include "common.h"
 
+#ifdef HAVE_LIBZ
+#include <zlib.h>
+#endif
+
 
 /*********  generic IO API implementation *************/
 
@@ -420,3 +424,1399 @@ void scalpel_freeInputReaderFile(ScalpelInputReader * fileReader)
     free(fileReader);
 }
 
+
+
+/********** split raw image implementation ***********/
+
+static inline SplitDataSource* castSplitDataSource(ScalpelInputReader * reader) 
+{
+    return (SplitDataSource*) reader->dataSource;
+}
+
+//make 'segment' the open segment
+static int splitDataSourceSelect(SplitDataSource * splitSource, int segment) 
+{
+    if (splitSource->current == segment) {
+        return 0;
+    }
+
+    if (splitSource->fileHandle) {
+        fclose(splitSource->fileHandle);
+        splitSource->fileHandle = NULL;
+        splitSource->current = -1;
+    }
+
+    splitSource->fileHandle = fopen(splitSource->segmentPaths[segment], "rb");
+    if (!splitSource->fileHandle) {
+        fprintf(stderr, "splitDataSourceSelect() - ERROR can't open segment %s\n",
+            splitSource->segmentPaths[segment]);
+        splitSource->error = errno ? errno : 1;
+        return -1;
+    }
+    splitSource->current = segment;
+    return 0;
+}
+
+//index of the segment holding logical position 'position'.  Empty segments
+//are never chosen, positions at or past the end map to the last segment
+static int splitDataSourceSegment(const SplitDataSource * splitSource,
+                                  unsigned long long position) 
+{
+    int low = 0, high = splitSource->numSegments - 1, mid;
+
+    while (low < high) {
+        mid = (low + high + 1) / 2;
+        if (splitSource->segmentStarts[mid] <= position) {
+            low = mid;
+        } else {
+            high = mid - 1;
+        }
+    }
+    return low;
+}
+
+//open the segment holding the current position and seek to it
+static int splitDataSourcePosition(SplitDataSource * splitSource) 
+{
+    int segment = splitDataSourceSegment(splitSource, splitSource->position);
+
+    if (splitDataSourceSelect(splitSource, segment)) {
+        return -1;
+    }
+    if (fseeko(splitSource->fileHandle,
+        splitSource->position - splitSource->segmentStarts[segment], SEEK_SET)) {
+        splitSource->error = errno ? errno : 1;
+        return -1;
+    }
+    return 0;
+}
+
+static int splitDataSourceRead(ScalpelInputReader * const reader, void * buf,
+                               size_t size, size_t count) 
+{
+    SplitDataSource* splitSource = castSplitDataSource(reader);
+    unsigned long long total = splitSource->segmentStarts[splitSource->numSegments];
+    unsigned long long end;
+    size_t wanted = size * count, done = 0, chunk, got;
+
+    if (size == 0) {
+        return 0;
+    }
+
+    while (done < wanted && splitSource->position < total) {
+        // crossed into the next segment
+        if (splitSource->current < 0 ||
+            splitSource->position >= splitSource->segmentStarts[splitSource->current + 1]) {
+            if (splitDataSourcePosition(splitSource)) {
+                break;
+            }
+        }
+
+        end = splitSource->segmentStarts[splitSource->current + 1];
+        chunk = wanted - done;
+        if (chunk > end - splitSource->position) {
+            chunk = (size_t) (end - splitSource->position);
+        }
+
+        got = fread((char*) buf + done, 1, chunk, splitSource->fileHandle);
+        done += got;
+        splitSource->position += got;
+        if (got < chunk) {
+            // a segment shorter than when the reader was opened is an error, too
+            fprintf(stderr, "splitDataSourceRead() - ERROR short read from segment %s\n",
+                splitSource->segmentPaths[splitSource->current]);
+            splitSource->error = ferror(splitSource->fileHandle) ? EIO : 1;
+            break;
+        }
+    }
+
+    // conform with fread() semantics by returning # of items read
+    return done / size;
+}
+
+static unsigned long long splitDataSourceTellO(ScalpelInputReader * const reader) 
+{
+    return castSplitDataSource(reader)->position;
+}
+
+static int splitDataSourceGetError(ScalpelInputReader * const reader) 
+{
+    return castSplitDataSource(reader)->error;
+}
+
+//return size from the current position like getSizeOpenFile(), or -1 on error
+static long long splitDataSourceGetSize(ScalpelInputReader * const reader) 
+{
+    if (!reader->isOpen) {
+        fprintf(stderr, "Error: Input Reader for file %s not open, can't get size\n", reader->id);
+        return -1;
+    }
+
+    const SplitDataSource* splitSource = castSplitDataSource(reader);
+    return splitSource->segmentStarts[splitSource->numSegments] - splitSource->position;
+}
+
+static int splitDataSourceSeekO(ScalpelInputReader * const reader, 
+                                long long offset,
+                                scalpel_SeekRel whence) 
+{
+    SplitDataSource* splitSource = castSplitDataSource(reader);
+    long long base = 0;
+
+    switch (whence) {
+    case SCALPEL_SEEK_SET:
+        base = 0;
+        break;
+    case SCALPEL_SEEK_CUR:
+        base = splitSource->position;
+        break;
+    case SCALPEL_SEEK_END:
+        base = splitSource->segmentStarts[splitSource->numSegments];
+        break;
+    default:
+
+        break;
+    }
+
+    if (base + offset < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    splitSource->position = base + offset;
+
+    // segments are switched lazily by the next read, unless the position
+    // stays in the open one
+    if (splitSource->current >= 0 &&
+        splitSource->position >= splitSource->segmentStarts[splitSource->current] &&
+        splitSource->position < splitSource->segmentStarts[splitSource->current + 1]) {
+        return fseeko(splitSource->fileHandle,
+            splitSource->position - splitSource->segmentStarts[splitSource->current],
+            SEEK_SET);
+    }
+    if (splitSource->fileHandle) {
+        fclose(splitSource->fileHandle);
+        splitSource->fileHandle = NULL;
+    }
+    splitSource->current = -1;
+    return 0;
+}
+
+static void splitDataSourceClose(ScalpelInputReader * const reader) 
+{
+    SplitDataSource* splitSource = castSplitDataSource(reader);
+    if (splitSource->fileHandle) {
+        fclose(splitSource->fileHandle);
+        splitSource->fileHandle = NULL;
+    }
+    splitSource->current = -1;
+    return;
+}
+
+//measure all segments once, so that getSize and seeks don't touch the files
+static int splitDataSourceOpen(ScalpelInputReader * const reader) 
+{
+    if (reader->isOpen) {
+        //OK, reuse it
+        fprintf(stderr, "splitDataSourceOpen -- WARNING -- Input Reader for file %s already open, will reuse it\n", reader->id);
+        return 0;
+    }
+
+    SplitDataSource* splitSource = castSplitDataSource(reader);
+    long long size;
+    int i;
+
+    splitSource->error = 0;
+    splitSource->position = 0;
+    splitSource->current = -1;
+    for (i = 0; i < splitSource->numSegments; i++) {
+        if (splitDataSourceSelect(splitSource, i)) {
+            return splitSource->error;
+        }
+        if ((size = getSizeOpenFile(splitSource->fileHandle)) < 0) {
+            fprintf(stderr, "splitDataSourceOpen -- ERROR -- Can't measure segment %s\n",
+                splitSource->segmentPaths[i]);
+            splitDataSourceClose(reader);
+            return EIO;
+        }
+        splitSource->segmentStarts[i + 1] = splitSource->segmentStarts[i] + size;
+    }
+
+    if (splitDataSourcePosition(splitSource)) {
+        splitDataSourceClose(reader);
+        return splitSource->error;
+    }
+
+    reader->isOpen = 1;
+
+    return 0;
+}
+
+ScalpelInputReader * scalpel_createInputReaderSplit(const char * const * segmentPaths,
+                                                    int numSegments) 
+{
+    printVerbose("createInputReaderSplit()\n");
+
+    if (!segmentPaths || numSegments < 1) {
+        fprintf(stderr, "createInputReaderSplit() - ERROR no segments\n");
+        return NULL;
+    }
+
+    ScalpelInputReader * splitReader = (ScalpelInputReader *) calloc(1,
+        sizeof(ScalpelInputReader));
+    SplitDataSource * splitSource = (SplitDataSource *) calloc(1,
+        sizeof(SplitDataSource));
+    if (!splitReader || !splitSource) {
+        fprintf(stderr, "createInputReaderSplit() - malloc() ERROR splitReader not created\n ");
+        free(splitReader);
+        free(splitSource);
+        return NULL;
+    }
+    splitReader->dataSource = (void*) splitSource;
+
+    splitSource->segmentPaths = (char **) calloc(numSegments, sizeof(char *));
+    splitSource->segmentStarts = (unsigned long long *) calloc(numSegments + 1,
+        sizeof(unsigned long long));
+    if (!splitSource->segmentPaths || !splitSource->segmentStarts) {
+        fprintf(stderr, "createInputReaderSplit() - malloc() ERROR segment table not created\n ");
+        scalpel_freeInputReaderSplit(splitReader);
+        return NULL;
+    }
+    for (splitSource->numSegments = 0; splitSource->numSegments < numSegments;
+        splitSource->numSegments++) {
+        splitSource->segmentPaths[splitSource->numSegments] =
+            strdup(segmentPaths[splitSource->numSegments]);
+        if (!splitSource->segmentPaths[splitSource->numSegments]) {
+            fprintf(stderr, "createInputReaderSplit() - malloc() ERROR segment path not copied\n ");
+            scalpel_freeInputReaderSplit(splitReader);
+            return NULL;
+        }
+    }
+    splitSource->current = -1;
+    splitSource->fileHandle = NULL;
+
+    //the first segment identifies the image
+    splitReader->id = strdup(segmentPaths[0]);
+    if (!splitReader->id) {
+        fprintf(stderr, "createInputReaderSplit() - malloc() ERROR id not set\n ");
+        scalpel_freeInputReaderSplit(splitReader);
+        return NULL;
+    }
+    splitReader->isOpen = 0;
+
+    //set up functions
+    splitReader->open = splitDataSourceOpen;
+    splitReader->close = splitDataSourceClose;
+    splitReader->getError = splitDataSourceGetError;
+    splitReader->getSize = splitDataSourceGetSize;
+    splitReader->seeko = splitDataSourceSeekO;
+    splitReader->tello = splitDataSourceTellO;
+    splitReader->read = splitDataSourceRead;
+
+    printVerbose("createInputReaderSplit -- input reader created\n");
+
+    return splitReader;
+}
+
+void scalpel_freeInputReaderSplit(ScalpelInputReader * splitReader) 
+{
+    printVerbose("freeInputReaderSplit()\n");
+    if (!splitReader) {
+        return;
+    }
+
+    SplitDataSource * splitSource = castSplitDataSource(splitReader);
+    if (splitSource) {
+        if (splitSource->fileHandle) {
+            fclose(splitSource->fileHandle);
+        }
+        scalpel_freeSplitSegments(splitSource->segmentPaths, splitSource->numSegments);
+        free(splitSource->segmentStarts);
+        free(splitSource);
+    }
+    splitReader->isOpen = 0;
+    free(splitReader->id);
+    free(splitReader);
+}
+
+int scalpel_findSplitSegments(const char * const filePath, char *** segmentPaths) 
+{
+    const char * ext = strrchr(filePath, '.');
+    size_t width, prefixLen, storage = 16, i;
+    unsigned long long number, limit = 1;
+    char ** paths;
+    struct stat info;
+    int numSegments = 0;
+
+    *segmentPaths = NULL;
+    if (!ext || strchr(ext, '/')
+#ifdef _WIN32
+        || strchr(ext, '\\')
+#endif
+        ) {
+        return 0;
+    }
+    ext++;
+    width = strlen(ext);
+    if (width < 3 || width > 9 || strspn(ext, "0123456789") != width) {
+        return 0;
+    }
+    number = strtoull(ext, NULL, 10);
+    if (number > 1) {
+        return 0;
+    }
+    prefixLen = ext - filePath;
+    for (i = 0; i < width; i++) {
+        limit *= 10;
+    }
+
+    paths = (char **) malloc(storage * sizeof(char *));
+    if (!paths) {
+        return 0;
+    }
+
+    // collect consecutive segments of the same extension width
+    while (number + numSegments < limit) {
+        if (numSegments == (int) storage) {
+            char ** grown = (char **) realloc(paths, 2 * storage * sizeof(char *));
+            if (!grown) {
+                scalpel_freeSplitSegments(paths, numSegments);
+                return 0;
+            }
+            paths = grown;
+            storage *= 2;
+        }
+        paths[numSegments] = (char *) malloc(prefixLen + width + 1);
+        if (!paths[numSegments]) {
+            scalpel_freeSplitSegments(paths, numSegments);
+            return 0;
+        }
+        memcpy(paths[numSegments], filePath, prefixLen);
+        snprintf(paths[numSegments] + prefixLen, width + 1, "%0*llu", (int) width,
+            number + numSegments);
+        if (stat(paths[numSegments], &info) != 0 || !S_ISREG(info.st_mode)) {
+            free(paths[numSegments]);
+            break;
+        }
+        numSegments++;
+    }
+
+    if (numSegments < 2) {
+        scalpel_freeSplitSegments(paths, numSegments);
+        return 0;
+    }
+    *segmentPaths = paths;
+    return numSegments;
+}
+
+void scalpel_freeSplitSegments(char ** segmentPaths, int numSegments) 
+{
+    int i;
+
+    if (!segmentPaths) {
+        return;
+    }
+    for (i = 0; i < numSegments; i++) {
+        free(segmentPaths[i]);
+    }
+    free(segmentPaths);
+}
+
+
+/********** stream implementation ***********/
+
+static inline StreamDataSource* castStreamDataSource(ScalpelInputReader * reader) 
+{
+    return (StreamDataSource*) reader->dataSource;
+}
+
+//read up to 'len' new bytes from the stream into 'buf', keeping them in the
+//rewind ring
+static size_t streamDataSourceFill(StreamDataSource * streamSource,
+                                   unsigned char * buf, size_t len) 
+{
+    size_t got = fread(buf, 1, len, streamSource->fileHandle);
+    size_t keep = got < SCALPEL_STREAM_REWIND ? got : SCALPEL_STREAM_REWIND;
+    const unsigned char * src = buf + got - keep;
+    size_t at, chunk;
+
+    streamSource->end += got - keep;
+    while (keep > 0) {
+        at = streamSource->end % SCALPEL_STREAM_REWIND;
+        chunk = SCALPEL_STREAM_REWIND - at < keep ? SCALPEL_STREAM_REWIND - at : keep;
+        memcpy(streamSource->rewind + at, src, chunk);
+        streamSource->end += chunk;
+        src += chunk;
+        keep -= chunk;
+    }
+    if (got < len && ferror(streamSource->fileHandle)) {
+        fprintf(stderr, "streamDataSourceFill() - ERROR reading stream\n");
+        streamSource->error = EIO;
+    }
+    return got;
+}
+
+static int streamDataSourceRead(ScalpelInputReader * const reader, void * buf,
+                                size_t size, size_t count) 
+{
+    StreamDataSource* streamSource = castStreamDataSource(reader);
+    unsigned char discard[64 * 1024];
+    size_t wanted = size * count, done = 0, chunk, at, got;
+
+    if (wanted == 0 || streamSource->error) {
+        return 0;
+    }
+
+    //bytes seeked back over are served from the rewind ring
+    while (done < wanted && streamSource->position < streamSource->end) {
+        at = streamSource->position % SCALPEL_STREAM_REWIND;
+        chunk = SCALPEL_STREAM_REWIND - at;
+        if (chunk > streamSource->end - streamSource->position) {
+            chunk = (size_t) (streamSource->end - streamSource->position);
+        }
+        if (chunk > wanted - done) {
+            chunk = wanted - done;
+        }
+        memcpy((char*) buf + done, streamSource->rewind + at, chunk);
+        streamSource->position += chunk;
+        done += chunk;
+    }
+
+    //bytes seeked forward over are read and discarded
+    while (streamSource->position > streamSource->end) {
+        chunk = sizeof(discard);
+        if (chunk > streamSource->position - streamSource->end) {
+            chunk = (size_t) (streamSource->position - streamSource->end);
+        }
+        if (streamDataSourceFill(streamSource, discard, chunk) < chunk) {
+            streamSource->position = streamSource->end;
+            return done / size;
+        }
+    }
+
+    while (done < wanted) {
+        got = streamDataSourceFill(streamSource, (unsigned char*) buf + done, wanted - done);
+        streamSource->position += got;
+        done += got;
+        if (got == 0) {
+            break;
+        }
+    }
+    return done / size;
+}
+
+static unsigned long long streamDataSourceTellO(ScalpelInputReader * const reader) 
+{
+    return castStreamDataSource(reader)->position;
+}
+
+static int streamDataSourceGetError(ScalpelInputReader * const reader) 
+{
+    return castStreamDataSource(reader)->error;
+}
+
+//the size of a stream isn't known until it ends
+static long long streamDataSourceGetSize(ScalpelInputReader * const reader) 
+{
+    if (!reader->isOpen) {
+        fprintf(stderr, "Error: Input Reader for file %s not open, can't get size\n", reader->id);
+    }
+    return -1;
+}
+
+//seek within the rewind ring, or forward; seeking relative to the end is
+//impossible
+static int streamDataSourceSeekO(ScalpelInputReader * const reader, 
+                                 long long offset,
+                                 scalpel_SeekRel whence) 
+{
+    StreamDataSource* streamSource = castStreamDataSource(reader);
+    long long base = 0;
+
+    switch (whence) {
+    case SCALPEL_SEEK_SET:
+        base = 0;
+        break;
+    case SCALPEL_SEEK_CUR:
+        base = streamSource->position;
+        break;
+    default:
+        errno = ESPIPE;
+        return -1;
+    }
+
+    if (base + offset < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    if ((unsigned long long) (base + offset) + SCALPEL_STREAM_REWIND < streamSource->end) {
+        fprintf(stderr, "streamDataSourceSeekO() - ERROR can't seek back past the last %d bytes of %s\n",
+            SCALPEL_STREAM_REWIND, reader->id);
+        errno = ESPIPE;
+        return -1;
+    }
+    streamSource->position = base + offset;
+    return 0;
+}
+
+static void streamDataSourceClose(ScalpelInputReader * const reader) 
+{
+    StreamDataSource* streamSource = castStreamDataSource(reader);
+    if (streamSource->fileHandle && streamSource->fileHandle != stdin) {
+        fclose(streamSource->fileHandle);
+    }
+    streamSource->fileHandle = NULL;
+    return;
+}
+
+static int streamDataSourceOpen(ScalpelInputReader * const reader) 
+{
+    if (reader->isOpen) {
+        //OK, reuse it
+        fprintf(stderr, "streamDataSourceOpen -- WARNING -- Input Reader for file %s already open, will reuse it\n", reader->id);
+        return 0;
+    }
+
+    StreamDataSource* streamSource = castStreamDataSource(reader);
+
+    if (streamSource->opened) {
+        fprintf(stderr, "streamDataSourceOpen -- ERROR -- Stream %s was read before and can't be read again\n", reader->id);
+        return ESPIPE;
+    }
+
+    if (!strcmp(reader->id, "-")) {
+        streamSource->fileHandle = stdin;
+#ifdef _WIN32
+        // set binary mode for Win32
+        setmode(fileno(stdin), O_BINARY);
+#endif
+    }
+    else {
+        streamSource->fileHandle = fopen(reader->id, "rb");
+        if (!streamSource->fileHandle) {
+            fprintf(stderr, "streamDataSourceOpen -- ERROR -- Can't open Input Reader for %s\n", reader->id);
+            return errno;
+        }
+    }
+
+    streamSource->opened = 1;
+    streamSource->error = 0;
+    streamSource->position = 0;
+    streamSource->end = 0;
+    reader->isOpen = 1;
+
+    return 0;
+}
+
+ScalpelInputReader * scalpel_createInputReaderStream(const char * const filePath) 
+{
+    printVerbose("createInputReaderStream()\n");
+
+    ScalpelInputReader * streamReader = (ScalpelInputReader *) calloc(1,
+        sizeof(ScalpelInputReader));
+    StreamDataSource * streamSource = (StreamDataSource *) calloc(1,
+        sizeof(StreamDataSource));
+    if (!streamReader || !streamSource) {
+        fprintf(stderr, "createInputReaderStream() - malloc() ERROR streamReader not created\n ");
+        free(streamReader);
+        free(streamSource);
+        return NULL;
+    }
+    streamReader->dataSource = (void*) streamSource;
+
+    streamSource->rewind = (unsigned char *) malloc(SCALPEL_STREAM_REWIND);
+    streamReader->id = strdup(filePath);
+    if (!streamSource->rewind || !streamReader->id) {
+        fprintf(stderr, "createInputReaderStream() - malloc() ERROR streamReader not created\n ");
+        scalpel_freeInputReaderStream(streamReader);
+        return NULL;
+    }
+    streamReader->isOpen = 0;
+
+    //set up functions
+    streamReader->open = streamDataSourceOpen;
+    streamReader->close = streamDataSourceClose;
+    streamReader->getError = streamDataSourceGetError;
+    streamReader->getSize = streamDataSourceGetSize;
+    streamReader->seeko = streamDataSourceSeekO;
+    streamReader->tello = streamDataSourceTellO;
+    streamReader->read = streamDataSourceRead;
+
+    printVerbose("createInputReaderStream -- input reader created\n");
+
+    return streamReader;
+}
+
+void scalpel_freeInputReaderStream(ScalpelInputReader * streamReader) 
+{
+    printVerbose("freeInputReaderStream()\n");
+    if (!streamReader) {
+        return;
+    }
+
+    StreamDataSource * streamSource = castStreamDataSource(streamReader);
+    if (streamSource) {
+        if (streamSource->fileHandle && streamSource->fileHandle != stdin) {
+            fclose(streamSource->fileHandle);
+        }
+        free(streamSource->rewind);
+        free(streamSource);
+    }
+    streamReader->isOpen = 0;
+    free(streamReader->id);
+    free(streamReader);
+}
+
+int scalpel_isStreamInput(const char * const filePath) 
+{
+#ifndef _WIN32
+    struct stat info;
+#endif
+
+    if (!strcmp(filePath, "-")) {
+        return 1;
+    }
+#ifndef _WIN32
+    if (stat(filePath, &info) == 0 && S_ISFIFO(info.st_mode)) {
+        return 1;
+    }
+#endif
+    return 0;
+}
+
+int scalpelInputIsStream(ScalpelInputReader * const reader) 
+{
+    return reader->open == streamDataSourceOpen;
+}
+
+
+#ifdef HAVE_LIBZ
+
+/********** seekable compressed image implementation ***********/
+
+#define GZIP_ID1                  0x1f
+#define GZIP_ID2                  0x8b
+#define GZIP_CM_DEFLATE           8
+#define GZIP_FLG_FEXTRA           4
+#define GZIP_FIXED_HEADER         12    //gzip member header through XLEN
+#define COMPRESSED_NO_FRAME       (~0ULL)
+#define COMPRESSED_MAX_WORKERS    32
+#define COMPRESSED_JOBS_PER_WORKER 8
+
+static inline CompressedDataSource* castCompressedDataSource(ScalpelInputReader * reader) 
+{
+    return (CompressedDataSource*) reader->dataSource;
+}
+
+static unsigned long long compressedLittleEndian(const unsigned char * p, int len) 
+{
+    unsigned long long value = 0;
+    while (len-- > 0) {
+        value = (value << 8) | p[len];
+    }
+    return value;
+}
+
+//the BGZF block size of the gzip member at the file position, 0 if the
+//member has no BC extra subfield, -1 if it is not a gzip member at all
+static long long compressedBlockSize(FILE * f) 
+{
+    unsigned char header[GZIP_FIXED_HEADER], extra[65536];
+    size_t xlen, i, slen;
+
+    if (fread(header, 1, GZIP_FIXED_HEADER, f) != GZIP_FIXED_HEADER ||
+        header[0] != GZIP_ID1 || header[1] != GZIP_ID2 || header[2] != GZIP_CM_DEFLATE) {
+        return -1;
+    }
+    if (!(header[3] & GZIP_FLG_FEXTRA)) {
+        return 0;
+    }
+    xlen = (size_t) compressedLittleEndian(header + 10, 2);
+    if (fread(extra, 1, xlen, f) != xlen) {
+        return -1;
+    }
+    for (i = 0; i + 4 <= xlen; i += 4 + slen) {
+        slen = (size_t) compressedLittleEndian(extra + i + 2, 2);
+        if (extra[i] == 'B' && extra[i + 1] == 'C' && slen == 2 && i + 6 <= xlen) {
+            return compressedLittleEndian(extra + i + 4, 2) + 1;
+        }
+    }
+    return 0;
+}
+
+//inflate length compressed bytes holding one or more gzip members.  With a
+//destination, exactly size bytes must come out; without one the output is
+//only counted into *size
+static int compressedInflate(z_stream * zs, unsigned char * in, size_t length,
+                             unsigned char * dest, unsigned long long * size) 
+{
+    unsigned char scratch[65536];
+    unsigned long long produced = 0;
+    int ret;
+
+    if (inflateReset(zs) != Z_OK) {
+        return -1;
+    }
+    zs->next_in = in;
+    zs->avail_in = (uInt) length;
+    for (;;) {
+        if (dest) {
+            zs->next_out = dest + produced;
+            zs->avail_out = (uInt) (*size - produced);
+        } else {
+            zs->next_out = scratch;
+            zs->avail_out = sizeof(scratch);
+        }
+        uInt before = zs->avail_out;
+        ret = inflate(zs, Z_NO_FLUSH);
+        produced += before - zs->avail_out;
+        if (ret == Z_STREAM_END) {
+            if ((dest && produced == *size) || zs->avail_in == 0) {
+                break;
+            }
+            // the next member of the frame
+            if (inflateReset(zs) != Z_OK) {
+                return -1;
+            }
+        } else if (ret != Z_OK) {
+            return -1;
+        }
+    }
+    if (!dest) {
+        *size = produced;
+    }
+    return dest && produced != *size ? -1 : 0;
+}
+
+//read and decompress frame into dest
+static int compressedDecodeFrame(CompressedWorker * worker, z_stream * zs,
+                                 unsigned long long frame, unsigned char * dest) 
+{
+    const CompressedFrame * f = worker->source->frames + frame;
+    size_t length = (size_t) (f[1].offset - f[0].offset);
+    unsigned long long size = f[1].start - f[0].start;
+
+    if (length > worker->inbufSize) {
+        unsigned char * inbuf = (unsigned char *) realloc(worker->inbuf, length);
+        if (!inbuf) {
+            return -1;
+        }
+        worker->inbuf = inbuf;
+        worker->inbufSize = length;
+    }
+    if (fseeko(worker->fileHandle, f->offset, SEEK_SET) ||
+        fread(worker->inbuf, 1, length, worker->fileHandle) != length) {
+        return -1;
+    }
+    return compressedInflate(zs, worker->inbuf, length, dest, &size);
+}
+
+//worker pool thread: decompress frames until handed a NULL job
+static void *compressedWorkerThread(void * arg) 
+{
+    CompressedWorker * worker = (CompressedWorker *) arg;
+    CompressedJob * job;
+    z_stream zs;
+    int ready;
+
+    memset(&zs, 0, sizeof(zs));
+    // 16 + MAX_WBITS: gzip wrapper, CRC and length are checked
+    ready = inflateInit2(&zs, 16 + MAX_WBITS) == Z_OK;
+    while ((job = (CompressedJob *) get(worker->source->todo)) != NULL) {
+        job->status = ready ? compressedDecodeFrame(worker, &zs, job->frame, job->dest) : -1;
+        put(worker->source->done, job);
+    }
+    if (ready) {
+        inflateEnd(&zs);
+    }
+    return NULL;
+}
+
+//wait for one finished job and recycle it
+static void compressedCollect(CompressedDataSource * source, int * failed) 
+{
+    CompressedJob * job = (CompressedJob *) get(source->done);
+    if (job->status) {
+        fprintf(stderr, "compressedDataSourceRead() - ERROR can't decompress frame at offset %llu\n",
+            source->frames[job->frame].offset);
+        *failed = 1;
+    }
+    source->freeJobs[source->numFreeJobs++] = job;
+}
+
+//queue a frame decompression, waiting for a job slot if all are in flight
+static void compressedSubmit(CompressedDataSource * source, unsigned long long frame,
+                             unsigned char * dest, int * failed) 
+{
+    if (source->numFreeJobs == 0) {
+        compressedCollect(source, failed);
+    }
+    CompressedJob * job = source->freeJobs[--source->numFreeJobs];
+    job->frame = frame;
+    job->dest = dest;
+    job->status = 0;
+    put(source->todo, job);
+}
+
+//index of the frame holding logical position 'position'
+static unsigned long long compressedFrameAt(const CompressedDataSource * source,
+                                            unsigned long long position) 
+{
+    unsigned long long low = 0, high = source->numFrames - 1, mid;
+
+    while (low < high) {
+        mid = low + (high - low + 1) / 2;
+        if (source->frames[mid].start <= position) {
+            low = mid;
+        } else {
+            high = mid - 1;
+        }
+    }
+    return low;
+}
+
+static int compressedDataSourceRead(ScalpelInputReader * const reader, void * buf,
+                                    size_t size, size_t count) 
+{
+    CompressedDataSource* source = castCompressedDataSource(reader);
+    unsigned long long total = source->frames[source->numFrames].start;
+    unsigned long long begin = source->position, end, first, last, frame, fbegin, fend;
+    unsigned long long edge[2] = { COMPRESSED_NO_FRAME, COMPRESSED_NO_FRAME };
+    int slot[2] = { -1, -1 }, decoded[2] = { 0, 0 }, failed = 0, e, s;
+
+    if (size == 0 || count == 0 || begin >= total || source->numFrames == 0) {
+        return 0;
+    }
+    end = begin + (unsigned long long) size * count;
+    if (end > total) {
+        end = total;
+    }
+    first = compressedFrameAt(source, begin);
+    last = compressedFrameAt(source, end - 1);
+
+    // frames only partly inside the read go through the cache
+    if (source->frames[first].start < begin || source->frames[first + 1].start > end) {
+        edge[0] = first;
+    }
+    if (last != first && source->frames[last + 1].start > end) {
+        edge[1] = last;
+    }
+    for (e = 0; e < 2; e++) {
+        for (s = 0; s < 2 && edge[e] != COMPRESSED_NO_FRAME; s++) {
+            if (source->cachedFrame[s] == edge[e]) {
+                slot[e] = s;
+            }
+        }
+    }
+    for (e = 0; e < 2; e++) {
+        if (edge[e] != COMPRESSED_NO_FRAME && slot[e] < 0) {
+            slot[e] = slot[1 - e] == 0 ? 1 : 0;
+            source->cachedFrame[slot[e]] = COMPRESSED_NO_FRAME;
+            compressedSubmit(source, edge[e], source->cache[slot[e]], &failed);
+            decoded[e] = 1;
+        }
+    }
+
+    // whole frames are decompressed in place
+    for (frame = first; frame <= last; frame++) {
+        if (frame != edge[0] && frame != edge[1]) {
+            compressedSubmit(source, frame,
+                (unsigned char *) buf + (source->frames[frame].start - begin), &failed);
+        }
+    }
+    while (source->numFreeJobs < source->numJobs) {
+        compressedCollect(source, &failed);
+    }
+    if (failed) {
+        source->error = EIO;
+        return 0;
+    }
+
+    for (e = 0; e < 2; e++) {
+        if (edge[e] == COMPRESSED_NO_FRAME) {
+            continue;
+        }
+        if (decoded[e]) {
+            source->cachedFrame[slot[e]] = edge[e];
+        }
+        fbegin = source->frames[edge[e]].start;
+        fend = source->frames[edge[e] + 1].start;
+        if (fbegin < begin) {
+            fbegin = begin;
+        }
+        if (fend > end) {
+            fend = end;
+        }
+        memcpy((unsigned char *) buf + (fbegin - begin),
+            source->cache[slot[e]] + (fbegin - source->frames[edge[e]].start),
+            (size_t) (fend - fbegin));
+    }
+
+    source->position = end;
+    // conform with fread() semantics by returning # of items read
+    return (end - begin) / size;
+}
+
+static unsigned long long compressedDataSourceTellO(ScalpelInputReader * const reader) 
+{
+    return castCompressedDataSource(reader)->position;
+}
+
+static int compressedDataSourceGetError(ScalpelInputReader * const reader) 
+{
+    return castCompressedDataSource(reader)->error;
+}
+
+//return size from the current position like getSizeOpenFile(), or -1 on error
+static long long compressedDataSourceGetSize(ScalpelInputReader * const reader) 
+{
+    if (!reader->isOpen) {
+        fprintf(stderr, "Error: Input Reader for file %s not open, can't get size\n", reader->id);
+        return -1;
+    }
+
+    const CompressedDataSource* source = castCompressedDataSource(reader);
+    return source->frames[source->numFrames].start - source->position;
+}
+
+static int compressedDataSourceSeekO(ScalpelInputReader * const reader, 
+                                     long long offset,
+                                     scalpel_SeekRel whence) 
+{
+    CompressedDataSource* source = castCompressedDataSource(reader);
+    long long base = 0;
+
+    switch (whence) {
+    case SCALPEL_SEEK_SET:
+        base = 0;
+        break;
+    case SCALPEL_SEEK_CUR:
+        base = source->position;
+        break;
+    case SCALPEL_SEEK_END:
+        base = source->frames[source->numFrames].start;
+        break;
+    default:
+
+        break;
+    }
+
+    if (base + offset < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    source->position = base + offset;
+    return 0;
+}
+
+//append a frame, growing the table as needed
+static int compressedAddFrame(CompressedDataSource * source, unsigned long long * storage,
+                              unsigned long long offset, unsigned long long start) 
+{
+    if (source->numFrames + 1 >= *storage) {
+        CompressedFrame * frames = (CompressedFrame *) realloc(source->frames,
+            2 * *storage * sizeof(CompressedFrame));
+        if (!frames) {
+            return -1;
+        }
+        source->frames = frames;
+        *storage *= 2;
+    }
+    source->frames[source->numFrames].offset = offset;
+    source->frames[source->numFrames].start = start;
+    source->numFrames++;
+    return 0;
+}
+
+//frame table from the BGZF block headers and ISIZE trailers.  Empty blocks,
+//such as the BGZF end-of-file marker, are folded into the preceding frame
+static int compressedIndexBlocks(ScalpelInputReader * const reader, FILE * f,
+                                 unsigned long long fileSize, unsigned long long * storage) 
+{
+    CompressedDataSource* source = castCompressedDataSource(reader);
+    unsigned long long offset = 0, start = 0, isize;
+    unsigned char trailer[4];
+    long long blockSize;
+
+    while (offset < fileSize) {
+        if (fseeko(f, offset, SEEK_SET) || (blockSize = compressedBlockSize(f)) <= 0 ||
+            offset + blockSize > fileSize) {
+            fprintf(stderr, "compressedDataSourceOpen -- ERROR -- %s has no BGZF block at offset %llu\n",
+                reader->id, offset);
+            return EIO;
+        }
+        if (fseeko(f, offset + blockSize - 4, SEEK_SET) || fread(trailer, 1, 4, f) != 4) {
+            return EIO;
+        }
+        isize = compressedLittleEndian(trailer, 4);
+        if (isize > 0 && compressedAddFrame(source, storage, offset, start)) {
+            return ENOMEM;
+        }
+        start += isize;
+        offset += blockSize;
+    }
+    source->frames[source->numFrames].offset = fileSize;
+    source->frames[source->numFrames].start = start;
+    return 0;
+}
+
+//frame table from a .gzi index: a count followed by (compressed, uncompressed)
+//offset pairs of all but the first frame, as 64-bit little endian.  The size of
+//the last frame isn't recorded, so it is measured by decompressing it once
+static int compressedIndexFile(CompressedDataSource * source, FILE * f,
+                               unsigned long long fileSize, unsigned long long * storage) 
+{
+    unsigned long long entries, i, offset, start, lastSize;
+    unsigned char entry[16], * inbuf;
+    FILE * index = fopen(source->indexPath, "rb");
+    int ret = EIO;
+    z_stream zs;
+
+    if (!index) {
+        fprintf(stderr, "compressedDataSourceOpen -- ERROR -- Can't open index %s\n", source->indexPath);
+        return errno ? errno : EIO;
+    }
+    if (fread(entry, 1, 8, index) != 8 || compressedAddFrame(source, storage, 0, 0)) {
+        goto out;
+    }
+    entries = compressedLittleEndian(entry, 8);
+    for (i = 0; i < entries; i++) {
+        if (fread(entry, 1, 16, index) != 16) {
+            goto out;
+        }
+        offset = compressedLittleEndian(entry, 8);
+        start = compressedLittleEndian(entry + 8, 8);
+        if (offset <= source->frames[source->numFrames - 1].offset || offset >= fileSize ||
+            start < source->frames[source->numFrames - 1].start) {
+            goto out;
+        }
+        // an empty frame is replaced by the one following it
+        if (start == source->frames[source->numFrames - 1].start) {
+            source->numFrames--;
+        }
+        if (compressedAddFrame(source, storage, offset, start)) {
+            ret = ENOMEM;
+            goto out;
+        }
+    }
+
+    offset = source->frames[source->numFrames - 1].offset;
+    inbuf = (unsigned char *) malloc((size_t) (fileSize - offset));
+    memset(&zs, 0, sizeof(zs));
+    if (inbuf && inflateInit2(&zs, 16 + MAX_WBITS) == Z_OK) {
+        if (!fseeko(f, offset, SEEK_SET) &&
+            fread(inbuf, 1, (size_t) (fileSize - offset), f) == fileSize - offset &&
+            !compressedInflate(&zs, inbuf, (size_t) (fileSize - offset), NULL, &lastSize)) {
+            source->frames[source->numFrames].offset = fileSize;
+            source->frames[source->numFrames].start =
+                source->frames[source->numFrames - 1].start + lastSize;
+            if (lastSize == 0) {
+                source->numFrames--;
+            }
+            ret = 0;
+        }
+        inflateEnd(&zs);
+    }
+    free(inbuf);
+
+  out:
+    if (ret) {
+        fprintf(stderr, "compressedDataSourceOpen -- ERROR -- index %s is damaged or doesn't match the image\n",
+            source->indexPath);
+    }
+    fclose(index);
+    return ret;
+}
+
+//build the frame table and the edge frame caches
+static int compressedBuildIndex(ScalpelInputReader * const reader) 
+{
+    CompressedDataSource* source = castCompressedDataSource(reader);
+    unsigned long long storage = 1024;
+    long long fileSize;
+    size_t frameSize;
+    unsigned long long i;
+    int ret;
+
+    FILE * f = fopen(reader->id, "rb");
+    if (!f) {
+        fprintf(stderr, "compressedDataSourceOpen -- ERROR -- Can't open Input Reader for %s\n", reader->id);
+        return errno ? errno : EIO;
+    }
+    source->numFrames = 0;
+    source->frames = (CompressedFrame *) malloc(storage * sizeof(CompressedFrame));
+    if (!source->frames) {
+        fclose(f);
+        return ENOMEM;
+    }
+    if ((fileSize = getSizeOpenFile(f)) < 0) {
+        ret = EIO;
+    } else if (source->indexPath) {
+        ret = compressedIndexFile(source, f, fileSize, &storage);
+    } else {
+        ret = compressedIndexBlocks(reader, f, fileSize, &storage);
+    }
+    fclose(f);
+
+    source->maxFrameSize = 1;
+    for (i = 0; ret == 0 && i < source->numFrames; i++) {
+        frameSize = (size_t) (source->frames[i + 1].start - source->frames[i].start);
+        if (frameSize > source->maxFrameSize) {
+            source->maxFrameSize = frameSize;
+        }
+    }
+    for (i = 0; ret == 0 && i < 2; i++) {
+        source->cachedFrame[i] = COMPRESSED_NO_FRAME;
+        if ((source->cache[i] = (unsigned char *) malloc(source->maxFrameSize)) == NULL) {
+            ret = ENOMEM;
+        }
+    }
+    if (ret) {
+        free(source->frames);
+        free(source->cache[0]);
+        free(source->cache[1]);
+        source->frames = NULL;
+        source->cache[0] = source->cache[1] = NULL;
+        source->numFrames = 0;
+    }
+    return ret;
+}
+
+static void compressedDataSourceClose(ScalpelInputReader * const reader) 
+{
+    CompressedDataSource* source = castCompressedDataSource(reader);
+    int i;
+
+    for (i = 0; i < source->numWorkers; i++) {
+        put(source->todo, NULL);
+    }
+    for (i = 0; i < source->numWorkers; i++) {
+        pthread_join(source->workers[i].thread, NULL);
+        fclose(source->workers[i].fileHandle);
+        free(source->workers[i].inbuf);
+    }
+    free(source->workers);
+    source->workers = NULL;
+    source->numWorkers = 0;
+    return;
+}
+
+//the frame table is built by the first open and kept; every open starts a
+//worker pool, which the close stops again
+static int compressedDataSourceOpen(ScalpelInputReader * const reader) 
+{
+    if (reader->isOpen) {
+        //OK, reuse it
+        fprintf(stderr, "compressedDataSourceOpen -- WARNING -- Input Reader for file %s already open, will reuse it\n", reader->id);
+        return 0;
+    }
+
+    CompressedDataSource* source = castCompressedDataSource(reader);
+    int ret, i;
+    long workers = 4;
+
+    if (!source->frames && (ret = compressedBuildIndex(reader)) != 0) {
+        return ret;
+    }
+
+#ifndef _WIN32
+    workers = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    if (workers < 1) {
+        workers = 1;
+    } else if (workers > COMPRESSED_MAX_WORKERS) {
+        workers = COMPRESSED_MAX_WORKERS;
+    }
+
+    source->error = 0;
+    source->position = 0;
+    source->workers = (CompressedWorker *) calloc(workers, sizeof(CompressedWorker));
+    if (!source->workers) {
+        return ENOMEM;
+    }
+    for (i = 0; i < workers; i++) {
+        CompressedWorker * worker = source->workers + i;
+        worker->source = source;
+        if ((worker->fileHandle = fopen(reader->id, "rb")) == NULL) {
+            ret = errno ? errno : EIO;
+        } else if (pthread_create(&worker->thread, NULL, compressedWorkerThread, worker)) {
+            fclose(worker->fileHandle);
+            ret = EAGAIN;
+        } else {
+            source->numWorkers++;
+            continue;
+        }
+        fprintf(stderr, "compressedDataSourceOpen -- ERROR -- Can't start decompression for %s\n", reader->id);
+        compressedDataSourceClose(reader);
+        return ret;
+    }
+
+    reader->isOpen = 1;
+
+    return 0;
+}
+
+ScalpelInputReader * scalpel_createInputReaderCompressed(const char * const filePath) 
+{
+    printVerbose("createInputReaderCompressed()\n");
+
+    ScalpelInputReader * compressedReader = (ScalpelInputReader *) calloc(1,
+        sizeof(ScalpelInputReader));
+    CompressedDataSource * source = (CompressedDataSource *) calloc(1,
+        sizeof(CompressedDataSource));
+    if (!compressedReader || !source) {
+        fprintf(stderr, "createInputReaderCompressed() - malloc() ERROR compressedReader not created\n ");
+        free(compressedReader);
+        free(source);
+        return NULL;
+    }
+    compressedReader->dataSource = (void*) source;
+
+    compressedReader->id = strdup(filePath);
+    source->indexPath = (char *) malloc(strlen(filePath) + 5);
+    source->numJobs = COMPRESSED_MAX_WORKERS * COMPRESSED_JOBS_PER_WORKER;
+    source->jobs = (CompressedJob *) calloc(source->numJobs, sizeof(CompressedJob));
+    source->freeJobs = (CompressedJob **) calloc(source->numJobs, sizeof(CompressedJob *));
+    if (!compressedReader->id || !source->indexPath || !source->jobs || !source->freeJobs) {
+        fprintf(stderr, "createInputReaderCompressed() - malloc() ERROR compressedReader not created\n ");
+        scalpel_freeInputReaderCompressed(compressedReader);
+        return NULL;
+    }
+    sprintf(source->indexPath, "%s.gzi", filePath);
+    if (access(source->indexPath, R_OK)) {
+        free(source->indexPath);
+        source->indexPath = NULL;
+    }
+    for (source->numFreeJobs = 0; source->numFreeJobs < source->numJobs; source->numFreeJobs++) {
+        source->freeJobs[source->numFreeJobs] = source->jobs + source->numFreeJobs;
+    }
+    // with at most numJobs in flight, workers never block on the done queue
+    source->todo = syncqueue_init("compressed todo", source->numJobs + COMPRESSED_MAX_WORKERS);
+    source->done = syncqueue_init("compressed done", source->numJobs);
+    compressedReader->isOpen = 0;
+
+    //set up functions
+    compressedReader->open = compressedDataSourceOpen;
+    compressedReader->close = compressedDataSourceClose;
+    compressedReader->getError = compressedDataSourceGetError;
+    compressedReader->getSize = compressedDataSourceGetSize;
+    compressedReader->seeko = compressedDataSourceSeekO;
+    compressedReader->tello = compressedDataSourceTellO;
+    compressedReader->read = compressedDataSourceRead;
+
+    printVerbose("createInputReaderCompressed -- input reader created\n");
+
+    return compressedReader;
+}
+
+void scalpel_freeInputReaderCompressed(ScalpelInputReader * compressedReader) 
+{
+    printVerbose("freeInputReaderCompressed()\n");
+    if (!compressedReader) {
+        return;
+    }
+
+    CompressedDataSource * source = castCompressedDataSource(compressedReader);
+    if (compressedReader->isOpen) {
+        compressedDataSourceClose(compressedReader);
+        compressedReader->isOpen = 0;
+    }
+    if (source->todo) {
+        syncqueue_destroy(source->todo);
+    }
+    if (source->done) {
+        syncqueue_destroy(source->done);
+    }
+    free(source->frames);
+    free(source->cache[0]);
+    free(source->cache[1]);
+    free(source->jobs);
+    free(source->freeJobs);
+    free(source->indexPath);
+    free(source);
+    free(compressedReader->id);
+    free(compressedReader);
+}
+
+int scalpel_isCompressedImage(const char * const filePath) 
+{
+    FILE * f = fopen(filePath, "rb");
+    char * indexPath;
+    long long blockSize;
+    int indexed = 0;
+
+    if (!f) {
+        return 0;
+    }
+    blockSize = compressedBlockSize(f);
+    fclose(f);
+    if (blockSize < 0) {
+        return 0;
+    }
+    if (blockSize == 0 && (indexPath = (char *) malloc(strlen(filePath) + 5)) != NULL) {
+        sprintf(indexPath, "%s.gzi", filePath);
+        indexed = access(indexPath, R_OK) == 0;
+        free(indexPath);
+    }
+    if (blockSize == 0 && !indexed) {
+        fprintf(stderr, "WARNING: %s is gzip compressed, but neither BGZF nor indexed (.gzi);\n"
+            "it will be carved as is.\n", filePath);
+        return 0;
+    }
+    return 1;
+}
+
+#endif
+
+
+/********** generic creation ***********/
+
+ScalpelInputReader * scalpel_createInputReader(const char * const filePath) 
+{
+    char ** segmentPaths;
+    int numSegments;
+
+    // a pipe must not be read before carving starts
+    if (scalpel_isStreamInput(filePath)) {
+        fprintf(stdout, "Reading %s as a stream, in a single pass.\n",
+            strcmp(filePath, "-") ? filePath : "standard input");
+        return scalpel_createInputReaderStream(filePath);
+    }
+
+    numSegments = scalpel_findSplitSegments(filePath, &segmentPaths);
+
+    if (numSegments > 0) {
+        fprintf(stdout, "Reading %s ... %s as one split image.\n",
+            segmentPaths[0], segmentPaths[numSegments - 1]);
+        ScalpelInputReader * splitReader = scalpel_createInputReaderSplit(
+            (const char * const *) segmentPaths, numSegments);
+        scalpel_freeSplitSegments(segmentPaths, numSegments);
+        return splitReader;
+    }
+
+#ifdef HAVE_LIBZ
+    if (scalpel_isCompressedImage(filePath)) {
+        fprintf(stdout, "Reading %s as a seekable compressed image.\n", filePath);
+        return scalpel_createInputReaderCompressed(filePath);
+    }
+#endif
+
+    return scalpel_createInputReaderFile(filePath);
+}
+
+void scalpel_freeInputReader(ScalpelInputReader * reader) 
+{
+    if (!reader) {
+        return;
+    }
+    if (reader->open == splitDataSourceOpen) {
+        scalpel_freeInputReaderSplit(reader);
+    } else if (reader->open == streamDataSourceOpen) {
+        scalpel_freeInputReaderStream(reader);
+#ifdef HAVE_LIBZ
+    } else if (reader->open == compressedDataSourceOpen) {
+        scalpel_freeInputReaderCompressed(reader);
+#endif
+    } else {
+        scalpel_freeInputReaderFile(reader);
+    }
+}
@@ -94,4 +94,135 @@ extern ScalpelInputReader * scalpel_createInputReaderFile(const char * const fil
 //frees a ScalpelInputReader with FILE implementation
 extern void scalpel_freeInputReaderFile(ScalpelInputReader * const fileReader);
 
+
+/********************* split raw image implementation of ScalpelInputReader **********************/
+
+//presents the segments of a split raw image (e.g. image.001, image.002, ...)
+//as one logical device.  Segment sizes are measured once when the reader is
+//opened; only the segment holding the current position is kept open.
+typedef struct SplitDataSource {
+    int numSegments;
+    char ** segmentPaths;
+    unsigned long long * segmentStarts; //logical offset of each segment, numSegments + 1 entries
+    int current;                        //segment holding position, -1 if none open
+    FILE * fileHandle;                  //handle of segment 'current'
+    unsigned long long position;        //logical position
+    int error;
+} SplitDataSource;
+
+
+//creates a ScalpelInputReader over the given ordered segment files.  The reader
+//is identified by the first segment's path
+extern ScalpelInputReader * scalpel_createInputReaderSplit(const char * const * segmentPaths,
+                                                           int numSegments);
+//frees a ScalpelInputReader with split raw image implementation
+extern void scalpel_freeInputReaderSplit(ScalpelInputReader * const splitReader);
+//if filePath is the first segment of a split raw image (a numeric extension of
+//at least 3 digits with value 0 or 1, e.g. image.001) and the next segment
+//exists, returns the number of consecutive segments and stores their paths in
+//*segmentPaths (free with scalpel_freeSplitSegments()); otherwise returns 0
+extern int scalpel_findSplitSegments(const char * const filePath, char *** segmentPaths);
+extern void scalpel_freeSplitSegments(char ** segmentPaths, int numSegments);
+
+
+/********************* stream implementation of ScalpelInputReader **********************/
+
+//reads a non-seekable stream, such as standard input or a named pipe, once.
+//The last SCALPEL_STREAM_REWIND bytes read are kept, so that reads may seek
+//back that far; seeking forward reads and discards.  The size of a stream
+//is unknown, getSize returns -1
+#define SCALPEL_STREAM_REWIND (1024 * 1024)
+
+typedef struct StreamDataSource {
+    FILE * fileHandle;
+    unsigned long long position;        //logical position
+    unsigned long long end;             //bytes read from the stream so far
+    unsigned char * rewind;             //ring of the last bytes read, indexed by position
+    int opened;                         //a stream can't be read twice
+    int error;
+} StreamDataSource;
+
+
+//creates a ScalpelInputReader over a stream; "-" is standard input
+extern ScalpelInputReader * scalpel_createInputReaderStream(const char * const filePath);
+//frees a ScalpelInputReader with stream implementation
+extern void scalpel_freeInputReaderStream(ScalpelInputReader * const streamReader);
+//1 if filePath is "-" or names a pipe, which must be read through the stream reader
+extern int scalpel_isStreamInput(const char * const filePath);
+//1 if the reader was created by scalpel_createInputReaderStream()
+extern int scalpelInputIsStream(ScalpelInputReader * const reader);
+
+
+/********************* seekable compressed image implementation of ScalpelInputReader **********************/
+
+#ifdef HAVE_LIBZ
+
+#include "syncqueue.h"
+
+//an independently decompressible unit of a seekable compressed image
+typedef struct CompressedFrame {
+    unsigned long long offset;  //compressed offset in the file
+    unsigned long long start;   //uncompressed (logical) offset
+} CompressedFrame;
+
+//a frame decompression handed to the worker pool
+typedef struct CompressedJob {
+    unsigned long long frame;
+    unsigned char * dest;
+    int status;                 //0 on success
+} CompressedJob;
+
+typedef struct CompressedWorker {
+    struct CompressedDataSource * source;
+    pthread_t thread;
+    FILE * fileHandle;          //each worker reads the compressed frames itself
+    unsigned char * inbuf;
+    size_t inbufSize;
+} CompressedWorker;
+
+//presents a BGZF image (gzip members with the BC block size field, as written
+//by bgzip) or a multi-member gzip image with a .gzi index as a raw device.
+//The frame table is built once; reads decompress every frame they span in
+//parallel on a worker pool, straight into the caller's buffer.  The partial
+//frames at the edges of a read are kept, since the next read usually overlaps
+typedef struct CompressedDataSource {
+    char * indexPath;           //.gzi sidecar, NULL if the frames are found by walking BGZF blocks
+    unsigned long long numFrames;
+    CompressedFrame * frames;   //numFrames + 1 entries, the last holds the compressed and uncompressed sizes
+    size_t maxFrameSize;        //largest uncompressed frame
+    unsigned long long position;
+    int error;
+    unsigned long long cachedFrame[2];
+    unsigned char * cache[2];
+    int numWorkers;
+    CompressedWorker * workers;
+    int numJobs;
+    CompressedJob * jobs;
+    CompressedJob ** freeJobs;
+    int numFreeJobs;
+    syncqueue_t * todo;
+    syncqueue_t * done;
+} CompressedDataSource;
+
+
+//creates a ScalpelInputReader over a BGZF or indexed gzip image
+extern ScalpelInputReader * scalpel_createInputReaderCompressed(const char * const filePath);
+//frees a ScalpelInputReader with seekable compressed image implementation
+extern void scalpel_freeInputReaderCompressed(ScalpelInputReader * const compressedReader);
+//1 if filePath is a gzip image that can be read through the compressed reader,
+//i.e. its first member is a BGZF block or a .gzi index exists next to it
+extern int scalpel_isCompressedImage(const char * const filePath);
+
+#endif
+
+
+/********************* generic creation of ScalpelInputReaders **********************/
+
+//creates a stream reader if filePath is "-" or a pipe, a split raw image reader
+//if filePath is the first segment of a split image, a compressed image reader
+//if it is a seekable gzip image (when built with zlib), otherwise a FILE reader
+extern ScalpelInputReader * scalpel_createInputReader(const char * const filePath);
+//frees a ScalpelInputReader created by any of the scalpel_createInputReader* functions
+extern void scalpel_freeInputReader(ScalpelInputReader * const reader);
+
 #endif
@@ -41,6 +41,13 @@ int main(int argc, char ** argv)
     options.previewMode = FALSE;
     options.carveWithMissingFooters = FALSE;
     options.noSearchOverlap = FALSE;
+    options.singlePass = FALSE;
+    options.windowsize = 0;
+    options.hashAlgorithms = 0;
+    options.dedupMode = 0;
+    options.packOutput = FALSE;
+    options.checkpointInterval = SCALPEL_DEFAULT_CHECKPOINT_INTERVAL;
+    options.resumeFromCheckpoint = FALSE;
 
     if (libscalpel_initialize(&pScalpelState, argv[1], argv[2], options) != SCALPEL_OK)
     {
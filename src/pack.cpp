@@ -0,0 +1,451 @@
+/*
+Copyright (C) 2013, Basis Technology Corp.
+Copyright (C) 2007-2011, Golden G. Richard III and Vico Marziale.
+Copyright (C) 2005-2007, Golden G. Richard III.
+*
+Written by Golden G. Richard III and Vico Marziale.
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+*
+http://www.apache.org/licenses/LICENSE-2.0
+*
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+Thanks to Kris Kendall, Jesse Kornblum, et al for their work
+on Foremost. Foremost 0.69 was used as the starting point for
+Scalpel, in 2005.
+*/
+
+// Pack file output (-P).  Instead of one file per carve, carved files
+// are stored back to back in a few large segment files, pack.000,
+// pack.001, ..., in the output directory, and listed in a text index,
+// pack.idx.  The index starts with a "scalpel-pack <version>" line;
+// every other line that doesn't start with '#' describes a carved file
+// with the tab separated fields
+//
+//   name type rule segment offset length chopped sha256 fragments image
+//
+// where name is the path the file would have had in the output
+// directory, fragments lists the image extents of the file as
+// "start+length,...", and image, the last field, is the id of the image
+// the file was carved from.  A file carved with identical content
+// stored once (-x) refers to the extent of the earlier file.
+
+#include "scalpel.h"
+
+
+#define PACK_INDEX_FIELDS  10
+
+
+static int openPackSegment(struct scalpelState *state) {
+
+    PackWriter *pack = state->pack;
+    char fn[MAX_STRING_LENGTH];
+    FILE *segment;
+
+    if(pack->numsegments == SCALPEL_PACK_MAX_SEGMENTS) {
+        fprintf(stderr, "ERROR: Too many pack segments.\n");
+        fprintf(state->auditFile, "ERROR: Too many pack segments.\n");
+        return SCALPEL_ERROR_FILE_WRITE;
+    }
+    snprintf(fn, MAX_STRING_LENGTH, "%s/" SCALPEL_PACK_SEGMENT,
+        state->outputdirectory, pack->numsegments);
+    if(!(segment = fopen(fn, "wb"))) {
+        fprintf(stderr, "Error opening file: %s -- %s\n", fn, strerror(errno));
+        fprintf(state->auditFile, "Error opening file: %s -- %s\n",
+            fn, strerror(errno));
+        return SCALPEL_ERROR_FILE_WRITE;
+    }
+    // carved files are mostly written in order, so large buffers turn
+    // them into large sequential writes
+    setvbuf(segment, NULL, _IOFBF, SCALPEL_PACK_BUFFER_SIZE);
+    pack->segments[pack->numsegments] = segment;
+    pack->positions[pack->numsegments] = 0;
+    pack->numsegments++;
+    pack->reserved = 0;
+    return SCALPEL_OK;
+}
+
+
+// create the pack index in the output directory.  Segments are created
+// as carved files are given extents.
+int openPack(struct scalpelState *state) {
+
+    char fn[MAX_STRING_LENGTH];
+
+    state->pack = (PackWriter *)malloc(sizeof(PackWriter));
+    checkMemoryAllocation(state, state->pack, __LINE__, __FILE__, "pack");
+    memset(state->pack, 0, sizeof(PackWriter));
+
+    snprintf(fn, MAX_STRING_LENGTH, "%s/%s", state->outputdirectory,
+        SCALPEL_PACK_INDEX);
+    if(!(state->pack->index = fopen(fn, "w"))) {
+        fprintf(stderr, "Couldn't open pack index\n%s -- %s\n", fn,
+            strerror(errno));
+        return SCALPEL_ERROR_FILE_OPEN;
+    }
+    fprintf(state->pack->index, "%s %d\n", SCALPEL_PACK_MAGIC, SCALPEL_PACK_VERSION);
+    fprintf(state->pack->index,
+        "# name\ttype\trule\tsegment\toffset\tlength\tchopped\tsha256\tfragments\timage\n");
+    return SCALPEL_OK;
+}
+
+
+// close the segments and index of the pack being written, if any
+int closePack(struct scalpelState *state) {
+
+    PackWriter *pack = state->pack;
+    int i, err = SCALPEL_OK;
+
+    if(!pack) {
+        return SCALPEL_OK;
+    }
+    for(i = 0; i < pack->numsegments; i++) {
+        if(fclose(pack->segments[i])) {
+            fprintf(stderr, "Error closing pack segment %d -- %s\n", i,
+                strerror(errno));
+            err = SCALPEL_ERROR_FILE_CLOSE;
+        }
+    }
+    if(pack->index && fclose(pack->index)) {
+        fprintf(stderr, "Error closing pack index -- %s\n", strerror(errno));
+        err = SCALPEL_ERROR_FILE_CLOSE;
+    }
+    free(pack);
+    state->pack = NULL;
+    return err;
+}
+
+
+// give a file to carve the next extent of the last segment, starting a
+// new segment if the file doesn't fit.  A file larger than a segment
+// gets a segment of its own.
+int reservePackExtent(struct scalpelState *state, struct CarveInfo *carve) {
+
+    PackWriter *pack = state->pack;
+    unsigned long long length = carve->stop - carve->start + 1;
+    int err;
+
+    if(pack->numsegments == 0 ||
+        (pack->reserved > 0 && pack->reserved + length > SCALPEL_PACK_SEGMENT_SIZE)) {
+            if((err = openPackSegment(state)) != SCALPEL_OK) {
+                return err;
+            }
+    }
+    carve->packsegment = pack->numsegments - 1;
+    carve->packoffset = pack->reserved;
+    pack->reserved += length;
+    return SCALPEL_OK;
+}
+
+
+// give back the extent of the last file given one, e.g. because it's
+// identical to a file already in the pack
+void releasePackExtent(struct scalpelState *state, struct CarveInfo *carve) {
+
+    PackWriter *pack = state->pack;
+
+    if(carve->packsegment == pack->numsegments - 1 &&
+        carve->packoffset + (carve->stop - carve->start + 1) == pack->reserved) {
+            pack->reserved = carve->packoffset;
+    }
+}
+
+
+// write 'len' bytes at 'position' of a carved file to its pack extent
+int writePackExtent(struct scalpelState *state, struct CarveInfo *carve,
+                    unsigned long long position, const void *buf, size_t len) {
+
+    PackWriter *pack = state->pack;
+    FILE *segment = pack->segments[carve->packsegment];
+    unsigned long long offset = carve->packoffset + position;
+
+    if(pack->positions[carve->packsegment] != offset &&
+        fseeko(segment, offset, SEEK_SET)) {
+            fprintf(stderr, "Error seeking in pack segment %d -- %s\n",
+                carve->packsegment, strerror(errno));
+            fprintf(state->auditFile, "Error seeking in pack segment %d -- %s\n",
+                carve->packsegment, strerror(errno));
+            return SCALPEL_ERROR_FILE_WRITE;
+    }
+    if(fwrite(buf, 1, len, segment) != len) {
+        fprintf(stderr, "Error writing to pack segment %d -- %s\n",
+            carve->packsegment, strerror(errno));
+        fprintf(state->auditFile, "Error writing to pack segment %d -- %s\n",
+            carve->packsegment, strerror(errno));
+        return SCALPEL_ERROR_FILE_WRITE;
+    }
+    pack->positions[carve->packsegment] = offset + len;
+    return SCALPEL_OK;
+}
+
+
+// list a carved file in the pack index.  'fragments' holds the image
+// extents of the file, from generateFragments().
+int writePackIndexEntry(struct scalpelState *state, struct CarveInfo *carve,
+                        const char *name, const char *sha256, PoolQueue * fragments) {
+
+    FILE *index = state->pack->index;
+    const char *type = state->SearchSpec[carve->needlenum].suffix;
+    Fragment *frag;
+    int first = TRUE;
+
+    if(type[0] == SCALPEL_NOEXTENSION) {
+        type = SCALPEL_NOEXTENSION_SUFFIX;
+    }
+
+#ifdef _WIN32
+    fprintf(index, "%s\t%s\t%d\t%d\t%I64u\t%I64u\t%d\t%s\t", name,
+#else
+    fprintf(index, "%s\t%s\t%d\t%d\t%llu\t%llu\t%d\t%s\t", name,
+#endif
+        type, carve->needlenum,
+        carve->packsegment, carve->packoffset, carve->stop - carve->start + 1,
+        carve->chopped ? 1 : 0, sha256 && sha256[0] ? sha256 : "-");
+    pool_rewind_queue(fragments);
+    while (!pool_end_of_queue(fragments)) {
+        frag = (Fragment *) pool_pointer_to_current(fragments);
+#ifdef _WIN32
+        fprintf(index, "%s%I64u+%I64u", first ? "" : ",",
+#else
+        fprintf(index, "%s%llu+%llu", first ? "" : ",",
+#endif
+            frag->start, frag->stop - frag->start + 1);
+        first = FALSE;
+        pool_next_element(fragments);
+    }
+    fprintf(index, "\t%s\n", scalpelInputGetId(state->inReader));
+    if(ferror(index)) {
+        fprintf(stderr, "Error writing to pack index -- %s\n", strerror(errno));
+        return SCALPEL_ERROR_FILE_WRITE;
+    }
+    return SCALPEL_OK;
+}
+
+
+/********** reading packs (libscalpel) **********/
+
+static char *copyString(const char *s, size_t len) {
+
+    char *copy = (char *)malloc(len + 1);
+
+    if(copy) {
+        memcpy(copy, s, len);
+        copy[len] = '\0';
+    }
+    return copy;
+}
+
+
+// parse an index line into 'entry'; returns FALSE if it's malformed
+static int parsePackIndexLine(char *line, ScalpelPackEntry *entry) {
+
+    char *fields[PACK_INDEX_FIELDS], *end;
+    int i;
+
+    memset(entry, 0, sizeof(ScalpelPackEntry));
+
+    // the image id, the last field, may hold tabs
+    fields[0] = line;
+    for(i = 1; i < PACK_INDEX_FIELDS; i++) {
+        if(!(end = strchr(fields[i - 1], '\t'))) {
+            return FALSE;
+        }
+        *end = '\0';
+        fields[i] = end + 1;
+    }
+    if((end = strchr(fields[PACK_INDEX_FIELDS - 1], '\n'))) {
+        *end = '\0';
+    }
+
+    entry->rule = atoi(fields[2]);
+    entry->segment = atoi(fields[3]);
+    entry->offset = strtoull(fields[4], NULL, 10);
+    entry->length = strtoull(fields[5], NULL, 10);
+    entry->chopped = atoi(fields[6]);
+    if(strcmp(fields[7], "-")) {
+        strncpy(entry->sha256, fields[7], sizeof(entry->sha256) - 1);
+    }
+    entry->name = copyString(fields[0], strlen(fields[0]));
+    entry->type = copyString(fields[1], strlen(fields[1]));
+    entry->fragments = copyString(fields[8], strlen(fields[8]));
+    entry->image = copyString(fields[9], strlen(fields[9]));
+    return entry->segment >= 0 && entry->segment < SCALPEL_PACK_MAX_SEGMENTS &&
+        entry->name && entry->type && entry->fragments && entry->image;
+}
+
+
+// read a line of any length into '*line', growing it as needed.  Returns
+// FALSE at the end of the file.
+static int readPackIndexLine(FILE *index, char **line, size_t *size) {
+
+    size_t len = 0;
+    char *grown;
+
+    while (fgets(*line + len, (int)(*size - len), index)) {
+        len += strlen(*line + len);
+        if(len > 0 && (*line)[len - 1] == '\n') {
+            return TRUE;
+        }
+        if(len + 1 < *size) {
+            return TRUE;	// last line, without a newline
+        }
+        if(!(grown = (char *)realloc(*line, *size * 2))) {
+            return FALSE;
+        }
+        *line = grown;
+        *size *= 2;
+    }
+    return len > 0;
+}
+
+
+static void freePackEntry(ScalpelPackEntry *entry) {
+
+    free(entry->name);
+    free(entry->type);
+    free(entry->fragments);
+    free(entry->image);
+}
+
+
+int libscalpel_open_pack(const char * directory, ScalpelPack ** pack)
+{
+    std::string funcname("libscalpel_open_pack");
+    char fn[MAX_STRING_LENGTH];
+    char *line;
+    size_t linesize = MAX_STRING_LENGTH;
+    ScalpelPack *p;
+    ScalpelPackEntry *entries;
+    unsigned long long size = 0;
+    int version, err = SCALPEL_OK;
+    FILE *index;
+
+    if (directory == NULL || pack == NULL)
+        throw std::runtime_error(funcname + ": NULL pointer provided.");
+
+    snprintf(fn, MAX_STRING_LENGTH, "%s/%s", directory, SCALPEL_PACK_INDEX);
+    if (!(index = fopen(fn, "r")))
+        return SCALPEL_ERROR_FILE_OPEN;
+
+    line = (char *)malloc(linesize);
+    p = (ScalpelPack *)calloc(1, sizeof(ScalpelPack));
+    if (!line || !p || !(p->directory = copyString(directory, strlen(directory)))) {
+        err = SCALPEL_GENERAL_ABORT;
+        goto out;
+    }
+
+    if (!readPackIndexLine(index, &line, &linesize) ||
+        sscanf(line, SCALPEL_PACK_MAGIC " %d", &version) != 1 ||
+        version != SCALPEL_PACK_VERSION) {
+        err = SCALPEL_ERROR_FATAL_READ;
+        goto out;
+    }
+
+    while (readPackIndexLine(index, &line, &linesize)) {
+        if (line[0] == '#')
+            continue;
+        if (p->numentries == size) {
+            size = size ? size * 2 : 1024;
+            if (!(entries = (ScalpelPackEntry *)realloc(p->entries,
+                sizeof(ScalpelPackEntry) * size))) {
+                err = SCALPEL_GENERAL_ABORT;
+                goto out;
+            }
+            p->entries = entries;
+        }
+        if (!parsePackIndexLine(line, &p->entries[p->numentries])) {
+            freePackEntry(&p->entries[p->numentries]);
+            err = SCALPEL_ERROR_FATAL_READ;
+            goto out;
+        }
+        p->numentries++;
+    }
+    if (ferror(index))
+        err = SCALPEL_ERROR_FILE_READ;
+
+out:
+    fclose(index);
+    free(line);
+    if (err != SCALPEL_OK) {
+        libscalpel_close_pack(&p);
+        return err;
+    }
+    *pack = p;
+    return SCALPEL_OK;
+}
+
+
+long long libscalpel_read_pack_entry(ScalpelPack * pack, unsigned long long i,
+                                     unsigned long long offset, void * buf, size_t len)
+{
+    std::string funcname("libscalpel_read_pack_entry");
+    char fn[MAX_STRING_LENGTH];
+    ScalpelPackEntry *entry;
+    FILE **segments;
+    size_t n;
+
+    if (pack == NULL || (buf == NULL && len > 0))
+        throw std::runtime_error(funcname + ": NULL pointer provided.");
+
+    if (i >= pack->numentries)
+        throw std::runtime_error(funcname + ": no such pack entry.");
+
+    entry = &pack->entries[i];
+    if (offset >= entry->length)
+        return 0;
+    if (len > entry->length - offset)
+        len = (size_t)(entry->length - offset);
+
+    // segments are opened when they're first read
+    if (entry->segment >= pack->numsegments) {
+        if (!(segments = (FILE **)realloc(pack->segments,
+            sizeof(FILE *) * (entry->segment + 1))))
+            return -1;
+        memset(segments + pack->numsegments, 0,
+            sizeof(FILE *) * (entry->segment + 1 - pack->numsegments));
+        pack->segments = segments;
+        pack->numsegments = entry->segment + 1;
+    }
+    if (!pack->segments[entry->segment]) {
+        snprintf(fn, MAX_STRING_LENGTH, "%s/" SCALPEL_PACK_SEGMENT,
+            pack->directory, entry->segment);
+        if (!(pack->segments[entry->segment] = fopen(fn, "rb")))
+            return -1;
+    }
+
+    if (fseeko(pack->segments[entry->segment], entry->offset + offset, SEEK_SET))
+        return -1;
+    n = fread(buf, 1, len, pack->segments[entry->segment]);
+    if (n < len && ferror(pack->segments[entry->segment]))
+        return -1;
+    return (long long)n;
+}
+
+
+void libscalpel_close_pack(ScalpelPack ** pack)
+{
+    ScalpelPack *p;
+    unsigned long long i;
+    int j;
+
+    if (pack == NULL || *pack == NULL)
+        return;
+
+    p = *pack;
+    for (i = 0; i < p->numentries; i++)
+        freePackEntry(&p->entries[i]);
+    for (j = 0; j < p->numsegments; j++) {
+        if (p->segments[j])
+            fclose(p->segments[j]);
+    }
+    free(p->segments);
+    free(p->entries);
+    free(p->directory);
+    free(p);
+    *pack = NULL;
+}
@@ -796,3 +796,223 @@ void local_init_context(Queue * q, Context * ctx)
     ctx->current = q->queue;
     ctx->previous = 0;
 }
+
+
+// allocate an element from 'pool', from the free list if possible,
+// otherwise from the newest slab
+static Pool_element pool_allocate_element(QueuePool * pool) 
+{
+    Pool_element element;
+
+    if(pool->freelist != 0) {
+        element = pool->freelist;
+        pool->freelist = element->next;
+        return element;
+    }
+
+    if(pool->nextfree == pool->slabend) {
+        // first slot of each slab links the slabs together
+        element = (Pool_element) malloc(pool->slotsize * 
+                                        (QUEUE_POOL_SLAB_ELEMENTS + 1));
+        if(element == 0) {
+            std::string msg("Malloc failed in function pool_add_to_queue()\n");
+            fprintf(stderr, "%s", msg.c_str());
+            throw std::runtime_error(msg);
+        }
+        element->next = pool->slabs;
+        pool->slabs = element;
+        pool->nextfree = (char *)element + pool->slotsize;
+        pool->slabend = pool->nextfree + 
+            pool->slotsize * QUEUE_POOL_SLAB_ELEMENTS;
+    }
+
+    element = (Pool_element) pool->nextfree;
+    pool->nextfree += pool->slotsize;
+    return element;
+}
+
+
+void init_queue_pool(QueuePool * pool, int elementsize) 
+{
+    size_t infosize = sizeof(((Pool_element) 0)->info[0]);
+    size_t datasize = elementsize > (int)infosize ? elementsize : infosize;
+
+    pool->elementsize = elementsize;
+    // round up so each element's data stays aligned
+    pool->slotsize = offsetof(struct _Pool_element, info) +
+        (datasize + infosize - 1) / infosize * infosize;
+    pool->freelist = 0;
+    pool->slabs = 0;
+    pool->nextfree = 0;
+    pool->slabend = 0;
+}
+
+
+void destroy_queue_pool(QueuePool * pool) 
+{
+    Pool_element temp;
+
+    while (pool->slabs != 0) {
+        temp = pool->slabs;
+        pool->slabs = pool->slabs->next;
+        free(temp);
+    }
+
+    pool->freelist = 0;
+    pool->nextfree = 0;
+    pool->slabend = 0;
+}
+
+
+void init_pool_queue(PoolQueue * q, QueuePool * pool, int priority_is_tag_only) 
+{
+    q->queue = 0;
+    q->queuelength = 0;
+    q->priority_is_tag_only = priority_is_tag_only;
+    q->pool = pool;
+    pool_rewind_queue(q);
+}
+
+
+void destroy_pool_queue(PoolQueue * q) 
+{
+    Pool_element temp;
+
+    while (q->queue != 0) {
+        temp = q->queue;
+        q->queue = q->queue->next;
+        temp->next = q->pool->freelist;
+        q->pool->freelist = temp;
+        (q->queuelength)--;
+    }
+
+    pool_rewind_queue(q);
+}
+
+
+void pool_add_to_queue(PoolQueue * q, void *element, int priority) 
+{
+    Pool_element new_element, ptr, prev = 0;
+
+    new_element = pool_allocate_element(q->pool);
+    memcpy(new_element->info, element, q->pool->elementsize);
+    new_element->priority = priority;
+
+    (q->queuelength)++;
+
+    if(q->queue == 0) {
+        new_element->next = 0;
+        q->queue = new_element;
+    }
+    else if(q->priority_is_tag_only || (q->queue)->priority >= priority) {
+        new_element->next = q->queue;
+        q->queue = new_element;
+    }
+    else {
+        ptr = q->queue;
+        while (ptr != 0 && priority >= ptr->priority) {
+            prev = ptr;
+            ptr = ptr->next;
+        }
+
+        new_element->next = prev->next;
+        prev->next = new_element;
+    }
+
+    pool_rewind_queue(q);
+}
+
+
+int pool_empty_queue(PoolQueue * q) 
+{
+    return q->queue == 0;
+}
+
+
+int pool_queue_length(PoolQueue * q) 
+{
+    return q->queuelength;
+}
+
+
+void pool_rewind_queue(PoolQueue * q) 
+{
+    q->current = q->queue;
+    q->previous = 0;
+}
+
+
+void pool_next_element(PoolQueue * q) 
+{
+#if defined(CONSISTENCY_CHECKING)
+    if(q->queue == 0) {
+        std::string msg("NULL pointer in function pool_next_element()\n");
+        fprintf(stderr, "%s", msg.c_str());
+        throw std::runtime_error(msg);
+    }
+    else if(q->current == 0) {
+        std::string msg("Advance past end in NULL pointer in function pool_next_element()\n");
+        fprintf(stderr, "%s", msg.c_str());
+        throw std::runtime_error(msg);
+    }
+    else
+#endif
+    {
+        q->previous = q->current;
+        q->current = q->current->next;
+    }
+}
+
+
+void pool_peek_at_current(PoolQueue * q, void *element) 
+{
+#if defined(CONSISTENCY_CHECKING)
+    if(q->queue == 0 || q->current == 0) {
+        std::string msg("NULL pointer in function pool_peek_at_current()\n");
+        fprintf(stderr, "%s", msg.c_str());
+        throw std::runtime_error(msg);
+    }
+    else
+#endif
+    {
+        memcpy(element, (q->current)->info, q->pool->elementsize);
+    }
+}
+
+
+void *pool_pointer_to_current(PoolQueue * q) 
+{
+#if defined(CONSISTENCY_CHECKING)
+    if(q->queue == 0 || q->current == 0) {
+        std::string msg("NULL pointer in function pool_pointer_to_current()\n");
+        fprintf(stderr, "%s", msg.c_str());
+        throw std::runtime_error(msg);
+    }
+    else
+#endif
+    {
+        return (q->current)->info;
+    }
+}
+
+
+int pool_current_priority(PoolQueue * q) 
+{
+#if defined(CONSISTENCY_CHECKING)
+    if(q->queue == 0 || q->current == 0) {
+        std::string msg("NULL pointer in function pool_current_priority()\n");
+        fprintf(stderr, "%s", msg.c_str());
+        throw std::runtime_error(msg);
+    }
+    else
+#endif
+    {
+        return (q->current)->priority;
+    }
+}
+
+
+int pool_end_of_queue(PoolQueue * q) 
+{
+    return (q->current == 0);
+}
@@ -43,8 +43,15 @@ Scalpel, in 2005.
 // serve only as a tag--the queue is not sorted by the priority field when 
 // 'priority_is_tag_only' is set.
 //
+// October 2026: added an unsynchronized "pooled" queue variant
+// (SECTION 4) for queues used by a single thread.  Elements are
+// allocated in slabs from a QueuePool shared by many queues, store the
+// element data inline, and are recycled through the pool's free list
+// instead of being freed.
+//
 
 #include <pthread.h>
+#include <stddef.h>
 
 #define  TRUE  1
 #define  FALSE 0
@@ -77,6 +84,45 @@ typedef struct Queue
     int priority_is_tag_only;
 } Queue;
 
+/* type of one element in a pooled queue.  The element data is stored
+   inline, starting at 'info'. */
+
+typedef struct _Pool_element
+{
+    struct _Pool_element *next;
+    int priority;
+    union
+    {
+        long long l;
+        double d;
+        void *p;
+    } info[1];			/* actually 'elementsize' bytes */
+} *Pool_element;
+
+/* pool of elements shared by pooled queues with the same element size */
+
+typedef struct QueuePool
+{
+    int elementsize;		/* 'sizeof()' one element */
+    size_t slotsize;		/* bytes allocated for one Pool_element */
+    Pool_element freelist;	/* recycled elements */
+    Pool_element slabs;		/* list of allocated slabs */
+    char *nextfree;		/* unused part of the newest slab */
+    char *slabend;
+} QueuePool;
+
+/* pooled queue type.  Not thread-safe! */
+
+typedef struct PoolQueue
+{
+    Pool_element queue;		/* linked list of elements */
+    Pool_element current;		/* current position for sequential access functions */
+    Pool_element previous;	/* one step back from current */
+    int queuelength;		/* # of elements in queue */
+    int priority_is_tag_only;
+    QueuePool *pool;		/* elements are allocated from this pool */
+} PoolQueue;
+
 typedef struct Context
 {
     Queue_element current;	/* current position for local seq access functions */
@@ -285,6 +331,79 @@ void local_delete_current (Context * ctx);
 */
 int local_end_of_queue (Context * ctx);
 
+////////////////////////////
+// SECTION 4
+////////////////////////////
+
+// Functions in this section implement the pooled queue variant.  A
+// pooled queue takes no locks and must only be used by one thread at
+// a time.  Duplicate elements are always allowed.  Elements are
+// allocated from the QueuePool given to init_pool_queue(), in slabs of
+// QUEUE_POOL_SLAB_ELEMENTS, and are returned to the pool's free list
+// when the queue is destroyed.
+
+#define QUEUE_POOL_SLAB_ELEMENTS 4096
+
+/* initializes a new pool 'pool' for elements of size 'elementsize'.
+*/
+void init_queue_pool (QueuePool * pool, int elementsize);
+
+
+/* releases all memory allocated by the 'pool', including the elements
+   of queues still using it.  Those queues must not be used afterwards.
+*/
+void destroy_queue_pool (QueuePool * pool);
+
+
+/* initializes a new pooled queue 'q' that allocates elements from
+   'pool'.  'priority_is_tag_only' has the same meaning as for
+   init_queue().
+*/
+void init_pool_queue (PoolQueue * q, QueuePool * pool,
+		      int priority_is_tag_only);
+
+
+/* returns all elements in 'q' to its pool */
+void destroy_pool_queue (PoolQueue * q);
+
+
+/* adds 'element' to the 'q', placed as add_to_queue() would */
+void pool_add_to_queue (PoolQueue * q, void *element, int priority);
+
+
+/* returns TRUE if 'q' is empty, FALSE otherwise */
+int pool_empty_queue (PoolQueue * q);
+
+
+/* returns the number of elements in the 'q' */
+int pool_queue_length (PoolQueue * q);
+
+
+/* move to the first element in the 'q' */
+void pool_rewind_queue (PoolQueue * q);
+
+
+/* move to the next element in the 'q' */
+void pool_next_element (PoolQueue * q);
+
+
+/* retrieve the element stored at the current position in the 'q' */
+void pool_peek_at_current (PoolQueue * q, void *element);
+
+
+/* return a pointer to the data portion of the current element */
+void *pool_pointer_to_current (PoolQueue * q);
+
+
+/* return priority of current element in the 'q' */
+int pool_current_priority (PoolQueue * q);
+
+
+/* has the current position in 'q' moved beyond the last valid element?
+   Returns TRUE if so, FALSE otherwise.
+*/
+int pool_end_of_queue (PoolQueue * q);
+
 
 #endif
 
@@ -325,4 +444,19 @@ void local_*pointer_to_current(Context *ctx);
 int local_current_priority(Context *ctx);
 void local_delete_current(Context *ctx);
 int local_end_of_queue(Context *ctx);
+
+// SECTION 4
+void init_queue_pool(QueuePool *pool, int elementsize);
+void destroy_queue_pool(QueuePool *pool);
+void init_pool_queue(PoolQueue *q, QueuePool *pool, int priority_is_tag_only);
+void destroy_pool_queue(PoolQueue *q);
+void pool_add_to_queue(PoolQueue *q, void *element, int priority);
+int pool_empty_queue(PoolQueue *q);
+int pool_queue_length(PoolQueue *q);
+void pool_rewind_queue(PoolQueue *q);
+void pool_next_element(PoolQueue *q);
+void pool_peek_at_current(PoolQueue *q, void *element);
+void *pool_pointer_to_current(PoolQueue *q);
+int pool_current_priority(PoolQueue *q);
+int pool_end_of_queue(PoolQueue *q);
  *** QUICK REFERENCE ***/
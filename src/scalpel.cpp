@@ -366,6 +366,9 @@ void initializeState(char ** argv, struct scalpelState *state) {
     state->invocation = (char *) malloc(MAX_STRING_LENGTH * sizeof(char));
     checkMemoryAllocation(state, state->invocation, __LINE__, __FILE__,
         "state->invocation");
+    state->headerFooterDatabaseDir = (char *) malloc(MAX_STRING_LENGTH * sizeof(char));
+    checkMemoryAllocation(state, state->headerFooterDatabaseDir, __LINE__, __FILE__,
+        "state->headerFooterDatabaseDir");
 
     // GGRIII: memory allocation made more sane, because we're storing
     // more information in Scalpel than foremost had to, for each file
@@ -394,6 +397,9 @@ void initializeState(char ** argv, struct scalpelState *state) {
         state->SearchSpec[i].offsets.footerstorage = 0;
         state->SearchSpec[i].numfilestocarve = 0;
         state->SearchSpec[i].organizeDirNum = 0;
+        state->SearchSpec[i].firstorganizeDirNum = 0;
+        state->SearchSpec[i].createdDirNum = -1;
+        state->SearchSpec[i].offsetsPreloaded = FALSE;
     }
 
     state->fileswritten = 0;
@@ -405,13 +411,58 @@ void initializeState(char ** argv, struct scalpelState *state) {
     state->carveWithMissingFooters = FALSE;
     state->noSearchOverlap = FALSE;
     state->generateHeaderFooterDatabase = FALSE;
+    state->useHeaderFooterDatabase = FALSE;
+    state->headerFooterDatabaseDir[0] = 0;
+    state->imageFingerprint = 0;
     state->updateCoverageBlockmap = FALSE;
     state->useCoverageBlockmap = FALSE;
     state->coverageblocksize = 0;
+    state->coveragebitmap = NULL;
+    state->coveragerank = NULL;
+    state->coverageextents = NULL;
+    state->coveragenumextents = 0;
+    state->coverageuncovered = 0;
+    state->coveragemapbits = NULL;
+    state->coveragemapping = NULL;
+    state->coveragemappinglen = 0;
+    state->coverageoverflow = NULL;
+    state->coverageoverflowsize = 0;
+    state->coverageoverflowused = 0;
+    state->coverageupdates = NULL;
+    state->coveragenumupdates = 0;
+    state->coverageupdatesize = 0;
+    state->coverageLegacyFormat = FALSE;
+    state->regions = NULL;
+    state->numregions = 0;
+    state->blockhashfile = NULL;
+    state->blockhashset = NULL;
+    state->coverageknown = NULL;
+    state->coverageknowncount = 0;
+    state->constantbytes = 0;
+    state->blockhashoutput = NULL;
+    state->generatedhashes = NULL;
+    state->numgeneratedhashes = 0;
+    state->generatedhashsize = 0;
     state->blockAlignedOnly = FALSE;
     state->organizeSubdirectories = TRUE;
     state->previewMode = FALSE;
+    state->singlePass = FALSE;
+    state->windowsize = 0;
+    state->imageCarved = FALSE;
+    state->hashAlgorithms = 0;
+    state->manifestFile = NULL;
+    state->dedupMode = 0;
+    state->carvedcontent = NULL;
+    state->carvedcontentsize = 0;
+    state->carvedcontentused = 0;
+    state->duplicatefiles = 0;
+    state->duplicatebytes = 0;
+    state->packOutput = FALSE;
+    state->pack = NULL;
     state->handleEmbedded = FALSE;
+    state->checkpointInterval = SCALPEL_DEFAULT_CHECKPOINT_INTERVAL;
+    state->resumeFromCheckpoint = FALSE;
+    state->checkpoint = NULL;
     state->auditFile = NULL;
     inputReaderVerbose = FALSE;
 
@@ -508,11 +559,215 @@ void freeState(struct scalpelState *state) {
         state->invocation = NULL;
     }
 
+    if (state->headerFooterDatabaseDir) {
+        free(state->headerFooterDatabaseDir);
+        state->headerFooterDatabaseDir = NULL;
+    }
+
     if (state->SearchSpec) {
         freeSearchSpec(state->SearchSpec);
         state->SearchSpec = NULL;
     }
 
+    if (state->regions) {
+        free(state->regions);
+        state->regions = NULL;
+        state->numregions = 0;
+    }
+
+    closeBlockHashSet(state);
+
+    if (state->blockhashfile) {
+        free(state->blockhashfile);
+        state->blockhashfile = NULL;
+    }
+
+    if (state->blockhashoutput) {
+        free(state->blockhashoutput);
+        state->blockhashoutput = NULL;
+    }
+
+    if (state->generatedhashes) {
+        free(state->generatedhashes);
+        state->generatedhashes = NULL;
+    }
+
+    if (state->manifestFile) {
+        fclose(state->manifestFile);
+        state->manifestFile = NULL;
+    }
+
+    freeCarvedContent(state);
+
+    closePack(state);
+
+}
+
+
+static int compareRegions(const void *a, const void *b) {
+
+    const ScalpelRegion *ra = (const ScalpelRegion *)a;
+    const ScalpelRegion *rb = (const ScalpelRegion *)b;
+
+    return ra->offset < rb->offset ? -1 : (ra->offset > rb->offset ? 1 : 0);
+}
+
+
+// restrict the search to 'numregions' extents of the image.  The
+// extents are copied, sorted and merged, so that overlapping or
+// adjacent extents become a single region; empty extents are dropped.
+// A region list of length 0 removes the restriction.
+int setRegionList(struct scalpelState *state, const ScalpelRegion *regions,
+                  unsigned long long numregions) {
+
+    unsigned long long i, n = 0;
+    ScalpelRegion *r;
+
+    if (state->regions) {
+        free(state->regions);
+        state->regions = NULL;
+    }
+    state->numregions = 0;
+
+    if (numregions == 0) {
+        return SCALPEL_OK;
+    }
+
+    r = (ScalpelRegion *)malloc(numregions * sizeof(ScalpelRegion));
+    checkMemoryAllocation(state, r, __LINE__, __FILE__, "regions");
+
+    for (i = 0; i < numregions; i++) {
+        if (regions[i].length == 0) {
+            continue;
+        }
+        r[n] = regions[i];
+        // clamp extents that run past the largest representable offset
+        if (r[n].offset + r[n].length < r[n].offset) {
+            r[n].length = ~0ULL - r[n].offset;
+        }
+        n++;
+    }
+
+    if (n == 0) {
+        free(r);
+        return SCALPEL_OK;
+    }
+
+    qsort(r, (size_t)n, sizeof(ScalpelRegion), compareRegions);
+
+    numregions = n;
+    n = 0;
+    for (i = 1; i < numregions; i++) {
+        if (r[i].offset <= r[n].offset + r[n].length) {
+            if (r[i].offset + r[i].length > r[n].offset + r[n].length) {
+                r[n].length = r[i].offset + r[i].length - r[n].offset;
+            }
+        }
+        else {
+            r[++n] = r[i];
+        }
+    }
+
+    state->regions = r;
+    state->numregions = n + 1;
+    return SCALPEL_OK;
+}
+
+
+// read a region list from file 'fn' and restrict the search to those
+// regions.  The file is either text, with one "offset length" pair per
+// line (decimal, or hex with a 0x prefix; '#' starts a comment), or
+// binary, a sequence of native 64bit offset, length pairs.  A file
+// with a NUL byte in its first 16 bytes is taken to be binary.
+int readRegionList(struct scalpelState *state, char *fn) {
+
+    FILE *regionfile;
+    ScalpelRegion *regions = NULL;
+    unsigned long long numregions = 0, size = 0, values[2];
+    char line[MAX_STRING_LENGTH], *p, *end;
+    size_t n;
+    int binary = FALSE, linenum = 0, err;
+
+    if ((regionfile = fopen(fn, "rb")) == NULL) {
+        fprintf(stderr, "Couldn't open region list file:\n%s -- %s\n",
+            fn, strerror(errno));
+        return SCALPEL_ERROR_FILE_OPEN;
+    }
+
+#ifdef __linux
+    fcntl(fileno(regionfile), F_SETFL, O_LARGEFILE);
+#endif
+
+    n = fread(line, 1, 2 * sizeof(unsigned long long), regionfile);
+    binary = (memchr(line, 0, n) != NULL);
+    rewind(regionfile);
+
+    while (TRUE) {
+        if (binary) {
+            n = fread(values, sizeof(unsigned long long), 2, regionfile);
+            if (n != 2) {
+                if (n != 0 || ferror(regionfile)) {
+                    fprintf(stderr,
+                        "Error reading region %"PRIu64 " of region list file %s\n",
+                        numregions + 1, fn);
+                    free(regions);
+                    fclose(regionfile);
+                    return SCALPEL_ERROR_FILE_READ;
+                }
+                break;
+            }
+        }
+        else {
+            if (fgets(line, MAX_STRING_LENGTH, regionfile) == NULL) {
+                break;
+            }
+            linenum++;
+            if ((p = strchr(line, '#')) != NULL) {
+                *p = 0;
+            }
+            for (p = line; isspace((unsigned char)*p); p++) {
+            }
+            if (*p == 0) {
+                continue;
+            }
+            values[0] = strtoull(p, &end, 0);
+            if (end != p) {
+                p = end;
+                values[1] = strtoull(p, &end, 0);
+            }
+            for (; isspace((unsigned char)*end); end++) {
+            }
+            if (end == p || *end != 0) {
+                fprintf(stderr,
+                    "Error on line %d of region list file %s: expected \"offset length\"\n",
+                    linenum, fn);
+                free(regions);
+                fclose(regionfile);
+                return SCALPEL_ERROR_FILE_READ;
+            }
+        }
+
+        if (numregions == size) {
+            size = size ? size * 2 : 1024;
+            regions = (ScalpelRegion *)realloc(regions,
+                size * sizeof(ScalpelRegion));
+            checkMemoryAllocation(state, regions, __LINE__, __FILE__,
+                "regions");
+        }
+        regions[numregions].offset = values[0];
+        regions[numregions].length = values[1];
+        numregions++;
+    }
+
+    fclose(regionfile);
+
+    err = setRegionList(state, regions, numregions);
+    free(regions);
+    if (err == SCALPEL_OK && state->numregions == 0) {
+        fprintf(stderr, "Region list file %s doesn't contain any regions.\n", fn);
+        return SCALPEL_ERROR_FILE_READ;
+    }
+    return err;
 }
 
 // full pathnames for all files used
@@ -531,6 +786,11 @@ void convertFileNames(struct scalpelState *state) {
     } else {
         //		perror("realpath");
     }
+
+    if (state->useHeaderFooterDatabase
+        && realpath(state->headerFooterDatabaseDir, fn)) {
+        strncpy(state->headerFooterDatabaseDir, fn, MAX_STRING_LENGTH);
+    }
 }
 
 int libscalpel_initialize(scalpelState ** state, char * confFilePath, 
@@ -550,6 +810,13 @@ int libscalpel_initialize(scalpelState ** state, char * confFilePath,
     if (confFilePath == NULL || strlen(confFilePath) == 0)
         throw std::runtime_error(funcname + ": no configuration file path provided.");
 
+    if ((options.hashAlgorithms || options.dedupMode || options.packOutput) &&
+        options.resumeFromCheckpoint)
+        throw std::runtime_error(funcname + ": runs hashing carved files can't be resumed.");
+
+    if (options.packOutput && options.previewMode)
+        throw std::runtime_error(funcname + ": pack output can't be combined with preview mode.");
+
     scalpelState * pState = new scalpelState(options);
 
     char * argv[3];
@@ -559,6 +826,31 @@ int libscalpel_initialize(scalpelState ** state, char * confFilePath,
 
     initializeState(&argv[0], pState);
 
+    // initializeState() resets all options to their defaults, so
+    // reapply the caller's
+    pState->generateHeaderFooterDatabase = options.generateHeaderFooterDatabase;
+    pState->handleEmbedded = options.handleEmbedded;
+    pState->organizeSubdirectories = options.organizeSubdirectories;
+    pState->previewMode = options.previewMode;
+    pState->carveWithMissingFooters = options.carveWithMissingFooters;
+    pState->noSearchOverlap = options.noSearchOverlap;
+    pState->singlePass = options.singlePass;
+    pState->windowsize = options.windowsize;
+    pState->hashAlgorithms = options.hashAlgorithms;
+    pState->dedupMode = options.dedupMode;
+    pState->packOutput = options.packOutput;
+    pState->checkpointInterval = options.checkpointInterval;
+    pState->resumeFromCheckpoint = options.resumeFromCheckpoint;
+
+    // identical carved files are found by their SHA-256 digests, which
+    // are also listed in pack indexes
+    if (pState->dedupMode || pState->packOutput)
+        pState->hashAlgorithms |= SCALPEL_HASH_SHA256;
+
+    // the digests of files being carved aren't recorded in checkpoints
+    if (pState->hashAlgorithms)
+        pState->checkpointInterval = 0;
+
     const size_t outDirLen = strlen(outDir);
     strncpy(pState->outputdirectory, outDir, outDirLen + 1);
     pState->outputdirectory[outDirLen + 1] = 0;
@@ -638,6 +930,20 @@ int libscalpel_carve_input(scalpelState * state, ScalpelInputReader * const read
     return SCALPEL_OK;
 }
 
+int libscalpel_set_regions(scalpelState * state, const ScalpelRegion * regions,
+                           unsigned long long numregions)
+{
+    std::string funcname("libscalpel_set_regions");
+
+    if (state == NULL)
+        throw std::runtime_error(funcname + ": NULL pointer provided for state.");
+
+    if (regions == NULL && numregions > 0)
+        throw std::runtime_error(funcname + ": NULL pointer provided for regions.");
+
+    return setRegionList(state, regions, numregions);
+}
+
 int libscalpel_finalize(scalpelState ** state)
 {
     std::string funcname("libscalpel_finalize");
@@ -648,6 +954,7 @@ int libscalpel_finalize(scalpelState ** state)
     if (*state == NULL)
         throw std::runtime_error(funcname + ": state has not been allocated.");
 
+    finishCheckpoint(*state);
     closeAuditFile((*state)->auditFile);
     destroy_threading_model(*state);
     destroyStore();
@@ -713,6 +1020,9 @@ int scalpel_carveSingleInput(ScalpelInputReader * const reader, const char * con
     state.previewMode = previewMode;
     state.carveWithMissingFooters = carveWithMissingFooters;
     state.noSearchOverlap = noSearchOverlap;
+    // callers of this entry point can't resume, so don't leave
+    // checkpoints behind
+    state.checkpointInterval = 0;
 
     convertFileNames(&state);
 
@@ -730,6 +1040,7 @@ int scalpel_carveSingleInput(ScalpelInputReader * const reader, const char * con
     // prepare audit file and make sure output directory is empty.
     if ((err = openAuditFile(&state))) {
         handleError(&state, err); //can throw
+        finishCheckpoint(&state);
         freeState(&state);
         std::stringstream ss;
         ss << "Error opening audit file, error code: " << err;
@@ -744,6 +1055,7 @@ int scalpel_carveSingleInput(ScalpelInputReader * const reader, const char * con
 
     if ((err = digImageFile(&state))) {
         handleError(&state, err); //can throw
+        finishCheckpoint(&state);
         closeAuditFile(state.auditFile);
         destroyStore();
         freeState(&state);
@@ -754,6 +1066,7 @@ int scalpel_carveSingleInput(ScalpelInputReader * const reader, const char * con
 
     if ((err = carveImageFile(&state))) {
         handleError(&state, err); //can throw
+        finishCheckpoint(&state);
         closeAuditFile(state.auditFile);
         destroy_threading_model(&state);
         destroyStore();
@@ -763,6 +1076,7 @@ int scalpel_carveSingleInput(ScalpelInputReader * const reader, const char * con
         throw std::runtime_error(ss.str());
     }
 
+    finishCheckpoint(&state);
     closeAuditFile(state.auditFile);
     destroy_threading_model(&state);
     destroyStore();
@@ -117,6 +117,7 @@ int getopt (int argc, char *const argv[], const char *optstring);
 #endif
 #else // ! defined(WIN32)
 #include <sys/mount.h>
+#include <sys/mman.h>
 #define gettimeofday_t struct timeval
 #endif // ! defined(WIN32)
 
@@ -160,6 +161,7 @@ int getopt (int argc, char *const argv[], const char *optstring);
 #define SCALPEL_ERROR_FILE_TOO_SMALL          10
 #define SCALPEL_ERROR_NONEMPTY_DIRECTORY      11
 #define SCALPEL_ERROR_PTHREAD_FAILURE         12
+#define SCALPEL_ERROR_BAD_CHECKPOINT          13
 
 #define SCALPEL_GENERAL_ABORT                999
 
@@ -198,6 +200,44 @@ extern double totalwrites;	// # of seconds spent in pass # 2 for writing carved
 
 #define SCALPEL_DEFAULT_OUTPUT_DIR     "scalpel-output"
 
+// header/footer database (-d, -D) file identification
+#define SCALPEL_HFD_MAGIC              "scalpel-hfd"
+#define SCALPEL_HFD_VERSION            3
+#define SCALPEL_HFD_SAMPLES            16
+#define SCALPEL_HFD_SAMPLE_SIZE        4096
+
+// checkpoint files (-k, -R) written into the output directory
+#define SCALPEL_CHECKPOINT_FILE        "scalpel.ckpt"
+#define SCALPEL_CHECKPOINT_JOURNAL     "scalpel.ckpt.offsets"
+#define SCALPEL_CHECKPOINT_MAGIC       "scalpel-checkpoint"
+#define SCALPEL_CHECKPOINT_VERSION     1
+#define SCALPEL_DEFAULT_CHECKPOINT_INTERVAL  60	// seconds
+#define SCALPEL_MAX_DEFAULT_WINDOW     (256 * 1024 * 1024)	// bytes
+
+// digests of carved files (-a)
+#define SCALPEL_MANIFEST_FILE          "manifest.csv"
+#define SCALPEL_HASH_MD5               1
+#define SCALPEL_HASH_SHA1              2
+#define SCALPEL_HASH_SHA256            4
+#define SCALPEL_HASH_FUZZY             8
+#define SCALPEL_NUM_HASHES             4
+#define SCALPEL_MAX_DIGEST_STRING      148	// fuzzy hashes are the longest
+
+// identical carved files (-x)
+#define SCALPEL_DEDUP_LINK             1	// later copies are hardlinks
+#define SCALPEL_DEDUP_DROP             2	// later copies are only listed
+                                            // in the manifest
+#define CARVED_CONTENT_MIN_SIZE        1024
+
+// pack file output (-P)
+#define SCALPEL_PACK_INDEX             "pack.idx"
+#define SCALPEL_PACK_SEGMENT           "pack.%03d"
+#define SCALPEL_PACK_MAGIC             "scalpel-pack"
+#define SCALPEL_PACK_VERSION           1
+#define SCALPEL_PACK_SEGMENT_SIZE      (1024ULL * 1024 * 1024)	// bytes
+#define SCALPEL_PACK_MAX_SEGMENTS      1000
+#define SCALPEL_PACK_BUFFER_SIZE       (1024 * 1024)	// stdio buffer per segment
+
 #define SCALPEL_BANNER_STRING \
 "Scalpel version %s\n"\
 "Written by Golden G. Richard III and Lodovico Marziale.\n", SCALPEL_VERSION
@@ -208,12 +248,14 @@ extern double totalwrites;	// # of seconds spent in pass # 2 for writing carved
 // During the file carving operations (which occur after an initial
 // scan of an image file to build the header/footer database), we want
 // to read the image file only once more, sequentially, for all
-// carves.  The following structure tracks the filename and first/last
-// bytes in the image file for a single file to be carved.  When the
-// read buffer includes the first byte of a file, the file is opened
-// and the first write occurs.  When the read buffer includes the end
-// byte, the last write operation occurs, the file is closed, and the
-// struct can be reused.
+// carves.  The following structure tracks the file type, sequence number
+// and first/last bytes in the image file for a single file to be
+// carved.  The output filename is generated from the file type and
+// sequence number only when it's needed.  When the read buffer
+// includes the first byte of a file, the file is opened and the first
+// write occurs.  When the read buffer includes the end byte, the last
+// write operation occurs and the file is closed.  CarveInfo structs
+// for an image file are allocated in large blocks, in dig.cpp.
 
 // *****GGRIII: use of priority field to store these flags and the 
 // data structures which track CarveInfo structs needs to be better
@@ -227,17 +269,125 @@ extern double totalwrites;	// # of seconds spent in pass # 2 for writing carved
 #define CONTINUECARVE   4	// carve operation includes entire contents
                             // of current buffer
 
+// running digests of a file being carved, see carvehash.cpp
+typedef struct DigestContext {
+    unsigned int state[8];
+    unsigned long long count;	// bytes digested
+    unsigned char buf[64];	// partial block
+} DigestContext;
+
+struct fuzzy_state;
+
+typedef struct CarveHash {
+    DigestContext md5;
+    DigestContext sha1;
+    DigestContext sha256;
+    struct fuzzy_state *fuzzy;	// NULL unless built with libfuzzy
+} CarveHash;
+
+// the first carved file with a given content, in the open addressing
+// hash table of carved files (-x)
+typedef struct CarvedContent {
+    unsigned long long length;
+    char sha256[65];
+    char *path;			// relative to the output directory, NULL
+                                // for a free slot
+    int packsegment;		// where the file is stored, with pack
+    unsigned long long packoffset;	// output (-P)
+} CarvedContent;
+
+// segments and index of a pack being written (-P).  Carved files are
+// given an extent of a segment when carving them starts, so files
+// carved at the same time can be written in place, piece by piece.
+typedef struct PackWriter {
+    FILE *index;
+    int numsegments;
+    FILE *segments[SCALPEL_PACK_MAX_SEGMENTS];
+    unsigned long long positions[SCALPEL_PACK_MAX_SEGMENTS];	// stdio file positions
+    unsigned long long reserved;	// bytes given out in the last segment
+} PackWriter;
+
+// a carved file in a pack, as read back by libscalpel_open_pack()
+typedef struct ScalpelPackEntry {
+    char *name;			// path the file would have had in the
+                                // output directory
+    char *type;			// file type (extension)
+    int rule;			// index of the search spec line
+    int segment;
+    unsigned long long offset;	// in the segment
+    unsigned long long length;
+    int chopped;
+    char sha256[65];
+    char *fragments;		// image extents, "start+length,..."
+    char *image;
+} ScalpelPackEntry;
+
+typedef struct ScalpelPack {
+    char *directory;
+    unsigned long long numentries;
+    ScalpelPackEntry *entries;
+    int numsegments;		// segments opened so far
+    FILE **segments;
+} ScalpelPack;
+
 typedef struct CarveInfo {
-    char *filename;		    // output filename for file to carve
     FILE *fp;			    // file descriptor for file to carve
+    CarveHash *hash;		// digests of the carved file, if hashing (-a)
     unsigned long long start;	// offset of first byte in file
     unsigned long long stop;	// offset of last byte in file
+    unsigned long long filenum;	// # of file among files of this type
+                                // carved from current image file
+    unsigned long long serial;	// # in the output filename, the value of
+                                // state->fileswritten when it was planned
+    int needlenum;		    // index of search spec line for file type
+    int packsegment;		// pack segment and offset of the carved
+    unsigned long long packoffset;	// file, with pack output (-P)
     char chopped;			// is carved file's length constrained
                             // by max file size for type? (i.e., could
                             // the file actually be longer?
 } CarveInfo;
 
 
+// Checkpoint/resume bookkeeping.  While an image file is processed,
+// header/footer offsets are appended to a journal and a small
+// checkpoint file records how much of the journal is valid, the
+// position reached in pass 1 or pass 2, and which carved files were
+// partially written.  A resumed run (-R) restores this information;
+// see dig.cpp.
+typedef struct Checkpoint {
+    time_t lastcheckpoint;	// time the last checkpoint was written
+    FILE *journal;		    // header/footer offsets for current image
+    unsigned long long journalsize;	// valid bytes in journal
+    unsigned long long journaledheaders[MAX_FILE_TYPES + 1];	// offsets already
+    unsigned long long journaledfooters[MAX_FILE_TYPES + 1];	// in the journal
+    unsigned long long startfileswritten;	// state at start of current image
+    unsigned long startorganizeDirNum[MAX_FILE_TYPES + 1];
+    int inImage;			// an image file is being processed
+    unsigned long long imagesize;	// size of current image file
+    char **done;			// images completely processed
+    int numdone;
+    int resumeDone;		// # entries in 'done' loaded from checkpoint
+    int skipImage;		// current image was completed before resume
+    int rulesRestored;	// per-rule state restored from checkpoint
+
+    // information loaded from a checkpoint file by readCheckpoint()
+    long long auditoffset;	// valid bytes in audit file
+    int resumeRules;		// # search spec lines in checkpoint
+    unsigned long long resumeFingerprint[MAX_FILE_TYPES + 1];
+    unsigned long long resumeHeaders[MAX_FILE_TYPES + 1];
+    unsigned long long resumeFooters[MAX_FILE_TYPES + 1];
+    unsigned long resumeOrganizeDirNum[MAX_FILE_TYPES + 1];
+    unsigned long long resumeFilesWritten;
+    char *resumeImage;		// image in progress, NULL if none
+    unsigned long long resumeImageSize;
+    unsigned long long resumeSkip;
+    int resumePass;		    // 1 or 2, 0 once resumed
+    unsigned long long resumeCursor;	// next buffer position in resumePass
+    char **partialnames;	// files partially written at resumeCursor
+    unsigned long long *partialbytes;
+    int numpartial;
+} Checkpoint;
+
 // Each struct SearchSpecLine defines a particular file type,
 // including header and footer information.  The following structure,
 // SearchSpecOffsets, defines the absolute locations of all matching
@@ -257,6 +407,98 @@ typedef struct SearchSpecOffsets {
     unsigned long long numfooters;	// # stored footer positions
 } SearchSpecOffsets;
 
+// # of CarveInfo structs allocated at once during carve planning.  The
+// first block is small and blocks double in size up to the maximum.
+#define CARVEINFO_MIN_BLOCK_SIZE     256
+#define CARVEINFO_MAX_BLOCK_SIZE     65536
+
+// the coverage bitmap is indexed for fast translation between image
+// file positions and positions that skip covered blocks.  The rank
+// table holds the # of covered blocks before each superblock of
+// COVERAGE_RANK_BLOCKS blocks.  The extent list holds each run of
+// uncovered blocks, in ascending order, followed by an entry for the
+// end of the image file.
+#define COVERAGE_RANK_BLOCKS         512
+
+typedef struct CoverageExtent {
+    unsigned long long block;	// first block of the run
+    unsigned long long logical;	// # uncovered blocks before the run
+} CoverageExtent;
+
+// coverage blockmap file format.  A blockmap starts with a
+// CoverageBlockmapHeader, followed by a bitmap with one bit per block
+// (set if any carved file covers the block) and a table of
+// CoverageOverflow entries, sorted by block, for blocks covered by more
+// than one carved file.  Blockmaps written by Scalpel 2.0 and earlier
+// (a block size followed by one unsigned int count per block) are
+// recognized because they don't begin with COVERAGE_BLOCKMAP_MAGIC.
+#define COVERAGE_BLOCKMAP_MAGIC      0x50414d42	// "BMAP"
+#define COVERAGE_BLOCKMAP_VERSION    2
+#define COVERAGE_LEGACY_CHUNK        65536	// legacy entries per read/write
+#define COVERAGE_OVERFLOW_MIN_SIZE   1024
+
+// blocks covered by carved files are queued as intervals and applied to
+// the coverage blockmap together, when the image file is finished or
+// when COVERAGE_UPDATE_BUDGET intervals are queued
+#define COVERAGE_UPDATE_MIN_SIZE     1024
+#define COVERAGE_UPDATE_BUDGET       1048576
+
+typedef struct CoverageBlockmapHeader {
+    unsigned int magic;
+    unsigned int version;
+    unsigned int blocksize;
+    unsigned int reserved;
+    unsigned long long numblocks;
+    unsigned long long numoverflow;	// # CoverageOverflow entries
+} CoverageBlockmapHeader;
+
+typedef struct CoverageInterval {
+    unsigned long long start;	// first and last covered blocks
+    unsigned long long stop;
+} CoverageInterval;
+
+typedef struct CoverageOverflow {
+    unsigned long long block;
+    unsigned long long count;	// # carved files covering block, 0 if unused
+} CoverageOverflow;
+
+// known-block hash set file format (-H, -G).  A hash set starts with a
+// BlockHashSetHeader, followed by a Bloom filter of 'bloombits' bits and
+// the sorted hashes of 'blocksize'-byte blocks of reference data.
+// Blocks of an image whose hashes are in the set are skipped like
+// covered blocks.
+#define BLOCKHASH_SET_MAGIC          0x48534842	// "BHSH"
+#define BLOCKHASH_SET_VERSION        1
+#define BLOCKHASH_BLOOM_BITS         16	// min Bloom filter bits per hash
+#define BLOCKHASH_BLOOM_PROBES       6
+
+typedef struct BlockHashSetHeader {
+    unsigned int magic;
+    unsigned int version;
+    unsigned int blocksize;
+    unsigned int bloomprobes;
+    unsigned long long numhashes;
+    unsigned long long bloombits;	// a power of 2
+} BlockHashSetHeader;
+
+typedef struct BlockHashSet {
+    unsigned int blocksize;
+    unsigned int bloomprobes;
+    unsigned long long numhashes;
+    unsigned long long bloommask;	// bloombits - 1
+    const unsigned char *bloom;
+    const unsigned long long *hashes;
+    void *mapping;		// hash set file mapping, if mmap()ed
+    size_t mappinglen;
+} BlockHashSet;
+
+// an extent of the image to search and carve in, e.g. unallocated
+// space reported by a filesystem layer.  Offsets are physical.
+typedef struct ScalpelRegion {
+    unsigned long long offset;
+    unsigned long long length;
+} ScalpelRegion;
+
 // max files to open at once during carving--modify if you get
 // a "too many files open" error message during the second carving phase.
 #ifdef _WIN32
@@ -291,6 +533,14 @@ typedef struct SearchSpecLine {
     unsigned long long numfilestocarve;	// # files to carve of this type
     unsigned long organizeDirNum;	// subdirectory # for organization 
                                     // of files of this type
+    unsigned long firstorganizeDirNum;	// organizeDirNum for first file of
+                                        // this type carved from current
+                                        // image file
+    long createdDirNum;		// last organization subdirectory created,
+                            // -1 if none
+    int offsetsPreloaded;	// header/footer offsets for this type were
+                            // loaded from a previous header/footer
+                            // database, so no search is required
 } SearchSpecLine;
 
 //prototype for external carving function
@@ -322,12 +572,40 @@ typedef struct scalpelState {
     FILE *coverageblockmap;
     unsigned char *coveragebitmap;
     unsigned long long coveragenumblocks;
+    unsigned long long *coveragerank;	// # covered blocks before each superblock
+    CoverageExtent *coverageextents;	// runs of uncovered blocks
+    unsigned long long coveragenumextents;
+    unsigned long long coverageuncovered;	// # uncovered blocks
+    unsigned char *coveragemapbits;	// blockmap bitmap being updated (-m)
+    void *coveragemapping;	// blockmap file mapping, if mmap()ed
+    size_t coveragemappinglen;
+    CoverageOverflow *coverageoverflow;	// hash table of counts > 1
+    unsigned long long coverageoverflowsize;
+    unsigned long long coverageoverflowused;
+    CoverageInterval *coverageupdates;	// queued blockmap updates
+    unsigned long long coveragenumupdates;
+    unsigned long long coverageupdatesize;
+    int coverageLegacyFormat;	// write blockmap in Scalpel 2.0 format
+    ScalpelRegion *regions;	// sorted, merged extents to search, if
+    unsigned long long numregions;	// the image is restricted to regions
+    char *blockhashfile;	// known-block hash set (-H), if any
+    BlockHashSet *blockhashset;
+    unsigned char *coverageknown;	// blocks found in the hash set
+    unsigned long long coverageknowncount;
+    unsigned long long constantbytes;	// bytes of constant blocks skipped
+    char *blockhashoutput;	// block hash set to generate (-G), if any
+    unsigned long long *generatedhashes;
+    unsigned long long numgeneratedhashes;
+    unsigned long long generatedhashsize;
     int useInputFileList;
     char *inputFileList;
     int carveWithMissingFooters;
     int noSearchOverlap;
     int handleEmbedded;
     int generateHeaderFooterDatabase;
+    int useHeaderFooterDatabase;
+    char *headerFooterDatabaseDir;
+    unsigned long long imageFingerprint;
     int updateCoverageBlockmap;
     int useCoverageBlockmap;
     int organizeSubdirectories;
@@ -335,6 +613,26 @@ typedef struct scalpelState {
     int blockAlignedOnly;
     unsigned int alignedblocksize;
     int previewMode;
+    int singlePass;		// carve image files while digging them (-F)
+    unsigned long long windowsize;	// bytes retained for carving streams,
+                                    // or image files with singlePass, 0 to
+                                    // size to the max carve sizes
+    int imageCarved;		// set by digImageFile() if it carved the
+                                // whole image file
+    int hashAlgorithms;		// SCALPEL_HASH_* digests of carved files (-a)
+    FILE *manifestFile;		// carved file digests, if hashing
+    int dedupMode;		// SCALPEL_DEDUP_* for identical carved files
+                                // (-x), 0 keeps every copy
+    CarvedContent *carvedcontent;	// carved files by content, if dedupMode
+    unsigned long long carvedcontentsize;
+    unsigned long long carvedcontentused;
+    unsigned long long duplicatefiles;	// carved files identical to an
+    unsigned long long duplicatebytes;	// earlier one, and their bytes
+    int packOutput;		// write carved files to pack segments (-P)
+    PackWriter *pack;
+    int checkpointInterval;	// seconds between checkpoints, 0 disables
+    int resumeFromCheckpoint;
+    struct Checkpoint *checkpoint;
 } scalpelState;
 
 
@@ -346,15 +644,39 @@ typedef struct Fragment {
     unsigned long long stop;
 } Fragment;
 
-// Interface for using scalpel as a library
+// Interface for using scalpel as a library.  libscalpel_initialize()
+// takes generateHeaderFooterDatabase, handleEmbedded,
+// organizeSubdirectories, previewMode, carveWithMissingFooters,
+// noSearchOverlap, singlePass, windowsize, hashAlgorithms, dedupMode,
+// packOutput, checkpointInterval and resumeFromCheckpoint from 'options';
+// all other fields are ignored.
 extern int libscalpel_initialize(scalpelState ** state, char * confFilePath, 
                                  char * outDir, const scalpelState& options);
 extern int libscalpel_carve_input(scalpelState * state, ScalpelInputReader * const reader);
+// restrict subsequent libscalpel_carve_input() calls to 'numregions'
+// extents of the input; 0 regions removes the restriction
+extern int libscalpel_set_regions(scalpelState * state,
+                                  const ScalpelRegion * regions,
+                                  unsigned long long numregions);
 extern int libscalpel_finalize(scalpelState ** state);
 
+// Reading packs written with packOutput (-P).  libscalpel_open_pack()
+// reads the index of the pack in 'directory'; the carved files are
+// (*pack)->entries[0 .. numentries - 1].  libscalpel_read_pack_entry()
+// reads up to 'len' bytes of entry 'i' from 'offset' and returns the
+// number of bytes read, or -1 on error.
+extern int libscalpel_open_pack(const char * directory, ScalpelPack ** pack);
+extern long long libscalpel_read_pack_entry(ScalpelPack * pack, unsigned long long i,
+                                            unsigned long long offset,
+                                            void * buf, size_t len);
+extern void libscalpel_close_pack(ScalpelPack ** pack);
+
 // prototypes for visible scalpel.c functions
 void freeState(struct scalpelState *state);
 void initializeState(char ** argv, struct scalpelState *state);
+int setRegionList(struct scalpelState *state, const ScalpelRegion *regions,
+                  unsigned long long numregions);
+int readRegionList(struct scalpelState *state, char *fn);
 void convertFileNames(struct scalpelState *state);
 int readSearchSpecFile(struct scalpelState *state);
 
@@ -364,9 +686,44 @@ int init_threading_model (struct scalpelState *state);
 void destroy_threading_model(struct scalpelState *state);
 int digImageFile (struct scalpelState *state);
 int carveImageFile (struct scalpelState *state);
+int readCheckpoint (struct scalpelState *state);
+void finishCheckpoint (struct scalpelState *state);
 void init_store ();  // return int for error??
 void destroyStore();
 
+// prototypes for visible blockhash.c functions
+unsigned long long blockHash (const unsigned char *buf, size_t len);
+int blockUniformValue (const unsigned char *buf, size_t len);
+int openBlockHashSet (struct scalpelState *state, char *fn);
+void closeBlockHashSet (struct scalpelState *state);
+int blockHashSetContains (const BlockHashSet *set, unsigned long long hash);
+int hashImageBlocks (struct scalpelState *state);
+int writeBlockHashSet (struct scalpelState *state, char *fn);
+
+// prototypes for visible carvehash.c functions
+int parseHashList (struct scalpelState *state, const char *list);
+const char *hashName (int i);
+CarveHash *startCarveHash (struct scalpelState *state);
+void updateCarveHash (struct scalpelState *state, CarveHash *hash,
+		      const unsigned char *buf, size_t len);
+void finishCarveHash (struct scalpelState *state, CarveHash *hash,
+		      char digests[SCALPEL_NUM_HASHES][SCALPEL_MAX_DIGEST_STRING]);
+void discardCarveHash (CarveHash *hash);
+const CarvedContent *findCarvedContent (struct scalpelState *state,
+				       struct CarveInfo *carve, const char *path,
+				       const char *sha256);
+void freeCarvedContent (struct scalpelState *state);
+
+// prototypes for visible pack.c functions
+int openPack (struct scalpelState *state);
+int closePack (struct scalpelState *state);
+int reservePackExtent (struct scalpelState *state, struct CarveInfo *carve);
+void releasePackExtent (struct scalpelState *state, struct CarveInfo *carve);
+int writePackExtent (struct scalpelState *state, struct CarveInfo *carve,
+		     unsigned long long position, const void *buf, size_t len);
+int writePackIndexEntry (struct scalpelState *state, struct CarveInfo *carve,
+			 const char *name, const char *sha256, PoolQueue * fragments);
+
 // prototypes for visible helpers.c functions
 
 // LMIII fix me
@@ -380,6 +737,7 @@ void checkMemoryAllocation (struct scalpelState *state, void *ptr, int line,
 int skipInFile (struct scalpelState *state, ScalpelInputReader * inReader);
 void scalpelLog (struct scalpelState *state, const char *format, ...);
 void handleError (struct scalpelState *s, int error);
+int charactersMatch (char a, char b, int caseSensitive);
 int memwildcardcmp (const void *s1, const void *s2,
 		    size_t n, int caseSensitive);
 void setProgramName (char *s);
@@ -399,6 +757,8 @@ void setttywidth ();
 long long measureOpenFile (FILE * f, struct scalpelState *state);
 int openAuditFile (struct scalpelState *state);
 int closeAuditFile (FILE * f);
+int truncateFile (const char *fn, unsigned long long length);
+int replaceWithHardLink (const char *existing, const char *fn);
 
 //// prototypes for visible dig.cu functions
 int gpuSearchBuffer (char *readbuffer, int size_of_buffer, char *gpuresults,
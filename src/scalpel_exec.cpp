@@ -67,9 +67,10 @@ int main(int argc, char **argv) {
         exit (-1);
     }
 
-    // read configuration file
+    // read configuration file, which isn't needed to generate a block
+    // hash set
     int err;
-    if ((err = readSearchSpecFile(&state))) {
+    if (!state.blockhashoutput && (err = readSearchSpecFile(&state))) {
         // problem with config file
         try {
             handleError(&state, err);
@@ -123,6 +124,12 @@ int main(int argc, char **argv) {
 
         try {
             digAllFiles(argv, &state);
+            // run completed, checkpoint no longer needed
+            finishCheckpoint(&state);
+            if (state.blockhashoutput &&
+                (err = writeBlockHashSet(&state, state.blockhashoutput))) {
+                    handleError(&state, err);
+            }
         } catch (std::runtime_error & e) {
             fprintf(stderr, "Error during carving: %s\n", e.what());
         }
@@ -143,6 +150,11 @@ int main(int argc, char **argv) {
     fprintf(stdout,
         "\nScalpel is done, files carved = %"PRIu64 ", elapsed  = %ld secs.\n",
         state.fileswritten, (int)time(0) - starttime);
+    if (state.dedupMode) {
+        fprintf(stdout,
+            "Identical carved files stored once = %"PRIu64 " (%"PRIu64 " bytes).\n",
+            state.duplicatefiles, state.duplicatebytes);
+    }
 
     destroy_threading_model(&state);
     destroyStore();
@@ -235,7 +247,7 @@ static void digAllFiles(char **argv, struct scalpelState *state) {
             // GGRIII: this function now *only* builds the header/footer
             // database.  Carving is handled afterward, in carveImageFile().
 
-            ScalpelInputReader * inputReader = scalpel_createInputReaderFile(inputFile);
+            ScalpelInputReader * inputReader = scalpel_createInputReader(inputFile);
             if (!inputReader) {
                 //error
                 printf("Error creating inputReader for file %s\n", inputFile);
@@ -249,7 +261,7 @@ static void digAllFiles(char **argv, struct scalpelState *state) {
                 }
                 catch (std::runtime_error & e) {
                     printf("Error digging file %s\n", e.what());
-                    scalpel_freeInputReaderFile(state->inReader);
+                    scalpel_freeInputReader(state->inReader);
                     state->inReader = NULL;
                 }
                 continue;
@@ -265,13 +277,13 @@ static void digAllFiles(char **argv, struct scalpelState *state) {
                     }
                     catch (std::runtime_error & e) {
                         printf("Error carving file %s\n", e.what());
-                        scalpel_freeInputReaderFile(state->inReader);
+                        scalpel_freeInputReader(state->inReader);
                         state->inReader = NULL;
                     }
                     continue;
                 }
             }
-            scalpel_freeInputReaderFile(state->inReader);
+            scalpel_freeInputReader(state->inReader);
             state->inReader = NULL;
         }
         while (!feof(listoffiles));
@@ -280,7 +292,7 @@ static void digAllFiles(char **argv, struct scalpelState *state) {
     else {
         do {
             strncpy(inputFile, *argv, MAX_STRING_LENGTH);
-            state->inReader = scalpel_createInputReaderFile(inputFile);
+            state->inReader = scalpel_createInputReader(inputFile);
             if (!state->inReader) {
                 //error
                 printf("Error creating inputReader for file %s\n", inputFile);
@@ -296,9 +308,10 @@ static void digAllFiles(char **argv, struct scalpelState *state) {
                 }
                 catch (std::runtime_error & e) {
                     printf("Error digging file %s\n", e.what());
-                    scalpel_freeInputReaderFile(state->inReader);
+                    scalpel_freeInputReader(state->inReader);
                     state->inReader = NULL;
                 }
+                ++argv;
                 continue;
             }
             else {
@@ -312,14 +325,15 @@ static void digAllFiles(char **argv, struct scalpelState *state) {
                     }
                     catch (std::runtime_error & e) {
                         printf("Error carving file %s\n", e.what());
-                        scalpel_freeInputReaderFile(state->inReader);
+                        scalpel_freeInputReader(state->inReader);
                         state->inReader = NULL;
                     }
+                    ++argv;
                     continue;
                 }
             }
             ++argv;
-            scalpel_freeInputReaderFile(state->inReader);
+            scalpel_freeInputReader(state->inReader);
             state->inReader = NULL;
         }
         while (*argv);
@@ -332,7 +346,7 @@ void processCommandLineArgs(int argc, char **argv, struct scalpelState *state) {
     int i;
     int numopts = 1;
 
-    while ((i = getopt(argc, argv, "behvVu:ndpq:rc:o:s:i:m:M:O")) != -1) {
+    while ((i = getopt(argc, argv, "a:beFhvVu:ndD:G:H:k:l:LpPq:Rrc:o:s:i:m:M:Ow:x:")) != -1) {
         numopts++;
         switch (i) {
 
@@ -360,43 +374,84 @@ void processCommandLineArgs(int argc, char **argv, struct scalpelState *state) {
             state->generateHeaderFooterDatabase = TRUE;
             break;
 
+        case 'D':
+            numopts++;
+            state->useHeaderFooterDatabase = TRUE;
+            strncpy(state->headerFooterDatabaseDir, optarg, MAX_STRING_LENGTH);
+            break;
+
         case 'e':
             state->handleEmbedded = TRUE;
             break;
 
-            /*
+        case 'G':
+            numopts++;
+            state->blockhashoutput = (char *)malloc(MAX_STRING_LENGTH * sizeof(char));
+            checkMemoryAllocation(state, state->blockhashoutput, __LINE__,
+                __FILE__, "state->blockhashoutput");
+            strncpy(state->blockhashoutput, optarg, MAX_STRING_LENGTH);
+            break;
+
+        case 'H':
+            numopts++;
+            state->blockhashfile = (char *)malloc(MAX_STRING_LENGTH * sizeof(char));
+            checkMemoryAllocation(state, state->blockhashfile, __LINE__,
+                __FILE__, "state->blockhashfile");
+            strncpy(state->blockhashfile, optarg, MAX_STRING_LENGTH);
+            break;
+
+        case 'k':
+            numopts++;
+            state->checkpointInterval = atoi(optarg);
+            if(state->checkpointInterval < 0) {
+                fprintf(stderr,
+                    "\nERROR: Invalid interval for -k command line option.\n");
+                exit(1);
+            }
+            break;
+
+        case 'l':
+            numopts++;
+            if(readRegionList(state, optarg) != SCALPEL_OK) {
+                fprintf(stderr,
+                    "\nERROR: Invalid region list for -l command line option.\n");
+                exit(1);
+            }
+            break;
+
+        case 'L':
+            state->coverageLegacyFormat = TRUE;
+            break;
 
-            case 'm':
+        case 'm':
             numopts++;
             state->updateCoverageBlockmap = TRUE;
             state->useCoverageBlockmap = TRUE;
             state->coveragefile = (char *)malloc(MAX_STRING_LENGTH * sizeof(char));
             checkMemoryAllocation(state, state->coveragefile, __LINE__,
-            __FILE__, "state->coveragefile");
+                __FILE__, "state->coveragefile");
             strncpy(state->coveragefile, optarg, MAX_STRING_LENGTH);
             break;
 
-            case 'u':
+        case 'u':
             numopts++;
             state->useCoverageBlockmap = TRUE;
             state->coveragefile = (char *)malloc(MAX_STRING_LENGTH * sizeof(char));
             checkMemoryAllocation(state, state->coveragefile, __LINE__,
-            __FILE__, "state->coveragefile");
+                __FILE__, "state->coveragefile");
             strncpy(state->coveragefile, optarg, MAX_STRING_LENGTH);
             break;
 
-            case 'M':
+        case 'M':
             numopts++;
             state->coverageblocksize = strtoul(optarg, NULL, 10);
             if(state->coverageblocksize <= 0) {
-            fprintf(stderr,
-            "\nERROR: Invalid blocksize for -M command line option.\n");
-            exit(1);
+                fprintf(stderr,
+                    "\nERROR: Invalid blocksize for -M command line option.\n");
+                exit(1);
             }
             break;
 
-            */
-
         case 'o':
             numopts++;
             strncpy(state->outputdirectory, optarg, MAX_STRING_LENGTH);
@@ -406,10 +461,42 @@ void processCommandLineArgs(int argc, char **argv, struct scalpelState *state) {
             state->organizeSubdirectories = FALSE;
             break;
 
+        case 'F':
+            state->singlePass = TRUE;
+            break;
+
         case 'p':
             state->previewMode = TRUE;
             break;
 
+        case 'a':
+            numopts++;
+            if(parseHashList(state, optarg) != SCALPEL_OK) {
+                fprintf(stderr,
+                    "\nERROR: Invalid digest list for -a command line option.\n");
+                exit(1);
+            }
+            break;
+
+        case 'P':
+            state->packOutput = TRUE;
+            break;
+
+        case 'x':
+            numopts++;
+            if(!strcasecmp(optarg, "link")) {
+                state->dedupMode = SCALPEL_DEDUP_LINK;
+            }
+            else if(!strcasecmp(optarg, "drop")) {
+                state->dedupMode = SCALPEL_DEDUP_DROP;
+            }
+            else {
+                fprintf(stderr,
+                    "\nERROR: -x takes \"link\" or \"drop\".\n");
+                exit(1);
+            }
+            break;
+
         case 'b':
             state->carveWithMissingFooters = TRUE;
             break;
@@ -439,10 +526,24 @@ void processCommandLineArgs(int argc, char **argv, struct scalpelState *state) {
             state->noSearchOverlap = TRUE;
             break;
 
+        case 'R':
+            state->resumeFromCheckpoint = TRUE;
+            break;
+
         case 'v':
             inputReaderVerbose = state->modeVerbose = TRUE;
             break;
 
+        case 'w':
+            numopts++;
+            state->windowsize = strtoull(optarg, NULL, 10) * 1024 * 1024;
+            if(state->windowsize == 0) {
+                fprintf(stderr,
+                    "\nERROR: Invalid size for -w command line option.\n");
+                exit(1);
+            }
+            break;
+
         default:
             exit(1);
         }
@@ -451,14 +552,78 @@ void processCommandLineArgs(int argc, char **argv, struct scalpelState *state) {
     // check for incompatible options
 
     if ((state->useInputFileList || argc - numopts > 1)
-        && (state->updateCoverageBlockmap || state->useCoverageBlockmap)) {
+        && (state->updateCoverageBlockmap || state->useCoverageBlockmap
+        || state->numregions > 0)) {
 
             fprintf(stderr, "%d %d\n", argc, numopts);
 
             fprintf(stderr,
-                "\nCoverage blockmaps can be processed only if a single image filename is\n"
-                "specified on the command line.\n");
+                "\nCoverage blockmaps and region lists can be processed only if a single\n"
+                "image filename is specified on the command line.\n");
+            exit(1);
+    }
+
+    if (state->blockhashoutput
+        && (state->updateCoverageBlockmap || state->useCoverageBlockmap
+        || state->numregions > 0 || state->blockhashfile)) {
+            fprintf(stderr,
+                "\nERROR: -G can't be combined with -H, -l, -m or -u.\n");
+            exit(1);
+    }
+
+    // blocks found in the block hash set in pass 1 aren't recorded in
+    // checkpoints
+    if (state->blockhashfile) {
+        if (state->resumeFromCheckpoint) {
+            fprintf(stderr,
+                "\nERROR: Runs using a block hash set (-H) can't be resumed.\n");
+            exit(1);
+        }
+        state->checkpointInterval = 0;
+    }
+
+    // files carved in a single pass are written as soon as they're
+    // decided, which isn't recorded in checkpoints
+    if (state->singlePass) {
+        if (state->resumeFromCheckpoint) {
+            fprintf(stderr,
+                "\nERROR: Single pass runs (-F) can't be resumed.\n");
+            exit(1);
+        }
+        state->checkpointInterval = 0;
+    }
+
+    if (state->packOutput && state->previewMode) {
+        fprintf(stderr,
+            "\nERROR: Pack output (-P) can't be combined with preview mode (-p).\n");
+        exit(1);
+    }
+
+    // the extents of files carved into a pack aren't recorded in
+    // checkpoints
+    if (state->packOutput) {
+        if (state->resumeFromCheckpoint) {
+            fprintf(stderr,
+                "\nERROR: Runs writing a pack (-P) can't be resumed.\n");
             exit(1);
+        }
+        state->checkpointInterval = 0;
+    }
+
+    // identical carved files are found by their SHA-256 digests, which
+    // are also listed in pack indexes
+    if (state->dedupMode || state->packOutput) {
+        state->hashAlgorithms |= SCALPEL_HASH_SHA256;
+    }
+
+    // the digests of files being carved aren't recorded in checkpoints
+    if (state->hashAlgorithms) {
+        if (state->resumeFromCheckpoint) {
+            fprintf(stderr,
+                "\nERROR: Runs hashing carved files (-a) can't be resumed.\n");
+            exit(1);
+        }
+        state->checkpointInterval = 0;
     }
 }
 
@@ -468,16 +633,24 @@ static void usage() {
         "Scalpel carves files or data fragments from a disk image based on a set of\n"
         "file carving patterns, which include headers, footers, and other information.\n\n"
 
-        "Usage: scalpel [-b] [-c <config file>] [-d] [-e] [-h] [-i <file>]\n"
-        "[-n] [-o <outputdir>] [-O] [-p] [-q <clustersize>] [-r]\n"
+        "Usage: scalpel [-a <digests>] [-b] [-c <config file>] [-d] [-D <dir>] [-e] [-F]\n"
+        "[-G <hash set>] [-h] [-H <hash set>] [-i <file>] [-k <seconds>]\n"
+        "[-l <region file>] [-L] [-m <blockmap file>] [-M <blocksize>] [-n]\n"
+        "[-o <outputdir>] [-O] [-p] [-P] [-q <clustersize>] [-r] [-R]\n"
+        "[-u <blockmap file>]\n"
 
         /*	 "[-s] [-m <blockmap file>] [-M <blocksize>] [-n] [-o <outputdir>]\n" */
         /*	 "[-O] [-p] [-q <clustersize>] [-r] [-s <num>] [-u <blockmap file>]\n" */
 
-        "[-v] [-V] <imgfile> [<imgfile>] ...\n\n"
+        "[-v] [-V] [-w <megabytes>] [-x link|drop] <imgfile> [<imgfile>] ...\n\n"
 
         "Options:\n"
 
+        "-a  Hash carved files as they are written, with the comma separated digests\n"
+        "    md5, sha1, sha256 and fuzzy (ssdeep, if built with libfuzzy).  Digests\n"
+        "    are added to the audit log and to manifest.csv in the output directory,\n"
+        "    also in preview mode (-p).  Disables checkpoints.\n"
+
         "-b  Carve files even if defined footers aren't discovered within\n"
         "    maximum carve size for file type [foremost 0.69 compat mode].\n"
 
@@ -487,31 +660,57 @@ static void usage() {
         "    and discover all footers, so performance suffers.  Doesn't affect\n"
         "    the set of files carved.  **EXPERIMENTAL**\n"
 
+        "-D  Reuse header/footer databases generated with -d by a previous run,\n"
+        "    found in the specified directory.  Only file types that are new or\n"
+        "    whose headers/footers changed since then are searched for.\n"
+
         "-e  Do nested header/footer matching, to deal with structured files that may\n"
         "    contain embedded files of the same type.  Applicable only to\n"
         "    FORWARD / NEXT patterns.\n"
 
+        "-F  Carve each image file while it is searched, in a single pass, from a\n"
+        "    window of the image as large as the largest max carve size (see -w).\n"
+        "    File types longer than the window are carved in a second pass.  Falls\n"
+        "    back to two passes with -d, -D or -H.  Disables checkpoints.\n"
+
+        "-G  Generate a block hash set from the image files instead of carving, for\n"
+        "    use with -H.  Every aligned block of the blocksize given by -M (default\n"
+        "    512 bytes) is hashed, except blocks of one repeated byte value.\n"
+
         "-h  Print this help message and exit.\n"
 
+        "-H  Skip blocks whose hashes are in the specified block hash set, e.g. the\n"
+        "    blocks of operating system and application files of a reference\n"
+        "    install.  Such blocks aren't searched and are skipped when carving, like\n"
+        "    blocks covered in a coverage blockmap.  Disables checkpoints.\n"
+
         "-i  Read names of disk images from specified file.  Note that minimal parsing of\n"
         "    the pathnames is performed and they should be formatted to be compliant C\n"
         "    strings; e.g., under Windows, backslashes must be properly quoted, etc.\n"
 
-        /*
+        "-k  Write a checkpoint at most every <seconds> seconds (default 60), so that\n"
+        "    an interrupted run can be resumed with -R.  0 disables checkpoints.\n"
+
+        "-l  Search and carve only the regions of the image listed in the specified\n"
+        "    file, e.g. unallocated space.  Each line holds the offset and length of\n"
+        "    a region in bytes; a file of binary 64bit offset, length pairs is also\n"
+        "    accepted.  Regions are rounded out to the blocksize given by -M (default\n"
+        "    512 bytes) and offsets in the audit log remain image offsets.\n"
+
+        "-L  Write the coverage blockmap updated with -m in the Scalpel 2.0 format\n"
+        "    (one 32bit count per block) instead of the compact format.\n"
 
         "-m  Use and update carve coverage blockmap file.  If the blockmap file does\n"
         "    not exist, it is created. For new blockmap files, 512 bytes is used as\n"
-        "    a default blocksize unless the -M option overrides this value. In the\n"
-        "    blockmap file, the first 32bit unsigned int in the file identifies the\n"
-        "    block size.  Thereafter each 32bit unsigned int entry in the blockmap\n"
-        "    file corresponds to one block in the image file.  Each entry counts how\n"
-        "    many carved files contain this block. Requires more system resources.\n"
-        "    This feature is currently experimental.\n"
+        "    a default blocksize unless the -M option overrides this value. The\n"
+        "    blockmap holds one bit per block in the image file, set if any carved\n"
+        "    file contains the block, and counts for blocks contained in more than\n"
+        "    one carved file.  Blockmaps in the Scalpel 2.0 format (a 32bit block\n"
+        "    size followed by a 32bit count per block) are converted unless -L is\n"
+        "    given.  This feature is currently experimental.\n"
 
         "-M  Set blocksize for new coverage blockmap file.\n"
 
-        */
-
         "-n  Don't add extensions to extracted files.\n"
 
         "-o  Set output directory for carved files.\n"
@@ -524,24 +723,41 @@ static void usage() {
         "    indexing file or data fragment locations or supporting in-place file\n"
         "    carving.\n"
 
+        "-P  Write carved files back to back into a few large pack segments\n"
+        "    (pack.000, pack.001, ...) in the output directory instead of one file\n"
+        "    per carve, listed in the index pack.idx.  Use scalpel-unpack to list or\n"
+        "    extract them.  Implies -a sha256.  Disables checkpoints.\n"
+
         "-q  Carve only when header is cluster-aligned.\n"
 
         "-r  Find only first of overlapping headers/footers [foremost 0.69 compat mode].\n"
 
+        "-R  Resume an interrupted run from the checkpoint in the output directory.\n"
+        "    The command line must otherwise be the same as for the interrupted run.\n"
+
         /*
 
         "-s  Skip num bytes in each disk image before carving.\n"
 
+        */
 
         "-u  Use (but don't update) carve coverage blockmap file when carving.\n"
         "    Carve only sections of the image whose entries in the blockmap are 0.\n"
         "    These areas are treated as contiguous regions.  This feature is\n"
         "    currently experimental.\n"
 
-        */
-
         "-V  Print copyright information and exit.\n"
 
-        "-v  Verbose mode.\n");
+        "-v  Verbose mode.\n"
+
+        "-w  Keep a window of the specified size of a stream (standard input, \"-\",\n"
+        "    or a named pipe), or of an image file with -F, for carving it in a\n"
+        "    single pass.  Default is the largest max carve size in the\n"
+        "    configuration file, up to 256MB.\n"
+
+        "-x  Store identical carved files once.  A carved file with the same length\n"
+        "    and SHA-256 digest as one carved before is made a hardlink to it (link),\n"
+        "    or isn't kept at all (drop).  Either way it's listed in the audit log and\n"
+        "    manifest.csv with the file it duplicates.  Implies -a sha256.\n");
 }
 
@@ -0,0 +1,171 @@
+/*
+Copyright (C) 2013, Basis Technology Corp.
+Copyright (C) 2007-2011, Golden G. Richard III and Vico Marziale.
+Copyright (C) 2005-2007, Golden G. Richard III.
+*
+Written by Golden G. Richard III and Vico Marziale.
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+*
+http://www.apache.org/licenses/LICENSE-2.0
+*
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+Thanks to Kris Kendall, Jesse Kornblum, et al for their work
+on Foremost. Foremost 0.69 was used as the starting point for
+Scalpel, in 2005.
+*/
+
+// lists or extracts the carved files of a pack written by scalpel -P,
+// through the libscalpel pack reading API
+
+#include "scalpel.h"
+
+#define UNPACK_BUFFER_SIZE  (1024 * 1024)
+
+static void usage() {
+
+    printf(
+        "Usage: scalpel-unpack [-l] [-o <outputdir>] <pack directory> [<name>] ...\n\n"
+        "Extracts the carved files stored in a pack written by scalpel -P, or only\n"
+        "the named ones, under the names they are listed with in the pack index.\n\n"
+        "-l  List the files in the pack (name, length, SHA-256, image) instead.\n"
+        "-o  Extract into the specified directory instead of the pack directory.\n");
+}
+
+
+// create the directories leading to 'fn'
+static int makeParentDirectories(char *fn) {
+
+    char *slash;
+    int err;
+
+    for(slash = strchr(fn + 1, '/'); slash; slash = strchr(slash + 1, '/')) {
+        *slash = '\0';
+#ifdef  __MINGW32__
+        err = mkdir(fn);
+#else
+        err = mkdir(fn, S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH);
+#endif
+        *slash = '/';
+        if(err && errno != EEXIST) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+
+static int extractEntry(ScalpelPack *pack, unsigned long long i,
+                        const char *outdir, unsigned char *buf) {
+
+    char fn[MAX_STRING_LENGTH];
+    unsigned long long offset = 0;
+    long long n;
+    FILE *f;
+
+    snprintf(fn, MAX_STRING_LENGTH, "%s/%s", outdir, pack->entries[i].name);
+    if(makeParentDirectories(fn) || !(f = fopen(fn, "wb"))) {
+        fprintf(stderr, "Error opening file: %s -- %s\n", fn, strerror(errno));
+        return SCALPEL_ERROR_FILE_OPEN;
+    }
+    while (offset < pack->entries[i].length) {
+        n = libscalpel_read_pack_entry(pack, i, offset, buf, UNPACK_BUFFER_SIZE);
+        if(n <= 0) {
+            fprintf(stderr, "Error reading %s from the pack\n", pack->entries[i].name);
+            fclose(f);
+            return SCALPEL_ERROR_FILE_READ;
+        }
+        if(fwrite(buf, 1, (size_t)n, f) != (size_t)n) {
+            fprintf(stderr, "Error writing to file: %s -- %s\n", fn, strerror(errno));
+            fclose(f);
+            return SCALPEL_ERROR_FILE_WRITE;
+        }
+        offset += n;
+    }
+    if(fclose(f)) {
+        fprintf(stderr, "Error closing file: %s -- %s\n", fn, strerror(errno));
+        return SCALPEL_ERROR_FILE_WRITE;
+    }
+    return SCALPEL_OK;
+}
+
+
+int main(int argc, char **argv) {
+
+    ScalpelPack *pack = NULL;
+    const char *outdir = NULL;
+    unsigned char *buf;
+    unsigned long long i, extracted = 0;
+    int list = FALSE, err = SCALPEL_OK, j, c;
+
+    while ((c = getopt(argc, argv, "hlo:")) != -1) {
+        switch (c) {
+        case 'l':
+            list = TRUE;
+            break;
+        case 'o':
+            outdir = optarg;
+            break;
+        default:
+            usage();
+            exit(c == 'h' ? 0 : 1);
+        }
+    }
+    if(optind >= argc) {
+        usage();
+        exit(1);
+    }
+    if(!outdir) {
+        outdir = argv[optind];
+    }
+
+    if((err = libscalpel_open_pack(argv[optind], &pack)) != SCALPEL_OK) {
+        fprintf(stderr, "ERROR: Couldn't read the pack index in %s (error %d).\n",
+            argv[optind], err);
+        exit(1);
+    }
+
+    buf = (unsigned char *)malloc(UNPACK_BUFFER_SIZE);
+    if(!buf) {
+        fprintf(stderr, "** MEMORY ALLOCATION FAILURE **\n");
+        exit(1);
+    }
+
+    for(i = 0; i < pack->numentries && err == SCALPEL_OK; i++) {
+        // with names given, extract only the files named
+        if(optind + 1 < argc) {
+            for(j = optind + 1; j < argc && strcmp(argv[j], pack->entries[i].name); j++) {
+            }
+            if(j == argc) {
+                continue;
+            }
+        }
+        if(list) {
+#ifdef _WIN32
+            printf("%s\t%I64u\t%s\t%s\n", pack->entries[i].name,
+#else
+            printf("%s\t%llu\t%s\t%s\n", pack->entries[i].name,
+#endif
+                pack->entries[i].length, pack->entries[i].sha256, pack->entries[i].image);
+        }
+        else if((err = extractEntry(pack, i, outdir, buf)) == SCALPEL_OK) {
+            extracted++;
+        }
+    }
+    if(!list) {
+#ifdef _WIN32
+        printf("%I64u files extracted.\n", extracted);
+#else
+        printf("%llu files extracted.\n", extracted);
+#endif
+    }
+
+    free(buf);
+    libscalpel_close_pack(&pack);
+    return err == SCALPEL_OK ? 0 : 1;
+}